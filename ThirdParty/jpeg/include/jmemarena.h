@@ -0,0 +1,77 @@
+/*
+ * jmemarena.h
+ *
+ * This file is part of the Independent JPEG Group's software,
+ * as modified for the BLPFormat plug-in.
+ * For conditions of distribution and use, see the accompanying README file.
+ *
+ * This file declares the application interface of jmemarena.c, the
+ * system-dependent memory backend that serves libjpeg's pools from an
+ * application-owned arena instead of malloc()/free().
+ *
+ * Usage: create an arena and hand it to the JPEG object with
+ * jpeg_set_arena() right after jpeg_create_compress()/
+ * jpeg_create_decompress(); it serves every allocation from then on for the
+ * life of the object.  What the object allocated before, and the memory of
+ * objects without an arena, comes from malloc()/free().  client_data stays
+ * the application's.  Reusing one JPEG object for several images (jpeg_abort() or
+ * jpeg_finish_compress() between them) hands the per-image pools back to
+ * the arena, and the next image is served from the same memory.
+ *
+ * To bound libjpeg's in-memory use, set cinfo->mem->max_memory_to_use
+ * after creating the object; whole-image buffers beyond it are spilled
+ * to a temporary file.
+ *
+ * An arena is not thread-safe; give each JPEG object its own.
+ *
+ * Include this file after jpeglib.h.
+ */
+
+#ifndef JMEMARENA_H
+#define JMEMARENA_H
+
+typedef struct jpeg_arena_struct jpeg_arena;
+
+
+/* Short forms of external names for systems with brain-damaged linkers. */
+
+#ifdef NEED_SHORT_EXTERNAL_NAMES
+#define jpeg_arena_create	jArenaCreate
+#define jpeg_arena_reset	jArenaReset
+#define jpeg_arena_destroy	jArenaDestroy
+#define jpeg_set_arena		jSetArena
+#define jpeg_set_mem_hook	jSetMemHook
+#endif /* NEED_SHORT_EXTERNAL_NAMES */
+
+/* Creates an empty arena that grows in chunks of at least chunk_size bytes
+ * (0 selects the default).  Returns NULL if out of memory.
+ */
+EXTERN(jpeg_arena *) jpeg_arena_create JPP((size_t chunk_size));
+
+/* Marks all memory in the arena free again while keeping it reserved.
+ * Only call this when no JPEG object using the arena is alive.
+ */
+EXTERN(void) jpeg_arena_reset JPP((jpeg_arena * arena));
+
+/* Releases all memory owned by the arena, and the arena itself. */
+EXTERN(void) jpeg_arena_destroy JPP((jpeg_arena * arena));
+
+/* Serves the allocations the JPEG object cinfo makes from now on from
+ * arena.  Call it once, after the object is created, and destroy
+ * the object before the arena.
+ */
+EXTERN(void) jpeg_set_arena JPP((j_common_ptr cinfo, jpeg_arena * arena));
+
+/* Accounting of the memory the system layer takes from malloc(): the hook
+ * is called with the size and freeing = FALSE after each malloc() that
+ * succeeded, and with freeing = TRUE before each free().  An arena counts
+ * its chunks, not the blocks it hands to libjpeg.  The hook runs on the
+ * thread of the JPEG object, so it must be thread-safe if several objects
+ * run at once.  Set it before any JPEG object exists; NULL (the default)
+ * turns it off.
+ */
+typedef void (*jpeg_mem_hook) JPP((size_t size, boolean freeing));
+
+EXTERN(void) jpeg_set_mem_hook JPP((jpeg_mem_hook hook));
+
+#endif /* JMEMARENA_H */
@@ -30,6 +30,7 @@
 #define jpeg_open_backing_store	jOpenBackStore
 #define jpeg_mem_init		jMemInit
 #define jpeg_mem_term		jMemTerm
+#define jpeg_mem_system_slot	jMemSysSlot
 #endif /* NEED_SHORT_EXTERNAL_NAMES */
 
 
@@ -196,3 +197,12 @@ EXTERN(void) jpeg_open_backing_store JPP((j_common_ptr cinfo,
 
 EXTERN(long) jpeg_mem_init JPP((j_common_ptr cinfo));
 EXTERN(void) jpeg_mem_term JPP((j_common_ptr cinfo));
+
+/*
+ * A pointer the system-dependent layer may keep per JPEG object, stored in
+ * the memory manager and NULL when it is created (jmemmgr.c).  Returns NULL
+ * while the object has no memory manager.  Added for the BLPFormat plug-in,
+ * whose jmemarena.c keeps the object's arena there.
+ */
+
+EXTERN(void **) jpeg_mem_system_slot JPP((j_common_ptr cinfo));
@@ -357,6 +357,7 @@ struct jpeg_compress_struct {
   boolean raw_data_in;		/* TRUE=caller supplies downsampled data */
   boolean arith_code;		/* TRUE=arithmetic coding, FALSE=Huffman */
   boolean optimize_coding;	/* TRUE=optimize entropy encoding parms */
+  boolean trellis_quant;	/* TRUE=rate-distortion optimized AC quant */
   boolean CCIR601_sampling;	/* TRUE=first samples are cosited */
   boolean do_fancy_downsampling; /* TRUE=apply fancy downsampling */
   int smoothing_factor;		/* 1..100, or 0 for no input smoothing */
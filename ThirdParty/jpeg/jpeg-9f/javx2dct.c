@@ -0,0 +1,153 @@
+/*
+ * javx2dct.c
+ *
+ * This file is part of the Independent JPEG Group's software,
+ * as modified for the BLPFormat plug-in.
+ * For conditions of distribution and use, see the accompanying README file.
+ *
+ * This file contains the AVX2 implementation of the 8x8 ISLOW forward
+ * DCT (with quantization) and inverse DCT (with dequantization).
+ * One 256-bit register holds a full row of eight 32-bit lanes.
+ * The arithmetic lives in jsimddct.h.
+ *
+ * MSVC accepts AVX2 intrinsics in any translation unit; GCC and Clang
+ * need this file (and only this file) compiled with -mavx2.  Without it
+ * the AVX2 kernels are left out and jsimd.c falls back to SSE2.
+ */
+
+#define JPEG_INTERNALS
+#include "jinclude.h"
+#include "jpeglib.h"
+#include "jdct.h"		/* Private declarations for DCT subsystem */
+#include "jsimd.h"
+
+#if defined(JSIMD_SUPPORTED) && (defined(_MSC_VER) || defined(__AVX2__))
+
+#include <immintrin.h>
+
+
+INLINE
+LOCAL(__m256i)
+avx2_load_u8 (const JSAMPLE * p)
+{
+  return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) p));
+}
+
+
+INLINE
+LOCAL(__m256i)
+avx2_load_s16 (const JCOEF * p)
+{
+  return _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) p));
+}
+
+
+INLINE
+LOCAL(void)
+avx2_store_u8_sat (JSAMPLE * p, __m256i a)
+{
+  __m128i x = _mm_packs_epi32(_mm256_castsi256_si128(a),
+			      _mm256_extracti128_si256(a, 1));
+
+  _mm_storel_epi64((__m128i *) p, _mm_packus_epi16(x, x));
+}
+
+
+LOCAL(void)
+avx2_transpose (__m256i * v)
+{
+  __m256i t0, t1, t2, t3, t4, t5, t6, t7;
+  __m256i u0, u1, u2, u3, u4, u5, u6, u7;
+
+  t0 = _mm256_unpacklo_epi32(v[0], v[1]);
+  t1 = _mm256_unpackhi_epi32(v[0], v[1]);
+  t2 = _mm256_unpacklo_epi32(v[2], v[3]);
+  t3 = _mm256_unpackhi_epi32(v[2], v[3]);
+  t4 = _mm256_unpacklo_epi32(v[4], v[5]);
+  t5 = _mm256_unpackhi_epi32(v[4], v[5]);
+  t6 = _mm256_unpacklo_epi32(v[6], v[7]);
+  t7 = _mm256_unpackhi_epi32(v[6], v[7]);
+
+  u0 = _mm256_unpacklo_epi64(t0, t2);
+  u1 = _mm256_unpackhi_epi64(t0, t2);
+  u2 = _mm256_unpacklo_epi64(t1, t3);
+  u3 = _mm256_unpackhi_epi64(t1, t3);
+  u4 = _mm256_unpacklo_epi64(t4, t6);
+  u5 = _mm256_unpackhi_epi64(t4, t6);
+  u6 = _mm256_unpacklo_epi64(t5, t7);
+  u7 = _mm256_unpackhi_epi64(t5, t7);
+
+  v[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+  v[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+  v[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+  v[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+  v[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+  v[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+  v[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+  v[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+
+
+/*
+ * Quantize one row exactly like forward_DCT(); see jsse2dct.c for why a
+ * single correction step after the float division is sufficient.
+ */
+
+INLINE
+LOCAL(void)
+avx2_quantize (JCOEFPTR p, __m256i a, const DCTELEM * d, const float * r)
+{
+  __m256i qval = _mm256_loadu_si256((const __m256i *) d);
+  __m256i num, q, rem;
+
+  num = _mm256_add_epi32(_mm256_abs_epi32(a), _mm256_srai_epi32(qval, 1));
+  q = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(num),
+					_mm256_loadu_ps(r)));
+  rem = _mm256_sub_epi32(num, _mm256_mullo_epi32(q, qval));
+  q = _mm256_sub_epi32(q, _mm256_cmpgt_epi32(rem,
+			    _mm256_sub_epi32(qval, _mm256_set1_epi32(1))));
+  q = _mm256_add_epi32(q, _mm256_cmpgt_epi32(_mm256_setzero_si256(), rem));
+  /* Restore the sign; a zero input always quantizes to zero. */
+  q = _mm256_sign_epi32(q, a);
+  _mm_storeu_si128((__m128i *) p,
+		   _mm_packs_epi32(_mm256_castsi256_si128(q),
+				   _mm256_extracti128_si256(q, 1)));
+}
+
+
+#define VEC			__m256i
+#define VSET1(c)		_mm256_set1_epi32((int) (c))
+#define VADD(a,b)		_mm256_add_epi32(a, b)
+#define VSUB(a,b)		_mm256_sub_epi32(a, b)
+#define VMUL(a,b)		_mm256_mullo_epi32(a, b)
+#define VSRAI(a,n)		_mm256_srai_epi32(a, n)
+#define VSLLI(a,n)		_mm256_slli_epi32(a, n)
+#define VAND(a,b)		_mm256_and_si256(a, b)
+#define VLOAD_U8(p)		avx2_load_u8(p)
+#define VLOAD_S16(p)		avx2_load_s16(p)
+#define VLOAD_I32(p)		_mm256_loadu_si256((const __m256i *) (p))
+#define VTRANSPOSE(v)		avx2_transpose(v)
+#define VSTORE_U8_SAT(p,a)	avx2_store_u8_sat(p, a)
+#define VQUANTIZE(p,a,d,r)	avx2_quantize(p, a, d, r)
+#define VEND()			_mm256_zeroupper()
+#define JSIMD_NAME(x)		x##_avx2
+#define JSIMD_NAME_STRING	"avx2"
+
+#include "jsimddct.h"
+
+
+GLOBAL(const jsimd_kernels *)
+jsimd_avx2_kernels (void)
+{
+  return &kernel_table_avx2;
+}
+
+#else /* AVX2 not available to this compiler */
+
+GLOBAL(const jsimd_kernels *)
+jsimd_avx2_kernels (void)
+{
+  return NULL;
+}
+
+#endif
@@ -16,6 +16,7 @@
 #include "jinclude.h"
 #include "jpeglib.h"
 #include "jdct.h"		/* Private declarations for DCT subsystem */
+#include "jsimd.h"
 
 
 /* Private subobject for this module */
@@ -30,6 +31,21 @@ typedef struct {
   /* Same as above for the floating-point case. */
   float_DCT_method_ptr do_float_dct[MAX_COMPONENTS];
 #endif
+
+  /* TRUE if flat blocks may bypass the DCT (8x8 ISLOW only) */
+  boolean flat_shortcut[MAX_COMPONENTS];
+
+  /* SIMD 8x8 ISLOW DCT with fused quantization, or NULL if not in use */
+  jsimd_fdct_quant_ptr do_simd_dct[MAX_COMPONENTS];
+  /* Reciprocals of the divisor tables, used by the SIMD quantizer */
+  float simd_recip[MAX_COMPONENTS][DCTSIZE2];
+
+  /* TRUE if AC coefficients are trellis quantized (8x8 integer DCTs only) */
+  boolean trellis[MAX_COMPONENTS];
+  /* Code length of each AC symbol in the component's table, 0 if none */
+  char ac_code_size[MAX_COMPONENTS][256];
+  /* Weight of squared error in steps, per coefficient (natural order) */
+  double trellis_weight[MAX_COMPONENTS][DCTSIZE2];
 } my_fdct_controller;
 
 typedef my_fdct_controller * my_fdct_ptr;
@@ -62,6 +78,175 @@ typedef union {
 #endif
 
 
+/*
+ * Flat blocks (solid colors, constant alpha, atlas padding) are common
+ * in texture data.  The ISLOW 8x8 DCT of a block whose samples all equal v
+ * is exactly (v - CENTERJSAMPLE) << 6 in the DC position and zero
+ * elsewhere, so such blocks are quantized directly without the DCT.
+ */
+
+LOCAL(boolean)
+block_is_flat (JSAMPARRAY sample_data, JDIMENSION start_col)
+{
+  register JSAMPROW elemptr;
+  register JSAMPLE first = sample_data[0][start_col];
+  int row, col;
+
+  for (row = 0; row < DCTSIZE; row++) {
+    elemptr = sample_data[row] + start_col;
+    for (col = 0; col < DCTSIZE; col++)
+      if (elemptr[col] != first)
+	return FALSE;
+  }
+  return TRUE;
+}
+
+
+LOCAL(void)
+quantize_flat_block (JSAMPARRAY sample_data, JDIMENSION start_col,
+		     DCTELEM qval, JCOEFPTR output_ptr)
+{
+  register DCTELEM temp;
+
+  temp = ((DCTELEM) GETJSAMPLE(sample_data[0][start_col]) - CENTERJSAMPLE)
+	 << 6;
+  /* Same rounding as in forward_DCT() below */
+  if (temp < 0) {
+    temp = (-temp + (qval>>1)) / qval;
+    temp = -temp;
+  } else
+    temp = (temp + (qval>>1)) / qval;
+
+  MEMZERO(output_ptr, SIZEOF(JBLOCK));
+  output_ptr[0] = (JCOEF) temp;
+}
+
+
+/*
+ * Trellis quantization (cinfo->trellis_quant).
+ *
+ * Rounding each coefficient to the nearest step minimizes the error but
+ * not the bits: a coefficient just above a step boundary, or a lone small
+ * one in a run of zeros, costs more in Huffman code than it buys back in
+ * error.  For each block, a dynamic program over the AC coefficients in
+ * zigzag order picks, for every coefficient, the rounded value, one step
+ * less, or zero, minimizing
+ *	distortion + TRELLIS_LAMBDA * bits
+ * where distortion is the squared error of the coefficient, in units of
+ * the table's smallest squared AC step, and bits are counted with the
+ * component's AC Huffman table: run/size symbols, ZRLs, the magnitude
+ * bits and the EOB.  The state is the position of the last
+ * nonzero coefficient.  DC is rounded as usual, since its cost depends on
+ * the neighboring block.
+ *
+ * The tables are those in cinfo when the pass starts: the standard ones,
+ * or, when one compressor is reused with optimize_coding, the ones
+ * optimized for the previous image, which are the better estimate.  The
+ * stream is ordinary baseline (or whatever the scans say); with
+ * optimize_coding the final tables fit the trellis output.
+ *
+ * The squared error is that of the pixels, since the DCT is orthonormal,
+ * so the trade-off is the one that keeps PSNR.  Scaled to the finest
+ * step, lambda follows the quality: at high rates one bit is worth about
+ * 2 ln 2 / 12 of a squared step, and measured against optimize_coding
+ * alone, 0.2 gave the smallest files at equal PSNR from quality 15 to 95.
+ */
+
+#define TRELLIS_LAMBDA	0.2	/* weighted squared error worth one bit */
+#define TRELLIS_NO_CODE	64	/* bits charged for a symbol not in the table */
+
+LOCAL(int)
+trellis_code_size (const char * code_size, int symbol)
+{
+  return code_size[symbol] ? code_size[symbol] : TRELLIS_NO_CODE;
+}
+
+
+LOCAL(void)
+trellis_quantize (DCTELEM * workspace, const DCTELEM * divisors,
+		  const char * code_size, const double * weight,
+		  JCOEFPTR output_ptr)
+{
+  double mag[DCTSIZE2];		/* |coefficient| in steps, zigzag order */
+  double zeroed[DCTSIZE2];	/* sum of mag^2 over 1..k: error if all zero */
+  double cost[DCTSIZE2];	/* best cost up to a nonzero at k */
+  int prev[DCTSIZE2];		/* the nonzero before it in that path */
+  int value[DCTSIZE2];		/* its magnitude there */
+  boolean reachable[DCTSIZE2];
+  int k, j, v, nbits, run, last;
+  double zrl_bits, best, total;
+  DCTELEM temp, qval;
+
+  /* DC as in forward_DCT() */
+  qval = divisors[0];
+  temp = workspace[0];
+  if (temp < 0) {
+    temp = (-temp + (qval>>1)) / qval;
+    temp = -temp;
+  } else
+    temp = (temp + (qval>>1)) / qval;
+  MEMZERO(output_ptr, SIZEOF(JBLOCK));
+  output_ptr[0] = (JCOEF) temp;
+
+  zrl_bits = TRELLIS_LAMBDA * trellis_code_size(code_size, 0xF0);
+  zeroed[0] = 0.0;
+  cost[0] = 0.0;
+  reachable[0] = TRUE;
+  for (k = 1; k < DCTSIZE2; k++) {
+    int n = jpeg_natural_order[k];
+    temp = workspace[n];
+    mag[k] = (double) (temp < 0 ? -temp : temp) / (double) divisors[n];
+    zeroed[k] = zeroed[k-1] + mag[k] * mag[k] * weight[n];
+  }
+
+  for (k = 1; k < DCTSIZE2; k++) {
+    int rounded = (int) (mag[k] + 0.5);
+    double w = weight[jpeg_natural_order[k]];
+    reachable[k] = FALSE;
+    for (v = rounded; v >= 1 && v >= rounded - 1; v--) {
+      double dist = (mag[k] - v) * (mag[k] - v) * w;
+      nbits = 0;
+      for (temp = v; temp; temp >>= 1)
+	nbits++;
+      for (j = k - 1; j >= 0; j--) {
+	if (! reachable[j])
+	  continue;
+	run = k - j - 1;
+	total = cost[j] + (zeroed[k-1] - zeroed[j]) + dist + (run >> 4) * zrl_bits +
+		TRELLIS_LAMBDA *
+		(trellis_code_size(code_size, ((run & 15) << 4) + nbits) + nbits);
+	if (! reachable[k] || total < cost[k]) {
+	  reachable[k] = TRUE;
+	  cost[k] = total;
+	  prev[k] = j;
+	  value[k] = v;
+	}
+      }
+    }
+  }
+
+  /* End the block after the best last nonzero, with an EOB unless full */
+  last = 0;
+  best = zeroed[DCTSIZE2-1] + TRELLIS_LAMBDA * trellis_code_size(code_size, 0x00);
+  for (k = 1; k < DCTSIZE2; k++) {
+    if (! reachable[k])
+      continue;
+    total = cost[k] + (zeroed[DCTSIZE2-1] - zeroed[k]);
+    if (k < DCTSIZE2 - 1)
+      total += TRELLIS_LAMBDA * trellis_code_size(code_size, 0x00);
+    if (total < best) {
+      best = total;
+      last = k;
+    }
+  }
+
+  for (k = last; k > 0; k = prev[k]) {
+    int n = jpeg_natural_order[k];
+    output_ptr[n] = (JCOEF) (workspace[n] < 0 ? -value[k] : value[k]);
+  }
+}
+
+
 /*
  * Perform forward DCT on one or more blocks of a component.
  *
@@ -84,9 +269,23 @@ forward_DCT (j_compress_ptr cinfo, jpeg_component_info * compptr,
   JDIMENSION bi;
 
   for (bi = 0; bi < num_blocks; bi++, start_col += compptr->DCT_h_scaled_size) {
+    if (fdct->flat_shortcut[compptr->component_index] &&
+	block_is_flat(sample_data, start_col)) {
+      quantize_flat_block(sample_data, start_col, divisors[0], coef_blocks[bi]);
+      continue;
+    }
+
     /* Perform the DCT */
     (*do_dct) (workspace, sample_data, start_col);
 
+    if (fdct->trellis[compptr->component_index]) {
+      trellis_quantize(workspace, divisors,
+		       fdct->ac_code_size[compptr->component_index],
+		       fdct->trellis_weight[compptr->component_index],
+		       coef_blocks[bi]);
+      continue;
+    }
+
     /* Quantize/descale the coefficients, and store into coef_blocks[] */
     { register DCTELEM temp, qval;
       register int i;
@@ -128,6 +327,29 @@ forward_DCT (j_compress_ptr cinfo, jpeg_component_info * compptr,
 }
 
 
+METHODDEF(void)
+forward_DCT_simd (j_compress_ptr cinfo, jpeg_component_info * compptr,
+		  JSAMPARRAY sample_data, JBLOCKROW coef_blocks,
+		  JDIMENSION start_col, JDIMENSION num_blocks)
+/* This version is used for the SIMD 8x8 ISLOW DCT, */
+/* which performs the quantization step itself. */
+{
+  my_fdct_ptr fdct = (my_fdct_ptr) cinfo->fdct;
+  int ci = compptr->component_index;
+  jsimd_fdct_quant_ptr do_dct = fdct->do_simd_dct[ci];
+  const DCTELEM * divisors = (const DCTELEM *) compptr->dct_table;
+  const float * recip = fdct->simd_recip[ci];
+  JDIMENSION bi;
+
+  for (bi = 0; bi < num_blocks; bi++, start_col += DCTSIZE) {
+    if (block_is_flat(sample_data, start_col))
+      quantize_flat_block(sample_data, start_col, divisors[0], coef_blocks[bi]);
+    else
+      (*do_dct) (sample_data, start_col, divisors, recip, coef_blocks[bi]);
+  }
+}
+
+
 #ifdef DCT_FLOAT_SUPPORTED
 
 METHODDEF(void)
@@ -188,9 +410,13 @@ start_pass_fdctmgr (j_compress_ptr cinfo)
   int method = 0;
   JQUANT_TBL * qtbl;
   DCTELEM * dtbl;
+  const jsimd_kernels * simd = jsimd_get_kernels();
 
   for (ci = 0, compptr = cinfo->comp_info; ci < cinfo->num_components;
        ci++, compptr++) {
+    fdct->do_simd_dct[ci] = NULL;
+    fdct->flat_shortcut[ci] = FALSE;
+    fdct->trellis[ci] = FALSE;
     /* Select the proper DCT routine for this component's scaling */
     switch ((compptr->DCT_h_scaled_size << 8) + compptr->DCT_v_scaled_size) {
 #ifdef DCT_SCALING_SUPPORTED
@@ -324,6 +550,9 @@ start_pass_fdctmgr (j_compress_ptr cinfo)
 #ifdef DCT_ISLOW_SUPPORTED
       case JDCT_ISLOW:
 	fdct->do_dct[ci] = jpeg_fdct_islow;
+	fdct->flat_shortcut[ci] = TRUE;
+	if (simd != NULL)
+	  fdct->do_simd_dct[ci] = simd->fdct_islow;
 	method = JDCT_ISLOW;
 	break;
 #endif
@@ -347,12 +576,48 @@ start_pass_fdctmgr (j_compress_ptr cinfo)
       ERREXIT2(cinfo, JERR_BAD_DCTSIZE,
 	       compptr->DCT_h_scaled_size, compptr->DCT_v_scaled_size);
     }
+    /* Trellis quantization replaces the fused SIMD quantizer.  A table
+     * not yet set up is the standard one, as jchuff.c would make it.
+     */
+    if (cinfo->trellis_quant && ! cinfo->arith_code && method != JDCT_FLOAT &&
+	compptr->DCT_h_scaled_size == DCTSIZE &&
+	compptr->DCT_v_scaled_size == DCTSIZE &&
+	compptr->ac_tbl_no >= 0 && compptr->ac_tbl_no < NUM_HUFF_TBLS &&
+	(cinfo->ac_huff_tbl_ptrs[compptr->ac_tbl_no] != NULL ||
+	 compptr->ac_tbl_no < 2)) {
+      JHUFF_TBL * htbl = cinfo->ac_huff_tbl_ptrs[compptr->ac_tbl_no];
+      int l, p = 0;
+
+      if (htbl == NULL)
+	htbl = jpeg_std_huff_table((j_common_ptr) cinfo, FALSE,
+				   compptr->ac_tbl_no);
+
+      MEMZERO(fdct->ac_code_size[ci], SIZEOF(fdct->ac_code_size[ci]));
+      for (l = 1; l <= 16; l++) {
+	for (i = htbl->bits[l]; i > 0 && p < 256; i--)
+	  fdct->ac_code_size[ci][htbl->huffval[p++]] = (char) l;
+      }
+      fdct->trellis[ci] = TRUE;
+      fdct->do_simd_dct[ci] = NULL;
+    }
     qtblno = compptr->quant_tbl_no;
     /* Make sure specified quantization table is present */
     if (qtblno < 0 || qtblno >= NUM_QUANT_TBLS ||
 	cinfo->quant_tbl_ptrs[qtblno] == NULL)
       ERREXIT1(cinfo, JERR_NO_QUANT_TABLE, qtblno);
     qtbl = cinfo->quant_tbl_ptrs[qtblno];
+    if (fdct->trellis[ci]) {
+      /* An error of one step weighs its squared size, relative to the
+       * smallest AC step so that one lambda serves every quality.
+       */
+      double finest = (double) qtbl->quantval[1];
+      for (i = 2; i < DCTSIZE2; i++)
+	if (qtbl->quantval[i] < finest)
+	  finest = (double) qtbl->quantval[i];
+      for (i = 0; i < DCTSIZE2; i++)
+	fdct->trellis_weight[ci][i] =
+	  (double) qtbl->quantval[i] * qtbl->quantval[i] / (finest * finest);
+    }
     /* Create divisor table from quant table */
     switch (method) {
 #ifdef PROVIDE_ISLOW_TABLES
@@ -365,7 +630,12 @@ start_pass_fdctmgr (j_compress_ptr cinfo)
 	dtbl[i] =
 	  ((DCTELEM) qtbl->quantval[i]) << (compptr->component_needed ? 4 : 3);
       }
-      fdct->pub.forward_DCT[ci] = forward_DCT;
+      if (fdct->do_simd_dct[ci] != NULL) {
+	for (i = 0; i < DCTSIZE2; i++)
+	  fdct->simd_recip[ci][i] = 1.0f / (float) dtbl[i];
+	fdct->pub.forward_DCT[ci] = forward_DCT_simd;
+      } else
+	fdct->pub.forward_DCT[ci] = forward_DCT;
       break;
 #endif
 #ifdef DCT_IFAST_SUPPORTED
@@ -246,6 +246,8 @@ jpeg_set_defaults (j_compress_ptr cinfo)
 
   /* By default, don't do extra passes to optimize entropy coding */
   cinfo->optimize_coding = FALSE;
+  /* ... nor trade quantization error for bits (see jcdctmgr.c) */
+  cinfo->trellis_quant = FALSE;
 
   /* By default, use the simpler non-cosited sampling alignment */
   cinfo->CCIR601_sampling = FALSE;
@@ -128,6 +128,8 @@ typedef FAST_FLOAT FLOAT_MULT_TYPE; /* preferred floating type */
 #define jpeg_fdct_2x4		jFD2x4
 #define jpeg_fdct_1x2		jFD1x2
 #define jpeg_idct_islow		jRDislow
+#define jpeg_idct_islow_dc	jRDislowdc
+#define jpeg_idct_islow_lowfreq	jRDislowlf
 #define jpeg_idct_ifast		jRDifast
 #define jpeg_idct_float		jRDfloat
 #define jpeg_idct_7x7		jRD7x7
@@ -237,6 +239,12 @@ EXTERN(void) jpeg_fdct_1x2
 EXTERN(void) jpeg_idct_islow
     JPP((j_decompress_ptr cinfo, jpeg_component_info * compptr,
 	 JCOEFPTR coef_block, JSAMPARRAY output_buf, JDIMENSION output_col));
+EXTERN(void) jpeg_idct_islow_dc
+    JPP((j_decompress_ptr cinfo, jpeg_component_info * compptr,
+	 JCOEFPTR coef_block, JSAMPARRAY output_buf, JDIMENSION output_col));
+EXTERN(void) jpeg_idct_islow_lowfreq
+    JPP((j_decompress_ptr cinfo, jpeg_component_info * compptr,
+	 JCOEFPTR coef_block, JSAMPARRAY output_buf, JDIMENSION output_col));
 EXTERN(void) jpeg_idct_ifast
     JPP((j_decompress_ptr cinfo, jpeg_component_info * compptr,
 	 JCOEFPTR coef_block, JSAMPARRAY output_buf, JDIMENSION output_col));
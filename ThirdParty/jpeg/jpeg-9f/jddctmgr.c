@@ -20,6 +20,7 @@
 #include "jinclude.h"
 #include "jpeglib.h"
 #include "jdct.h"		/* Private declarations for DCT subsystem */
+#include "jsimd.h"
 
 
 /*
@@ -50,6 +51,9 @@ typedef struct {
    * per-component comp_info structures.
    */
   int cur_method[MAX_COMPONENTS];
+
+  /* Full 8x8 ISLOW routine (C or SIMD) behind the sparse-block dispatch */
+  inverse_DCT_method_ptr full_islow[MAX_COMPONENTS];
 } my_idct_controller;
 
 typedef my_idct_controller * my_idct_ptr;
@@ -80,6 +84,47 @@ typedef union {
 #endif
 
 
+#ifdef DCT_ISLOW_SUPPORTED
+
+/*
+ * Texture data has many flat or smooth blocks, so after quantization
+ * most 8x8 blocks carry only a DC term or a few low-frequency terms.
+ * This routine looks at where the nonzero coefficients are and routes
+ * the block to the cheapest ISLOW variant that gives identical output.
+ */
+
+METHODDEF(void)
+idct_islow_sparse (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+		   JCOEFPTR coef_block,
+		   JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  JCOEFPTR inptr = coef_block;
+  int low = 0, high = 0;
+  int row;
+
+  /* Rows 0..3: columns 1..3 are low frequency, 4..7 high. */
+  for (row = 0; row < 4; row++, inptr += DCTSIZE) {
+    low |= inptr[1] | inptr[2] | inptr[3] | (row ? inptr[0] : 0);
+    high |= inptr[4] | inptr[5] | inptr[6] | inptr[7];
+  }
+  /* Rows 4..7 are all high frequency. */
+  for (; row < DCTSIZE; row++, inptr += DCTSIZE)
+    high |= inptr[0] | inptr[1] | inptr[2] | inptr[3] |
+	    inptr[4] | inptr[5] | inptr[6] | inptr[7];
+
+  if (high)
+    (*((my_idct_ptr) cinfo->idct)->full_islow[compptr->component_index])
+      (cinfo, compptr, coef_block, output_buf, output_col);
+  else if (low)
+    jpeg_idct_islow_lowfreq(cinfo, compptr, coef_block,
+			    output_buf, output_col);
+  else
+    jpeg_idct_islow_dc(cinfo, compptr, coef_block, output_buf, output_col);
+}
+
+#endif /* DCT_ISLOW_SUPPORTED */
+
+
 /*
  * Prepare for an output pass.
  * Here we select the proper IDCT routine for each component and build
@@ -95,6 +140,7 @@ start_pass (j_decompress_ptr cinfo)
   int method = 0;
   inverse_DCT_method_ptr method_ptr = NULL;
   JQUANT_TBL * qtbl;
+  const jsimd_kernels * simd = jsimd_get_kernels();
 
   for (ci = 0, compptr = cinfo->comp_info; ci < cinfo->num_components;
        ci++, compptr++) {
@@ -230,7 +276,10 @@ start_pass (j_decompress_ptr cinfo)
       switch (cinfo->dct_method) {
 #ifdef DCT_ISLOW_SUPPORTED
       case JDCT_ISLOW:
-	method_ptr = jpeg_idct_islow;
+	/* The SIMD kernel is bit-identical and uses the same table. */
+	idct->full_islow[ci] =
+	  simd != NULL ? simd->idct_islow : jpeg_idct_islow;
+	method_ptr = idct_islow_sparse;
 	method = JDCT_ISLOW;
 	break;
 #endif
@@ -424,6 +424,198 @@ jpeg_idct_islow (j_decompress_ptr cinfo, jpeg_component_info * compptr,
   }
 }
 
+/*
+ * Perform dequantization and inverse DCT on one block of coefficients
+ * in which only the DC term may be nonzero.
+ *
+ * The result is identical to jpeg_idct_islow on such a block: every
+ * column takes the all-AC-zero path there, and so does every row.
+ */
+
+GLOBAL(void)
+jpeg_idct_islow_dc (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+		    JCOEFPTR coef_block,
+		    JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  INT32 z2;
+  ISLOW_MULT_TYPE * quantptr;
+  JSAMPROW outptr;
+  JSAMPLE *range_limit = IDCT_range_limit(cinfo);
+  JSAMPLE dcval;
+  int ctr;
+  SHIFT_TEMPS
+
+  quantptr = (ISLOW_MULT_TYPE *) compptr->dct_table;
+  z2 = (INT32) (DEQUANTIZE(coef_block[0], quantptr[0]) << PASS1_BITS) +
+       ((((INT32) RANGE_CENTER) << (PASS1_BITS+3)) +
+	(ONE << (PASS1_BITS+2)));
+  dcval = range_limit[(int) RIGHT_SHIFT(z2, PASS1_BITS+3) & RANGE_MASK];
+
+  for (ctr = 0; ctr < DCTSIZE; ctr++) {
+    outptr = output_buf[ctr] + output_col;
+    outptr[0] = dcval;
+    outptr[1] = dcval;
+    outptr[2] = dcval;
+    outptr[3] = dcval;
+    outptr[4] = dcval;
+    outptr[5] = dcval;
+    outptr[6] = dcval;
+    outptr[7] = dcval;
+  }
+}
+
+
+/*
+ * Perform dequantization and inverse DCT on one block of coefficients
+ * in which only the upper left 4x4 (low-frequency) terms may be nonzero.
+ *
+ * This is jpeg_idct_islow with the known-zero inputs 4..7 of both
+ * passes removed, so the result is identical; only four columns need
+ * the first pass, and each 1-D transform saves three multiplies.
+ */
+
+GLOBAL(void)
+jpeg_idct_islow_lowfreq (j_decompress_ptr cinfo,
+			 jpeg_component_info * compptr,
+			 JCOEFPTR coef_block,
+			 JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  INT32 tmp0, tmp1, tmp2, tmp3;
+  INT32 tmp10, tmp11, tmp12, tmp13;
+  INT32 z1, z2, z3;
+  JCOEFPTR inptr;
+  ISLOW_MULT_TYPE * quantptr;
+  int * wsptr;
+  JSAMPROW outptr;
+  JSAMPLE *range_limit = IDCT_range_limit(cinfo);
+  int ctr;
+  int workspace[4*DCTSIZE];	/* buffers data between passes */
+  SHIFT_TEMPS
+
+  /* Pass 1: process columns 0..3 from input, store into work array.
+   * Columns 4..7 of the work array would be all zero, so they are omitted.
+   */
+
+  inptr = coef_block;
+  quantptr = (ISLOW_MULT_TYPE *) compptr->dct_table;
+  wsptr = workspace;
+  for (ctr = 0; ctr < 4; ctr++, inptr++, quantptr++, wsptr++) {
+    /* Even part: input 4 and 6 are zero. */
+
+    z2 = DEQUANTIZE(inptr[DCTSIZE*0], quantptr[DCTSIZE*0]);
+    z2 <<= CONST_BITS;
+    /* Add fudge factor here for final descale. */
+    z2 += ONE << (CONST_BITS-PASS1_BITS-1);
+
+    z3 = DEQUANTIZE(inptr[DCTSIZE*2], quantptr[DCTSIZE*2]);
+    z1 = MULTIPLY(z3, FIX_0_541196100);            /* c6 */
+    tmp2 = z1 + MULTIPLY(z3, FIX_0_765366865);     /* c2-c6 */
+
+    tmp10 = z2 + tmp2;
+    tmp13 = z2 - tmp2;
+    tmp11 = z2 + z1;
+    tmp12 = z2 - z1;
+
+    /* Odd part: inputs 7 and 5 are zero. */
+
+    tmp2 = DEQUANTIZE(inptr[DCTSIZE*3], quantptr[DCTSIZE*3]);
+    tmp3 = DEQUANTIZE(inptr[DCTSIZE*1], quantptr[DCTSIZE*1]);
+
+    z1 = MULTIPLY(tmp2 + tmp3, FIX_1_175875602);   /*  c3 */
+    z2 = MULTIPLY(tmp2, - FIX_1_961570560) + z1;   /* -c3-c5 */
+    z3 = MULTIPLY(tmp3, - FIX_0_390180644) + z1;   /* -c3+c5 */
+
+    z1 = MULTIPLY(tmp3, - FIX_0_899976223);        /* -c3+c7 */
+    tmp0 = z1 + z2;
+    tmp3 = MULTIPLY(tmp3, FIX_1_501321110) + z1 + z3; /* c1+c3-c5-c7 */
+
+    z1 = MULTIPLY(tmp2, - FIX_2_562915447);        /* -c1-c3 */
+    tmp1 = z1 + z3;
+    tmp2 = MULTIPLY(tmp2, FIX_3_072711026) + z1 + z2; /* c1+c3+c5-c7 */
+
+    /* Final output stage: inputs are tmp10..tmp13, tmp0..tmp3 */
+
+    wsptr[4*0] = (int) RIGHT_SHIFT(tmp10 + tmp3, CONST_BITS-PASS1_BITS);
+    wsptr[4*7] = (int) RIGHT_SHIFT(tmp10 - tmp3, CONST_BITS-PASS1_BITS);
+    wsptr[4*1] = (int) RIGHT_SHIFT(tmp11 + tmp2, CONST_BITS-PASS1_BITS);
+    wsptr[4*6] = (int) RIGHT_SHIFT(tmp11 - tmp2, CONST_BITS-PASS1_BITS);
+    wsptr[4*2] = (int) RIGHT_SHIFT(tmp12 + tmp1, CONST_BITS-PASS1_BITS);
+    wsptr[4*5] = (int) RIGHT_SHIFT(tmp12 - tmp1, CONST_BITS-PASS1_BITS);
+    wsptr[4*3] = (int) RIGHT_SHIFT(tmp13 + tmp0, CONST_BITS-PASS1_BITS);
+    wsptr[4*4] = (int) RIGHT_SHIFT(tmp13 - tmp0, CONST_BITS-PASS1_BITS);
+  }
+
+  /* Pass 2: process rows from work array, store into output array.
+   * Inputs 4..7 of every row are zero.
+   */
+
+  wsptr = workspace;
+  for (ctr = 0; ctr < DCTSIZE; ctr++, wsptr += 4) {
+    outptr = output_buf[ctr] + output_col;
+
+    /* Even part */
+
+    /* Add range center and fudge factor for final descale and range-limit. */
+    z2 = (INT32) wsptr[0] +
+	   ((((INT32) RANGE_CENTER) << (PASS1_BITS+3)) +
+	    (ONE << (PASS1_BITS+2)));
+    z2 <<= CONST_BITS;
+
+    z3 = (INT32) wsptr[2];
+    z1 = MULTIPLY(z3, FIX_0_541196100);            /* c6 */
+    tmp2 = z1 + MULTIPLY(z3, FIX_0_765366865);     /* c2-c6 */
+
+    tmp10 = z2 + tmp2;
+    tmp13 = z2 - tmp2;
+    tmp11 = z2 + z1;
+    tmp12 = z2 - z1;
+
+    /* Odd part */
+
+    tmp2 = (INT32) wsptr[3];
+    tmp3 = (INT32) wsptr[1];
+
+    z1 = MULTIPLY(tmp2 + tmp3, FIX_1_175875602);   /*  c3 */
+    z2 = MULTIPLY(tmp2, - FIX_1_961570560) + z1;   /* -c3-c5 */
+    z3 = MULTIPLY(tmp3, - FIX_0_390180644) + z1;   /* -c3+c5 */
+
+    z1 = MULTIPLY(tmp3, - FIX_0_899976223);        /* -c3+c7 */
+    tmp0 = z1 + z2;
+    tmp3 = MULTIPLY(tmp3, FIX_1_501321110) + z1 + z3; /* c1+c3-c5-c7 */
+
+    z1 = MULTIPLY(tmp2, - FIX_2_562915447);        /* -c1-c3 */
+    tmp1 = z1 + z3;
+    tmp2 = MULTIPLY(tmp2, FIX_3_072711026) + z1 + z2; /* c1+c3+c5-c7 */
+
+    /* Final output stage: inputs are tmp10..tmp13, tmp0..tmp3 */
+
+    outptr[0] = range_limit[(int) RIGHT_SHIFT(tmp10 + tmp3,
+					      CONST_BITS+PASS1_BITS+3)
+			    & RANGE_MASK];
+    outptr[7] = range_limit[(int) RIGHT_SHIFT(tmp10 - tmp3,
+					      CONST_BITS+PASS1_BITS+3)
+			    & RANGE_MASK];
+    outptr[1] = range_limit[(int) RIGHT_SHIFT(tmp11 + tmp2,
+					      CONST_BITS+PASS1_BITS+3)
+			    & RANGE_MASK];
+    outptr[6] = range_limit[(int) RIGHT_SHIFT(tmp11 - tmp2,
+					      CONST_BITS+PASS1_BITS+3)
+			    & RANGE_MASK];
+    outptr[2] = range_limit[(int) RIGHT_SHIFT(tmp12 + tmp1,
+					      CONST_BITS+PASS1_BITS+3)
+			    & RANGE_MASK];
+    outptr[5] = range_limit[(int) RIGHT_SHIFT(tmp12 - tmp1,
+					      CONST_BITS+PASS1_BITS+3)
+			    & RANGE_MASK];
+    outptr[3] = range_limit[(int) RIGHT_SHIFT(tmp13 + tmp0,
+					      CONST_BITS+PASS1_BITS+3)
+			    & RANGE_MASK];
+    outptr[4] = range_limit[(int) RIGHT_SHIFT(tmp13 - tmp0,
+					      CONST_BITS+PASS1_BITS+3)
+			    & RANGE_MASK];
+  }
+}
+
 #ifdef IDCT_SCALING_SUPPORTED
 
 
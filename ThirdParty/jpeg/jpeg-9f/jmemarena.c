@@ -0,0 +1,387 @@
+/*
+ * jmemarena.c
+ *
+ * This file is part of the Independent JPEG Group's software,
+ * as modified for the BLPFormat plug-in.
+ * For conditions of distribution and use, see the accompanying README file.
+ *
+ * This file provides the system-dependent portion of the JPEG memory
+ * manager on top of an application-owned arena (see jmemarena.h).
+ *
+ * max_memory_to_use is respected: when the application sets a budget
+ * (the plug-in derives it from the host's maxData), whole-image virtual
+ * arrays that do not fit are spilled to an anonymous temporary file, as
+ * in jmemansi.c.  With no budget everything stays in memory.
+ *
+ * jmemmgr.c asks the system layer for only a handful of large slabs per
+ * image and returns them all at jpeg_abort()/jpeg_destroy().  When one JPEG
+ * object encodes a chain of shrinking mip levels, each level requests the
+ * same slabs at smaller sizes, so a best-fit free list with splitting
+ * satisfies every level after the first without touching malloc().
+ * Freed blocks are not coalesced; jpeg_arena_reset() restores each chunk
+ * to a single free block.
+ */
+
+#define JPEG_INTERNALS
+#include "jinclude.h"
+#include "jpeglib.h"
+#include "jmemsys.h"		/* import the system-dependent declarations */
+#include "jmemarena.h"
+
+#ifndef HAVE_STDLIB_H		/* <stdlib.h> should declare malloc(),free() */
+extern void * malloc JPP((size_t size));
+extern void free JPP((void *ptr));
+#endif
+
+
+#define ARENA_ALIGN		16	/* alignment of every returned block */
+#define ARENA_DEFAULT_CHUNK	((size_t) 256 * 1024)
+
+#define ARENA_ROUND(n)	(((n) + (ARENA_ALIGN-1)) & ~((size_t) (ARENA_ALIGN-1)))
+
+static jpeg_mem_hook mem_hook = NULL;	/* see jpeg_set_mem_hook */
+
+#define NOTE_MALLOC(size)	if (mem_hook != NULL) (*mem_hook)((size), FALSE)
+#define NOTE_FREE(size)		if (mem_hook != NULL) (*mem_hook)((size), TRUE)
+
+/* A chunk obtained from malloc(); its data area follows the header. */
+
+typedef struct arena_chunk {
+  struct arena_chunk * next;
+  size_t size;			/* bytes in the data area */
+} arena_chunk;
+
+#define CHUNK_HDR	ARENA_ROUND(SIZEOF(arena_chunk))
+#define CHUNK_DATA(c)	((char *) (c) + CHUNK_HDR)
+
+/* A free block; the header lives in the free memory itself. */
+
+typedef struct arena_block {
+  struct arena_block * next;
+  size_t size;
+} arena_block;
+
+#define MIN_BLOCK	ARENA_ROUND(SIZEOF(arena_block))
+
+/* Size of the block that backs a request of n bytes */
+#define BLOCK_SIZE(n)	((n) < MIN_BLOCK ? MIN_BLOCK : ARENA_ROUND(n))
+
+struct jpeg_arena_struct {
+  arena_chunk * chunks;		/* all chunks, newest first */
+  char * bump_ptr;		/* unused tail of the newest chunk */
+  size_t bump_left;
+  arena_block * free_list;	/* blocks handed back by libjpeg */
+  size_t chunk_size;		/* minimum size of a new chunk */
+};
+
+
+LOCAL(void)
+arena_release (jpeg_arena * arena, void * object, size_t size)
+{
+  arena_block * block = (arena_block *) object;
+
+  block->size = size;
+  block->next = arena->free_list;
+  arena->free_list = block;
+}
+
+
+LOCAL(void *)
+arena_alloc (jpeg_arena * arena, size_t sizeofobject)
+{
+  size_t size = BLOCK_SIZE(sizeofobject);
+  arena_block ** link;
+  arena_block ** best = NULL;
+  arena_block * block;
+  arena_chunk * chunk;
+  char * result;
+
+  if (size < sizeofobject)	/* wrapped around */
+    return NULL;
+
+  /* Best fit from the free list */
+  for (link = &arena->free_list; *link != NULL; link = &(*link)->next) {
+    if ((*link)->size >= size &&
+	(best == NULL || (*link)->size < (*best)->size)) {
+      best = link;
+      if ((*link)->size == size)
+	break;
+    }
+  }
+  if (best != NULL) {
+    block = *best;
+    *best = block->next;
+    if (block->size - size >= MIN_BLOCK)
+      arena_release(arena, (char *) block + size, block->size - size);
+    return (void *) block;
+  }
+
+  /* Carve from the newest chunk, or start a new one */
+  if (size > arena->bump_left) {
+    size_t chunk_bytes = size > arena->chunk_size ? size : arena->chunk_size;
+
+    if (chunk_bytes > (size_t) -1 - CHUNK_HDR)
+      return NULL;
+    chunk = (arena_chunk *) malloc(CHUNK_HDR + chunk_bytes);
+    if (chunk == NULL)
+      return NULL;
+    NOTE_MALLOC(CHUNK_HDR + chunk_bytes);
+    chunk->size = chunk_bytes;
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    /* Keep the old tail for later requests */
+    if (arena->bump_left >= MIN_BLOCK)
+      arena_release(arena, arena->bump_ptr, arena->bump_left);
+    arena->bump_ptr = CHUNK_DATA(chunk);
+    arena->bump_left = chunk_bytes;
+  }
+  result = arena->bump_ptr;
+  arena->bump_ptr += size;
+  arena->bump_left -= size;
+  return (void *) result;
+}
+
+
+LOCAL(boolean)
+arena_owns (jpeg_arena * arena, void * object)
+{
+  arena_chunk * chunk;
+
+  for (chunk = arena->chunks; chunk != NULL; chunk = chunk->next)
+    if ((char *) object >= CHUNK_DATA(chunk) &&
+	(char *) object < CHUNK_DATA(chunk) + chunk->size)
+      return TRUE;
+  return FALSE;
+}
+
+
+LOCAL(void)
+arena_free (jpeg_arena * arena, void * object, size_t sizeofobject)
+{
+  size_t size = BLOCK_SIZE(sizeofobject);
+
+  arena_release(arena, object, size);
+}
+
+
+GLOBAL(jpeg_arena *)
+jpeg_arena_create (size_t chunk_size)
+{
+  jpeg_arena * arena = (jpeg_arena *) malloc(SIZEOF(jpeg_arena));
+
+  if (arena == NULL)
+    return NULL;
+  arena->chunks = NULL;
+  arena->bump_ptr = NULL;
+  arena->bump_left = 0;
+  arena->free_list = NULL;
+  arena->chunk_size =
+    chunk_size ? ARENA_ROUND(chunk_size) : ARENA_DEFAULT_CHUNK;
+  return arena;
+}
+
+
+GLOBAL(void)
+jpeg_arena_reset (jpeg_arena * arena)
+{
+  arena_chunk * chunk;
+
+  if (arena == NULL)
+    return;
+  arena->free_list = NULL;
+  arena->bump_ptr = NULL;
+  arena->bump_left = 0;
+  for (chunk = arena->chunks; chunk != NULL; chunk = chunk->next)
+    arena_release(arena, CHUNK_DATA(chunk), chunk->size);
+}
+
+
+GLOBAL(void)
+jpeg_arena_destroy (jpeg_arena * arena)
+{
+  arena_chunk * chunk;
+
+  if (arena == NULL)
+    return;
+  while ((chunk = arena->chunks) != NULL) {
+    arena->chunks = chunk->next;
+    NOTE_FREE(CHUNK_HDR + chunk->size);
+    free(chunk);
+  }
+  free(arena);
+}
+
+
+GLOBAL(void)
+jpeg_set_mem_hook (jpeg_mem_hook hook)
+{
+  mem_hook = hook;
+}
+
+
+/*
+ * The JPEG object's arena, or NULL to use malloc()/free().  It lives in the
+ * memory manager's system slot, so client_data stays the application's.
+ */
+
+LOCAL(jpeg_arena *)
+arena_of (j_common_ptr cinfo)
+{
+  void ** slot = jpeg_mem_system_slot(cinfo);
+
+  return slot != NULL ? (jpeg_arena *) *slot : NULL;
+}
+
+#define ARENA_OF(cinfo)	arena_of(cinfo)
+
+
+GLOBAL(void)
+jpeg_set_arena (j_common_ptr cinfo, jpeg_arena * arena)
+{
+  void ** slot = jpeg_mem_system_slot(cinfo);
+
+  if (slot != NULL)
+    *slot = (void *) arena;
+}
+
+
+GLOBAL(void *)
+jpeg_get_small (j_common_ptr cinfo, size_t sizeofobject)
+{
+  jpeg_arena * arena = ARENA_OF(cinfo);
+
+  void * object;
+
+  if (arena != NULL)
+    return arena_alloc(arena, sizeofobject);
+  object = malloc(sizeofobject);
+  if (object != NULL)
+    NOTE_MALLOC(sizeofobject);
+  return object;
+}
+
+GLOBAL(void)
+jpeg_free_small (j_common_ptr cinfo, void * object, size_t sizeofobject)
+{
+  jpeg_arena * arena = ARENA_OF(cinfo);
+
+  /* What was allocated before jpeg_set_arena came from malloc() */
+  if (arena == NULL || ! arena_owns(arena, object)) {
+    NOTE_FREE(sizeofobject);
+    free(object);
+  } else
+    arena_free(arena, object, sizeofobject);
+}
+
+
+/*
+ * "Large" objects are treated the same as "small" ones.
+ */
+
+GLOBAL(void FAR *)
+jpeg_get_large (j_common_ptr cinfo, size_t sizeofobject)
+{
+  return (void FAR *) jpeg_get_small(cinfo, sizeofobject);
+}
+
+GLOBAL(void)
+jpeg_free_large (j_common_ptr cinfo, void FAR * object, size_t sizeofobject)
+{
+  jpeg_free_small(cinfo, (void *) object, sizeofobject);
+}
+
+
+/*
+ * This routine computes the total memory space available for allocation.
+ */
+
+GLOBAL(long)
+jpeg_mem_available (j_common_ptr cinfo, long min_bytes_needed,
+		    long max_bytes_needed, long already_allocated)
+{
+  if (cinfo->mem->max_memory_to_use)
+    return cinfo->mem->max_memory_to_use - already_allocated;
+
+  /* Here we say, "we got all you want bud!" */
+  return max_bytes_needed;
+}
+
+
+/*
+ * Backing store (temporary file) management.
+ * Backing store objects are only used when the value returned by
+ * jpeg_mem_available is less than the total space needed, that is, only
+ * when the application has set max_memory_to_use.
+ */
+
+
+METHODDEF(void)
+read_backing_store (j_common_ptr cinfo, backing_store_ptr info,
+		    void FAR * buffer_address,
+		    long file_offset, long byte_count)
+{
+  if (fseek(info->temp_file, file_offset, SEEK_SET))
+    ERREXIT(cinfo, JERR_TFILE_SEEK);
+  if (JFREAD(info->temp_file, buffer_address, byte_count)
+      != (size_t) byte_count)
+    ERREXIT(cinfo, JERR_TFILE_READ);
+}
+
+
+METHODDEF(void)
+write_backing_store (j_common_ptr cinfo, backing_store_ptr info,
+		     void FAR * buffer_address,
+		     long file_offset, long byte_count)
+{
+  if (fseek(info->temp_file, file_offset, SEEK_SET))
+    ERREXIT(cinfo, JERR_TFILE_SEEK);
+  if (JFWRITE(info->temp_file, buffer_address, byte_count)
+      != (size_t) byte_count)
+    ERREXIT(cinfo, JERR_TFILE_WRITE);
+}
+
+
+METHODDEF(void)
+close_backing_store (j_common_ptr cinfo, backing_store_ptr info)
+{
+  fclose(info->temp_file);
+  /* tmpfile() files are deleted when closed (or when the process exits) */
+}
+
+
+/*
+ * Initial opening of a backing-store object.
+ *
+ * tmpfile() creates an unnamed file in the system temporary directory
+ * (the Universal CRT uses GetTempPath), so info->temp_name[] is unused.
+ * The OS file cache keeps small spills in RAM much like anonymous mmap.
+ */
+
+GLOBAL(void)
+jpeg_open_backing_store (j_common_ptr cinfo, backing_store_ptr info,
+			 long total_bytes_needed)
+{
+  if ((info->temp_file = tmpfile()) == NULL)
+    ERREXITS(cinfo, JERR_TFILE_CREATE, "");
+  info->read_backing_store = read_backing_store;
+  info->write_backing_store = write_backing_store;
+  info->close_backing_store = close_backing_store;
+}
+
+
+/*
+ * These routines take care of any system-dependent initialization and
+ * cleanup required.  Here, there isn't any.
+ */
+
+GLOBAL(long)
+jpeg_mem_init (j_common_ptr cinfo)
+{
+  return 0;			/* no budget unless the application sets one */
+}
+
+GLOBAL(void)
+jpeg_mem_term (j_common_ptr cinfo)
+{
+  /* no work */
+}
@@ -136,6 +136,9 @@ typedef struct {
    * array routines.
    */
   JDIMENSION last_rowsperchunk;	/* from most recent alloc_sarray/barray */
+
+  /* Private to the system-dependent layer (see jpeg_mem_system_slot) */
+  void * system_private;
 } my_memory_mgr;
 
 typedef my_memory_mgr * my_mem_ptr;
@@ -1016,6 +1019,20 @@ self_destruct (j_common_ptr cinfo)
 }
 
 
+/*
+ * The system-dependent layer's slot in the memory manager of cinfo, NULL
+ * before jinit_memory_mgr has made it or after self_destruct (jmemsys.h).
+ */
+
+GLOBAL(void **)
+jpeg_mem_system_slot (j_common_ptr cinfo)
+{
+  if (cinfo->mem == NULL)
+    return NULL;
+  return &((my_mem_ptr) cinfo->mem)->system_private;
+}
+
+
 /*
  * Memory manager initialization.
  * When this is called, only the error manager pointer is valid in cinfo!
@@ -1088,6 +1105,8 @@ jinit_memory_mgr (j_common_ptr cinfo)
 
   mem->total_space_allocated = SIZEOF(my_memory_mgr);
 
+  mem->system_private = NULL;
+
   /* Declare ourselves open for business */
   cinfo->mem = &mem->pub;
 
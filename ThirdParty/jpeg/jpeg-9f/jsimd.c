@@ -0,0 +1,127 @@
+/*
+ * jsimd.c
+ *
+ * This file is part of the Independent JPEG Group's software,
+ * as modified for the BLPFormat plug-in.
+ * For conditions of distribution and use, see the accompanying README file.
+ *
+ * This file contains the run-time CPU detection that selects between
+ * the AVX2, SSE2 and portable C implementations of the ISLOW DCT.
+ */
+
+#define JPEG_INTERNALS
+#include "jinclude.h"
+#include "jpeglib.h"
+#include "jdct.h"		/* Private declarations for DCT subsystem */
+#include "jsimd.h"
+
+#ifdef JSIMD_SUPPORTED
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+#define JSIMD_LEVEL_NONE  0
+#define JSIMD_LEVEL_SSE2  1
+#define JSIMD_LEVEL_AVX2  2
+
+
+LOCAL(void)
+cpuid_query (int leaf, int subleaf, unsigned int regs[4])
+{
+#if defined(_MSC_VER)
+  int info[4];
+
+  __cpuidex(info, leaf, subleaf);
+  regs[0] = (unsigned int) info[0];
+  regs[1] = (unsigned int) info[1];
+  regs[2] = (unsigned int) info[2];
+  regs[3] = (unsigned int) info[3];
+#else
+  __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+
+LOCAL(unsigned int)
+xgetbv_lo (void)
+/* Low half of XCR0: which register states the OS saves on context switch */
+{
+#if defined(_MSC_VER)
+  return (unsigned int) _xgetbv(0);
+#else
+  unsigned int eax, edx;
+
+  __asm__ __volatile__ ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+  return eax;
+#endif
+}
+
+
+LOCAL(int)
+detect_simd_level (void)
+{
+  unsigned int regs[4];
+  unsigned int max_leaf;
+  int level = JSIMD_LEVEL_NONE;
+
+  cpuid_query(0, 0, regs);
+  max_leaf = regs[0];
+  if (max_leaf < 1)
+    return level;
+
+  cpuid_query(1, 0, regs);
+  if (regs[3] & (1U << 26))		/* EDX.SSE2 */
+    level = JSIMD_LEVEL_SSE2;
+
+  /* AVX2 requires CPU support plus OS support for saving YMM state. */
+  if ((regs[2] & (1U << 27)) &&		/* ECX.OSXSAVE */
+      (regs[2] & (1U << 28)) &&		/* ECX.AVX */
+      (xgetbv_lo() & 6) == 6 &&		/* XMM and YMM state enabled */
+      max_leaf >= 7) {
+    cpuid_query(7, 0, regs);
+    if (regs[1] & (1U << 5))		/* EBX.AVX2 */
+      level = JSIMD_LEVEL_AVX2;
+  }
+
+#ifndef NO_GETENV
+  if (getenv("JSIMD_FORCENONE") != NULL)
+    level = JSIMD_LEVEL_NONE;
+  else if (getenv("JSIMD_FORCESSE2") != NULL && level > JSIMD_LEVEL_SSE2)
+    level = JSIMD_LEVEL_SSE2;
+#endif
+
+  return level;
+}
+
+
+GLOBAL(const jsimd_kernels *)
+jsimd_get_kernels (void)
+{
+  /* Detection is idempotent, so a racing first call is harmless. */
+  static int simd_level = -1;
+  const jsimd_kernels * kernels;
+
+  if (simd_level < 0)
+    simd_level = detect_simd_level();
+
+  if (simd_level >= JSIMD_LEVEL_AVX2 &&
+      (kernels = jsimd_avx2_kernels()) != NULL)
+    return kernels;
+  if (simd_level >= JSIMD_LEVEL_SSE2 &&
+      (kernels = jsimd_sse2_kernels()) != NULL)
+    return kernels;
+  return NULL;
+}
+
+#else /* ! JSIMD_SUPPORTED */
+
+GLOBAL(const jsimd_kernels *)
+jsimd_get_kernels (void)
+{
+  return NULL;
+}
+
+#endif /* JSIMD_SUPPORTED */
@@ -0,0 +1,64 @@
+/*
+ * jsimd.h
+ *
+ * This file is part of the Independent JPEG Group's software,
+ * as modified for the BLPFormat plug-in.
+ * For conditions of distribution and use, see the accompanying README file.
+ *
+ * This include file contains the private interface to the SIMD kernels
+ * (SSE2 and AVX2) used for the 8x8 ISLOW forward and inverse DCT.
+ * The kernels produce output bit-identical to jfdctint.c/jidctint.c;
+ * jcdctmgr.c and jddctmgr.c select them at run time when the CPU
+ * supports them.
+ */
+
+
+/* SIMD kernels are only provided for 8-bit samples on x86 targets. */
+
+#if BITS_IN_JSAMPLE == 8
+#if defined(_M_X64) || defined(_M_IX86) || \
+    defined(__x86_64__) || defined(__i386__)
+#define JSIMD_SUPPORTED
+#endif
+#endif
+
+
+/*
+ * Forward DCT with fused quantization.  The kernel performs the ISLOW
+ * forward DCT of one 8x8 sample block starting at sample_data[0][start_col]
+ * and quantizes the result with the ISLOW divisor table (as built by
+ * jcdctmgr.c) into output[].  reciprocals[] holds 1/divisors[i] and is
+ * only used to seed the division; the result is exact.
+ */
+
+typedef JMETHOD(void, jsimd_fdct_quant_ptr,
+		(JSAMPARRAY sample_data, JDIMENSION start_col,
+		 const DCTELEM * divisors, const float * reciprocals,
+		 JCOEFPTR output));
+
+/* The set of kernels available for one instruction set. */
+
+typedef struct {
+  const char * name;			/* "sse2", "avx2" */
+  jsimd_fdct_quant_ptr fdct_islow;	/* 8x8 ISLOW FDCT + quantization */
+  inverse_DCT_method_ptr idct_islow;	/* 8x8 ISLOW dequantization + IDCT */
+} jsimd_kernels;
+
+
+/* Short forms of external names for systems with brain-damaged linkers. */
+
+#ifdef NEED_SHORT_EXTERNAL_NAMES
+#define jsimd_get_kernels	jSGetKern
+#define jsimd_sse2_kernels	jSSse2Kern
+#define jsimd_avx2_kernels	jSAvx2Kern
+#endif /* NEED_SHORT_EXTERNAL_NAMES */
+
+/* Returns the best kernel set for the running CPU, or NULL to use the
+ * portable C code.  The environment variables JSIMD_FORCENONE and
+ * JSIMD_FORCESSE2 may be used to restrict the selection (for testing).
+ */
+EXTERN(const jsimd_kernels *) jsimd_get_kernels JPP((void));
+
+/* Per-instruction-set tables; NULL if not compiled in. */
+EXTERN(const jsimd_kernels *) jsimd_sse2_kernels JPP((void));
+EXTERN(const jsimd_kernels *) jsimd_avx2_kernels JPP((void));
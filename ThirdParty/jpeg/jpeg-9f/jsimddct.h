@@ -0,0 +1,297 @@
+/*
+ * jsimddct.h
+ *
+ * This file is part of the Independent JPEG Group's software,
+ * as modified for the BLPFormat plug-in.
+ * For conditions of distribution and use, see the accompanying README file.
+ *
+ * This file contains the instruction-set independent body of the SIMD
+ * ISLOW forward and inverse DCT.  It is included by jsse2dct.c and
+ * javx2dct.c after they define the vector type and primitives below:
+ *
+ *   VEC                   eight signed 32-bit lanes
+ *   VSET1(c)              broadcast an int constant
+ *   VADD(a,b) VSUB(a,b)   lane-wise add/subtract
+ *   VMUL(a,b)             lane-wise multiply, low 32 bits
+ *   VSRAI(a,n) VSLLI(a,n) arithmetic right/left shift by constant
+ *   VAND(a,b)             bitwise and
+ *   VLOAD_U8(p)           load 8 JSAMPLEs, zero-extended
+ *   VLOAD_S16(p)          load 8 JCOEFs, sign-extended
+ *   VLOAD_I32(p)          load 8 ints
+ *   VTRANSPOSE(v)         transpose VEC v[8] in place
+ *   VSTORE_U8_SAT(p,a)    store 8 lanes as JSAMPLEs, saturating to 0..255
+ *   VQUANTIZE(p,a,d,r)    quantize lanes by divisors d[] (reciprocals r[])
+ *                         and store 8 JCOEFs at p
+ *   VEND()                leave the vector unit clean before returning
+ *   JSIMD_NAME(x)         decorate a function name with the ISA suffix
+ *   JSIMD_NAME_STRING     name of the instruction set, for the kernel table
+ *
+ * The arithmetic below is a lane-parallel transcription of
+ * jpeg_fdct_islow() and jpeg_idct_islow(): every intermediate is kept in
+ * 32 bits exactly as in the C code, so the results are bit-identical.
+ * (Where INT32 is a 64-bit long, the C IDCT can differ for dequantized
+ * coefficients beyond +-32767, which no valid 8-bit stream contains.)
+ * The row pass works on transposed data (one lane per row), the column
+ * pass on natural data (one lane per column).
+ */
+
+#define CONST_BITS  13
+#define PASS1_BITS  2
+
+#define FIX_0_298631336  ((INT32)  2446)	/* FIX(0.298631336) */
+#define FIX_0_390180644  ((INT32)  3196)	/* FIX(0.390180644) */
+#define FIX_0_541196100  ((INT32)  4433)	/* FIX(0.541196100) */
+#define FIX_0_765366865  ((INT32)  6270)	/* FIX(0.765366865) */
+#define FIX_0_899976223  ((INT32)  7373)	/* FIX(0.899976223) */
+#define FIX_1_175875602  ((INT32)  9633)	/* FIX(1.175875602) */
+#define FIX_1_501321110  ((INT32)  12299)	/* FIX(1.501321110) */
+#define FIX_1_847759065  ((INT32)  15137)	/* FIX(1.847759065) */
+#define FIX_1_961570560  ((INT32)  16069)	/* FIX(1.961570560) */
+#define FIX_2_053119869  ((INT32)  16819)	/* FIX(2.053119869) */
+#define FIX_2_562915447  ((INT32)  20995)	/* FIX(2.562915447) */
+#define FIX_3_072711026  ((INT32)  25172)	/* FIX(3.072711026) */
+
+#define VMULC(a,c)  VMUL(a, VSET1(c))
+
+
+/*
+ * Odd part of the forward DCT, shared by both passes.
+ * On entry d0..d3 hold the differences tmp0..tmp3 of jpeg_fdct_islow;
+ * on exit they hold the unshifted outputs 1, 3, 5 and 7.
+ */
+
+#define FDCT_ODD(tmp0, tmp1, tmp2, tmp3, fudge)  { \
+    VEC o12, o13, oz1; \
+    o12 = VADD(tmp0, tmp2); \
+    o13 = VADD(tmp1, tmp3); \
+    oz1 = VADD(VMULC(VADD(o12, o13), FIX_1_175875602), VSET1(fudge)); \
+    o12 = VADD(VMULC(o12, - FIX_0_390180644), oz1); \
+    o13 = VADD(VMULC(o13, - FIX_1_961570560), oz1); \
+    oz1 = VMULC(VADD(tmp0, tmp3), - FIX_0_899976223); \
+    tmp0 = VADD(VMULC(tmp0, FIX_1_501321110), VADD(oz1, o12)); \
+    tmp3 = VADD(VMULC(tmp3, FIX_0_298631336), VADD(oz1, o13)); \
+    oz1 = VMULC(VADD(tmp1, tmp2), - FIX_2_562915447); \
+    tmp1 = VADD(VMULC(tmp1, FIX_3_072711026), VADD(oz1, o13)); \
+    tmp2 = VADD(VMULC(tmp2, FIX_2_053119869), VADD(oz1, o12)); \
+  }
+
+
+/*
+ * Perform the forward DCT on one block of samples and quantize it.
+ */
+
+METHODDEF(void)
+JSIMD_NAME(fdct_islow) (JSAMPARRAY sample_data, JDIMENSION start_col,
+			      const DCTELEM * divisors,
+			      const float * reciprocals, JCOEFPTR output)
+{
+  VEC v[DCTSIZE];
+  VEC tmp0, tmp1, tmp2, tmp3, tmp10, tmp11, tmp12, tmp13, z1;
+  int i;
+
+  for (i = 0; i < DCTSIZE; i++)
+    v[i] = VLOAD_U8(sample_data[i] + start_col);
+
+  /* Pass 1: process rows (one row per lane). */
+  VTRANSPOSE(v);
+
+  tmp0 = VADD(v[0], v[7]);
+  tmp1 = VADD(v[1], v[6]);
+  tmp2 = VADD(v[2], v[5]);
+  tmp3 = VADD(v[3], v[4]);
+
+  tmp10 = VADD(tmp0, tmp3);
+  tmp12 = VSUB(tmp0, tmp3);
+  tmp11 = VADD(tmp1, tmp2);
+  tmp13 = VSUB(tmp1, tmp2);
+
+  tmp0 = VSUB(v[0], v[7]);
+  tmp1 = VSUB(v[1], v[6]);
+  tmp2 = VSUB(v[2], v[5]);
+  tmp3 = VSUB(v[3], v[4]);
+
+  /* Apply unsigned->signed conversion. */
+  v[0] = VSLLI(VSUB(VADD(tmp10, tmp11), VSET1(8 * CENTERJSAMPLE)),
+	       PASS1_BITS);
+  v[4] = VSLLI(VSUB(tmp10, tmp11), PASS1_BITS);
+
+  z1 = VMULC(VADD(tmp12, tmp13), FIX_0_541196100);
+  z1 = VADD(z1, VSET1(ONE << (CONST_BITS-PASS1_BITS-1)));
+  v[2] = VSRAI(VADD(z1, VMULC(tmp12, FIX_0_765366865)),
+	       CONST_BITS-PASS1_BITS);
+  v[6] = VSRAI(VSUB(z1, VMULC(tmp13, FIX_1_847759065)),
+	       CONST_BITS-PASS1_BITS);
+
+  FDCT_ODD(tmp0, tmp1, tmp2, tmp3, ONE << (CONST_BITS-PASS1_BITS-1));
+
+  v[1] = VSRAI(tmp0, CONST_BITS-PASS1_BITS);
+  v[3] = VSRAI(tmp1, CONST_BITS-PASS1_BITS);
+  v[5] = VSRAI(tmp2, CONST_BITS-PASS1_BITS);
+  v[7] = VSRAI(tmp3, CONST_BITS-PASS1_BITS);
+
+  /* Pass 2: process columns (one column per lane). */
+  VTRANSPOSE(v);
+
+  tmp0 = VADD(v[0], v[7]);
+  tmp1 = VADD(v[1], v[6]);
+  tmp2 = VADD(v[2], v[5]);
+  tmp3 = VADD(v[3], v[4]);
+
+  /* Add fudge factor here for final descale. */
+  tmp10 = VADD(VADD(tmp0, tmp3), VSET1(ONE << (PASS1_BITS-1)));
+  tmp12 = VSUB(tmp0, tmp3);
+  tmp11 = VADD(tmp1, tmp2);
+  tmp13 = VSUB(tmp1, tmp2);
+
+  tmp0 = VSUB(v[0], v[7]);
+  tmp1 = VSUB(v[1], v[6]);
+  tmp2 = VSUB(v[2], v[5]);
+  tmp3 = VSUB(v[3], v[4]);
+
+  v[0] = VSRAI(VADD(tmp10, tmp11), PASS1_BITS);
+  v[4] = VSRAI(VSUB(tmp10, tmp11), PASS1_BITS);
+
+  z1 = VMULC(VADD(tmp12, tmp13), FIX_0_541196100);
+  z1 = VADD(z1, VSET1(ONE << (CONST_BITS+PASS1_BITS-1)));
+  v[2] = VSRAI(VADD(z1, VMULC(tmp12, FIX_0_765366865)),
+	       CONST_BITS+PASS1_BITS);
+  v[6] = VSRAI(VSUB(z1, VMULC(tmp13, FIX_1_847759065)),
+	       CONST_BITS+PASS1_BITS);
+
+  FDCT_ODD(tmp0, tmp1, tmp2, tmp3, ONE << (CONST_BITS+PASS1_BITS-1));
+
+  v[1] = VSRAI(tmp0, CONST_BITS+PASS1_BITS);
+  v[3] = VSRAI(tmp1, CONST_BITS+PASS1_BITS);
+  v[5] = VSRAI(tmp2, CONST_BITS+PASS1_BITS);
+  v[7] = VSRAI(tmp3, CONST_BITS+PASS1_BITS);
+
+  /* Quantize/descale the coefficients, and store into output[]. */
+  for (i = 0; i < DCTSIZE; i++)
+    VQUANTIZE(output + i * DCTSIZE, v[i],
+	      divisors + i * DCTSIZE, reciprocals + i * DCTSIZE);
+
+  VEND();
+}
+
+
+/*
+ * One 1-D pass of the inverse DCT, on eight lanes at once.
+ * in[0] must already contain the DC term shifted left by CONST_BITS
+ * plus any fudge factor; in[4] is shifted here.
+ * Outputs are left unshifted in out[].
+ */
+
+LOCAL(void)
+JSIMD_NAME(idct_pass) (VEC * in, VEC * out)
+{
+  VEC tmp0, tmp1, tmp2, tmp3, tmp10, tmp11, tmp12, tmp13, z1, z2, z3;
+
+  /* Even part: reverse the even part of the forward DCT. */
+  z2 = in[0];
+  z3 = VSLLI(in[4], CONST_BITS);
+  tmp0 = VADD(z2, z3);
+  tmp1 = VSUB(z2, z3);
+
+  z2 = in[2];
+  z3 = in[6];
+  z1 = VMULC(VADD(z2, z3), FIX_0_541196100);
+  tmp2 = VADD(z1, VMULC(z2, FIX_0_765366865));
+  tmp3 = VSUB(z1, VMULC(z3, FIX_1_847759065));
+
+  tmp10 = VADD(tmp0, tmp2);
+  tmp13 = VSUB(tmp0, tmp2);
+  tmp11 = VADD(tmp1, tmp3);
+  tmp12 = VSUB(tmp1, tmp3);
+
+  /* Odd part per figure 8. */
+  tmp0 = in[7];
+  tmp1 = in[5];
+  tmp2 = in[3];
+  tmp3 = in[1];
+
+  z2 = VADD(tmp0, tmp2);
+  z3 = VADD(tmp1, tmp3);
+
+  z1 = VMULC(VADD(z2, z3), FIX_1_175875602);
+  z2 = VADD(VMULC(z2, - FIX_1_961570560), z1);
+  z3 = VADD(VMULC(z3, - FIX_0_390180644), z1);
+
+  z1 = VMULC(VADD(tmp0, tmp3), - FIX_0_899976223);
+  tmp0 = VADD(VMULC(tmp0, FIX_0_298631336), VADD(z1, z2));
+  tmp3 = VADD(VMULC(tmp3, FIX_1_501321110), VADD(z1, z3));
+
+  z1 = VMULC(VADD(tmp1, tmp2), - FIX_2_562915447);
+  tmp1 = VADD(VMULC(tmp1, FIX_2_053119869), VADD(z1, z3));
+  tmp2 = VADD(VMULC(tmp2, FIX_3_072711026), VADD(z1, z2));
+
+  out[0] = VADD(tmp10, tmp3);
+  out[7] = VSUB(tmp10, tmp3);
+  out[1] = VADD(tmp11, tmp2);
+  out[6] = VSUB(tmp11, tmp2);
+  out[2] = VADD(tmp12, tmp1);
+  out[5] = VSUB(tmp12, tmp1);
+  out[3] = VADD(tmp13, tmp0);
+  out[4] = VSUB(tmp13, tmp0);
+}
+
+
+/*
+ * Perform dequantization and inverse DCT on one block of coefficients.
+ */
+
+METHODDEF(void)
+JSIMD_NAME(idct_islow) (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+			JCOEFPTR coef_block,
+			JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  const ISLOW_MULT_TYPE * quantptr = (ISLOW_MULT_TYPE *) compptr->dct_table;
+  VEC v[DCTSIZE], w[DCTSIZE];
+  int i;
+
+  /* Pass 1: process columns from input (one column per lane). */
+  for (i = 0; i < DCTSIZE; i++)
+    v[i] = VMUL(VLOAD_S16(coef_block + i * DCTSIZE),
+		VLOAD_I32(quantptr + i * DCTSIZE));
+  /* Add fudge factor here for final descale. */
+  v[0] = VADD(VSLLI(v[0], CONST_BITS),
+	      VSET1(ONE << (CONST_BITS-PASS1_BITS-1)));
+
+  JSIMD_NAME(idct_pass) (v, w);
+  for (i = 0; i < DCTSIZE; i++)
+    w[i] = VSRAI(w[i], CONST_BITS-PASS1_BITS);
+
+  /* Pass 2: process rows from work array (one row per lane). */
+  VTRANSPOSE(w);
+
+  /* Add range center and fudge factor for final descale and range-limit. */
+  w[0] = VADD(w[0], VSET1((((INT32) RANGE_CENTER) << (PASS1_BITS+3)) +
+			  (ONE << (PASS1_BITS+2))));
+  w[0] = VSLLI(w[0], CONST_BITS);
+
+  JSIMD_NAME(idct_pass) (w, v);
+
+  /* Range-limit exactly as IDCT_range_limit(): the masked value, less
+   * RANGE_SUBSET, saturated to 0..MAXJSAMPLE.
+   */
+  for (i = 0; i < DCTSIZE; i++)
+    v[i] = VSUB(VAND(VSRAI(v[i], CONST_BITS+PASS1_BITS+3),
+		     VSET1(RANGE_MASK)),
+		VSET1(RANGE_SUBSET));
+
+  VTRANSPOSE(v);
+  for (i = 0; i < DCTSIZE; i++)
+    VSTORE_U8_SAT(output_buf[i] + output_col, v[i]);
+
+  VEND();
+}
+
+
+/*
+ * Kernel table exported to jsimd.c.
+ */
+
+static const jsimd_kernels JSIMD_NAME(kernel_table) = {
+  JSIMD_NAME_STRING,
+  JSIMD_NAME(fdct_islow),
+  JSIMD_NAME(idct_islow)
+};
@@ -0,0 +1,269 @@
+/*
+ * jsse2dct.c
+ *
+ * This file is part of the Independent JPEG Group's software,
+ * as modified for the BLPFormat plug-in.
+ * For conditions of distribution and use, see the accompanying README file.
+ *
+ * This file contains the SSE2 implementation of the 8x8 ISLOW forward
+ * DCT (with quantization) and inverse DCT (with dequantization).
+ * SSE2 is part of the x86-64 baseline, so no special compiler switch
+ * is needed.  The arithmetic lives in jsimddct.h.
+ */
+
+#define JPEG_INTERNALS
+#include "jinclude.h"
+#include "jpeglib.h"
+#include "jdct.h"		/* Private declarations for DCT subsystem */
+#include "jsimd.h"
+
+#ifdef JSIMD_SUPPORTED
+
+#include <emmintrin.h>
+
+
+/* An SSE2 register holds four lanes, so a vector of eight is a pair. */
+
+typedef struct {
+  __m128i l;			/* lanes 0..3 */
+  __m128i h;			/* lanes 4..7 */
+} sse2_vec;
+
+
+INLINE
+LOCAL(sse2_vec)
+sse2_set1 (int c)
+{
+  sse2_vec r;
+
+  r.l = r.h = _mm_set1_epi32(c);
+  return r;
+}
+
+
+INLINE
+LOCAL(sse2_vec)
+sse2_add (sse2_vec a, sse2_vec b)
+{
+  a.l = _mm_add_epi32(a.l, b.l);
+  a.h = _mm_add_epi32(a.h, b.h);
+  return a;
+}
+
+
+INLINE
+LOCAL(sse2_vec)
+sse2_sub (sse2_vec a, sse2_vec b)
+{
+  a.l = _mm_sub_epi32(a.l, b.l);
+  a.h = _mm_sub_epi32(a.h, b.h);
+  return a;
+}
+
+
+/* SSE2 has no 32-bit multiply-low; build it from two 32x32->64 products. */
+
+INLINE
+LOCAL(__m128i)
+sse2_mullo (__m128i a, __m128i b)
+{
+  __m128i even = _mm_mul_epu32(a, b);
+  __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+
+  return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0,0,2,0)),
+			    _mm_shuffle_epi32(odd, _MM_SHUFFLE(0,0,2,0)));
+}
+
+
+INLINE
+LOCAL(sse2_vec)
+sse2_mul (sse2_vec a, sse2_vec b)
+{
+  a.l = sse2_mullo(a.l, b.l);
+  a.h = sse2_mullo(a.h, b.h);
+  return a;
+}
+
+
+INLINE
+LOCAL(sse2_vec)
+sse2_srai (sse2_vec a, int n)
+{
+  a.l = _mm_srai_epi32(a.l, n);
+  a.h = _mm_srai_epi32(a.h, n);
+  return a;
+}
+
+
+INLINE
+LOCAL(sse2_vec)
+sse2_slli (sse2_vec a, int n)
+{
+  a.l = _mm_slli_epi32(a.l, n);
+  a.h = _mm_slli_epi32(a.h, n);
+  return a;
+}
+
+
+INLINE
+LOCAL(sse2_vec)
+sse2_and (sse2_vec a, sse2_vec b)
+{
+  a.l = _mm_and_si128(a.l, b.l);
+  a.h = _mm_and_si128(a.h, b.h);
+  return a;
+}
+
+
+INLINE
+LOCAL(sse2_vec)
+sse2_load_u8 (const JSAMPLE * p)
+{
+  __m128i zero = _mm_setzero_si128();
+  __m128i x = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) p), zero);
+  sse2_vec r;
+
+  r.l = _mm_unpacklo_epi16(x, zero);
+  r.h = _mm_unpackhi_epi16(x, zero);
+  return r;
+}
+
+
+INLINE
+LOCAL(sse2_vec)
+sse2_load_s16 (const JCOEF * p)
+{
+  __m128i x = _mm_loadu_si128((const __m128i *) p);
+  sse2_vec r;
+
+  r.l = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+  r.h = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+  return r;
+}
+
+
+INLINE
+LOCAL(sse2_vec)
+sse2_load_i32 (const int * p)
+{
+  sse2_vec r;
+
+  r.l = _mm_loadu_si128((const __m128i *) p);
+  r.h = _mm_loadu_si128((const __m128i *) (p + 4));
+  return r;
+}
+
+
+INLINE
+LOCAL(void)
+sse2_store_u8_sat (JSAMPLE * p, sse2_vec a)
+{
+  __m128i x = _mm_packs_epi32(a.l, a.h);
+
+  _mm_storel_epi64((__m128i *) p, _mm_packus_epi16(x, x));
+}
+
+
+#define SSE2_TRANSPOSE4(r0, r1, r2, r3)  { \
+    __m128i t0 = _mm_unpacklo_epi32(r0, r1); \
+    __m128i t1 = _mm_unpacklo_epi32(r2, r3); \
+    __m128i t2 = _mm_unpackhi_epi32(r0, r1); \
+    __m128i t3 = _mm_unpackhi_epi32(r2, r3); \
+    r0 = _mm_unpacklo_epi64(t0, t1); \
+    r1 = _mm_unpackhi_epi64(t0, t1); \
+    r2 = _mm_unpacklo_epi64(t2, t3); \
+    r3 = _mm_unpackhi_epi64(t2, t3); \
+  }
+
+/* Transpose the four 4x4 quadrants, then swap the off-diagonal ones. */
+
+LOCAL(void)
+sse2_transpose (sse2_vec * v)
+{
+  int i;
+  __m128i t;
+
+  SSE2_TRANSPOSE4(v[0].l, v[1].l, v[2].l, v[3].l);
+  SSE2_TRANSPOSE4(v[0].h, v[1].h, v[2].h, v[3].h);
+  SSE2_TRANSPOSE4(v[4].l, v[5].l, v[6].l, v[7].l);
+  SSE2_TRANSPOSE4(v[4].h, v[5].h, v[6].h, v[7].h);
+  for (i = 0; i < 4; i++) {
+    t = v[i].h;
+    v[i].h = v[i+4].l;
+    v[i+4].l = t;
+  }
+}
+
+
+/*
+ * Quantize four lanes exactly like forward_DCT(): round the magnitude
+ * to nearest and divide.  The float product gives a quotient that is at
+ * most one off (the numerators are far below 2^24); one correction step
+ * in each direction makes it exact.
+ */
+
+INLINE
+LOCAL(__m128i)
+sse2_quantize4 (__m128i a, const DCTELEM * d, const float * r)
+{
+  __m128i qval = _mm_loadu_si128((const __m128i *) d);
+  __m128i sign = _mm_srai_epi32(a, 31);
+  __m128i num, q, rem;
+
+  num = _mm_sub_epi32(_mm_xor_si128(a, sign), sign);
+  num = _mm_add_epi32(num, _mm_srai_epi32(qval, 1));
+  q = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(num), _mm_loadu_ps(r)));
+  rem = _mm_sub_epi32(num, sse2_mullo(q, qval));
+  q = _mm_sub_epi32(q, _mm_cmpgt_epi32(rem,
+			 _mm_sub_epi32(qval, _mm_set1_epi32(1))));
+  q = _mm_add_epi32(q, _mm_cmplt_epi32(rem, _mm_setzero_si128()));
+  return _mm_sub_epi32(_mm_xor_si128(q, sign), sign);
+}
+
+
+INLINE
+LOCAL(void)
+sse2_quantize (JCOEFPTR p, sse2_vec a, const DCTELEM * d, const float * r)
+{
+  _mm_storeu_si128((__m128i *) p,
+		   _mm_packs_epi32(sse2_quantize4(a.l, d, r),
+				   sse2_quantize4(a.h, d + 4, r + 4)));
+}
+
+
+#define VEC			sse2_vec
+#define VSET1(c)		sse2_set1((int) (c))
+#define VADD(a,b)		sse2_add(a, b)
+#define VSUB(a,b)		sse2_sub(a, b)
+#define VMUL(a,b)		sse2_mul(a, b)
+#define VSRAI(a,n)		sse2_srai(a, n)
+#define VSLLI(a,n)		sse2_slli(a, n)
+#define VAND(a,b)		sse2_and(a, b)
+#define VLOAD_U8(p)		sse2_load_u8(p)
+#define VLOAD_S16(p)		sse2_load_s16(p)
+#define VLOAD_I32(p)		sse2_load_i32(p)
+#define VTRANSPOSE(v)		sse2_transpose(v)
+#define VSTORE_U8_SAT(p,a)	sse2_store_u8_sat(p, a)
+#define VQUANTIZE(p,a,d,r)	sse2_quantize(p, a, d, r)
+#define VEND()
+#define JSIMD_NAME(x)		x##_sse2
+#define JSIMD_NAME_STRING	"sse2"
+
+#include "jsimddct.h"
+
+
+GLOBAL(const jsimd_kernels *)
+jsimd_sse2_kernels (void)
+{
+  return &kernel_table_sse2;
+}
+
+#else /* ! JSIMD_SUPPORTED */
+
+GLOBAL(const jsimd_kernels *)
+jsimd_sse2_kernels (void)
+{
+  return NULL;
+}
+
+#endif /* JSIMD_SUPPORTED */
@@ -0,0 +1,425 @@
+//-------------------------------------------------------------------------------
+//
+//	File:
+//		BLPCodec.cpp
+//
+//	Description:
+//		Reading and writing of BLP1 levels. See BLPCodec.h.
+//
+//		libjpeg reports errors with longjmp; each function here that calls
+//		it sets its own jump point and keeps what must be freed in the
+//		error manager, so no jump leaves this file.
+//
+//-------------------------------------------------------------------------------
+
+#include "BLPCodec.h"
+#include "BLPHash.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <setjmp.h>
+
+extern "C" {
+#include "../ThirdParty/jpeg/include/jpeglib.h"
+#include "../ThirdParty/jpeg/include/jerror.h"
+}
+
+namespace {
+
+// The output buffer starts at this size and doubles when full.
+const size_t kMinOutputBytes = 65536;
+
+// Compresses into a vector the caller owns, so that nothing is left to
+// free however libjpeg stops. (jpeg_mem_dest frees the buffer it hands
+// back whenever it grows, which a longjmp leaves dangling.)
+typedef struct VectorDestination
+{
+    struct jpeg_destination_mgr pub;
+    std::vector<uint8>* out;
+} VectorDestination;
+
+// Everything that must survive a longjmp out of libjpeg lives here rather
+// than in locals of the frame that called setjmp.
+typedef struct CodecErrorMgr
+{
+    struct jpeg_error_mgr pub;
+    jmp_buf setjmp_buffer;
+    VectorDestination dest;
+} CodecErrorMgr;
+
+METHODDEF(void) CodecErrorExit(j_common_ptr cinfo)
+{
+    CodecErrorMgr* err = (CodecErrorMgr*)cinfo->err;
+    longjmp(err->setjmp_buffer, 1);
+}
+
+METHODDEF(void) CodecOutputMessage(j_common_ptr)
+{
+    // Warnings are ignored and errors returned.
+}
+
+// Grows dest's vector to at least size bytes, or ends the call in progress
+// through error_exit.
+void GrowOutput(j_compress_ptr cinfo, VectorDestination* dest, size_t size)
+{
+    bool grown = true;
+    try {
+        dest->out->resize(size);
+    } catch (const std::bad_alloc&) {
+        grown = false;
+    }
+    if (!grown)
+        ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 0);
+}
+
+METHODDEF(void) InitVectorDestination(j_compress_ptr cinfo)
+{
+    VectorDestination* dest = (VectorDestination*)cinfo->dest;
+    GrowOutput(cinfo, dest, kMinOutputBytes);
+    dest->pub.next_output_byte = dest->out->data();
+    dest->pub.free_in_buffer = dest->out->size();
+}
+
+METHODDEF(boolean) EmptyVectorDestination(j_compress_ptr cinfo)
+{
+    VectorDestination* dest = (VectorDestination*)cinfo->dest;
+    size_t used = dest->out->size();
+    GrowOutput(cinfo, dest, used * 2);
+    dest->pub.next_output_byte = dest->out->data() + used;
+    dest->pub.free_in_buffer = dest->out->size() - used;
+    return TRUE;
+}
+
+METHODDEF(void) TermVectorDestination(j_compress_ptr cinfo)
+{
+    VectorDestination* dest = (VectorDestination*)cinfo->dest;
+    dest->out->resize(dest->out->size() - dest->pub.free_in_buffer);
+}
+
+// Rows of a pass between polls of a BLPCancel.
+const long kCancelRows = 16;
+
+// libjpeg has no message for a stop the application asked for; this code
+// is past its own.
+const int kCancelledCode = JMSG_LASTMSGCODE;
+
+typedef struct CancelMonitor
+{
+    struct jpeg_progress_mgr pub;
+    BLPCancel cancel;
+} CancelMonitor;
+
+METHODDEF(void) CancelProgress(j_common_ptr cinfo)
+{
+    CancelMonitor* monitor = (CancelMonitor*)cinfo->progress;
+    if (monitor->pub.pass_counter % kCancelRows == 0 && BLPCancelled(&monitor->cancel))
+        ERREXIT(cinfo, kCancelledCode);
+}
+
+uint64 QuantTablesHash(const jpeg_component_info* components, int count, JQUANT_TBL* const* tables)
+{
+    uint64 hash = BLPHash64(&count, sizeof(count));
+    for (int c = 0; c < count; c++) {
+        const JQUANT_TBL* table = components[c].quant_tbl_no < NUM_QUANT_TBLS
+            ? tables[components[c].quant_tbl_no] : NULL;
+        int32 sampling[2] = { components[c].h_samp_factor, components[c].v_samp_factor };
+        hash = BLPHash64(sampling, sizeof(sampling), hash);
+        if (table != NULL)
+            hash = BLPHash64(table->quantval, sizeof(table->quantval), hash);
+    }
+    return hash;
+}
+
+// BLPResizeLevel for exactly half of srcW x srcH, every mip of an even
+// size: each byte is the truncated mean of a 2x2 square, as the general
+// loop makes it, without its per-pixel spans.
+void HalveLevel(const uint8* src, int32 srcW, uint8* dst, int32 dstW, int32 dstH,
+                const BLPCancel* cancel)
+{
+    const size_t srcRow = (size_t)srcW * 4;
+    const size_t dstRow = (size_t)dstW * 4;
+
+    for (int32 y = 0; y < dstH; y++) {
+        if (y % kCancelRows == 0 && BLPCancelled(cancel))
+            return;
+        const uint8* top = src + (size_t)y * 2 * srcRow;
+        const uint8* bottom = top + srcRow;
+        uint8* d = dst + (size_t)y * dstRow;
+        for (size_t x = 0; x < dstRow; x += 4, top += 8, bottom += 8) {
+            for (int32 c = 0; c < 4; c++)
+                d[x + c] = (uint8)((top[c] + top[4 + c] + bottom[c] + bottom[4 + c]) >> 2);
+        }
+    }
+}
+
+} // namespace
+
+bool BLPCheckHeader(const BLP_HEADER& header)
+{
+    const char* magic = (const char*)&header.MagicNumber;
+    if (magic[0] != 'B' || magic[1] != 'L' || magic[2] != 'P' || magic[3] != '1')
+        return false;
+    return header.Compression == BLP_COMPRESSION_JPEG || header.Compression == BLP_COMPRESSION_DIRECT;
+}
+
+int32 BLPMipLevelCount(int32 width, int32 height)
+{
+    int32 levels = 1;
+    while ((width > 1 || height > 1) && levels < kBLPMaxMips) {
+        width = width / 2 > 0 ? width / 2 : 1;
+        height = height / 2 > 0 ? height / 2 : 1;
+        levels++;
+    }
+    return levels;
+}
+
+void BLPResizeLevel(const uint8* src, int32 srcW, int32 srcH, uint8* dst, int32 dstW, int32 dstH,
+                    const BLPCancel* cancel)
+{
+    if (srcW == dstW * 2 && srcH == dstH * 2) {
+        HalveLevel(src, srcW, dst, dstW, dstH, cancel);
+        return;
+    }
+
+    float xRatio = (float)srcW / dstW;
+    float yRatio = (float)srcH / dstH;
+
+    for (int32 y = 0; y < dstH; y++) {
+        if (y % kCancelRows == 0 && BLPCancelled(cancel))
+            return;
+        int32 startY = (int32)(y * yRatio);
+        int32 endY = (int32)((y + 1) * yRatio);
+        if (endY <= startY)
+            endY = startY + 1;
+        if (endY > srcH)
+            endY = srcH;
+
+        for (int32 x = 0; x < dstW; x++) {
+            int32 startX = (int32)(x * xRatio);
+            int32 endX = (int32)((x + 1) * xRatio);
+            if (endX <= startX)
+                endX = startX + 1;
+            if (endX > srcW)
+                endX = srcW;
+
+            int32 sum[4] = { 0, 0, 0, 0 };
+            int32 count = 0;
+            for (int32 sy = startY; sy < endY; sy++) {
+                const uint8* p = src + ((size_t)sy * srcW + startX) * 4;
+                for (int32 sx = startX; sx < endX; sx++, p += 4) {
+                    sum[0] += p[0];
+                    sum[1] += p[1];
+                    sum[2] += p[2];
+                    sum[3] += p[3];
+                    count++;
+                }
+            }
+
+            if (count > 0) {
+                uint8* d = dst + ((size_t)y * dstW + x) * 4;
+                d[0] = (uint8)(sum[0] / count);
+                d[1] = (uint8)(sum[1] / count);
+                d[2] = (uint8)(sum[2] / count);
+                d[3] = (uint8)(sum[3] / count);
+            }
+        }
+    }
+}
+
+void BLPSwapRedBlue(const uint8* src, uint8* dst, size_t count)
+{
+    for (size_t i = 0; i < count; i++, src += 4, dst += 4) {
+        uint8 first = src[0];
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = first;
+        dst[3] = src[3];
+    }
+}
+
+void BLPExpandPalette(const uint8* indices, const uint8* alpha, uint32 alphaBits,
+                      const uint8* palette, size_t count, uint8* rgba)
+{
+    for (size_t i = 0; i < count; i++, rgba += 4) {
+        const uint8* entry = palette + indices[i] * 4;
+        rgba[0] = entry[2];
+        rgba[1] = entry[1];
+        rgba[2] = entry[0];
+        rgba[3] = 255;
+    }
+    if (alpha == NULL)
+        return;
+
+    rgba -= count * 4;
+    if (alphaBits == 8) {
+        for (size_t i = 0; i < count; i++)
+            rgba[i * 4 + 3] = alpha[i];
+    } else if (alphaBits == 1) {
+        for (size_t i = 0; i < count; i++)
+            rgba[i * 4 + 3] = (alpha[i / 8] & (1 << (i % 8))) ? 255 : 0;
+    } else if (alphaBits == 4) {
+        // Even pixels take the high nibble, as BLP.py reads them.
+        for (size_t i = 0; i < count; i++) {
+            uint8 byte = alpha[i / 2];
+            uint8 value = (i % 2 == 0) ? (byte >> 4) : (byte & 0x0F);
+            rgba[i * 4 + 3] = (uint8)((value << 4) | value);
+        }
+    }
+}
+
+bool BLPAlphaAllZero(const uint8* rgba, size_t count)
+{
+    // Or the alpha bytes of a run together and test once per run, which
+    // leaves the inner loop without a branch.
+    const size_t kRun = 1024;
+    for (size_t start = 0; start < count; start += kRun) {
+        size_t end = start + kRun < count ? start + kRun : count;
+        uint8 any = 0;
+        for (size_t i = start; i < end; i++)
+            any |= rgba[i * 4 + 3];
+        if (any != 0)
+            return false;
+    }
+    return true;
+}
+
+bool BLPDecodeJpegLevel(const uint8* jpeg, size_t size, int32 width, int32 height,
+                        long maxMemory, uint8* rgba, BLPJpegLevelInfo* info,
+                        const BLPCancel* cancel)
+{
+    struct jpeg_decompress_struct cinfo;
+    CodecErrorMgr jerr;
+
+    memset(&cinfo, 0, sizeof(cinfo));
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = CodecErrorExit;
+    jerr.pub.output_message = CodecOutputMessage;
+
+    if (setjmp(jerr.setjmp_buffer)) {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    cinfo.mem->max_memory_to_use = maxMemory;
+    if (cancel != NULL)
+        BLPWatchCancel((j_common_ptr)&cinfo, *cancel);
+    jpeg_mem_src(&cinfo, jpeg, (unsigned long)size);
+    (void)jpeg_read_header(&cinfo, TRUE);
+    if (info != NULL)
+        info->tablesHash = QuantTablesHash(cinfo.comp_info, cinfo.num_components, cinfo.quant_tbl_ptrs);
+
+    if (cinfo.num_components == 4) {
+        cinfo.jpeg_color_space = JCS_CMYK;
+        cinfo.out_color_space = JCS_CMYK;
+    }
+    (void)jpeg_start_decompress(&cinfo);
+
+    const int32 components = cinfo.output_components;
+    if (info != NULL) {
+        info->width = (int32)cinfo.output_width;
+        info->height = (int32)cinfo.output_height;
+        info->components = components;
+    }
+
+    JSAMPARRAY buffer = (*cinfo.mem->alloc_sarray)((j_common_ptr)&cinfo, JPOOL_IMAGE,
+                                                   cinfo.output_width * components, 1);
+    const int32 columns = width < (int32)cinfo.output_width ? width : (int32)cinfo.output_width;
+
+    while (cinfo.output_scanline < cinfo.output_height) {
+        int32 row = (int32)cinfo.output_scanline;
+        (void)jpeg_read_scanlines(&cinfo, buffer, 1);
+        if (row >= height)
+            continue;
+
+        // The components are B, G, R and, with four, A.
+        const uint8* src = buffer[0];
+        uint8* dst = rgba + (size_t)row * width * 4;
+        if (components == 4) {
+            BLPSwapRedBlue(src, dst, (size_t)columns);
+        } else if (components == 3) {
+            for (int32 x = 0; x < columns; x++, src += 3, dst += 4) {
+                dst[0] = src[2];
+                dst[1] = src[1];
+                dst[2] = src[0];
+                dst[3] = 255;
+            }
+        } else {
+            for (int32 x = 0; x < columns; x++, src += components, dst += 4) {
+                dst[0] = dst[1] = dst[2] = src[0];
+                dst[3] = 255;
+            }
+        }
+    }
+
+    (void)jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return true;
+}
+
+void BLPWatchCancel(struct jpeg_common_struct* cinfo, const BLPCancel& cancel)
+{
+    CancelMonitor* monitor = (CancelMonitor*)(*cinfo->mem->alloc_small)(cinfo, JPOOL_PERMANENT,
+                                                                        sizeof(CancelMonitor));
+    memset(monitor, 0, sizeof(*monitor));
+    monitor->pub.progress_monitor = CancelProgress;
+    monitor->cancel = cancel;
+    cinfo->progress = &monitor->pub;
+}
+
+void BLPWriteJpegScanlines(struct jpeg_compress_struct* cinfo, const uint8* rgba,
+                           int32 width, uint8* row)
+{
+    JSAMPROW rowPointer = row;
+    while (cinfo->next_scanline < cinfo->image_height) {
+        BLPSwapRedBlue(rgba + (size_t)cinfo->next_scanline * width * 4, row, (size_t)width);
+        jpeg_write_scanlines(cinfo, &rowPointer, 1);
+    }
+}
+
+bool BLPEncodeJpegLevel(const uint8* rgba, int32 width, int32 height,
+                        const BLPEncodeSettings& settings, std::vector<uint8>& out,
+                        const BLPCancel* cancel)
+{
+    uint8* row = (uint8*)malloc((size_t)width * 4);
+    if (row == NULL)
+        return false;
+
+    struct jpeg_compress_struct cinfo;
+    CodecErrorMgr jerr;
+    jerr.dest.pub.init_destination = InitVectorDestination;
+    jerr.dest.pub.empty_output_buffer = EmptyVectorDestination;
+    jerr.dest.pub.term_destination = TermVectorDestination;
+    jerr.dest.out = &out;
+
+    memset(&cinfo, 0, sizeof(cinfo));
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = CodecErrorExit;
+    jerr.pub.output_message = CodecOutputMessage;
+
+    if (setjmp(jerr.setjmp_buffer)) {
+        jpeg_destroy_compress(&cinfo);
+        free(row);
+        return false;
+    }
+
+    jpeg_create_compress(&cinfo);
+    if (cancel != NULL)
+        BLPWatchCancel((j_common_ptr)&cinfo, *cancel);
+    BLPSetupEncoder(&cinfo, settings);
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.dest = &jerr.dest.pub;
+    jpeg_start_compress(&cinfo, TRUE);
+    BLPWriteJpegScanlines(&cinfo, rgba, width, row);
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    free(row);
+    return true;
+}
+
+uint64 BLPQuantTablesHash(const struct jpeg_compress_struct* cinfo)
+{
+    return QuantTablesHash(cinfo->comp_info, cinfo->num_components, cinfo->quant_tbl_ptrs);
+}
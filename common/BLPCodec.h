@@ -0,0 +1,101 @@
+//-------------------------------------------------------------------------------
+//
+//	File:
+//		BLPCodec.h
+//
+//	Description:
+//		Reading and writing of BLP1 levels: header checks, palette
+//		expansion, channel swizzles, mip resizing and the JPEG encode and
+//		decode of one level, as the plug-in does them.
+//
+//		The plug-in keeps RGBA pixels; a JPEG level holds its components
+//		in B, G, R, A order, and a palette has B, G, R, 0 entries. Every
+//		function here takes and returns RGBA unless it says otherwise.
+//
+//		Together with BLPHash.h, BLPMemPolicy.h, BLPMetrics.h, BLPPalette.h,
+//		BLPRateControl.h, BLPReader.h, BLPTaskPool.h, BLPTransform.h,
+//		BLPWriter.h and BLPWriteSession.h this makes up blpcore, which
+//		builds without the Photoshop SDK (CMakeLists.txt).
+//
+//-------------------------------------------------------------------------------
+
+#ifndef __BLPCodec_H__
+#define __BLPCodec_H__
+
+#include "BLPFile.h"
+#include "BLPRateControl.h"
+#include <cstddef>
+#include <vector>
+
+struct jpeg_common_struct;
+struct jpeg_compress_struct;
+
+// True for a BLP1 header of a compression the plug-in reads.
+bool BLPCheckHeader(const BLP_HEADER& header);
+
+// Levels the plug-in writes for a width x height image: halving down to
+// 1x1, at most kBLPMaxMips.
+int32 BLPMipLevelCount(int32 width, int32 height);
+
+// Box-filters the srcW x srcH pixels at src down to dstW x dstH at dst.
+// Works on any 4-byte pixels, so the channel order does not matter. Polls
+// cancel (may be NULL) every 16 rows of dst and leaves the rest undone
+// once it has fired.
+void BLPResizeLevel(const uint8* src, int32 srcW, int32 srcH, uint8* dst, int32 dstW, int32 dstH,
+                    const BLPCancel* cancel = NULL);
+
+// Swaps the first and third byte of count 4-byte pixels, RGBA to BGRA or
+// back. src and dst may be the same.
+void BLPSwapRedBlue(const uint8* src, uint8* dst, size_t count);
+
+// Expands count palette indices to RGBA. palette holds 256 B, G, R, 0
+// entries. alpha is packed at alphaBits per pixel as in a Direct level
+// (1: LSB first, 4: high nibble first, 8), or NULL for opaque pixels.
+void BLPExpandPalette(const uint8* indices, const uint8* alpha, uint32 alphaBits,
+                      const uint8* palette, size_t count, uint8* rgba);
+
+// True if the alpha of all count RGBA pixels is 0.
+bool BLPAlphaAllZero(const uint8* rgba, size_t count);
+
+// What BLPDecodeJpegLevel found in a stream.
+typedef struct BLPJpegLevelInfo
+{
+    int32 width;            // of the stream, which may differ from the level's
+    int32 height;
+    int32 components;       // 4 with alpha, 3 without
+    uint64 tablesHash;      // BLPQuantTablesHash of the stream
+} BLPJpegLevelInfo;
+
+// Decodes the JPEG stream of size bytes at jpeg (the shared header, if
+// any, already in front) into width x height RGBA pixels at rgba. Rows
+// and columns beyond the stream are left alone and those beyond the
+// level dropped; without alpha, alpha is 255. maxMemory is libjpeg's
+// max_memory_to_use, 0 for no limit. info may be NULL. Returns false if
+// libjpeg rejected the stream or cancel (may be NULL) fired.
+bool BLPDecodeJpegLevel(const uint8* jpeg, size_t size, int32 width, int32 height,
+                        long maxMemory, uint8* rgba, BLPJpegLevelInfo* info,
+                        const BLPCancel* cancel = NULL);
+
+// Makes libjpeg poll cancel, of which it keeps a copy, every 16 rows of
+// every pass over cinfo, which must be created and not yet started. When
+// it fires, the call in progress ends through error_exit.
+void BLPWatchCancel(struct jpeg_common_struct* cinfo, const BLPCancel& cancel);
+
+// Writes the width x height RGBA pixels at rgba as the scanlines of
+// cinfo, whose compression is started, through row, 4 * width bytes.
+void BLPWriteJpegScanlines(struct jpeg_compress_struct* cinfo, const uint8* rgba,
+                           int32 width, uint8* row);
+
+// Encodes width x height RGBA pixels into out as one complete JPEG level
+// with settings (BLPSetupEncoder). Returns false if out of memory,
+// libjpeg failed or cancel (may be NULL) fired.
+bool BLPEncodeJpegLevel(const uint8* rgba, int32 width, int32 height,
+                        const BLPEncodeSettings& settings, std::vector<uint8>& out,
+                        const BLPCancel* cancel = NULL);
+
+// Identifies the quantization of cinfo, with its defaults and quality set:
+// component count, sampling and the table of every component. Streams
+// with the same hash were quantized alike (BLPJpegLevelInfo::tablesHash).
+uint64 BLPQuantTablesHash(const struct jpeg_compress_struct* cinfo);
+
+#endif // __BLPCodec_H__
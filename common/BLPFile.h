@@ -0,0 +1,69 @@
+//-------------------------------------------------------------------------------
+//
+//	File:
+//		BLPFile.h
+//
+//	Description:
+//		On-disk layout of BLP1 files, shared by the plug-in and the
+//		host-independent tools (BLPTransform.h).
+//
+//-------------------------------------------------------------------------------
+
+#ifndef __BLPFile_H__
+#define __BLPFile_H__
+
+#include "PSIntTypes.h"
+
+//-------------------------------------------------------------------------------
+//	Structure -- FileHeader
+//-------------------------------------------------------------------------------
+
+#pragma pack(push, 1)
+struct BLP_HEADER
+{
+    uint32 MagicNumber; // 'BLP1'
+    uint32 Compression; // 0: JPEG, 1: Direct (Paletted or Uncompressed)
+    uint32 alpha_bits;  // Alpha channel depth: 0, 1, 4, or 8 bits
+    uint32 Width;       // Image width in pixels
+    uint32 Height;      // Image height in pixels
+    uint32 extra;       // Team color flag / Content type (usually 5)
+    uint32 has_mipMaps; // 0 = no mipmaps, 1 = has mipmaps
+    uint32 Offset[16];  // Offsets to mipmap data for each level
+    uint32 Size[16];    // Sizes of mipmap data for each level
+};
+#pragma pack(pop)
+
+// BLP1 Format Details:
+// 
+// Header (156 bytes):
+// - MagicNumber: Always 'BLP1'
+// - Compression:
+//   - 0 (JPEG): Data is stored as JPEG chunks.
+//     - Header is followed by a uint32 specifying the JPEG header size.
+//     - Then the JPEG header data itself.
+//     - Mipmap data at Offset[i] contains the JPEG body for that level.
+//     - Note: JPEG data is typically CMYK (actually BGRA) or YCCK.
+//   - 1 (Direct): Data is uncompressed or paletted.
+//     - Header is followed by a 256-color palette (256 * 4 bytes = 1024 bytes).
+//     - Mipmap data at Offset[i] contains indices into the palette.
+//
+// - AlphaBits:
+//   - 0: No alpha.
+//   - 8: 8-bit alpha channel (usually appended after color data in Direct mode, or part of JPEG).
+//
+// - Mipmaps:
+//   - Up to 16 levels of mipmaps.
+//   - Offset[0] points to the full resolution image.
+//   - Offset[i] points to the i-th mipmap level (width/2^i, height/2^i).
+//   - Size[i] is the size in bytes of the data for that level.
+//   - If Size[i] is 0, that level does not exist.
+
+enum BLPCompression {
+    BLP_COMPRESSION_JPEG = 0,
+    BLP_COMPRESSION_DIRECT = 1
+};
+
+// Levels a BLP1 file can hold.
+const int32 kBLPMaxMips = 16;
+
+#endif // __BLPFile_H__
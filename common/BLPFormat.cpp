@@ -31,14 +31,21 @@
 #include <vector>
 #include <cstdio>
 #include <ctime>
+#include <new>
+#include <thread>
 #include "BLPFormat.h"
 #include "PIUI.h"
 #include "Logger.h"
-#include "Timer.h"
-
-extern "C" {
-#include "../ThirdParty/jpeg/include/jpeglib.h"
-}
+#include "BLPCodec.h"
+#include "BLPHash.h"
+#include "BLPMemPolicy.h"
+#include "BLPMemStats.h"
+#include "BLPRateControl.h"
+#include "BLPReader.h"
+#include "BLPTaskPool.h"
+#include "BLPTrace.h"
+#include "BLPWriter.h"
+#include "BLPWriteSession.h"
 
 /*****************************************************************************/
 
@@ -81,16 +88,40 @@ const int32 DESIREDMATTING = 0;
 /*****************************************************************************/
 
 static unsigned32 RowBytes (void);
+static const char* SelectorZoneName (int16 selector);
+static void LogMemory (const BLPMemSnapshot & before, int64 peak);
 
 static void ReadSome (int32 count, void * buffer);
 static void WriteSome (int32 count, void * buffer);
+static bool ReadDataFork (void * context, uint32 offset, void * buffer, uint32 size);
+static bool WriteDataFork (void * context, uint32 offset, const void * data, uint32 size);
+static bool Succeeded (BLPReaderError error);
+static bool Succeeded (BLPWriterError error);
 static void ReadRow (Ptr pixelData, bool needsSwap);
 static void WriteRow (Ptr pixelData);
 static void DisposeImageResources (void);
+static void DisposeImageBuffer (void);
+static bool CheckAbort (void);
+static bool OpensIndexed (const BLPReader& reader);
+static uint8* AllocPixels (size_t bytes);
+static void PlanMemory (int64 workingSet, int32 width, int32 height);
+static int32 BandRows (int32 height);
+static BLPEncodeSettings WriteSettings (void);
+static BLPWriteOptions WriteOptions (int32 width, int32 height);
 static void SwapRow(int32 rowBytes, Ptr pixelData);
 
-static bool IsDirectAlphaAllZero(int32 width, int32 height);
-static bool DecodeJPEGMip0ToImageBuffer(int32 width, int32 height, bool& outHasAlpha, bool& outAlphaAllZero);
+static bool DecodeJPEGMip0ToImageBuffer(BLPReader& reader, bool& outHasAlpha, bool& outAlphaAllZero);
+static long JPEGMemoryBudget(size_t reservedBytes);
+static void KeepReuseInfo(BLPReader& reader, const BLPByteBuffer& mip0, uint64 tablesHash);
+static const void* LockReuseInfo(size_t& size);
+static void UnlockReuseInfo(void);
+static int32 EncoderThreads(void);
+static BLPTaskPool* TaskPool(void);
+static bool HostAborted(void* context);
+static void HostProgress(void* context, int64 done, int64 total);
+
+// CheckAbort for the long loops of blpcore that run on the host's thread.
+static const BLPCancel kHostCancel = { HostAborted, NULL };
 
 static VPoint GetFormatImageSize(void);
 static void SetFormatImageSize(VPoint inPoint);
@@ -110,12 +141,47 @@ BLPData* gData = NULL;
 int16* gResult = NULL;
 Logger* gLogger = NULL;
 
+// The threads of the selector running now, made by the first task and
+// stopped before PluginMain returns: a format plug-in is not told when it
+// is unloaded, so no thread may outlive the call.
+static BLPTaskPool* gTaskPool = NULL;
+
+// When the selector running now started, on BLPTraceNow's clock.
+static int64 gSelectorStart = 0;
+
 /*****************************************************************************/
 
 #define gCountResources gFormatRecord->resourceProcs->countProc
 #define gGetResources   gFormatRecord->resourceProcs->getProc
 #define gAddResource	gFormatRecord->resourceProcs->addProc
 
+// Fragments of a log line at a level; see LOGGER_WRITE in Logger.h.
+#define LogDebug(...)	LOGGER_WRITE(gLogger, LOGGER_DEBUG, __VA_ARGS__)
+#define LogInfo(...)	LOGGER_WRITE(gLogger, LOGGER_INFO, __VA_ARGS__)
+#define LogError(...)	LOGGER_WRITE(gLogger, LOGGER_ERROR, __VA_ARGS__)
+
+// A trace zone whose time also counts to a phase of gData->stats.
+class PhaseZone {
+  public:
+	PhaseZone(const char* name, BLPPhase inPhase) : zone(name), phase(inPhase), ended(false) {}
+	~PhaseZone() { End(); }
+
+	double End(void)
+	{
+		if (ended)
+			return 0;
+		ended = true;
+		double ms = zone.End();
+		gData->stats.phaseMs[phase] += ms;
+		return ms;
+	}
+
+  private:
+	BLPTraceZone zone;
+	BLPPhase phase;
+	bool ended;
+};
+
 /*****************************************************************************/
 
 //-------------------------------------------------------------------------------
@@ -169,11 +235,14 @@ DLLExport MACPASCAL void PluginMain (const int16 selector,
 	if (gLogger == NULL)
 		gLogger = new Logger( "BLPFormatPlugin" );
 	  
-	Timer timeIt;
+	// The first call also hooks libjpeg, before any JPEG object exists.
+	BLPMemSnapshot memBefore;
+	if (BLPMemStatsEnabled())
+		BLPMemTake(memBefore);
+	BLPMemPeak memPeak;
 
-	gLogger->Write( "Selector: " );
-	gLogger->Write( selector );
-    gLogger->Write( " " );
+	BLPTraceZone selectorZone(SelectorZoneName(selector));
+	gSelectorStart = BLPTraceNow();
 
 	//---------------------------------------------------------------------------
 	//	(1) Update our global parameters from the passed in values.
@@ -297,10 +366,35 @@ DLLExport MACPASCAL void PluginMain (const int16 selector,
 				DoFilterFile();
 				break;
 		}
+
+		// The host calls no Continue or Finish after an error or a cancel,
+		// so the pixels would stay behind for the next call.
+		if (*gResult != noErr)
+			DisposeImageBuffer();
 			
 	} // about selector special
 
-	gLogger->Write( timeIt.GetElapsed(), true );
+	delete gTaskPool;
+	gTaskPool = NULL;
+
+	double selectorMs = selectorZone.End();
+	if (gData != NULL)
+		gData->stats.selectorMs += selectorMs;
+	int32 selectorLevel = *gResult != noErr ? LOGGER_ERROR : LOGGER_INFO;
+	LOGGER_WRITE( gLogger, selectorLevel, "Selector: " );
+	LOGGER_WRITE( gLogger, selectorLevel, selector );
+	LOGGER_WRITE( gLogger, selectorLevel, " " );
+	LOGGER_WRITE( gLogger, selectorLevel, selectorMs );
+	LOGGER_WRITE( gLogger, selectorLevel, " ms" );
+	if (*gResult != noErr)
+	{
+		LogError( ", error " );
+		LogError( *gResult );
+	}
+	LOGGER_WRITE( gLogger, selectorLevel, "", true );
+	if (BLPMemStatsEnabled())
+		LogMemory(memBefore, memPeak.End());
+	BLPTraceFlush();
 	  
 	// release any suites that we may have acquired
 	if (selector == formatSelectorAbout ||
@@ -323,6 +417,8 @@ DLLExport MACPASCAL void PluginMain (const int16 selector,
 
 	catch(...)
 	{
+		delete gTaskPool;
+		gTaskPool = NULL;
 #if __PIMac__
 		UnLoadRuntimeFunctions();
 #endif
@@ -335,6 +431,66 @@ DLLExport MACPASCAL void PluginMain (const int16 selector,
 } // end PluginMain
 
 
+/*****************************************************************************/
+
+double StatsTotalMs (void)
+{
+	return gData->stats.selectorMs + (BLPTraceNow() - gSelectorStart) / 1e6;
+}
+
+/*****************************************************************************/
+
+// The trace zone of a whole selector call.
+static const char* SelectorZoneName (int16 selector)
+{
+	switch (selector)
+	{
+		case formatSelectorAbout:            return "About";
+		case formatSelectorReadPrepare:      return "ReadPrepare";
+		case formatSelectorReadStart:        return "ReadStart";
+		case formatSelectorReadContinue:     return "ReadContinue";
+		case formatSelectorReadFinish:       return "ReadFinish";
+		case formatSelectorOptionsPrepare:   return "OptionsPrepare";
+		case formatSelectorOptionsStart:     return "OptionsStart";
+		case formatSelectorOptionsContinue:  return "OptionsContinue";
+		case formatSelectorOptionsFinish:    return "OptionsFinish";
+		case formatSelectorEstimatePrepare:  return "EstimatePrepare";
+		case formatSelectorEstimateStart:    return "EstimateStart";
+		case formatSelectorEstimateContinue: return "EstimateContinue";
+		case formatSelectorEstimateFinish:   return "EstimateFinish";
+		case formatSelectorWritePrepare:     return "WritePrepare";
+		case formatSelectorWriteStart:       return "WriteStart";
+		case formatSelectorWriteContinue:    return "WriteContinue";
+		case formatSelectorWriteFinish:      return "WriteFinish";
+		case formatSelectorFilterFile:       return "FilterFile";
+	}
+	return "selector";
+}
+
+/*****************************************************************************/
+
+// What the selector allocated, by kind, and the peak of live bytes while
+// it ran.
+static void LogMemory (const BLPMemSnapshot & before, int64 peak)
+{
+	static const char * const kKindNames[BLP_MEM_KINDS] = { "heap", "host", "jpeg" };
+
+	BLPMemSnapshot after;
+	BLPMemTake(after);
+	char text[64];
+	LogInfo( "Memory:" );
+	for (int32 kind = 0; kind < BLP_MEM_KINDS; kind++)
+	{
+		snprintf(text, sizeof(text), " %s %lld allocs %lld KB,", kKindNames[kind],
+				 (long long)(after.allocations[kind] - before.allocations[kind]),
+				 (long long)((after.bytes[kind] - before.bytes[kind]) / 1024));
+		LogInfo( text );
+	}
+	snprintf(text, sizeof(text), " peak %lld KB, live %lld KB",
+			 (long long)(peak / 1024), (long long)(after.liveTotal / 1024));
+	LogInfo( text, true );
+}
+
 /*****************************************************************************/
 
 static unsigned32 RowBytes (void)
@@ -348,25 +504,51 @@ static unsigned32 RowBytes (void)
 
 static void DoReadPrepare (void)
 {
+	gData->hostMaxData = gFormatRecord->maxData;
 	gFormatRecord->maxData = 0;
     gData->usePOSIX = true;
+	gData->reportStats = false;
+	memset(&gData->stats, 0, sizeof(gData->stats));
+	gData->stats.threads = 1;
+	gData->stats.targetMet = -1;
 	
-	// script params may change our usePOSIX
+	// script params may change our usePOSIX and reportStats
    	gData->showDialog = ReadScriptParamsOnRead ();
 
   #if __PIMac__
     if (gFormatRecord->hostSupportsPOSIXIO && gData->usePOSIX)
     {
         gFormatRecord->pluginUsingPOSIXIO = true;
-        gLogger->Write( "Using POSIX " );
+        LogDebug( "Using POSIX", true );
     }
     else
     {
         gData->usePOSIX = false;
-        gLogger->Write( "Using FS " );
+        LogDebug( "Using FS", true );
     }
   #endif
 
+    // The header tells the size of what ReadStart will decode. A file it
+    // cannot parse keeps nothing and ReadStart reports why; a read that
+    // failed fails here, with the data fork's error left in *gResult.
+    gData->bandRows = 1;
+    if (*gResult == noErr)
+    {
+        BLPReader reader(ReadDataFork, NULL);
+        BLPReaderError error = reader.Open();
+        if (error == BLP_READER_OK)
+        {
+            const BLP_HEADER& header = reader.Header();
+            PlanMemory(BLPReadWorkingSet(header.Width, header.Height, header.Size[0],
+                                         OpensIndexed(reader)),
+                       header.Width, header.Height);
+        }
+        else if (error != BLP_READER_NOT_BLP && error != BLP_READER_CORRUPT)
+        {
+            (void)Succeeded(error);
+        }
+    }
+
 }
 
 /*****************************************************************************/
@@ -379,6 +561,9 @@ static void ReadSome (int32 count, void * buffer)
 	if (*gResult != noErr)
 		return;
 
+	PhaseZone zone("file read", BLP_PHASE_FILE_READ);
+	BLPTraceCount("bytes read", count);
+
 	*gResult = PSSDKRead (gFormatRecord->dataFork,
                           gFormatRecord->posixFileDescriptor,
                           gFormatRecord->pluginUsingPOSIXIO,
@@ -399,6 +584,9 @@ static void WriteSome (int32 count, void * buffer)
 	
 	if (*gResult != noErr)
 		return;
+
+	PhaseZone zone("file write", BLP_PHASE_FILE_WRITE);
+	BLPTraceCount("bytes written", count);
 	
 	*gResult = PSSDKWrite (gFormatRecord->dataFork,
                            gFormatRecord->posixFileDescriptor,
@@ -412,6 +600,79 @@ static void WriteSome (int32 count, void * buffer)
 
 /*****************************************************************************/
 
+// BLPReader's source: the document's data fork through ReadSome. An error
+// is left in *gResult, and bytes past what the host can seek to read as
+// the end of the file.
+static bool ReadDataFork (void * context, uint32 offset, void * buffer, uint32 size)
+{
+	(void)context;
+	if (*gResult != noErr)
+		return false;
+	if ((uint64)offset + size > 0x7FFFFFFF)
+	{
+		*gResult = eofErr;
+		return false;
+	}
+
+	*gResult = PSSDKSetFPos (gFormatRecord->dataFork,
+                             gFormatRecord->posixFileDescriptor,
+                             gFormatRecord->pluginUsingPOSIXIO,
+                             fsFromStart, (long)offset);
+	ReadSome ((int32)size, buffer);
+	return *gResult == noErr;
+}
+
+// BLPWriter's destination, the same way through WriteSome.
+static bool WriteDataFork (void * context, uint32 offset, const void * data, uint32 size)
+{
+	(void)context;
+	if (*gResult != noErr)
+		return false;
+	if ((uint64)offset + size > 0x7FFFFFFF)
+	{
+		*gResult = dskFulErr;
+		return false;
+	}
+
+	*gResult = PSSDKSetFPos (gFormatRecord->dataFork,
+                             gFormatRecord->posixFileDescriptor,
+                             gFormatRecord->pluginUsingPOSIXIO,
+                             fsFromStart, (long)offset);
+	WriteSome ((int32)size, (void *)data);
+	return *gResult == noErr;
+}
+
+// True for no error; otherwise leaves the host's code for error in
+// *gResult, unless an I/O error from the data fork is already there.
+static bool Succeeded (BLPReaderError error)
+{
+	if (error == BLP_READER_OK)
+		return true;
+
+	LogError( "Read failed: " );
+	LogError( BLPReaderErrorString(error), true );
+	if (*gResult == noErr)
+		*gResult = error == BLP_READER_NO_MEMORY ? memFullErr
+		         : error == BLP_READER_CANCELLED ? userCanceledErr
+		         : error == BLP_READER_IO ? readErr : formatCannotRead;
+	return false;
+}
+
+static bool Succeeded (BLPWriterError error)
+{
+	if (error == BLP_WRITER_OK)
+		return true;
+
+	LogError( "Write failed: " );
+	LogError( BLPWriterErrorString(error), true );
+	if (*gResult == noErr)
+		*gResult = error == BLP_WRITER_NO_MEMORY ? memFullErr
+		         : error == BLP_WRITER_CANCELLED ? userCanceledErr : writErr;
+	return false;
+}
+
+/*****************************************************************************/
+
 static void ReadRow (Ptr pixelData, bool needsSwap)
 {
 	ReadSome (RowBytes(), pixelData);
@@ -451,6 +712,105 @@ static void DisposeImageResources (void)
 	
 }
 
+// The RGBA pixels kept from ReadStart to ReadContinue, or acquired by
+// WriteStart. Every way out of a selector that may have made them,
+// errors and cancels included, ends up here.
+static void DisposeImageBuffer (void)
+{
+	BLPLargeFree(gData->imageBuffer);
+	gData->imageBuffer = NULL;
+}
+
+/*****************************************************************************/
+
+// The Buffer suite as the source of large blocks, so that the pixels come
+// out of the maxData the plug-in kept rather than from under Photoshop's
+// cache. Only called on the host's thread.
+static void* HostBlockNew (void* /*context*/, size_t bytes)
+{
+	if (bytes > 0xFFFFFFFFu)
+		return NULL;
+	unsigned32 size = (unsigned32)bytes;
+	return sPSBuffer->New(&size, size);
+}
+
+static void HostBlockDispose (void* /*context*/, void* block)
+{
+	Ptr p = (Ptr)block;
+	sPSBuffer->Dispose(&p);
+}
+
+static const BLPBlockSource kHostBlocks = { HostBlockNew, HostBlockDispose, NULL };
+
+// An RGBA image or level, or a band of rows: from the host's buffers while
+// they last, else from the heap, aligned for SIMD either way. Free with
+// BLPLargeFree.
+static uint8* AllocPixels (size_t bytes)
+{
+	return (uint8*)BLPLargeAlloc(bytes, &kHostBlocks);
+}
+
+/*****************************************************************************/
+
+// Keeps of the maxData the host offered what a call of workingSet bytes
+// needs, with a band of single-plane rows of a width x height image, and
+// sets the rows moved per advanceState from what is left (BLPMemPolicy.h).
+static void PlanMemory (int64 workingSet, int32 width, int32 height)
+{
+	BLPMemoryPlan plan;
+	BLPPlanMemory(gData->hostMaxData, workingSet, (uint32)(width > 0 ? width : 1), height, plan);
+	gFormatRecord->maxData = plan.maxData;
+	gData->bandRows = plan.bandRows;
+}
+
+// Rows per advanceState for an image height rows tall, as planned at the
+// Prepare selector.
+static int32 BandRows (int32 height)
+{
+	int32 rows = gData->bandRows > 0 ? gData->bandRows : 1;
+	return rows < height ? rows : (height > 0 ? height : 1);
+}
+
+/*****************************************************************************/
+
+// Whether the user asked to stop, which abortProc tells on the host's
+// thread only. Called between rows, bands and levels; once it returns
+// true, *gResult holds userCanceledErr and it keeps returning true.
+static bool CheckAbort (void)
+{
+	if (*gResult == noErr && gFormatRecord->abortProc != NULL && gFormatRecord->abortProc())
+		*gResult = userCanceledErr;
+	return *gResult == userCanceledErr;
+}
+
+/*****************************************************************************/
+
+// libjpeg may keep at most this many bytes in memory; whole-image buffers
+// beyond it (optimized Huffman tables, multi-scan, lossless transforms)
+// spill to a temp file. The figure is what the host offered at Prepare
+// minus what we already hold, and 0 (no limit) if the host gave none.
+static long JPEGMemoryBudget(size_t reservedBytes)
+{
+    const int64 kMinBudget = 16 << 20;
+
+    if (gData->hostMaxData <= 0)
+        return 0;
+
+    int64 budget = (int64)gData->hostMaxData - (int64)reservedBytes;
+    if (budget < kMinBudget)
+        budget = kMinBudget;
+    return (long)budget;
+}
+
+/*****************************************************************************/
+
+// Direct files without alpha open as indexed color: one plane of the
+// indices as stored, with the palette as the LUT.
+static bool OpensIndexed (const BLPReader& reader)
+{
+	return reader.Direct() && reader.Header().alpha_bits == 0;
+}
+
 /*****************************************************************************/
 
 static void DoReadStart (void)
@@ -461,42 +821,37 @@ static void DoReadStart (void)
 	// FormatRecord. You do not need to parse the entire file. You need to
 	// process enough for a thumbnail view and you need to do it quickly.
 
-	*gResult = PSSDKSetFPos (gFormatRecord->dataFork,
-                             gFormatRecord->posixFileDescriptor,
-                             gFormatRecord->pluginUsingPOSIXIO,
-                             fsFromStart, 0);
-	if (*gResult != noErr) return;
-	
-	ReadSome (sizeof (BLP_HEADER), &gData->blpHeader);
-	if (*gResult != noErr) return;
+	PhaseZone headerZone("parse header", BLP_PHASE_PARSE);
 
-    // Check Magic 'BLP1'
-    char* magic = (char*)&gData->blpHeader.MagicNumber;
-    if (magic[0] != 'B' || magic[1] != 'L' || magic[2] != 'P' || magic[3] != '1')
-    {
-         *gResult = formatCannotRead;
-         return;
-    }
+	BLPReader reader(ReadDataFork, NULL);
+	if (!Succeeded(reader.Open())) return;
+	gData->blpHeader = reader.Header();
+    headerZone.End();
+
+    for (int32 level = 0; level < kBLPMaxMips; level++)
+        gData->stats.mipBytes[level] = gData->blpHeader.Size[level];
+    gData->stats.compression = reader.Direct() ? BLP_WRITE_DIRECT : BLP_WRITE_JPEG;
+    gData->stats.alphaBits = gData->blpHeader.alpha_bits;
 
 	gData->needsSwap = false; 
     
 	VPoint imageSize;
-	imageSize.v = gData->blpHeader.Height;
-	imageSize.h = gData->blpHeader.Width;
+	imageSize.v = reader.Height();
+	imageSize.h = reader.Width();
 
 	SetFormatImageSize(imageSize);
 	gFormatRecord->depth = 8;
 	
-    if (gData->blpHeader.Compression == BLP_COMPRESSION_DIRECT)
+    if (reader.Direct())
     {
-        if (gData->blpHeader.alpha_bits > 0)
+        if (!OpensIndexed(reader))
         {
              gFormatRecord->imageMode = plugInModeRGBColor;
 
            // 仅当 alpha 通道“纯透明(全 0)”时，才把它作为独立 Alpha 通道返回。
            // 否则将其作为透明度使用（Photoshop 会把它当作文档透明度，而不是额外通道）。
-           bool alphaAllZero = IsDirectAlphaAllZero(imageSize.h, imageSize.v);
-           if (*gResult != noErr) return;
+           bool alphaAllZero = true;
+           if (!Succeeded(reader.DirectAlphaAllZero(alphaAllZero, &kHostCancel))) return;
 
            gFormatRecord->planes = 4;
            gFormatRecord->transparencyPlane = alphaAllZero ? -1 : 3;
@@ -508,14 +863,10 @@ static void DoReadStart (void)
              gFormatRecord->transparencyPlane = -1;
              
              // Read Palette
-             int32 paletteSize = (gData->blpHeader.Offset[0] - sizeof(BLP_HEADER)) / 4;
-             if (paletteSize > 256) paletteSize = 256;
-             
              uint8 palette[256 * 4];
-             ReadSome(paletteSize * 4, palette);
-             if (*gResult != noErr) return;
+             if (!Succeeded(reader.ReadPalette(palette))) return;
              
-             for (int i = 0; i < paletteSize; i++)
+             for (int i = 0; i < reader.PaletteEntries(); i++)
              {
                  gFormatRecord->blueLUT[i] = palette[i*4 + 0];
                  gFormatRecord->greenLUT[i] = palette[i*4 + 1];
@@ -523,7 +874,7 @@ static void DoReadStart (void)
              }
         }
     }
-    else if (gData->blpHeader.Compression == BLP_COMPRESSION_JPEG)
+    else
     {
         gFormatRecord->imageMode = plugInModeRGBColor;
 
@@ -532,7 +883,7 @@ static void DoReadStart (void)
         bool alphaAllZero = false;
         if (gData->imageBuffer == NULL)
         {
-            if (!DecodeJPEGMip0ToImageBuffer(imageSize.h, imageSize.v, hasAlpha, alphaAllZero))
+            if (!DecodeJPEGMip0ToImageBuffer(reader, hasAlpha, alphaAllZero))
                 return;
         }
         else
@@ -553,11 +904,6 @@ static void DoReadStart (void)
             gFormatRecord->transparencyPlane = -1;
         }
     }
-    else
-    {
-        *gResult = formatCannotRead;
-        return;
-    }
 
 	gFormatRecord->transparencyMatting = DESIREDMATTING;
 	
@@ -565,113 +911,7 @@ static void DoReadStart (void)
     gFormatRecord->imageRsrcData = NULL;
 }
 
-static bool IsDirectAlphaAllZero(int32 width, int32 height)
-{
-    if (*gResult != noErr)
-        return false;
-
-    if (gData->blpHeader.Compression != BLP_COMPRESSION_DIRECT || gData->blpHeader.alpha_bits == 0)
-        return true;
-
-    const uint32 alphaBits = gData->blpHeader.alpha_bits;
-    const uint64 pixels = static_cast<uint64>(width) * static_cast<uint64>(height);
-    const uint64 alphaSize = (pixels * static_cast<uint64>(alphaBits) + 7ull) / 8ull;
-
-    // Direct 模式下 alpha 数据紧跟在 index 数据后面。
-    const uint64 alphaOffset = static_cast<uint64>(gData->blpHeader.Offset[0]) + pixels;
-
-    if (alphaOffset > 0xFFFFFFFFull)
-    {
-        *gResult = formatCannotRead;
-        return false;
-    }
-
-    *gResult = PSSDKSetFPos(
-        gFormatRecord->dataFork,
-        gFormatRecord->posixFileDescriptor,
-        gFormatRecord->pluginUsingPOSIXIO,
-        fsFromStart,
-        static_cast<int32>(alphaOffset));
-    if (*gResult != noErr)
-        return false;
-
-    std::vector<uint8> buffer(64 * 1024);
-    uint64 remaining = alphaSize;
-    while (remaining > 0 && *gResult == noErr)
-    {
-        int32 chunk = static_cast<int32>(remaining < buffer.size() ? remaining : buffer.size());
-        ReadSome(chunk, buffer.data());
-        if (*gResult != noErr)
-            return false;
-
-        for (int32 i = 0; i < chunk; i++)
-        {
-            if (buffer[i] != 0)
-                return false;
-        }
-        remaining -= static_cast<uint64>(chunk);
-    }
-
-    return (*gResult == noErr);
-}
-
-#include <setjmp.h>
-
-struct my_error_mgr {
-  struct jpeg_error_mgr pub;
-  jmp_buf setjmp_buffer;
-};
-
-METHODDEF(void) my_error_exit (j_common_ptr cinfo) {
-  my_error_mgr * myerr = (my_error_mgr *) cinfo->err;
-  longjmp(myerr->setjmp_buffer, 1);
-}
-
-// Memory source manager for libjpeg
-typedef struct {
-  struct jpeg_source_mgr pub;
-  const JOCTET * buffer;
-  size_t size;
-} my_source_mgr;
-
-METHODDEF(void) init_source (j_decompress_ptr cinfo) {}
-METHODDEF(boolean) fill_input_buffer (j_decompress_ptr cinfo) {
-    static JOCTET mybuffer[4];
-    mybuffer[0] = (JOCTET) 0xFF;
-    mybuffer[1] = (JOCTET) 0xD9;
-    cinfo->src->next_input_byte = mybuffer;
-    cinfo->src->bytes_in_buffer = 2;
-    return TRUE;
-}
-METHODDEF(void) skip_input_data (j_decompress_ptr cinfo, long num_bytes) {
-    if (num_bytes > 0) {
-        if (num_bytes > (long)cinfo->src->bytes_in_buffer)
-            num_bytes = (long)cinfo->src->bytes_in_buffer;
-        cinfo->src->next_input_byte += (size_t) num_bytes;
-        cinfo->src->bytes_in_buffer -= (size_t) num_bytes;
-    }
-}
-METHODDEF(void) term_source (j_decompress_ptr cinfo) {}
-
-GLOBAL(void) jpeg_mem_src_custom (j_decompress_ptr cinfo, const unsigned char * buffer, size_t size) {
-    my_source_mgr * src;
-    if (cinfo->src == NULL) {
-        cinfo->src = (struct jpeg_source_mgr *)
-            (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_PERMANENT,
-            sizeof(my_source_mgr));
-        src = (my_source_mgr *) cinfo->src;
-        src->pub.init_source = init_source;
-        src->pub.fill_input_buffer = fill_input_buffer;
-        src->pub.skip_input_data = skip_input_data;
-        src->pub.resync_to_restart = jpeg_resync_to_restart;
-        src->pub.term_source = term_source;
-    }
-    src = (my_source_mgr *) cinfo->src;
-    src->pub.bytes_in_buffer = size;
-    src->pub.next_input_byte = (const JOCTET *) buffer;
-}
-
-static bool DecodeJPEGMip0ToImageBuffer(int32 width, int32 height, bool& outHasAlpha, bool& outAlphaAllZero)
+static bool DecodeJPEGMip0ToImageBuffer(BLPReader& reader, bool& outHasAlpha, bool& outAlphaAllZero)
 {
     outHasAlpha = false;
     outAlphaAllZero = true;
@@ -679,159 +919,194 @@ static bool DecodeJPEGMip0ToImageBuffer(int32 width, int32 height, bool& outHasA
     if (*gResult != noErr)
         return false;
 
-    // Read JPEG header size
-    uint32 headerSize = 0;
-    *gResult = PSSDKSetFPos(
-        gFormatRecord->dataFork,
-        gFormatRecord->posixFileDescriptor,
-        gFormatRecord->pluginUsingPOSIXIO,
-        fsFromStart,
-        sizeof(BLP_HEADER));
-    if (*gResult != noErr)
-        return false;
-
-    ReadSome(4, &headerSize);
-    if (*gResult != noErr)
-        return false;
-
-    const uint32 dataSize = gData->blpHeader.Size[0];
-    const uint32 fullSize = headerSize + dataSize;
-    uint8* fullJpg = (uint8*)malloc(fullSize);
-    if (!fullJpg)
-    {
-        *gResult = memFullErr;
-        return false;
-    }
-
-    // Read JPEG header bytes (immediately after headerSize field)
-    ReadSome(headerSize, fullJpg);
-    if (*gResult != noErr)
-    {
-        free(fullJpg);
-        return false;
-    }
-
-    // Read JPEG body bytes
-    *gResult = PSSDKSetFPos(
-        gFormatRecord->dataFork,
-        gFormatRecord->posixFileDescriptor,
-        gFormatRecord->pluginUsingPOSIXIO,
-        fsFromStart,
-        gData->blpHeader.Offset[0]);
-    if (*gResult != noErr)
-    {
-        free(fullJpg);
-        return false;
-    }
-    ReadSome(dataSize, fullJpg + headerSize);
-    if (*gResult != noErr)
-    {
-        free(fullJpg);
+    // The shared JPEG header followed by the mip 0 body.
+    BLPByteBuffer stream;
+    if (!Succeeded(reader.ReadJpegStream(0, stream)))
         return false;
-    }
 
+    const int32 width = reader.Width();
+    const int32 height = reader.Height();
     if (gData->imageBuffer == NULL)
     {
-        gData->imageBuffer = (uint8*)malloc(static_cast<size_t>(width) * static_cast<size_t>(height) * 4u);
+        gData->imageBuffer = AllocPixels(static_cast<size_t>(width) * static_cast<size_t>(height) * 4u);
         if (!gData->imageBuffer)
         {
-            free(fullJpg);
             *gResult = memFullErr;
             return false;
         }
         memset(gData->imageBuffer, 0, static_cast<size_t>(width) * static_cast<size_t>(height) * 4u);
     }
 
-    struct jpeg_decompress_struct cinfo;
-    struct my_error_mgr jerr;
-
-    cinfo.err = jpeg_std_error(&jerr.pub);
-    jerr.pub.error_exit = my_error_exit;
-
-    if (setjmp(jerr.setjmp_buffer))
-    {
-        jpeg_destroy_decompress(&cinfo);
-        free(fullJpg);
-        *gResult = formatCannotRead;
+    BLPJpegLevelInfo info;
+    PhaseZone decodeZone("decode", BLP_PHASE_DECODE);
+    if (!Succeeded(reader.DecodeJpeg(stream, 0, JPEGMemoryBudget(static_cast<size_t>(width) * height * 4u),
+                                     gData->imageBuffer, &info, &kHostCancel)))
         return false;
-    }
+    decodeZone.End();
 
-    jpeg_create_decompress(&cinfo);
-    jpeg_mem_src_custom(&cinfo, fullJpg, fullSize);
-    (void)jpeg_read_header(&cinfo, TRUE);
+    outHasAlpha = (info.components == 4);
+    outAlphaAllZero = outHasAlpha &&
+        BLPAlphaAllZero(gData->imageBuffer, static_cast<size_t>(width) * static_cast<size_t>(height));
 
-    if (cinfo.num_components == 4)
-    {
-        cinfo.jpeg_color_space = JCS_CMYK;
-        cinfo.out_color_space = JCS_CMYK;
-    }
+    KeepReuseInfo(reader, stream, info.tablesHash);
 
-    (void)jpeg_start_decompress(&cinfo);
+    return (*gResult == noErr);
+}
 
-    outHasAlpha = (cinfo.output_components == 4);
-    if (!outHasAlpha)
-        outAlphaAllZero = false;
+/*****************************************************************************/
 
-    int stride = cinfo.output_width * cinfo.output_components;
-    JSAMPARRAY buffer = (*cinfo.mem->alloc_sarray)((j_common_ptr)&cinfo, JPOOL_IMAGE, stride, 1);
+// Stores the file's compressed levels and the hash of the mip 0 pixels they
+// stand for in revertInfo (see BLPReuseInfo), so that a save of the
+// unchanged pixels copies them (fmtCanWriteIfRead makes open-and-save the
+// common case). mip0 holds the shared header and
+// the mip 0 bytes, and gData->imageBuffer the decoded RGBA pixels. Reuse is
+// only an optimization, so a lower level that cannot be read, or no memory
+// for the copy, leaves revertInfo empty rather than failing the read.
+static void KeepReuseInfo(BLPReader& reader, const BLPByteBuffer& mip0, uint64 tablesHash)
+{
+    if (*gResult != noErr || gFormatRecord->openForPreview)
+        return;
 
-    while (cinfo.output_scanline < cinfo.output_height)
-    {
-        int row = (int)cinfo.output_scanline;
-        (void)jpeg_read_scanlines(&cinfo, buffer, 1);
-        if (row >= height)
-            continue;
+    if (gFormatRecord->revertInfo != NULL) {
+        sPSHandle->Dispose(gFormatRecord->revertInfo);
+        gFormatRecord->revertInfo = NULL;
+    }
 
-        uint8* dstRow = gData->imageBuffer + static_cast<size_t>(row) * static_cast<size_t>(width) * 4u;
-        int maxW = (width < (int)cinfo.output_width ? width : (int)cinfo.output_width);
+    const int32 width = reader.Width();
+    const int32 height = reader.Height();
+    const uint32 headerSize = reader.JpegHeaderSize();
+    const int32 levels = reader.Levels();
+    uint64 total = sizeof(BLPReuseInfo) + headerSize;
+    for (int32 level = 0; level < levels; level++)
+        total += reader.Level(level).size;
+    if (total > 0x7FFFFFFF)
+        return;
 
-        if (cinfo.output_components == 4)
-        {
-            memcpy(dstRow, buffer[0], static_cast<size_t>(maxW) * 4u);
-
-            if (outAlphaAllZero)
-            {
-                // alpha 在第 4 个分量
-                for (int x = 0; x < maxW; x++)
-                {
-                    if (dstRow[x * 4 + 3] != 0)
-                    {
-                        outAlphaAllZero = false;
-                        break;
-                    }
-                }
-            }
-        }
-        else
-        {
-            for (int x = 0; x < maxW; x++)
-            {
-                dstRow[x * 4 + 0] = buffer[0][x * 3 + 0];
-                dstRow[x * 4 + 1] = buffer[0][x * 3 + 1];
-                dstRow[x * 4 + 2] = buffer[0][x * 3 + 2];
-                dstRow[x * 4 + 3] = 255;
+    Handle h = sPSHandle->New((int32)total);
+    if (h == NULL)
+        return;
+
+    Boolean oldLock = FALSE;
+    Ptr p = NULL;
+    sPSHandle->SetLock(h, true, &p, &oldLock);
+    bool ok = p != NULL;
+    if (ok) {
+        BLPReuseInfo* info = (BLPReuseInfo*)p;
+        uint8* bytes = (uint8*)(info + 1);
+        memset(info, 0, sizeof(BLPReuseInfo));
+        info->tag = kBLPReuseTag;
+        info->width = width;
+        info->height = height;
+        info->levels = levels;
+        info->tablesHash = tablesHash;
+        info->settingsHash = BLPEncodeSettingsHash(BLPProfileSettings(BLP_PROFILE_STANDARD));
+        info->mip0Hash = BLPHash64(gData->imageBuffer, static_cast<size_t>(width) * height * 4u);
+        info->headerSize = headerSize;
+        memcpy(bytes, mip0.data(), headerSize);
+
+        uint32 position = headerSize;
+        for (int32 level = 0; ok && level < levels; level++) {
+            const uint32 size = reader.Level(level).size;
+            info->offset[level] = position;
+            info->size[level] = size;
+            if (level == 0) {
+                memcpy(bytes + position, mip0.data() + headerSize, size);
+            } else if (reader.ReadLevel(level, bytes + position) != BLP_READER_OK) {
+                // Its read error only costs the reuse.
+                ok = false;
+                *gResult = noErr;
             }
+            position += size;
         }
+        sPSHandle->SetLock(h, false, &p, &oldLock);
     }
 
-    // Swap R/B: BGRA -> RGBA
-    for (int32 i = 0; i < width * height; i++)
-    {
-        uint8* px = gData->imageBuffer + i * 4;
-        uint8 temp = px[2];
-        px[2] = px[0];
-        px[0] = temp;
-    }
+    if (ok)
+        gFormatRecord->revertInfo = h;
+    else
+        sPSHandle->Dispose(h);
+}
 
-    (void)jpeg_finish_decompress(&cinfo);
-    jpeg_destroy_decompress(&cinfo);
-    free(fullJpg);
+// Locks revertInfo and returns its bytes and their size for the write
+// session, which checks whether they hold a BLPReuseInfo for this save.
+// NULL, with nothing locked, if there is none.
+static const void* LockReuseInfo(size_t& size)
+{
+    size = 0;
+    Handle h = gFormatRecord->revertInfo;
+    if (h == NULL)
+        return NULL;
+
+    Boolean oldLock = FALSE;
+    Ptr p = NULL;
+    sPSHandle->SetLock(h, true, &p, &oldLock);
+    if (p == NULL)
+        return NULL;
+    int32 handleSize = sPSHandle->GetSize(h);
+    size = handleSize > 0 ? (size_t)handleSize : 0;
+    return p;
+}
 
-    return (*gResult == noErr);
+static void UnlockReuseInfo(void)
+{
+    Boolean oldLock = FALSE;
+    Ptr p = NULL;
+    sPSHandle->SetLock(gFormatRecord->revertInfo, false, &p, &oldLock);
 }
 
 /*****************************************************************************/
 
+// The indexed open of DoReadStart: each band of rows is read from the file
+// into the buffer handed to the host, one byte a pixel, with no RGBA image
+// in between.
+static void DeliverIndexedRows (void)
+{
+	BLPReader reader(ReadDataFork, NULL);
+	if (!Succeeded(reader.Open()))
+		return;
+
+	VPoint imageSize = GetFormatImageSize();
+	const int32 bandRows = BandRows(imageSize.v);
+	const unsigned32 rowBytes = RowBytes();
+	Ptr pixelData = (Ptr)AllocPixels(static_cast<size_t>(rowBytes) * bandRows);
+	if (pixelData == NULL)
+	{
+		*gResult = memFullErr;
+		return;
+	}
+
+	VRect theRect;
+	theRect.left = 0;
+	theRect.right = imageSize.h;
+	gFormatRecord->colBytes = 1;
+	gFormatRecord->rowBytes = rowBytes;
+	gFormatRecord->planeBytes = 0;
+	gFormatRecord->loPlane = gFormatRecord->hiPlane = 0;
+	gFormatRecord->data = pixelData;
+
+	PhaseZone deliverZone("deliver rows", BLP_PHASE_DELIVER);
+	for (int32 row = 0; *gResult == noErr && row < imageSize.v; row += bandRows)
+	{
+		const int32 rows = imageSize.v - row < bandRows ? imageSize.v - row : bandRows;
+		if (!Succeeded(reader.ReadDirectRows(0, row, rows, (uint8*)pixelData)))
+			break;
+
+		theRect.top = row;
+		theRect.bottom = row + rows;
+		SetFormatTheRect(theRect);
+		*gResult = gFormatRecord->advanceState();
+		BLPTraceCount("rows delivered", rows);
+
+		gFormatRecord->progressProc(row + rows, imageSize.v);
+		if (CheckAbort())
+			break;
+	}
+	deliverZone.End();
+
+	gFormatRecord->data = NULL;
+	BLPLargeFree(pixelData);
+}
+
 static void DoReadContinue (void)
 {
 	int32 done = 0;
@@ -841,6 +1116,12 @@ static void DoReadContinue (void)
 	
 	DisposeImageResources ();
 	
+	if (gFormatRecord->imageMode == plugInModeIndexedColor)
+	{
+		DeliverIndexedRows();
+		return;
+	}
+
 	VPoint imageSize = GetFormatImageSize();
 	total = imageSize.v * gFormatRecord->planes;
     
@@ -851,94 +1132,46 @@ static void DoReadContinue (void)
         int32 width = imageSize.h;
         int32 height = imageSize.v;
         // Always allocate 4 channels (RGBA) for internal buffer
-        gData->imageBuffer = (uint8*)malloc(width * height * 4);
+        gData->imageBuffer = AllocPixels(static_cast<size_t>(width) * height * 4u);
         if (gData->imageBuffer == NULL)
         {
             *gResult = memFullErr;
             return;
         }
-        memset(gData->imageBuffer, 0, width * height * 4);
+        memset(gData->imageBuffer, 0, static_cast<size_t>(width) * height * 4u);
         
-        if (gData->blpHeader.Compression == BLP_COMPRESSION_DIRECT)
+        BLPReader reader(ReadDataFork, NULL);
+        if (!Succeeded(reader.Open()))
+            return;
+
+        if (reader.Direct())
         {
-             // Implement Direct Mode Reading
-             // 1. Read Palette
+             // The palette, then the indices and the alpha of mip 0
              uint8 palette[256 * 4];
-             int32 paletteSize = (gData->blpHeader.Offset[0] - sizeof(BLP_HEADER)) / 4;
-             if (paletteSize > 256) paletteSize = 256;
-             
-             // Seek to palette start (after header)
-             *gResult = PSSDKSetFPos(gFormatRecord->dataFork, gFormatRecord->posixFileDescriptor, gFormatRecord->pluginUsingPOSIXIO, fsFromStart, sizeof(BLP_HEADER));
-             ReadSome(paletteSize * 4, palette);
-             if (*gResult != noErr) return;
-             
-             // 2. Read Indices
-             // Seek to Offset[0]
-             *gResult = PSSDKSetFPos(gFormatRecord->dataFork, gFormatRecord->posixFileDescriptor, gFormatRecord->pluginUsingPOSIXIO, fsFromStart, gData->blpHeader.Offset[0]);
-             if (*gResult != noErr) return;
-             
-             uint8* indices = (uint8*)malloc(width * height);
-             if (!indices) { *gResult = memFullErr; return; }
-             ReadSome(width * height, indices);
-             if (*gResult != noErr) { free(indices); return; }
-             
-             // 3. Read Alpha
-             uint8* alpha = NULL;
-             if (gData->blpHeader.alpha_bits > 0)
-             {
-                 int alphaSize = (width * height * gData->blpHeader.alpha_bits + 7) / 8;
-                 alpha = (uint8*)malloc(alphaSize);
-                 if (!alpha) { free(indices); *gResult = memFullErr; return; }
-                 ReadSome(alphaSize, alpha);
-                 if (*gResult != noErr) { free(indices); free(alpha); return; }
-             }
-             
-             // 4. Fill imageBuffer
-             for (int i = 0; i < width * height; i++)
-             {
-                 int idx = indices[i];
-                 uint8 r = palette[idx * 4 + 2]; // BLP is BGRA
-                 uint8 g = palette[idx * 4 + 1];
-                 uint8 b = palette[idx * 4 + 0];
-                 uint8 a = 255;
-                 
-                 if (gData->blpHeader.alpha_bits > 0)
-                 {
-                     if (gData->blpHeader.alpha_bits == 8) {
-                         a = alpha[i];
-                     } else if (gData->blpHeader.alpha_bits == 1) {
-                         a = (alpha[i / 8] & (1 << (i % 8))) ? 255 : 0;
-                     } else if (gData->blpHeader.alpha_bits == 4) {
-                         uint8 byte = alpha[i / 2];
-                         uint8 val = (i % 2 == 0) ? (byte >> 4) : (byte & 0x0F); // Low nibble first? BLP.py: i%2==0 -> byte >> 4. Wait.
-                         // BLP.py: img_data[(i * 4) + 3] = byte >> 4 if i % 2 == 0 else byte & 0xF0
-                         // This means even pixels take the HIGH nibble.
-                         val = (i % 2 == 0) ? (byte >> 4) : (byte & 0x0F);
-                         a = (val << 4) | val; // Expand 4-bit to 8-bit
-                     }
-                 }
-                 
-                 // Always store as RGBA
-                 gData->imageBuffer[i*4 + 0] = r;
-                 gData->imageBuffer[i*4 + 1] = g;
-                 gData->imageBuffer[i*4 + 2] = b;
-                 gData->imageBuffer[i*4 + 3] = a;
-             }
+             BLPByteBuffer level;
+             if (CheckAbort() ||
+                 !Succeeded(reader.ReadPalette(palette)) || !Succeeded(reader.ReadDirectLevel(0, level)))
+                 return;
              
-             free(indices);
-             if (alpha) free(alpha);
+             // Fill imageBuffer, always as RGBA
+             PhaseZone decodeZone("decode", BLP_PHASE_DECODE);
+             if (!Succeeded(reader.DecodeDirect(level, palette, 0, gData->imageBuffer, &kHostCancel)))
+                 return;
         }
-        else if (gData->blpHeader.Compression == BLP_COMPRESSION_JPEG)
+        else
         {
              bool hasAlpha = false;
              bool alphaAllZero = false;
-             if (!DecodeJPEGMip0ToImageBuffer(width, height, hasAlpha, alphaAllZero))
+             if (!DecodeJPEGMip0ToImageBuffer(reader, hasAlpha, alphaAllZero))
                  return;
         }
     }
 
-	unsigned32 bufferSize = RowBytes();
-	Ptr pixelData = sPSBuffer->New( &bufferSize, bufferSize );
+	// A band of rows of one plane per advanceState, as many as the plan
+	// made at ReadPrepare allows.
+	const int32 bandRows = BandRows(imageSize.v);
+	const unsigned32 rowBytes = RowBytes();
+	Ptr pixelData = (Ptr)AllocPixels(static_cast<size_t>(rowBytes) * bandRows);
 	if (pixelData == NULL)
 	{
 		*gResult = memFullErr;
@@ -949,53 +1182,50 @@ static void DoReadContinue (void)
 	theRect.left = 0;
 	theRect.right = imageSize.h;
 	gFormatRecord->colBytes = (gFormatRecord->depth + 7) >> 3;
-	gFormatRecord->rowBytes = RowBytes();
+	gFormatRecord->rowBytes = rowBytes;
 	gFormatRecord->planeBytes = 0; 
     
 	gFormatRecord->data = pixelData;
 
+	PhaseZone deliverZone("deliver rows", BLP_PHASE_DELIVER);
 	for (plane = 0; *gResult == noErr && plane < gFormatRecord->planes; ++plane)
 	{
 		gFormatRecord->loPlane = gFormatRecord->hiPlane = plane;
 		
-		for (row = 0; *gResult == noErr && row < imageSize.v; ++row)
+		for (row = 0; *gResult == noErr && row < imageSize.v; row += bandRows)
 		{
+			const int32 rows = imageSize.v - row < bandRows ? imageSize.v - row : bandRows;
 			theRect.top = row;
-			theRect.bottom = row + 1;
+			theRect.bottom = row + rows;
 			SetFormatTheRect(theRect);
 			
+			for (int32 r = 0; r < rows; r++)
+			{
             // Copy row from gData->imageBuffer to pixelData
             // imageBuffer is always RGBA (4 bytes/pixel)
-            uint8* srcRow = gData->imageBuffer + (row * imageSize.h * 4);
-            uint8* dstRow = (uint8*)pixelData;
+            uint8* srcRow = gData->imageBuffer + (static_cast<size_t>(row + r) * imageSize.h * 4);
+            uint8* dstRow = (uint8*)pixelData + static_cast<size_t>(r) * rowBytes;
             
-            if (gFormatRecord->planes == 1)
-            {
-                for (int col = 0; col < imageSize.h; col++)
-                    dstRow[col] = srcRow[col * 4 + 0];
-            }
-            else
-            {
-                for (int col = 0; col < imageSize.h; col++)
-                    dstRow[col] = srcRow[col * 4 + plane];
-            }
+            for (int col = 0; col < imageSize.h; col++)
+                dstRow[col] = srcRow[col * 4 + plane];
+			}
 			
 			if (*gResult == noErr)
 				*gResult = gFormatRecord->advanceState();
+			BLPTraceCount("rows delivered", rows);
             
-			gFormatRecord->progressProc(++done, total);
+			done += rows;
+			gFormatRecord->progressProc(done, total);
+			if (CheckAbort())
+				break;
 		}
 	}
+	deliverZone.End();
 		
 	gFormatRecord->data = NULL;
-	sPSBuffer->Dispose(&pixelData);
+	BLPLargeFree(pixelData);
     
-    // Free image buffer
-    if (gData->imageBuffer)
-    {
-        free(gData->imageBuffer);
-        gData->imageBuffer = NULL;
-    }
+    DisposeImageBuffer();
 }
 
 /*****************************************************************************/
@@ -1010,6 +1240,7 @@ static void DoReadFinish (void)
 	
 	/* Dispose of the image resource data if it exists. */
 	DisposeImageResources ();
+	DisposeImageBuffer ();
 	WriteScriptParamsOnRead (); // should be different for read/write
 	AddComment (); // write a history comment
 	
@@ -1103,141 +1334,130 @@ static void DoEstimateFinish (void)
 
 static void DoWritePrepare (void)
 {
+	gData->hostMaxData = gFormatRecord->maxData;
 	gFormatRecord->maxData = 0;
     gData->usePOSIX = true;
 	gData->saveResources = true;
-
-	// script params may change our usePOSIX and saveResources
+	gData->smallestMipFirst = false;
+	gData->alignMips = false;
+	gData->byteBudget = 0;
+	gData->minSsim = 0;
+	gData->compression = BLP_WRITE_JPEG;
+	gData->encodeProfile = BLP_PROFILE_STANDARD;
+	gData->alphaQuality = 0;
+	gData->alphaSampling = 0;
+	gData->trellis = false;
+	gData->encodePreset = BLP_PRESET_NONE;
+	gData->quality = 0;
+	gData->dctMethod = 0;
+	gData->optimizeCoding = false;
+	gData->threads = 0;
+	gData->reportStats = false;
+	memset(&gData->stats, 0, sizeof(gData->stats));
+	gData->stats.targetMet = -1;
+
+	// script params may change our usePOSIX, saveResources, the mipmapCount
+	// DoOptionsStart chose, the encoder and layout options
+	// (smallestMipFirst, alignMips, byteBudget, minSsim, compression,
+	// encodeProfile, alphaQuality, alphaSampling, trellis, encodePreset,
+	// quality, dctMethod, optimizeCoding, threads) and reportStats
     gData->showDialog = ReadScriptParamsOnWrite ();
 
   #if __PIMac__
     if (gFormatRecord->hostSupportsPOSIXIO && gData->usePOSIX)
     {
         gFormatRecord->pluginUsingPOSIXIO = true;
-        gLogger->Write( "Using POSIX " );
+        LogDebug( "Using POSIX", true );
     }
     else
     {
         gData->usePOSIX = false;
-        gLogger->Write( "Using FS " );
+        LogDebug( "Using FS", true );
     }
   #endif
 
+    // What DoWriteStart will hold for this document and these settings.
+    VPoint imageSize = GetFormatImageSize();
+    BLPWriteShape shape;
+    BLPShapeWrite(WriteOptions(imageSize.h, imageSize.v), imageSize.h, imageSize.v, EncoderThreads(), shape);
+    PlanMemory(BLPWriteWorkingSet(shape), imageSize.h, imageSize.v);
 }
 
 /*****************************************************************************/
 
-// Memory destination manager for libjpeg
-typedef struct {
-  struct jpeg_destination_mgr pub;
-  JOCTET * buffer;
-  size_t size;
-  size_t * outSize;
-  std::vector<JOCTET> * vecBuffer;
-} my_destination_mgr;
-
-METHODDEF(void) init_destination (j_compress_ptr cinfo) {
-    my_destination_mgr * dest = (my_destination_mgr *) cinfo->dest;
-    dest->pub.next_output_byte = dest->buffer;
-    dest->pub.free_in_buffer = dest->size;
+// Threads the encoder may use: the script's count, else one per processor.
+static int32 EncoderThreads(void)
+{
+    int32 threads = gData->threads > 0 ? gData->threads : (int32)std::thread::hardware_concurrency();
+    return threads > 0 ? threads : 1;
 }
 
-METHODDEF(boolean) empty_output_buffer (j_compress_ptr cinfo) {
-    // Buffer overflow - resize
-    my_destination_mgr * dest = (my_destination_mgr *) cinfo->dest;
-    size_t oldSize = dest->size;
-    size_t newSize = oldSize * 2;
-    
-    // We need to use vector to handle resizing safely if we were using it, 
-    // but here we are using a fixed buffer or we need to realloc.
-    // For simplicity, let's assume we allocated enough, or use a vector approach.
-    // Since we can't easily realloc the buffer pointer passed in without updating the caller,
-    // we will use the vector if provided.
-    
-    if (dest->vecBuffer) {
-        size_t currentPos = dest->vecBuffer->size();
-        dest->vecBuffer->resize(newSize);
-        dest->buffer = dest->vecBuffer->data();
-        dest->pub.next_output_byte = dest->buffer + currentPos;
-        dest->pub.free_in_buffer = newSize - currentPos;
-        dest->size = newSize;
-        return TRUE;
-    }
-    
-    return FALSE; // Error
+// The pool of the selector running now, with EncoderThreads workers.
+static BLPTaskPool* TaskPool(void)
+{
+    if (gTaskPool == NULL)
+        gTaskPool = new (std::nothrow) BLPTaskPool(EncoderThreads());
+    return gTaskPool;
 }
 
-METHODDEF(void) term_destination (j_compress_ptr cinfo) {
-    my_destination_mgr * dest = (my_destination_mgr *) cinfo->dest;
-    *dest->outSize = dest->size - dest->pub.free_in_buffer;
-    if (dest->vecBuffer) {
-        dest->vecBuffer->resize(*dest->outSize);
-    }
+// The host's side of a task group's Wait, called on the host's thread.
+static bool HostAborted(void* /*context*/)
+{
+    return CheckAbort();
 }
 
-GLOBAL(void) jpeg_mem_dest_custom (j_compress_ptr cinfo, std::vector<JOCTET> & buffer, size_t * outSize) {
-    my_destination_mgr * dest;
-    if (cinfo->dest == NULL) {
-        cinfo->dest = (struct jpeg_destination_mgr *)
-            (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_PERMANENT,
-            sizeof(my_destination_mgr));
+static void HostProgress(void* /*context*/, int64 done, int64 total)
+{
+    if (gFormatRecord->progressProc == NULL || total <= 0)
+        return;
+    while (total > 0x7FFFFFFF) {
+        done >>= 1;
+        total >>= 1;
     }
-    
-    dest = (my_destination_mgr *) cinfo->dest;
-    dest->pub.init_destination = init_destination;
-    dest->pub.empty_output_buffer = empty_output_buffer;
-    dest->pub.term_destination = term_destination;
-    
-    if (buffer.empty()) buffer.resize(65536); // Initial size
-    
-    dest->vecBuffer = &buffer;
-    dest->buffer = buffer.data();
-    dest->size = buffer.size();
-    dest->outSize = outSize;
+    gFormatRecord->progressProc((int32)(done < total ? done : total), (int32)total);
 }
 
-static void ResizeImage(uint8* src, int srcW, int srcH, uint8* dst, int dstW, int dstH) {
-    float xRatio = (float)srcW / dstW;
-    float yRatio = (float)srcH / dstH;
-    
-    for (int y = 0; y < dstH; y++) {
-        for (int x = 0; x < dstW; x++) {
-            int r = 0, g = 0, b = 0, a = 0;
-            int count = 0;
-            
-            int startX = (int)(x * xRatio);
-            int endX = (int)((x + 1) * xRatio);
-            int startY = (int)(y * yRatio);
-            int endY = (int)((y + 1) * yRatio);
-            
-            if (endX <= startX) endX = startX + 1;
-            if (endY <= startY) endY = startY + 1;
-            
-            for (int sy = startY; sy < endY && sy < srcH; sy++) {
-                for (int sx = startX; sx < endX && sx < srcW; sx++) {
-                    int idx = (sy * srcW + sx) * 4;
-                    b += src[idx + 0];
-                    g += src[idx + 1];
-                    r += src[idx + 2];
-                    a += src[idx + 3];
-                    count++;
-                }
-            }
-            
-            if (count > 0) {
-                dst[(y * dstW + x) * 4 + 0] = b / count;
-                dst[(y * dstW + x) * 4 + 1] = g / count;
-                dst[(y * dstW + x) * 4 + 2] = r / count;
-                dst[(y * dstW + x) * 4 + 3] = a / count;
-            }
-        }
-    }
+// The profile's settings with the preset's trade-offs, each one the
+// script gave overriding them. The switches only turn work on.
+static BLPEncodeSettings WriteSettings (void)
+{
+    BLPEncodeSettings settings = BLPProfileSettings((BLPEncodeProfile)gData->encodeProfile);
+    BLPApplyPreset((BLPEncodePreset)gData->encodePreset, settings);
+    if (gData->quality > 0)
+        settings.quality = gData->quality;
+    if (gData->alphaQuality > 0)
+        settings.alphaQuality = gData->alphaQuality;
+    if (gData->alphaSampling > 0)
+        settings.alphaSampling = gData->alphaSampling;
+    if (gData->dctMethod > 0)
+        settings.dctMethod = gData->dctMethod;
+    settings.optimizeCoding = settings.optimizeCoding || gData->optimizeCoding;
+    settings.trellis = settings.trellis || gData->trellis;
+    return settings;
+}
+
+// What the script and the options asked of a save of a width x height
+// document, for the write session. libjpeg may keep what the host offered
+// besides the image.
+static BLPWriteOptions WriteOptions (int32 width, int32 height)
+{
+    BLPWriteOptions options;
+    options.levels = gData->mipmapCount;
+    options.hasAlpha = gFormatRecord->planes >= 4;
+    options.settings = WriteSettings();
+    options.compression = gData->compression;
+    options.byteBudget = gData->byteBudget;
+    options.minSsim = gData->minSsim;
+    options.layout.smallestFirst = gData->smallestMipFirst;
+    options.layout.alignMips = gData->alignMips;
+    options.maxMemory = JPEGMemoryBudget(static_cast<size_t>(width) * height * 4u);
+    return options;
 }
 
+/*****************************************************************************/
+
 static void DoWriteStart (void)
 {
-	BLP_HEADER header;
-	memset(&header, 0, sizeof(BLP_HEADER));
 	int32 done;
 	int32 total;
 	int16 plane;
@@ -1260,21 +1480,35 @@ static void DoWriteStart (void)
 
     // Allocate buffer for the whole image
     if (gData->imageBuffer == NULL) {
-        gData->imageBuffer = (uint8*)malloc(width * height * 4); // Always alloc 4 channels for simplicity
+        gData->imageBuffer = AllocPixels(static_cast<size_t>(width) * height * 4u); // Always alloc 4 channels for simplicity
         if (gData->imageBuffer == NULL) {
             *gResult = memFullErr;
             return;
         }
-        memset(gData->imageBuffer, 255, width * height * 4); // Fill with opaque white/black
+        // Fill with opaque white, four bands' worth at a time: the first
+        // touch of the pages costs as much as acquiring them, so a cancel
+        // is polled for between the pieces and before the first band.
+        const size_t imageBytes = static_cast<size_t>(width) * height * 4u;
+        const size_t fillBytes = static_cast<size_t>(kBLPMaxBandBytes) * 4u;
+        for (size_t at = 0; at < imageBytes; at += fillBytes) {
+            if (CheckAbort()) return;
+            memset(gData->imageBuffer + at, 255, imageBytes - at < fillBytes ? imageBytes - at : fillBytes);
+        }
     }
+    if (CheckAbort()) return;
 
 	/* Set up the progress variables. */
 	done = 0;
 	total = height * planes;
 		
-	/* Next, we will allocate the pixel buffer for one row. */
-	unsigned32 bufferSize = RowBytes();
-	Ptr pixelData = sPSBuffer->New( &bufferSize, bufferSize );
+	// An indexed document, such as a Direct file opened without alpha,
+	// comes as one plane of indices into the LUT.
+	const bool indexed = gFormatRecord->imageMode == plugInModeIndexedColor;
+
+	/* Next, we will allocate the pixel buffer for a band of rows. */
+	const int32 bandRows = BandRows(height);
+	const unsigned32 rowBytes = RowBytes();
+	Ptr pixelData = (Ptr)AllocPixels(static_cast<size_t>(rowBytes) * bandRows);
 	if (pixelData == NULL)
 	{
 		*gResult = memFullErr;
@@ -1285,32 +1519,37 @@ static void DoWriteStart (void)
 	theRect.left = 0;
 	theRect.right = width;
 	gFormatRecord->colBytes = (gFormatRecord->depth + 7) >> 3;
-	gFormatRecord->rowBytes = RowBytes();
+	gFormatRecord->rowBytes = rowBytes;
 	gFormatRecord->planeBytes = 0;
 	gFormatRecord->data = pixelData;
 	gFormatRecord->transparencyMatting = DESIREDMATTING;
 
     // Read data from Photoshop and store in gData->imageBuffer
+	PhaseZone acquireZone("acquire rows", BLP_PHASE_ACQUIRE);
 	for (plane = 0; *gResult == noErr && plane < planes; ++plane)
 	{
 		gFormatRecord->loPlane = gFormatRecord->hiPlane = plane;
 		
-		for (row = 0; *gResult == noErr && row < height; ++row)
+		for (row = 0; *gResult == noErr && row < height; row += bandRows)
 		{
+			const int32 rows = height - row < bandRows ? height - row : bandRows;
 			theRect.top = row;
-			theRect.bottom = row + 1;
+			theRect.bottom = row + rows;
 			SetFormatTheRect(theRect);
 			
 			if (*gResult == noErr)
 				*gResult = gFormatRecord->advanceState ();
+			BLPTraceCount("rows acquired", rows);
 				
+			for (int32 r = 0; *gResult == noErr && r < rows; r++)
+			{
             // Copy pixelData to imageBuffer
-            // pixelData is one row of one plane
+            // pixelData is a band of rows of one plane
             // imageBuffer is Interleaved BGRA (for BLP)
             // Photoshop gives us R, G, B, A planes usually.
             
-            uint8* srcRow = (uint8*)pixelData;
-            uint8* dstBase = gData->imageBuffer + (row * width * 4);
+            uint8* srcRow = (uint8*)pixelData + static_cast<size_t>(r) * rowBytes;
+            uint8* dstBase = gData->imageBuffer + (static_cast<size_t>(row + r) * width * 4);
             
             for (int col = 0; col < width; col++) {
                 // Map Plane to RGBA for processing
@@ -1325,7 +1564,13 @@ static void DoWriteStart (void)
                 else if (plane == 2) dstIdx = 2; // B -> B
                 else if (plane == targetAlphaPlane) dstIdx = 3; // A -> A
                 
-                if (planes == 1) {
+                if (planes == 1 && indexed) {
+                    uint8 index = srcRow[col];
+                    dstBase[col*4 + 0] = gFormatRecord->redLUT[index];
+                    dstBase[col*4 + 1] = gFormatRecord->greenLUT[index];
+                    dstBase[col*4 + 2] = gFormatRecord->blueLUT[index];
+                    dstBase[col*4 + 3] = 255;
+                } else if (planes == 1) {
                     uint8 val = srcRow[col];
                     dstBase[col*4 + 0] = val;
                     dstBase[col*4 + 1] = val;
@@ -1336,171 +1581,79 @@ static void DoWriteStart (void)
                     if (planes == 3 && plane == 0) dstBase[col*4 + 3] = 255;
                 }
             }
+			}
 			
-			gFormatRecord->progressProc (++done, total);
+			done += rows;
+			gFormatRecord->progressProc (done, total);
+			if (CheckAbort())
+				break;
 		}
 	}
+	acquireZone.End();
 		
 	gFormatRecord->data = NULL;
-	sPSBuffer->Dispose(&pixelData);
+	BLPLargeFree(pixelData);
 
     if (*gResult != noErr) return;
 
-    // Prepare Header
-    header.MagicNumber = '1PLB';
-    header.Width = width;
-    header.Height = height;
-    header.Compression = BLP_COMPRESSION_JPEG;
-    header.alpha_bits = (planes >= 4) ? 8 : 0;
-    header.extra = 4; // Team color flag, usually 4 or 5
-    header.has_mipMaps = 1; // Always has mipmaps structure
-
-    // Write Header Placeholder
-	*gResult = PSSDKSetFPos (gFormatRecord->dataFork,
-                             gFormatRecord->posixFileDescriptor,
-                             gFormatRecord->pluginUsingPOSIXIO,
-                             fsFromStart,
-                             0);
-	if (*gResult != noErr) return;
-    
-    WriteSome(sizeof(BLP_HEADER), &header);
-
-    // Write Header Size (0)
-    uint32 jpgHeaderSize = 0;
-    WriteSome(4, &jpgHeaderSize);
-
-    uint32 currentOffset = sizeof(BLP_HEADER) + 4;
-    
-    // Mipmap Loop
-    int mipLevel = 0;
-    int maxMips = 16;
-    int curW = width;
-    int curH = height;
-    uint8* curBuffer = gData->imageBuffer;
-    bool allocatedCurBuffer = false;
-    while (mipLevel < 16) {
-        if (mipLevel >= maxMips) {
-             // Stop generating if we reached count, but fill zeros?
-             // BLP format expects 16 entries. If we stop, size=0.
-             header.Offset[mipLevel] = 0;
-             header.Size[mipLevel] = 0;
-             mipLevel++;
-             continue;
-        }
-        
-        if (curW == 0) curW = 1;
-        if (curH == 0) curH = 1;
-
-        // Compress current buffer
-        struct jpeg_compress_struct cinfo;
-        struct jpeg_error_mgr jerr;
-        
-        cinfo.err = jpeg_std_error(&jerr);
-        jpeg_create_compress(&cinfo);
-        
-        std::vector<JOCTET> jpgBuffer;
-        size_t jpgSize = 0;
-        jpeg_mem_dest_custom(&cinfo, jpgBuffer, &jpgSize);
-        
-        cinfo.image_width = curW;
-        cinfo.image_height = curH;
-        cinfo.input_components = 4;
-        cinfo.in_color_space = JCS_CMYK; 
-        
-        jpeg_set_defaults(&cinfo);
-        jpeg_set_quality(&cinfo, 85, TRUE);
-        
-        // Disable JFIF and Adobe markers to match BLP format (Raw JPEG)
-        cinfo.write_JFIF_header = FALSE;
-        cinfo.write_Adobe_marker = FALSE;
-        
-        jpeg_start_compress(&cinfo, TRUE);
-        
-        std::vector<uint8> rowBuffer(curW * 4);
-        JSAMPROW row_pointer[1];
-        row_pointer[0] = rowBuffer.data();
-        
-        while (cinfo.next_scanline < cinfo.image_height) {
-            uint8* src = &curBuffer[cinfo.next_scanline * curW * 4];
-            for (int i = 0; i < curW; i++) {
-                uint8 r = src[i*4 + 0];
-                uint8 g = src[i*4 + 1];
-                uint8 b = src[i*4 + 2];
-                uint8 a = src[i*4 + 3];
-                
-                // Write as Inverted CMYK (Standard BLP: C=255-B, M=255-G, Y=255-R, K=255-A)
-                // Comp 0 (C) = Inv Blue
-                // Comp 1 (M) = Inv Green
-                // Comp 2 (Y) = Inv Red
-                // Comp 3 (K) = Inv Alpha
-                
-                rowBuffer[i*4 + 0] = b;
-                rowBuffer[i*4 + 1] = g;
-                rowBuffer[i*4 + 2] = r;
-                rowBuffer[i*4 + 3] = a;
-            }
-            jpeg_write_scanlines(&cinfo, row_pointer, 1);
-        }
-        
-        jpeg_finish_compress(&cinfo);
-        jpeg_destroy_compress(&cinfo);
-        
-        // Write Data
-        header.Offset[mipLevel] = currentOffset;
-        header.Size[mipLevel] = (uint32)jpgSize;
-        
-        WriteSome((int32)jpgSize, jpgBuffer.data());
-        currentOffset += (uint32)jpgSize;
-        
-        // Prepare next mipmap
-        int nextW = curW / 2;
-        int nextH = curH / 2;
-        if (nextW < 1) nextW = 1;
-        if (nextH < 1) nextH = 1;
-        
-        if (nextW == curW && nextH == curH) {
-             // Reached 1x1, stop after this if we already processed it?
-             // If we just processed 1x1, next is 1x1.
-             // We should stop if we just processed 1x1.
-             if (curW == 1 && curH == 1) {
-                 mipLevel++;
-                 // Fill remaining with 0
-                 while (mipLevel < 16) {
-                     header.Offset[mipLevel] = 0;
-                     header.Size[mipLevel] = 0;
-                     mipLevel++;
-                 }
-                 break;
-             }
-        }
-        
-        uint8* nextBuffer = (uint8*)malloc(nextW * nextH * 4);
-        ResizeImage(curBuffer, curW, curH, nextBuffer, nextW, nextH);
-        
-        if (allocatedCurBuffer) free(curBuffer);
-        curBuffer = nextBuffer;
-        allocatedCurBuffer = true;
-        
-        curW = nextW;
-        curH = nextH;
-        mipLevel++;
+    // The session encodes, or copies from revertInfo, and writes the levels.
+    const BLPWriteOptions options = WriteOptions(width, height);
+    const bool preEncoded = BLPEncodesUpFront(options);
+    const BLPTaskHost waiter = { HostAborted, HostProgress, NULL };
+    BLPWriteEnvironment environment;
+    environment.write = WriteDataFork;
+    environment.context = NULL;
+    environment.blocks = &kHostBlocks;
+    environment.cancel = &kHostCancel;
+    environment.waiter = &waiter;
+    environment.pool = preEncoded ? TaskPool() : NULL;
+
+    size_t reuseSize = 0;
+    const void* reuse = preEncoded ? NULL : LockReuseInfo(reuseSize);
+    BLPWriteSession session(options, environment);
+    const bool ok = Succeeded(session.Write(gData->imageBuffer, width, height, reuse, reuseSize));
+    if (reuse != NULL)
+        UnlockReuseInfo();
+
+    const BLPWriteReport& report = session.Report();
+    gData->stats.phaseMs[BLP_PHASE_RESIZE] += report.resizeMs;
+    gData->stats.phaseMs[BLP_PHASE_ENCODE] += report.encodeMs;
+    if (report.autoChosen) {
+        LogInfo( "Auto compression JPEG " );
+        LogInfo( (int32)report.jpegBytes );
+        LogInfo( " bytes SSIM " );
+        LogInfo( report.jpegSsim );
+        LogInfo( ", Direct " );
+        LogInfo( (int32)report.directBytes );
+        LogInfo( " bytes SSIM " );
+        LogInfo( report.directSsim, true );
     }
-    
-    if (allocatedCurBuffer) free(curBuffer);
-
-    // Rewrite Header
-	*gResult = PSSDKSetFPos (gFormatRecord->dataFork,
-                             gFormatRecord->posixFileDescriptor,
-                             gFormatRecord->pluginUsingPOSIXIO,
-                             fsFromStart,
-                             0);
-	if (*gResult != noErr) return;
-    WriteSome(sizeof(BLP_HEADER), &header);
-    
-    if (gData->imageBuffer) {
-        free(gData->imageBuffer);
-        gData->imageBuffer = NULL;
+    if (report.reusedLevels > 0) {
+        LogInfo( "Reused levels " );
+        LogInfo( report.reusedLevels, true );
+    }
+    if (report.rateControlled) {
+        LogInfo( report.rateMet ? "Rate control met, quality " : "Rate control missed, quality " );
+        LogInfo( report.rateQuality );
+        LogInfo( ", trials " );
+        LogInfo( report.rateTrials, true );
     }
+    if (!ok) return;
+
+    const BLP_HEADER& header = session.Header();
+    for (int32 level = 0; level < kBLPMaxMips; level++)
+        gData->stats.mipBytes[level] = header.Size[level];
+    gData->stats.compression = report.compression;
+    gData->stats.alphaBits = header.alpha_bits;
+    gData->stats.threads = preEncoded ? EncoderThreads() : 1;
+    gData->stats.fileBytes = session.Bytes();
+    gData->stats.targetMet = report.targetMet;
+    if (report.targetMet == 0) {
+        LogInfo( "Rate target missed, file bytes " );
+        LogInfo( (int32)session.Bytes(), true );
+    }
+    
+    DisposeImageBuffer();
 }
 
 /*****************************************************************************/
@@ -1513,6 +1666,7 @@ static void DoWriteContinue (void)
 
 static void DoWriteFinish (void)
 {
+	DisposeImageBuffer ();
 	WriteScriptParamsOnWrite (); // should be different for read/write
 }
 
@@ -1521,32 +1675,21 @@ static void DoWriteFinish (void)
 static void DoFilterFile (void)
 {
 	
-	BLP_HEADER header;
-	
 	/* Exit if we have already encountered an error. */
 
     if (*gResult != noErr) return;
 
-	/* Read the file header. */
+  #if __PIMac__
+	/* FilterFile comes before ReadPrepare, which has not chosen the I/O yet. */
+	if (gFormatRecord->hostSupportsPOSIXIO)
+		gFormatRecord->pluginUsingPOSIXIO = true;
+  #endif
+
+	/* Read and check the file header. */
 
-	*gResult = PSSDKSetFPos (gFormatRecord->dataFork,
-                             gFormatRecord->posixFileDescriptor,
-                             gFormatRecord->pluginUsingPOSIXIO,
-                             fsFromStart, 0);
-	if (*gResult != noErr) return;
-	
-	ReadSome (sizeof (BLP_HEADER), &header);
-	
-	if (*gResult != noErr) return;
-	
-	/* Check the identifier. */
-	
-    char* magic = (char*)&header.MagicNumber;
-    if (magic[0] != 'B' || magic[1] != 'L' || magic[2] != 'P' || magic[3] != '1')
-	{
-		*gResult = formatCannotRead;
-		return;
-	}
+	BLPTraceZone zone("parse header");
+	BLPReader reader(ReadDataFork, NULL);
+	Succeeded(reader.Open());
 	
 }
 
@@ -1642,8 +1785,9 @@ static void SetFormatTheRect(VRect inRect)
 
 #if __PIMac__
 
-bool DoUI (vector<ResourceInfo *> & rInfos)
+bool DoUI (vector<BLPResourceInfo *> & rInfos)
 {
+	(void)rInfos;
 	return false;
 }
 
@@ -1651,6 +1795,8 @@ bool DoUI (vector<ResourceInfo *> & rInfos)
 
 void DoAbout(SPPluginRef plugin, int dialogID)
 {
+	(void)plugin;
+	(void)dialogID;
 }
 
 #endif
@@ -32,62 +32,42 @@
 #include "PIUtilities.h"				// SDK Utility library.
 #include "FileUtilities.h"				// File Utility library.
 #include "BLPFormatTerminology.h"	// Terminology for plug-in.
+#include "BLPFile.h"				// BLP1 file layout.
+#include "BLPWriteSession.h"		// BLPWriteCompression.
 #include <string>
 #include <vector>
 
 using namespace std;
 //-------------------------------------------------------------------------------
-//	Structure -- FileHeader
+//	Data -- structures
 //-------------------------------------------------------------------------------
 
-#pragma pack(push, 1)
-struct BLP_HEADER
-{
-    uint32 MagicNumber; // 'BLP1'
-    uint32 Compression; // 0: JPEG, 1: Direct (Paletted or Uncompressed)
-    uint32 alpha_bits;  // Alpha channel depth: 0, 1, 4, or 8 bits
-    uint32 Width;       // Image width in pixels
-    uint32 Height;      // Image height in pixels
-    uint32 extra;       // Team color flag / Content type (usually 5)
-    uint32 has_mipMaps; // 0 = no mipmaps, 1 = has mipmaps
-    uint32 Offset[16];  // Offsets to mipmap data for each level
-    uint32 Size[16];    // Sizes of mipmap data for each level
-};
-#pragma pack(pop)
-
-// BLP1 Format Details:
-// 
-// Header (156 bytes):
-// - MagicNumber: Always 'BLP1'
-// - Compression:
-//   - 0 (JPEG): Data is stored as JPEG chunks.
-//     - Header is followed by a uint32 specifying the JPEG header size.
-//     - Then the JPEG header data itself.
-//     - Mipmap data at Offset[i] contains the JPEG body for that level.
-//     - Note: JPEG data is typically CMYK (actually BGRA) or YCCK.
-//   - 1 (Direct): Data is uncompressed or paletted.
-//     - Header is followed by a 256-color palette (256 * 4 bytes = 1024 bytes).
-//     - Mipmap data at Offset[i] contains indices into the palette.
-//
-// - AlphaBits:
-//   - 0: No alpha.
-//   - 8: 8-bit alpha channel (usually appended after color data in Direct mode, or part of JPEG).
-//
-// - Mipmaps:
-//   - Up to 16 levels of mipmaps.
-//   - Offset[0] points to the full resolution image.
-//   - Offset[i] points to the i-th mipmap level (width/2^i, height/2^i).
-//   - Size[i] is the size in bytes of the data for that level.
-//   - If Size[i] is 0, that level does not exist.
-
-enum BLPCompression {
-    BLP_COMPRESSION_JPEG = 0,
-    BLP_COMPRESSION_DIRECT = 1
+// Phases of an open or a save, as BLPPerfStats times them.
+enum BLPPhase {
+    BLP_PHASE_FILE_READ = 0,    // reading the file
+    BLP_PHASE_PARSE,            // checking the header
+    BLP_PHASE_DECODE,           // decoding mip 0
+    BLP_PHASE_DELIVER,          // handing rows to the host
+    BLP_PHASE_ACQUIRE,          // taking rows from the host
+    BLP_PHASE_RESIZE,           // making the next mip level
+    BLP_PHASE_ENCODE,           // compressing the levels, with their resizing when up front
+    BLP_PHASE_FILE_WRITE,       // writing the file
+    BLP_PHASE_COUNT
 };
 
-//-------------------------------------------------------------------------------
-//	Data -- structures
-//-------------------------------------------------------------------------------
+// What the last open or save cost, for scripts that ask with
+// keyReportStats (BLPFormatScripting.cpp).
+typedef struct BLPPerfStats
+{
+    double selectorMs;                  // in the selectors since Read/WritePrepare
+    double phaseMs[BLP_PHASE_COUNT];
+    uint32 mipBytes[kBLPMaxMips];       // as stored, 0 past the last level
+    int32 compression;                  // BLP_WRITE_JPEG or BLP_WRITE_DIRECT, as stored
+    int32 alphaBits;
+    int32 threads;                      // the encoder could use, 1 for a read
+    uint32 fileBytes;                   // as written, 0 for a read
+    int32 targetMet;                    // byte budget or SSIM floor: 1 met, 0 missed, -1 none
+} BLPPerfStats;
 
 typedef struct BLPData
 { 
@@ -96,7 +76,25 @@ typedef struct BLPData
     bool usePOSIX;
     bool showDialog;
 	bool saveResources;
-    int32 mipmapCount;
+    int32 mipmapCount;      // levels to write, 0 for all of them down to 1x1
+    int32 hostMaxData;      // maxData offered by the host at Read/WritePrepare
+    int32 bandRows;         // rows per advanceState, planned at Read/WritePrepare (BLPMemPolicy.h)
+    bool smallestMipFirst;  // store levels smallest first, as one contiguous low-LOD prefix
+    bool alignMips;         // start large levels on a page boundary (kMipAlignment)
+    uint32 byteBudget;      // largest file to write, 0 for the fixed quality (BLPRateControl.h)
+    double minSsim;         // else the least SSIM of every level, 0 for the fixed quality
+    int32 compression;      // BLPWriteCompression
+    int32 encodeProfile;    // BLPEncodeProfile, the JPEG settings the next three start from
+    int32 alphaQuality;     // JPEG quality of alpha, 0 for the profile's
+    int32 alphaSampling;    // 1 for full size alpha, 2 for half, 0 for the profile's
+    bool trellis;           // trellis quantization, levels encoded on worker threads
+    int32 encodePreset;     // BLPEncodePreset; the keys below and trellis only add to it
+    int32 quality;          // JPEG quality of color, 0 for the profile's
+    int32 dctMethod;        // BLPDctMethod, 0 for the preset's
+    bool optimizeCoding;    // Huffman tables fitted to each level
+    int32 threads;          // encoder threads, 0 for one per processor
+    bool reportStats;       // return stats with the script parameters
+    BLPPerfStats stats;
     BLP_HEADER blpHeader;
     uint8* imageBuffer;
 } BLPData;
@@ -132,6 +130,9 @@ OSErr WriteScriptParamsOnRead (void);	// Write any scripting params.
 bool ReadScriptParamsOnWrite (void);	// Read any scripting params.
 OSErr WriteScriptParamsOnWrite (void);	// Write any scripting params.
 
+// Milliseconds in the selectors since Read/WritePrepare, this one included.
+double StatsTotalMs (void);
+
 //-------------------------------------------------------------------------------
 
 #endif // __BLPFormat_H__
@@ -188,9 +188,211 @@ resource 'aete' (ResourceID, plugInName " dictionary", purgeable)
 				typeBoolean,
 				"OPENSMART",
 				flagsSingleProperty,
+				
+				"Smallest mipmap first",
+				keySmallestFirst,
+				typeBoolean,
+				"SMALLESTFIRST",
+				flagsSingleProperty,
+				
+				"Page aligned mipmaps",
+				keyAlignMips,
+				typeBoolean,
+				"ALIGNMIPS",
+				flagsSingleProperty,
+				
+				"Byte budget",
+				keyByteBudget,
+				typeInteger,
+				"BYTEBUDGET",
+				flagsSingleProperty,
+				
+				"Minimum SSIM",
+				keyMinSsim,
+				typeFloat,
+				"MINSSIM",
+				flagsSingleProperty,
+				
+				"Compression",
+				keyCompression,
+				typeInteger,
+				"COMPRESSION",
+				flagsSingleProperty,
+				
+				"Encoding profile",
+				keyProfile,
+				typeInteger,
+				"PROFILE",
+				flagsSingleProperty,
+				
+				"Alpha quality",
+				keyAlphaQuality,
+				typeInteger,
+				"ALPHAQUALITY",
+				flagsSingleProperty,
+				
+				"Alpha sampling",
+				keyAlphaSampling,
+				typeInteger,
+				"ALPHASAMPLING",
+				flagsSingleProperty,
+				
+				"Trellis quantization",
+				keyTrellis,
+				typeBoolean,
+				"TRELLIS",
+				flagsSingleProperty,
+				
+				"Mipmap count",
+				keyMipmapCount,
+				typeInteger,
+				"MIPMAPCOUNT",
+				flagsSingleProperty,
+				
+				"Quality",
+				keyQuality,
+				typeInteger,
+				"QUALITY",
+				flagsSingleProperty,
+				
+				"DCT method",
+				keyDctMethod,
+				typeInteger,
+				"DCTMETHOD",
+				flagsSingleProperty,
+				
+				"Optimize Huffman tables",
+				keyOptimizeCoding,
+				typeBoolean,
+				"OPTIMIZECODING",
+				flagsSingleProperty,
+				
+				"Encoder threads",
+				keyThreads,
+				typeInteger,
+				"THREADS",
+				flagsSingleProperty,
+				
+				/* 0 none, 2 balanced, 3 max compression. Balanced only		*/
+				/* fits the Huffman tables, the same pixels as none. Max	*/
+				/* compression adds trellis quantization: a smaller file at	*/
+				/* a slightly lower PSNR for the same quality.				*/
+				"Encoder preset",
+				keyPreset,
+				typeInteger,
+				"PRESET",
+				flagsSingleProperty,
+				
+				"Report statistics",
+				keyReportStats,
+				typeBoolean,
+				"REPORTSTATS",
+				flagsSingleProperty,
+				
+				"Statistics",
+				keyStatistics,
+				classStatistics,
+				"STATISTICS",
+				flagsSingleProperty,
 			},
 			{}, /* elements (not supported) */
 			/* class descriptions */
+			
+			vendorName " blpStatistics",					/* what an open or save cost */
+			classStatistics,								/* class ID */
+			"times in milliseconds, mipmap bytes as a comma separated list, on a save the file bytes and whether the byte budget or SSIM floor was met",
+			{
+				"Total time",
+				keyTotalTime,
+				typeFloat,
+				"TOTALTIME",
+				flagsSingleProperty,
+				
+				"File read time",
+				keyFileReadTime,
+				typeFloat,
+				"FILEREADTIME",
+				flagsSingleProperty,
+				
+				"Parse time",
+				keyParseTime,
+				typeFloat,
+				"PARSETIME",
+				flagsSingleProperty,
+				
+				"Decode time",
+				keyDecodeTime,
+				typeFloat,
+				"DECODETIME",
+				flagsSingleProperty,
+				
+				"Deliver time",
+				keyDeliverTime,
+				typeFloat,
+				"DELIVERTIME",
+				flagsSingleProperty,
+				
+				"Acquire time",
+				keyAcquireTime,
+				typeFloat,
+				"ACQUIRETIME",
+				flagsSingleProperty,
+				
+				"Resize time",
+				keyResizeTime,
+				typeFloat,
+				"RESIZETIME",
+				flagsSingleProperty,
+				
+				"Encode time",
+				keyEncodeTime,
+				typeFloat,
+				"ENCODETIME",
+				flagsSingleProperty,
+				
+				"File write time",
+				keyFileWriteTime,
+				typeFloat,
+				"FILEWRITETIME",
+				flagsSingleProperty,
+				
+				"Mipmap bytes",
+				keyMipBytes,
+				typeChar,
+				"MIPBYTES",
+				flagsSingleProperty,
+				
+				"Compression",
+				keyCompression,
+				typeInteger,
+				"COMPRESSION",
+				flagsSingleProperty,
+				
+				"Alpha bits",
+				keyAlphaBits,
+				typeInteger,
+				"ALPHABITS",
+				flagsSingleProperty,
+				
+				"Encoder threads",
+				keyThreads,
+				typeInteger,
+				"THREADS",
+				flagsSingleProperty,
+				
+				"File bytes",
+				keyFileBytes,
+				typeInteger,
+				"FILEBYTES",
+				flagsSingleProperty,
+				
+				"Target met",
+				keyTargetMet,
+				typeBoolean,
+				"TARGETMET",
+				flagsSingleProperty,
+			},
+			{}, /* elements (not supported) */
 		},
 		{}, /* comparison ops (not supported) */
 		{}	/* any enumerations */
@@ -31,6 +31,11 @@
 //-------------------------------------------------------------------------------
 
 #include "BLPFormat.h"
+#include "BLPRateControl.h"
+#include <cstdio>
+#include <cstring>
+
+static void WriteStats (WriteDescriptorProcs * writeProcs, PIWriteDescriptor token, bool write);
 
 //-------------------------------------------------------------------------------
 //
@@ -90,6 +95,13 @@ bool ReadScriptParamsOnRead (void)
                 gData->openAsSmartObject = readParam;
                 break;
             }
+			case keyReportStats:
+			{
+				Boolean readParam = false;
+				readProcs->getBooleanProc(token, &readParam);
+				gData->reportStats = readParam;
+				break;
+			}
 		}
 	}
 
@@ -171,6 +183,122 @@ bool ReadScriptParamsOnWrite (void)
 				gData->saveResources = readParam;
 				break;
 			}
+			case keySmallestFirst:
+			{
+				Boolean readParam = false;
+				readProcs->getBooleanProc(token, &readParam);
+				gData->smallestMipFirst = readParam;
+				break;
+			}
+			case keyAlignMips:
+			{
+				Boolean readParam = false;
+				readProcs->getBooleanProc(token, &readParam);
+				gData->alignMips = readParam;
+				break;
+			}
+			case keyByteBudget:
+			{
+				int32 readParam = 0;
+				readProcs->getIntegerProc(token, &readParam);
+				gData->byteBudget = readParam > 0 ? (uint32)readParam : 0;
+				break;
+			}
+			case keyMinSsim:
+			{
+				real64 readParam = 0;
+				readProcs->getFloatProc(token, &readParam);
+				gData->minSsim = readParam > 0 && readParam <= 1 ? readParam : 0;
+				break;
+			}
+			case keyCompression:
+			{
+				int32 readParam = BLP_WRITE_JPEG;
+				readProcs->getIntegerProc(token, &readParam);
+				if (readParam >= BLP_WRITE_JPEG && readParam <= BLP_WRITE_AUTO)
+					gData->compression = readParam;
+				break;
+			}
+			case keyProfile:
+			{
+				int32 readParam = BLP_PROFILE_STANDARD;
+				readProcs->getIntegerProc(token, &readParam);
+				if (readParam >= BLP_PROFILE_STANDARD && readParam < BLP_PROFILE_COUNT)
+					gData->encodeProfile = readParam;
+				break;
+			}
+			case keyAlphaQuality:
+			{
+				int32 readParam = 0;
+				readProcs->getIntegerProc(token, &readParam);
+				gData->alphaQuality = readParam >= 1 && readParam <= 100 ? readParam : 0;
+				break;
+			}
+			case keyAlphaSampling:
+			{
+				int32 readParam = 0;
+				readProcs->getIntegerProc(token, &readParam);
+				gData->alphaSampling = readParam == 1 || readParam == 2 ? readParam : 0;
+				break;
+			}
+			case keyTrellis:
+			{
+				Boolean readParam = false;
+				readProcs->getBooleanProc(token, &readParam);
+				gData->trellis = readParam;
+				break;
+			}
+			case keyMipmapCount:
+			{
+				int32 readParam = 0;
+				readProcs->getIntegerProc(token, &readParam);
+				gData->mipmapCount = readParam >= 1 && readParam <= kBLPMaxMips ? readParam : 0;
+				break;
+			}
+			case keyQuality:
+			{
+				int32 readParam = 0;
+				readProcs->getIntegerProc(token, &readParam);
+				gData->quality = readParam >= 1 && readParam <= 100 ? readParam : 0;
+				break;
+			}
+			case keyDctMethod:
+			{
+				int32 readParam = 0;
+				readProcs->getIntegerProc(token, &readParam);
+				gData->dctMethod = readParam >= BLP_DCT_ISLOW && readParam <= BLP_DCT_FLOAT ? readParam : 0;
+				break;
+			}
+			case keyOptimizeCoding:
+			{
+				Boolean readParam = false;
+				readProcs->getBooleanProc(token, &readParam);
+				gData->optimizeCoding = readParam;
+				break;
+			}
+			case keyThreads:
+			{
+				int32 readParam = 0;
+				readProcs->getIntegerProc(token, &readParam);
+				gData->threads = readParam > 0 ? readParam : 0;
+				break;
+			}
+			case keyPreset:
+			{
+				int32 readParam = BLP_PRESET_NONE;
+				readProcs->getIntegerProc(token, &readParam);
+				if (readParam == BLP_PRESET_NONE ||
+					(readParam >= BLP_PRESET_BALANCED && readParam < BLP_PRESET_COUNT))
+					gData->encodePreset = readParam;
+				break;
+			}
+			case keyReportStats:
+			{
+				Boolean readParam = false;
+				readProcs->getBooleanProc(token, &readParam);
+				gData->reportStats = readParam;
+				break;
+			}
 		}
 	}
 	
@@ -221,6 +349,12 @@ OSErr WriteScriptParamsOnRead (void)
 
 	writeProcs->putBooleanProc(token, keyOpenAsSmart, gData->openAsSmartObject);
 
+	if (gData->reportStats)
+	{
+		writeProcs->putBooleanProc(token, keyReportStats, true);
+		WriteStats(writeProcs, token, false);
+	}
+
 	sPSHandle->Dispose(descParams->descriptor);
 	writeProcs->closeWriteDescriptorProc(token, &h);
 	descParams->descriptor = h;
@@ -265,6 +399,42 @@ OSErr WriteScriptParamsOnWrite (void)
 	
 	writeProcs->putBooleanProc(token, keySaveResources, gData->saveResources);
 
+	writeProcs->putBooleanProc(token, keySmallestFirst, gData->smallestMipFirst);
+
+	writeProcs->putBooleanProc(token, keyAlignMips, gData->alignMips);
+
+	writeProcs->putIntegerProc(token, keyByteBudget, (int32)gData->byteBudget);
+
+	writeProcs->putFloatProc(token, keyMinSsim, &gData->minSsim);
+
+	writeProcs->putIntegerProc(token, keyCompression, gData->compression);
+
+	writeProcs->putIntegerProc(token, keyProfile, gData->encodeProfile);
+
+	writeProcs->putIntegerProc(token, keyAlphaQuality, gData->alphaQuality);
+
+	writeProcs->putIntegerProc(token, keyAlphaSampling, gData->alphaSampling);
+
+	writeProcs->putBooleanProc(token, keyTrellis, gData->trellis);
+
+	writeProcs->putIntegerProc(token, keyMipmapCount, gData->mipmapCount);
+
+	writeProcs->putIntegerProc(token, keyQuality, gData->quality);
+
+	writeProcs->putIntegerProc(token, keyDctMethod, gData->dctMethod);
+
+	writeProcs->putBooleanProc(token, keyOptimizeCoding, gData->optimizeCoding);
+
+	writeProcs->putIntegerProc(token, keyThreads, gData->threads);
+
+	writeProcs->putIntegerProc(token, keyPreset, gData->encodePreset);
+
+	if (gData->reportStats)
+	{
+		writeProcs->putBooleanProc(token, keyReportStats, true);
+		WriteStats(writeProcs, token, true);
+	}
+
 	sPSHandle->Dispose(descParams->descriptor);
 	writeProcs->closeWriteDescriptorProc(token, &h);
 	descParams->descriptor = h;
@@ -272,5 +442,81 @@ OSErr WriteScriptParamsOnWrite (void)
 	return gotErr;
 }
 
+//-------------------------------------------------------------------------------
+//
+//	WriteStats
+//
+//	Puts what the open or save cost, gData->stats, under keyStatistics as an
+//	object of classStatistics: the total and the phases of the read or the
+//	write in milliseconds, the bytes of each stored level as a comma
+//	separated list, the compression and alpha bits stored and the encoder
+//	threads. A save also reports the bytes of the file and, with a byte
+//	budget or SSIM floor, whether it was met; a target that cannot be met
+//	still writes the closest file, so a script checks keyTargetMet. A host
+//	without putObjectProc gets none of it.
+//
+//-------------------------------------------------------------------------------
+
+static void WriteStats (WriteDescriptorProcs * writeProcs, PIWriteDescriptor token, bool write)
+{
+	static const DescriptorKeyID kPhaseKeys[BLP_PHASE_COUNT] = {
+		keyFileReadTime, keyParseTime, keyDecodeTime, keyDeliverTime,
+		keyAcquireTime, keyResizeTime, keyEncodeTime, keyFileWriteTime
+	};
+
+	if (writeProcs->putObjectProc == NULL || writeProcs->putStringProc == NULL)
+		return;
+
+	PIWriteDescriptor statsToken = writeProcs->openWriteDescriptorProc();
+	if (statsToken == NULL)
+		return;
+
+	const BLPPerfStats & stats = gData->stats;
+	real64 ms = StatsTotalMs();
+	writeProcs->putFloatProc(statsToken, keyTotalTime, &ms);
+
+	const int32 firstPhase = write ? BLP_PHASE_ACQUIRE : BLP_PHASE_FILE_READ;
+	const int32 endPhase = write ? BLP_PHASE_COUNT : BLP_PHASE_ACQUIRE;
+	for (int32 phase = firstPhase; phase < endPhase; phase++)
+	{
+		ms = stats.phaseMs[phase];
+		writeProcs->putFloatProc(statsToken, kPhaseKeys[phase], &ms);
+	}
+
+	// A Pascal string: at most 16 levels of 10 digits and a comma.
+	Str255 mipBytes;
+	size_t length = 0;
+	for (int32 level = 0; level < kBLPMaxMips && stats.mipBytes[level] != 0; level++)
+	{
+		char number[16];
+		snprintf(number, sizeof(number), level > 0 ? ",%u" : "%u", (unsigned)stats.mipBytes[level]);
+		size_t numberLength = strlen(number);
+		if (length + numberLength > 255)
+			break;
+		memcpy(&mipBytes[1 + length], number, numberLength);
+		length += numberLength;
+	}
+	mipBytes[0] = (unsigned char)length;
+	writeProcs->putStringProc(statsToken, keyMipBytes, mipBytes);
+
+	writeProcs->putIntegerProc(statsToken, keyCompression, stats.compression);
+	writeProcs->putIntegerProc(statsToken, keyAlphaBits, stats.alphaBits);
+	writeProcs->putIntegerProc(statsToken, keyThreads, stats.threads);
+	if (write)
+	{
+		writeProcs->putIntegerProc(statsToken, keyFileBytes, (int32)stats.fileBytes);
+		if (stats.targetMet >= 0)
+			writeProcs->putBooleanProc(statsToken, keyTargetMet, stats.targetMet != 0);
+	}
+
+	PIDescriptorHandle h = NULL;
+	writeProcs->closeWriteDescriptorProc(statsToken, &h);
+	if (h != NULL)
+	{
+		writeProcs->putObjectProc(token, keyStatistics, classStatistics, h);
+		sPSHandle->Dispose(h);
+	}
+}
+
 //-------------------------------------------------------------------------------
 // end BLPFormatScripting.cpp
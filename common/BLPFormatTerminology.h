@@ -34,6 +34,45 @@
 #define keyUsePOSIX      'useP'
 #define keySaveResources 'savR'
 #define keyOpenAsSmart   'opSm'
+#define keySmallestFirst 'smlF'
+#define keyAlignMips     'algM'
+#define keyByteBudget    'bytB'
+#define keyMinSsim       'minS'
+#define keyCompression   'cmpr'
+#define keyProfile       'prof'
+#define keyAlphaQuality  'alpQ'
+#define keyAlphaSampling 'alpS'
+#define keyTrellis       'trlQ'
+#define keyMipmapCount   'mipC'
+#define keyQuality       'qual'
+#define keyDctMethod     'dctT'
+#define keyOptimizeCoding 'optH'
+#define keyThreads       'thrd'
+// A BLPEncodePreset: 0 none, 2 balanced, 3 max compression. Balanced
+// decodes to the same pixels as none; max compression's trellis changes
+// them (BLPRateControl.h).
+#define keyPreset        'pres'
+#define keyReportStats   'stat'
+#define keyStatistics    'stts'
+
+//-------------------------------------------------------------------------------
+//	Definitions -- Statistics, the object under keyStatistics
+//-------------------------------------------------------------------------------
+
+#define classStatistics  'BLPs'
+#define keyTotalTime     'totT'
+#define keyFileReadTime  'frdT'
+#define keyParseTime     'prsT'
+#define keyDecodeTime    'dcdT'
+#define keyDeliverTime   'dlvT'
+#define keyAcquireTime   'acqT'
+#define keyResizeTime    'rszT'
+#define keyEncodeTime    'encT'
+#define keyFileWriteTime 'fwrT'
+#define keyMipBytes      'mipB'
+#define keyAlphaBits     'alpB'
+#define keyFileBytes     'filB'
+#define keyTargetMet     'tgtM'
 
 //-------------------------------------------------------------------------------
 //	Definitions -- Resource types
@@ -0,0 +1,126 @@
+//-------------------------------------------------------------------------------
+//
+//	File:
+//		BLPHash.cpp
+//
+//	Description:
+//		XXH64. See BLPHash.h.
+//
+//		Input words are read with memcpy, which compiles to a plain
+//		unaligned load, and assembled little-endian so the value is the
+//		same on every host.
+//
+//-------------------------------------------------------------------------------
+
+#include "BLPHash.h"
+#include <cstring>
+
+namespace {
+
+const uint64 kPrime1 = 0x9E3779B185EBCA87ULL;
+const uint64 kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64 kPrime3 = 0x165667B19E3779F9ULL;
+const uint64 kPrime4 = 0x85EBCA77C2B2AE63ULL;
+const uint64 kPrime5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64 RotateLeft(uint64 x, int bits)
+{
+    return (x << bits) | (x >> (64 - bits));
+}
+
+inline bool IsLittleEndian(void)
+{
+    const uint16 one = 1;
+    uint8 first;
+    memcpy(&first, &one, 1);
+    return first == 1;
+}
+
+inline uint64 Read64(const uint8* p)
+{
+    uint64 v;
+    memcpy(&v, p, sizeof(v));
+    if (!IsLittleEndian()) {
+        v = ((v & 0x00000000000000FFULL) << 56) | ((v & 0x000000000000FF00ULL) << 40) |
+            ((v & 0x0000000000FF0000ULL) << 24) | ((v & 0x00000000FF000000ULL) << 8) |
+            ((v & 0x000000FF00000000ULL) >> 8) | ((v & 0x0000FF0000000000ULL) >> 24) |
+            ((v & 0x00FF000000000000ULL) >> 40) | ((v & 0xFF00000000000000ULL) >> 56);
+    }
+    return v;
+}
+
+inline uint64 Read32(const uint8* p)
+{
+    return (uint64)p[0] | ((uint64)p[1] << 8) | ((uint64)p[2] << 16) | ((uint64)p[3] << 24);
+}
+
+inline uint64 Round(uint64 acc, uint64 input)
+{
+    acc += input * kPrime2;
+    acc = RotateLeft(acc, 31);
+    return acc * kPrime1;
+}
+
+inline uint64 MergeRound(uint64 acc, uint64 lane)
+{
+    acc ^= Round(0, lane);
+    return acc * kPrime1 + kPrime4;
+}
+
+} // namespace
+
+uint64 BLPHash64(const void* data, size_t size, uint64 seed)
+{
+    const uint8* p = (const uint8*)data;
+    const uint8* end = p + size;
+    uint64 h;
+
+    if (size >= 32) {
+        // The four lanes do not depend on each other within a stripe.
+        uint64 v1 = seed + kPrime1 + kPrime2;
+        uint64 v2 = seed + kPrime2;
+        uint64 v3 = seed;
+        uint64 v4 = seed - kPrime1;
+        const uint8* limit = end - 32;
+        do {
+            v1 = Round(v1, Read64(p));
+            v2 = Round(v2, Read64(p + 8));
+            v3 = Round(v3, Read64(p + 16));
+            v4 = Round(v4, Read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        h = RotateLeft(v1, 1) + RotateLeft(v2, 7) + RotateLeft(v3, 12) + RotateLeft(v4, 18);
+        h = MergeRound(h, v1);
+        h = MergeRound(h, v2);
+        h = MergeRound(h, v3);
+        h = MergeRound(h, v4);
+    } else {
+        h = seed + kPrime5;
+    }
+
+    h += (uint64)size;
+
+    for (; p + 8 <= end; p += 8) {
+        h ^= Round(0, Read64(p));
+        h = RotateLeft(h, 27) * kPrime1 + kPrime4;
+    }
+    if (p + 4 <= end) {
+        h ^= Read32(p) * kPrime1;
+        h = RotateLeft(h, 23) * kPrime2 + kPrime3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= (*p) * kPrime5;
+        h = RotateLeft(h, 11) * kPrime1;
+    }
+
+    h ^= h >> 33;
+    h *= kPrime2;
+    h ^= h >> 29;
+    h *= kPrime3;
+    h ^= h >> 32;
+    return h;
+}
+
+// end BLPHash.cpp
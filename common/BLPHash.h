@@ -0,0 +1,30 @@
+//-------------------------------------------------------------------------------
+//
+//	File:
+//		BLPHash.h
+//
+//	Description:
+//		Fast 64-bit content hash, used to tell whether the pixels of a
+//		mip level are the same ones a compressed level was made from.
+//
+//		The function is XXH64 (same results as the reference xxHash
+//		implementation): four independent 64-bit lanes over 32-byte
+//		stripes, which keeps the multipliers of a modern CPU busy and
+//		reaches memory bandwidth on a whole image. It is not a
+//		cryptographic hash.
+//
+//		A save compares the hash of mip 0 with the one kept in its
+//		BLPReuseInfo (BLPWriteSession.h) before it copies any level.
+//
+//-------------------------------------------------------------------------------
+
+#ifndef __BLPHash_H__
+#define __BLPHash_H__
+
+#include "PSIntTypes.h"
+#include <cstddef>
+
+// Hashes size bytes at data.
+uint64 BLPHash64(const void* data, size_t size, uint64 seed = 0);
+
+#endif // __BLPHash_H__
@@ -0,0 +1,159 @@
+//-------------------------------------------------------------------------------
+//
+//	File:
+//		BLPMemPolicy.cpp
+//
+//	Description:
+//		Working sets, the maxData plan and large blocks. See BLPMemPolicy.h.
+//
+//		A large block is over-allocated by one alignment and a header, the
+//		block handed out is the first aligned byte after the header, and
+//		the header records where the allocation starts, its size and the
+//		source to give it back to.
+//
+//-------------------------------------------------------------------------------
+
+#include "BLPMemPolicy.h"
+#include "BLPMemStats.h"
+#include <cstdlib>
+
+namespace {
+
+typedef struct LargeHeader
+{
+    void* start;            // of the allocation
+    size_t size;            // of the allocation
+    BLPBlockSource source;  // release is NULL for the heap
+} LargeHeader;
+
+const size_t kLargeOverhead = sizeof(LargeHeader) + kBLPLargeAlignment;
+
+// Default band while the host says nothing about its memory.
+const int64 kDefaultBandBytes = kBLPMaxBandBytes;
+
+uint8* Place(void* start, size_t size, const BLPBlockSource* source)
+{
+    size_t first = ((size_t)start + sizeof(LargeHeader) + kBLPLargeAlignment - 1) & ~(kBLPLargeAlignment - 1);
+    LargeHeader* header = (LargeHeader*)first - 1;
+    header->start = start;
+    header->size = size;
+    if (source != NULL) {
+        header->source = *source;
+    } else {
+        header->source.allocate = NULL;
+        header->source.release = NULL;
+        header->source.context = NULL;
+    }
+    return (uint8*)first;
+}
+
+int64 LevelBytes(int32 width, int32 height)
+{
+    return (int64)width * height * 4;
+}
+
+int32 Halved(int32 size, int32 times)
+{
+    size >>= times;
+    return size > 0 ? size : 1;
+}
+
+} // namespace
+
+void* BLPLargeAlloc(size_t bytes, const BLPBlockSource* source)
+{
+    if (bytes > (size_t)-1 - kLargeOverhead)
+        return NULL;
+    const size_t size = bytes + kLargeOverhead;
+
+    if (source != NULL && source->allocate != NULL) {
+        void* start = source->allocate(source->context, size);
+        if (start != NULL) {
+            BLPMemCount(BLP_MEM_HOST, size, false);
+            return Place(start, size, source);
+        }
+    }
+
+    void* start = malloc(size);
+    if (start == NULL)
+        return NULL;
+    BLPMemCount(BLP_MEM_HEAP, size, false);
+    return Place(start, size, NULL);
+}
+
+void BLPLargeFree(void* block)
+{
+    if (block == NULL)
+        return;
+    const LargeHeader header = *((LargeHeader*)block - 1);
+    if (header.source.release != NULL) {
+        BLPMemCount(BLP_MEM_HOST, header.size, true);
+        header.source.release(header.source.context, header.start);
+    } else {
+        BLPMemCount(BLP_MEM_HEAP, header.size, true);
+        free(header.start);
+    }
+}
+
+int64 BLPReadWorkingSet(int32 width, int32 height, uint64 mip0Bytes, bool indexed)
+{
+    if (indexed)
+        return 0;
+
+    // The stored mip 0 is read whole for JPEG and Direct alike.
+    return LevelBytes(width, height) + (int64)mip0Bytes;
+}
+
+int64 BLPWriteWorkingSet(const BLPWriteShape& shape)
+{
+    const int64 image = LevelBytes(shape.width, shape.height);
+    int64 below = 0;
+    for (int32 level = 1; level < shape.levels; level++)
+        below += LevelBytes(Halved(shape.width, level), Halved(shape.height, level));
+
+    if (!shape.preEncoded) {
+        // Two resize buffers, mips 1 and 2, and the encoder's output,
+        // which stays under the RGBA bytes of mip 0 at any quality.
+        return image + LevelBytes(Halved(shape.width, 1), Halved(shape.height, 1)) +
+               LevelBytes(Halved(shape.width, 2), Halved(shape.height, 2)) + image;
+    }
+
+    // The resized chain, then per trial in flight its output and, when
+    // scored, the decode of mip 0; the winners of every level are kept.
+    int64 bytes = image + below;
+    if (shape.jpeg) {
+        int64 threads = shape.threads > 0 ? shape.threads : 1;
+        bytes += threads * (image + (shape.scored ? image : 0)) + image + below;
+    }
+    if (shape.direct) {
+        // Indices and alpha of every level, and the levels as stored for
+        // their SSIM.
+        bytes += (image + below) / 2 + image;
+    }
+    return bytes;
+}
+
+void BLPPlanMemory(int64 offered, int64 workingSet, uint32 rowBytes, int32 height,
+                   BLPMemoryPlan& plan)
+{
+    if (rowBytes == 0)
+        rowBytes = 1;
+    if (height < 1)
+        height = 1;
+
+    // Smaller bands only help while they fit the rest of the offer; below
+    // the working set they would cost advanceStates and save nothing.
+    int64 band = kDefaultBandBytes;
+    if (offered > workingSet && offered - workingSet < band)
+        band = offered - workingSet;
+    if (band < (int64)rowBytes)
+        band = rowBytes;
+
+    int64 rows = band / rowBytes;
+    plan.bandRows = rows < height ? (int32)rows : height;
+
+    int64 keep = offered > 0 ? workingSet + (int64)plan.bandRows * rowBytes : 0;
+    plan.maxData = keep < 0x7FFFFFFF ? (int32)keep : 0x7FFFFFFF;
+}
+
+// end BLPMemPolicy.cpp
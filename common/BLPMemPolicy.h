@@ -0,0 +1,98 @@
+//-------------------------------------------------------------------------------
+//
+//	File:
+//		BLPMemPolicy.h
+//
+//	Description:
+//		How much memory an open or a save needs, what to ask the host for
+//		and where the large blocks come from.
+//
+//		Photoshop offers maxData at the Prepare selectors and keeps for
+//		its tiles and scratch disk whatever the plug-in does not take. A
+//		plug-in that takes nothing and then mallocs whole images makes the
+//		two compete for RAM. Instead the plug-in keeps its working set,
+//		plus a band of rows, takes the large blocks from the host's
+//		buffers while they last and moves as many rows per advanceState as
+//		the rest of the offer allows. When the offer is short of the
+//		working set it still keeps all of it, so the host knows what the
+//		call really holds.
+//
+//		Working sets are estimates from the image shape, for the blocks
+//		that grow with it; libjpeg's own memory is bounded separately
+//		through max_memory_to_use.
+//
+//-------------------------------------------------------------------------------
+
+#ifndef __BLPMemPolicy_H__
+#define __BLPMemPolicy_H__
+
+#include "PSIntTypes.h"
+#include <cstddef>
+
+// Every BLPLargeAlloc block starts on this boundary, a cache line, which
+// suits any SIMD load.
+const size_t kBLPLargeAlignment = 64;
+
+// Bands of rows are at most this big; more saves no time per advanceState.
+const uint32 kBLPMaxBandBytes = 1u << 20;
+
+// Where BLPLargeAlloc tries first, such as the host's Buffer suite.
+// allocate returns NULL when it has no room; release takes back what it
+// gave. Both are called on the thread that calls BLPLargeAlloc and
+// BLPLargeFree.
+typedef struct BLPBlockSource
+{
+    void* (*allocate)(void* context, size_t bytes);
+    void (*release)(void* context, void* block);
+    void* context;
+} BLPBlockSource;
+
+// A block of bytes aligned to kBLPLargeAlignment from source, which may be
+// NULL, or if it has no room from the plug-in heap. BLPMemStats counts it
+// as BLP_MEM_HOST or BLP_MEM_HEAP. NULL if neither has room.
+void* BLPLargeAlloc(size_t bytes, const BLPBlockSource* source);
+
+// Gives a BLPLargeAlloc block back to where it came from. Takes NULL.
+void BLPLargeFree(void* block);
+
+// Bytes an open holds at its peak besides the rows it hands the host: the
+// RGBA image and mip 0 as stored (mip0Bytes). An indexed open reads the rows it hands the host
+// straight from the file and holds nothing else.
+int64 BLPReadWorkingSet(int32 width, int32 height, uint64 mip0Bytes, bool indexed);
+
+// The shape of a save, as a BLPWriteSession will do it (BLPShapeWrite).
+typedef struct BLPWriteShape
+{
+    int32 width;
+    int32 height;
+    int32 levels;
+    bool preEncoded;        // every level encoded before any is written
+    bool jpeg;              // with preEncoded: JPEG trials are made
+    bool direct;            // with preEncoded: the levels are palettized
+    bool scored;            // trials are decoded to score their SSIM
+    int32 threads;          // trials that run at once
+} BLPWriteShape;
+
+// Bytes a save holds at its peak besides the rows it takes from the host:
+// the RGBA image, then the resized levels and the outputs and decodes of
+// the trials in flight, or the two resize buffers and one encoded level.
+int64 BLPWriteWorkingSet(const BLPWriteShape& shape);
+
+// What to keep of maxData and how many rows to move at a time.
+typedef struct BLPMemoryPlan
+{
+    int32 maxData;          // to leave in maxData at the Prepare selector
+    int32 bandRows;         // per advanceState, at least 1
+} BLPMemoryPlan;
+
+// Plans for a call with workingSet bytes, of which the host offered
+// offered (0 or less when it said nothing), moving rows of rowBytes of an
+// image height rows tall. The band is kBLPMaxBandBytes, or what is left
+// over the working set when that is less, down to one row. An offer
+// below the working set cannot be met by smaller bands, so it keeps the
+// whole working set and a full band, more than offered; with nothing
+// offered the band is full and nothing is kept.
+void BLPPlanMemory(int64 offered, int64 workingSet, uint32 rowBytes, int32 height,
+                   BLPMemoryPlan& plan);
+
+#endif // __BLPMemPolicy_H__
@@ -0,0 +1,145 @@
+//-------------------------------------------------------------------------------
+//
+//	File:
+//		BLPMemStats.cpp
+//
+//	Description:
+//		Allocation counts and peak live bytes. See BLPMemStats.h.
+//
+//		Counters are relaxed atomics. A peak span owns one of 32 slots;
+//		each allocation raises the slots that are open, so spans may nest
+//		and overlap across threads.
+//
+//-------------------------------------------------------------------------------
+
+#include "BLPMemStats.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+
+extern "C" {
+#include "../ThirdParty/jpeg/include/jpeglib.h"
+#include "../ThirdParty/jpeg/include/jmemarena.h"
+}
+
+namespace {
+
+const int32 kPeakSlots = 32;
+
+// Keeps BLPMemAlloc blocks aligned as malloc's.
+const size_t kHeaderBytes = 16;
+
+std::atomic<int64> gAllocations[BLP_MEM_KINDS];
+std::atomic<int64> gBytes[BLP_MEM_KINDS];
+std::atomic<int64> gLive[BLP_MEM_KINDS];
+std::atomic<int64> gLiveTotal(0);
+std::atomic<uint32> gOpenSlots(0);
+std::atomic<int64> gPeaks[kPeakSlots];
+
+void RaisePeaks(int64 live)
+{
+    uint32 open = gOpenSlots.load(std::memory_order_relaxed);
+    for (int32 slot = 0; open != 0; slot++, open >>= 1) {
+        if ((open & 1) == 0)
+            continue;
+        int64 peak = gPeaks[slot].load(std::memory_order_relaxed);
+        while (live > peak && !gPeaks[slot].compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+        }
+    }
+}
+
+void JpegMemHook(size_t size, boolean freeing)
+{
+    BLPMemCount(BLP_MEM_JPEG, size, freeing != FALSE);
+}
+
+bool ReadEnvironment(void)
+{
+    const char* value = getenv("BLP_MEMSTATS");
+    bool enabled = value != NULL && value[0] != '\0' && value[0] != '0';
+    if (enabled)
+        jpeg_set_mem_hook(JpegMemHook);
+    return enabled;
+}
+
+} // namespace
+
+bool BLPMemStatsEnabled(void)
+{
+    static const bool enabled = ReadEnvironment();
+    return enabled;
+}
+
+void BLPMemCount(BLPMemKind kind, size_t bytes, bool freeing)
+{
+    if (!BLPMemStatsEnabled())
+        return;
+    if (freeing) {
+        gLive[kind].fetch_sub((int64)bytes, std::memory_order_relaxed);
+        gLiveTotal.fetch_sub((int64)bytes, std::memory_order_relaxed);
+        return;
+    }
+    gAllocations[kind].fetch_add(1, std::memory_order_relaxed);
+    gBytes[kind].fetch_add((int64)bytes, std::memory_order_relaxed);
+    gLive[kind].fetch_add((int64)bytes, std::memory_order_relaxed);
+    RaisePeaks(gLiveTotal.fetch_add((int64)bytes, std::memory_order_relaxed) + (int64)bytes);
+}
+
+void* BLPMemAlloc(size_t size)
+{
+    if (size > (size_t)-1 - kHeaderBytes)
+        return NULL;
+    char* block = (char*)malloc(size + kHeaderBytes);
+    if (block == NULL)
+        return NULL;
+    *(size_t*)block = size;
+    BLPMemCount(BLP_MEM_HEAP, size, false);
+    return block + kHeaderBytes;
+}
+
+void BLPMemFree(void* block)
+{
+    if (block == NULL)
+        return;
+    char* start = (char*)block - kHeaderBytes;
+    BLPMemCount(BLP_MEM_HEAP, *(size_t*)start, true);
+    free(start);
+}
+
+void BLPMemTake(BLPMemSnapshot& snapshot)
+{
+    for (int32 kind = 0; kind < BLP_MEM_KINDS; kind++) {
+        snapshot.allocations[kind] = gAllocations[kind].load(std::memory_order_relaxed);
+        snapshot.bytes[kind] = gBytes[kind].load(std::memory_order_relaxed);
+        snapshot.live[kind] = gLive[kind].load(std::memory_order_relaxed);
+    }
+    snapshot.liveTotal = gLiveTotal.load(std::memory_order_relaxed);
+}
+
+int32 BLPMemPeakBegin(void)
+{
+    if (!BLPMemStatsEnabled())
+        return -1;
+    uint32 open = gOpenSlots.load(std::memory_order_relaxed);
+    for (;;) {
+        int32 slot = 0;
+        while (slot < kPeakSlots && (open & (1u << slot)) != 0)
+            slot++;
+        if (slot == kPeakSlots)
+            return -1;
+        // The slot is set before it is opened, so RaisePeaks never sees
+        // a stale peak.
+        gPeaks[slot].store(gLiveTotal.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        if (gOpenSlots.compare_exchange_weak(open, open | (1u << slot), std::memory_order_acq_rel))
+            return slot;
+    }
+}
+
+int64 BLPMemPeakEnd(int32 mark)
+{
+    if (mark < 0 || mark >= kPeakSlots)
+        return 0;
+    int64 peak = gPeaks[mark].load(std::memory_order_relaxed);
+    gOpenSlots.fetch_and(~(1u << mark), std::memory_order_acq_rel);
+    return peak;
+}
@@ -0,0 +1,107 @@
+//-------------------------------------------------------------------------------
+//
+//	File:
+//		BLPMemStats.h
+//
+//	Description:
+//		Allocation counts and peak live bytes, to find what drives the
+//		memory of a large texture.
+//
+//		With the environment variable BLP_MEMSTATS set, every counted
+//		allocation adds to the totals of its kind: the plug-in's own
+//		buffers (BLPMemAlloc, BLPMemAllocator), the buffers it takes from
+//		the host, and what libjpeg takes from malloc (through the hook of
+//		jmemarena.h). The totals are process-wide and thread-safe.
+//		BLPMemPeak (or BLPMemPeakBegin and End) gives the highest live total
+//		over a span, such as a selector or a BLPTraceZone, on any thread.
+//
+//		Without BLP_MEMSTATS nothing is counted; BLPMemAlloc still
+//		tags each block with its size.
+//
+//-------------------------------------------------------------------------------
+
+#ifndef __BLPMemStats_H__
+#define __BLPMemStats_H__
+
+#include "PSIntTypes.h"
+#include <cstddef>
+#include <new>
+#include <vector>
+
+typedef enum BLPMemKind
+{
+    BLP_MEM_HEAP = 0,       // the plug-in's own buffers
+    BLP_MEM_HOST,           // buffers from the host's Buffer suite
+    BLP_MEM_JPEG,           // libjpeg's pools and arenas
+    BLP_MEM_KINDS
+} BLPMemKind;
+
+typedef struct BLPMemSnapshot
+{
+    int64 allocations[BLP_MEM_KINDS];   // since the process started
+    int64 bytes[BLP_MEM_KINDS];         // allocated since the process started
+    int64 live[BLP_MEM_KINDS];          // allocated and not yet freed
+    int64 liveTotal;
+} BLPMemSnapshot;
+
+// True if BLP_MEMSTATS is set. The first call installs the libjpeg hook,
+// so make it before any JPEG object exists.
+bool BLPMemStatsEnabled(void);
+
+// Counts an allocation of bytes, or a free with freeing.
+void BLPMemCount(BLPMemKind kind, size_t bytes, bool freeing);
+
+// malloc and free counted as BLP_MEM_HEAP. BLPMemFree takes NULL.
+void* BLPMemAlloc(size_t size);
+void BLPMemFree(void* block);
+
+void BLPMemTake(BLPMemSnapshot& snapshot);
+
+// Starts watching the live total; -1 if not counting or if 32 spans are
+// already open. BLPMemPeakEnd(mark) returns the highest live total since
+// BLPMemPeakBegin, and 0 for -1.
+int32 BLPMemPeakBegin(void);
+int64 BLPMemPeakEnd(int32 mark);
+
+// A peak span over the scope it lives in.
+class BLPMemPeak {
+  public:
+	BLPMemPeak() : mark(BLPMemPeakBegin()) {}
+	~BLPMemPeak() { End(); }
+
+	/// Ends the span early and returns its peak.
+	int64 End(void) { int64 peak = BLPMemPeakEnd(mark); mark = -1; return peak; }
+
+  private:
+	int32 mark;
+
+	BLPMemPeak(const BLPMemPeak&);
+	BLPMemPeak& operator=(const BLPMemPeak&);
+};
+
+// For containers of the plug-in's own buffers: counts as BLP_MEM_HEAP.
+template <typename T>
+struct BLPMemAllocator
+{
+    typedef T value_type;
+
+    BLPMemAllocator() {}
+    template <typename U> BLPMemAllocator(const BLPMemAllocator<U>&) {}
+
+    T* allocate(size_t count)
+    {
+        void* block = BLPMemAlloc(count * sizeof(T));
+        if (block == NULL)
+            throw std::bad_alloc();
+        return (T*)block;
+    }
+    void deallocate(T* block, size_t) { BLPMemFree(block); }
+
+    template <typename U> bool operator==(const BLPMemAllocator<U>&) const { return true; }
+    template <typename U> bool operator!=(const BLPMemAllocator<U>&) const { return false; }
+};
+
+// A byte buffer of the plug-in's own.
+typedef std::vector<uint8, BLPMemAllocator<uint8> > BLPByteBuffer;
+
+#endif // __BLPMemStats_H__
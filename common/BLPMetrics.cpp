@@ -0,0 +1,183 @@
+//-------------------------------------------------------------------------------
+//
+//	File:
+//		BLPMetrics.cpp
+//
+//	Description:
+//		PSNR and SSIM. See BLPMetrics.h.
+//
+//		Windows 8 rows tall that start every 4 rows are made of two
+//		4-row groups, so SSIM sums each row only once: the column sums of
+//		one group are kept while the next is added up, and a window's
+//		total is read from both.
+//
+//-------------------------------------------------------------------------------
+
+#include "BLPMetrics.h"
+#include <cmath>
+#include <vector>
+
+namespace {
+
+const int32 kWindow = 8;
+const int32 kStep = 4;
+const int32 kCancelGroups = 16;     // of kStep rows between polls of a BLPCancel
+const double kC1 = (0.01 * 255) * (0.01 * 255);
+const double kC2 = (0.03 * 255) * (0.03 * 255);
+
+// Per-sample sums down a group of rows.
+typedef struct ColumnSums
+{
+    std::vector<int32> a;
+    std::vector<int32> b;
+    std::vector<int32> aa;
+    std::vector<int32> bb;
+    std::vector<int32> ab;
+} ColumnSums;
+
+void ResizeSums(ColumnSums& sums, size_t count)
+{
+    sums.a.resize(count);
+    sums.b.resize(count);
+    sums.aa.resize(count);
+    sums.bb.resize(count);
+    sums.ab.resize(count);
+}
+
+// Sums rows rows of rowSamples samples each, starting at a and b.
+void SumRows(const uint8* a, const uint8* b, int32 rows, size_t rowSamples, ColumnSums& sums)
+{
+    int32* sa = &sums.a[0];
+    int32* sb = &sums.b[0];
+    int32* saa = &sums.aa[0];
+    int32* sbb = &sums.bb[0];
+    int32* sab = &sums.ab[0];
+    for (size_t i = 0; i < rowSamples; i++)
+        sa[i] = sb[i] = saa[i] = sbb[i] = sab[i] = 0;
+
+    for (int32 r = 0; r < rows; r++, a += rowSamples, b += rowSamples) {
+        for (size_t i = 0; i < rowSamples; i++) {
+            int32 x = a[i];
+            int32 y = b[i];
+            sa[i] += x;
+            sb[i] += y;
+            saa[i] += x * x;
+            sbb[i] += y * y;
+            sab[i] += x * y;
+        }
+    }
+}
+
+double WindowSsim(double n, double sa, double sb, double saa, double sbb, double sab)
+{
+    double ma = sa / n;
+    double mb = sb / n;
+    double va = saa / n - ma * ma;
+    double vb = sbb / n - mb * mb;
+    double cov = sab / n - ma * mb;
+    return ((2 * ma * mb + kC1) * (2 * cov + kC2)) /
+           ((ma * ma + mb * mb + kC1) * (va + vb + kC2));
+}
+
+// Adds the SSIM of every window along one band of rows, whose column sums
+// are top plus bottom (bottom may be NULL), and returns how many windows.
+int32 BandSsim(const ColumnSums& top, const ColumnSums* bottom, int32 width, int32 windowW,
+               int32 windowH, int32 pixelBytes, int32 channels, double& total)
+{
+    int32 windows = 0;
+    double n = (double)windowW * windowH;
+    for (int32 x0 = 0; x0 + windowW <= width; x0 += kStep) {
+        for (int32 c = 0; c < channels; c++) {
+            int32 sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+            for (int32 x = x0; x < x0 + windowW; x++) {
+                size_t i = (size_t)x * pixelBytes + c;
+                sa += top.a[i];
+                sb += top.b[i];
+                saa += top.aa[i];
+                sbb += top.bb[i];
+                sab += top.ab[i];
+                if (bottom != NULL) {
+                    sa += bottom->a[i];
+                    sb += bottom->b[i];
+                    saa += bottom->aa[i];
+                    sbb += bottom->bb[i];
+                    sab += bottom->ab[i];
+                }
+            }
+            total += WindowSsim(n, sa, sb, saa, sbb, sab);
+        }
+        windows++;
+        if (windowW < kWindow)
+            break;
+    }
+    return windows;
+}
+
+} // namespace
+
+double BLPPsnr(const uint8* a, const uint8* b, int32 width, int32 height,
+               int32 pixelBytes, int32 channels)
+{
+    if (width <= 0 || height <= 0 || channels <= 0)
+        return kBLPMaxPsnr;
+
+    size_t rowSamples = (size_t)width * pixelBytes;
+    int64 squares = 0;
+    for (int32 y = 0; y < height; y++, a += rowSamples, b += rowSamples) {
+        if (channels == pixelBytes) {
+            for (size_t i = 0; i < rowSamples; i++) {
+                int32 d = (int32)a[i] - (int32)b[i];
+                squares += d * d;
+            }
+        } else {
+            for (size_t i = 0; i < rowSamples; i += pixelBytes) {
+                for (int32 c = 0; c < channels; c++) {
+                    int32 d = (int32)a[i + c] - (int32)b[i + c];
+                    squares += d * d;
+                }
+            }
+        }
+    }
+
+    if (squares == 0)
+        return kBLPMaxPsnr;
+    double mse = (double)squares / ((double)width * height * channels);
+    double psnr = 10.0 * log10(255.0 * 255.0 / mse);
+    return psnr < kBLPMaxPsnr ? psnr : kBLPMaxPsnr;
+}
+
+double BLPSsim(const uint8* a, const uint8* b, int32 width, int32 height,
+               int32 pixelBytes, int32 channels, const BLPCancel* cancel)
+{
+    if (width <= 0 || height <= 0 || channels <= 0)
+        return 1.0;
+
+    size_t rowSamples = (size_t)width * pixelBytes;
+    int32 windowW = width < kWindow ? width : kWindow;
+    double total = 0;
+    int32 windows = 0;
+
+    ColumnSums sums[2];
+    ResizeSums(sums[0], rowSamples);
+
+    if (height < kWindow) {
+        SumRows(a, b, height, rowSamples, sums[0]);
+        windows = BandSsim(sums[0], NULL, width, windowW, height, pixelBytes, channels, total);
+    } else {
+        ResizeSums(sums[1], rowSamples);
+        SumRows(a, b, kStep, rowSamples, sums[0]);
+        for (int32 group = 1; (group + 1) * kStep <= height; group++) {
+            if (group % kCancelGroups == 0 && BLPCancelled(cancel))
+                return 0.0;
+            const ColumnSums& top = sums[(group - 1) & 1];
+            ColumnSums& bottom = sums[group & 1];
+            size_t offset = (size_t)group * kStep * rowSamples;
+            SumRows(a + offset, b + offset, kStep, rowSamples, bottom);
+            windows += BandSsim(top, &bottom, width, windowW, kWindow, pixelBytes, channels, total);
+        }
+    }
+
+    return windows > 0 ? total / ((double)windows * channels) : 1.0;
+}
+
+// end BLPMetrics.cpp
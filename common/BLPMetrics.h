@@ -0,0 +1,42 @@
+//-------------------------------------------------------------------------------
+//
+//	File:
+//		BLPMetrics.h
+//
+//	Description:
+//		Image quality metrics for comparing a mip level with its decoded
+//		JPEG: PSNR and SSIM over interleaved 8-bit pixels.
+//
+//		SSIM is the mean over 8x8 windows placed every 4 pixels, with the
+//		usual constants (K1 = 0.01, K2 = 0.03, L = 255) and a flat window,
+//		computed per channel and averaged. A level smaller than 8 pixels
+//		in either direction is one window of its own size.
+//
+//		The sums run over whole rows of samples with no branch in the
+//		inner loops, which compilers turn into SIMD code.
+//
+//		SSIM scores the trials of rate control and the AUTO choice;
+//		BLPHostSim reports PSNR for a roundtrip.
+//
+//-------------------------------------------------------------------------------
+
+#ifndef __BLPMetrics_H__
+#define __BLPMetrics_H__
+
+#include "BLPTaskPool.h"
+#include "PSIntTypes.h"
+
+// PSNR reported for identical images.
+const double kBLPMaxPsnr = 100.0;
+
+// Both functions compare the first channels samples of each pixelBytes
+// byte pixel of two width x height images.
+double BLPPsnr(const uint8* a, const uint8* b, int32 width, int32 height,
+               int32 pixelBytes, int32 channels);
+
+// SSIM polls cancel (may be NULL) every 64 rows and returns 0 once it has
+// fired.
+double BLPSsim(const uint8* a, const uint8* b, int32 width, int32 height,
+               int32 pixelBytes, int32 channels, const BLPCancel* cancel = NULL);
+
+#endif // __BLPMetrics_H__
@@ -0,0 +1,401 @@
+//-------------------------------------------------------------------------------
+//
+//	File:
+//		BLPPalette.cpp
+//
+//	Description:
+//		Palettized encoding. See BLPPalette.h.
+//
+//		The median cut works on the occupied 6-bit cells of mip 0, each
+//		with its pixel count and mean color, so its cost depends on the
+//		number of distinct colors rather than on the image size. Pixels
+//		are mapped through a table over the same cells, filled in as cells
+//		are met, holding the entry nearest to the cell's center; colors of
+//		an exact palette are looked up first and always map to themselves.
+//
+//-------------------------------------------------------------------------------
+
+#include "BLPPalette.h"
+#include "BLPMetrics.h"
+#include "BLPTrace.h"
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+namespace {
+
+const int32 kCellBits = 6;
+const int32 kCells = 1 << (3 * kCellBits);
+const int32 kKMeansPasses = 2;
+const uint16 kUnmapped = 0xFFFF;
+
+inline uint32 CellOf(const uint8* rgba)
+{
+    const int32 shift = 8 - kCellBits;
+    return ((uint32)(rgba[0] >> shift) << (2 * kCellBits)) |
+           ((uint32)(rgba[1] >> shift) << kCellBits) |
+            (uint32)(rgba[2] >> shift);
+}
+
+inline uint32 ColorOf(const uint8* rgba)
+{
+    return ((uint32)rgba[0] << 16) | ((uint32)rgba[1] << 8) | rgba[2];
+}
+
+// The occupied cells: pixel count and mean color.
+typedef struct Bucket
+{
+    double mean[3];
+    uint32 count;
+} Bucket;
+
+typedef struct Entry
+{
+    int32 rgb[3];
+} Entry;
+
+// A small open-addressed set of 24-bit colors, which gives up past 256.
+class ExactColors
+{
+public:
+    ExactColors() : count_(0), overflow_(false)
+    {
+        for (int32 i = 0; i < kSlots; i++)
+            slots_[i] = kEmpty;
+    }
+
+    void Add(uint32 color)
+    {
+        if (overflow_)
+            return;
+        uint32 slot = Find(color);
+        if (slots_[slot] != kEmpty)
+            return;
+        if (count_ == kBLPPaletteColors) {
+            overflow_ = true;
+            return;
+        }
+        slots_[slot] = color;
+        index_[slot] = (uint16)count_;
+        colors_[count_++] = color;
+    }
+
+    // Entry of color, or kUnmapped.
+    uint16 Lookup(uint32 color) const
+    {
+        uint32 slot = Find(color);
+        return slots_[slot] == kEmpty ? kUnmapped : index_[slot];
+    }
+
+    bool Overflow() const { return overflow_; }
+    int32 Count() const { return count_; }
+    uint32 Color(int32 i) const { return colors_[i]; }
+
+private:
+    static const int32 kSlots = 1024;
+    static const uint32 kEmpty = 0xFFFFFFFF;
+
+    uint32 Find(uint32 color) const
+    {
+        uint32 slot = (color * 2654435761u) >> 22;
+        while (slots_[slot] != kEmpty && slots_[slot] != color)
+            slot = (slot + 1) & (kSlots - 1);
+        return slot;
+    }
+
+    uint32 slots_[kSlots];
+    uint16 index_[kSlots];
+    uint32 colors_[kBLPPaletteColors];
+    int32 count_;
+    bool overflow_;
+};
+
+int32 Nearest(const Entry* palette, int32 colors, double r, double g, double b)
+{
+    int32 best = 0;
+    double bestDistance = 0;
+    for (int32 i = 0; i < colors; i++) {
+        double dr = palette[i].rgb[0] - r;
+        double dg = palette[i].rgb[1] - g;
+        double db = palette[i].rgb[2] - b;
+        double distance = dr * dr + dg * dg + db * db;
+        if (i == 0 || distance < bestDistance) {
+            best = i;
+            bestDistance = distance;
+        }
+    }
+    return best;
+}
+
+typedef struct Box
+{
+    size_t begin;
+    size_t end;
+    int32 axis;         // channel of the largest spread
+    double error;       // count-weighted variance along axis
+} Box;
+
+void MeasureBox(const std::vector<Bucket>& buckets, Box& box)
+{
+    double n = 0;
+    double sum[3] = { 0, 0, 0 };
+    double squares[3] = { 0, 0, 0 };
+    for (size_t i = box.begin; i < box.end; i++) {
+        const Bucket& bucket = buckets[i];
+        n += bucket.count;
+        for (int32 c = 0; c < 3; c++) {
+            sum[c] += bucket.mean[c] * bucket.count;
+            squares[c] += bucket.mean[c] * bucket.mean[c] * bucket.count;
+        }
+    }
+    box.axis = 0;
+    box.error = 0;
+    for (int32 c = 0; c < 3; c++) {
+        double error = squares[c] - sum[c] * sum[c] / n;
+        if (error > box.error) {
+            box.axis = c;
+            box.error = error;
+        }
+    }
+    if (box.end - box.begin < 2)
+        box.error = 0;
+}
+
+struct ByAxis
+{
+    int32 axis;
+    bool operator()(const Bucket& a, const Bucket& b) const { return a.mean[axis] < b.mean[axis]; }
+};
+
+// Median cut of the buckets into at most kBLPPaletteColors entries.
+int32 MedianCut(std::vector<Bucket>& buckets, Entry* palette)
+{
+    std::vector<Box> boxes;
+    Box all = { 0, buckets.size(), 0, 0 };
+    MeasureBox(buckets, all);
+    boxes.push_back(all);
+
+    while ((int32)boxes.size() < kBLPPaletteColors) {
+        size_t worst = 0;
+        for (size_t i = 1; i < boxes.size(); i++) {
+            if (boxes[i].error > boxes[worst].error)
+                worst = i;
+        }
+        Box box = boxes[worst];
+        if (box.error <= 0)
+            break;
+
+        // Split at the weighted median along the widest channel.
+        ByAxis byAxis = { box.axis };
+        std::sort(buckets.begin() + box.begin, buckets.begin() + box.end, byAxis);
+        double total = 0;
+        for (size_t i = box.begin; i < box.end; i++)
+            total += buckets[i].count;
+        double half = 0;
+        size_t split = box.begin + 1;
+        for (size_t i = box.begin; i + 1 < box.end; i++) {
+            half += buckets[i].count;
+            split = i + 1;
+            if (half * 2 >= total)
+                break;
+        }
+
+        Box low = { box.begin, split, 0, 0 };
+        Box high = { split, box.end, 0, 0 };
+        MeasureBox(buckets, low);
+        MeasureBox(buckets, high);
+        boxes[worst] = low;
+        boxes.push_back(high);
+    }
+
+    for (size_t b = 0; b < boxes.size(); b++) {
+        double n = 0;
+        double sum[3] = { 0, 0, 0 };
+        for (size_t i = boxes[b].begin; i < boxes[b].end; i++) {
+            n += buckets[i].count;
+            for (int32 c = 0; c < 3; c++)
+                sum[c] += buckets[i].mean[c] * buckets[i].count;
+        }
+        for (int32 c = 0; c < 3; c++)
+            palette[b].rgb[c] = (int32)(sum[c] / n + 0.5);
+    }
+    return (int32)boxes.size();
+}
+
+// Moves each entry to the mean of the buckets nearest to it.
+void RefineKMeans(const std::vector<Bucket>& buckets, Entry* palette, int32 colors)
+{
+    std::vector<double> sums(colors * 4);
+    for (int32 pass = 0; pass < kKMeansPasses; pass++) {
+        std::fill(sums.begin(), sums.end(), 0.0);
+        for (size_t i = 0; i < buckets.size(); i++) {
+            const Bucket& bucket = buckets[i];
+            int32 entry = Nearest(palette, colors, bucket.mean[0], bucket.mean[1], bucket.mean[2]);
+            for (int32 c = 0; c < 3; c++)
+                sums[entry * 4 + c] += bucket.mean[c] * bucket.count;
+            sums[entry * 4 + 3] += bucket.count;
+        }
+        for (int32 e = 0; e < colors; e++) {
+            double n = sums[e * 4 + 3];
+            if (n > 0) {
+                for (int32 c = 0; c < 3; c++)
+                    palette[e].rgb[c] = (int32)(sums[e * 4 + c] / n + 0.5);
+            }
+        }
+    }
+}
+
+uint32 ChooseAlphaBits(const BLPRateLevel& level, bool hasAlpha)
+{
+    if (!hasAlpha)
+        return 0;
+    bool opaque = true;
+    size_t pixels = (size_t)level.width * level.height;
+    for (size_t i = 0; i < pixels; i++) {
+        uint8 a = level.pixels[i * 4 + 3];
+        if (a != 0 && a != 255)
+            return 8;
+        if (a != 255)
+            opaque = false;
+    }
+    return opaque ? 0 : 1;
+}
+
+} // namespace
+
+bool BLPEncodeDirect(const BLPRateLevel* levels, int32 count, bool hasAlpha, BLPDirectResult& result,
+                     const BLPCancel* cancel)
+{
+    if (count < 1 || count > kBLPMaxMips)
+        return false;
+
+    BLPTraceZone zone("palettize");
+    try {
+        const BLPRateLevel& mip0 = levels[0];
+        size_t pixels0 = (size_t)mip0.width * mip0.height;
+        Entry palette[kBLPPaletteColors];
+        ExactColors* exact = new ExactColors();
+        std::vector<uint16> cellMap;
+
+        for (size_t i = 0; i < pixels0; i++)
+            exact->Add(ColorOf(mip0.pixels + i * 4));
+
+        if (!exact->Overflow()) {
+            result.colors = exact->Count();
+            for (int32 e = 0; e < result.colors; e++) {
+                uint32 color = exact->Color(e);
+                palette[e].rgb[0] = (int32)(color >> 16);
+                palette[e].rgb[1] = (int32)((color >> 8) & 0xFF);
+                palette[e].rgb[2] = (int32)(color & 0xFF);
+            }
+        } else {
+            std::vector<double> sums((size_t)kCells * 3);
+            std::vector<uint32> counts(kCells);
+            for (size_t i = 0; i < pixels0; i++) {
+                const uint8* p = mip0.pixels + i * 4;
+                uint32 cell = CellOf(p);
+                counts[cell]++;
+                sums[cell * 3 + 0] += p[0];
+                sums[cell * 3 + 1] += p[1];
+                sums[cell * 3 + 2] += p[2];
+            }
+            std::vector<Bucket> buckets;
+            for (int32 cell = 0; cell < kCells; cell++) {
+                if (counts[cell] == 0)
+                    continue;
+                Bucket bucket;
+                bucket.count = counts[cell];
+                for (int32 c = 0; c < 3; c++)
+                    bucket.mean[c] = sums[cell * 3 + c] / counts[cell];
+                buckets.push_back(bucket);
+            }
+            result.colors = MedianCut(buckets, palette);
+            RefineKMeans(buckets, palette, result.colors);
+        }
+        result.exact = !exact->Overflow();
+
+        memset(result.palette, 0, sizeof(result.palette));
+        for (int32 e = 0; e < result.colors; e++) {
+            result.palette[e * 4 + 0] = (uint8)palette[e].rgb[2];
+            result.palette[e * 4 + 1] = (uint8)palette[e].rgb[1];
+            result.palette[e * 4 + 2] = (uint8)palette[e].rgb[0];
+        }
+
+        result.alphaBits = ChooseAlphaBits(mip0, hasAlpha);
+        result.bytes = sizeof(result.palette);
+        cellMap.assign(kCells, kUnmapped);
+
+        for (int32 l = 0; l < count; l++) {
+            if (BLPCancelled(cancel)) {
+                delete exact;
+                return false;
+            }
+            const BLPRateLevel& level = levels[l];
+            size_t pixels = (size_t)level.width * level.height;
+            size_t alphaBytes = (pixels * result.alphaBits + 7) / 8;
+            std::vector<uint8>& out = result.levels[l];
+            out.assign(pixels + alphaBytes, 0);
+
+            uint8* alpha = &out[0] + pixels;
+            for (size_t i = 0; i < pixels; i++) {
+                const uint8* p = level.pixels + i * 4;
+                uint16 entry = result.exact ? exact->Lookup(ColorOf(p)) : kUnmapped;
+                if (entry == kUnmapped) {
+                    uint32 cell = CellOf(p);
+                    if (cellMap[cell] == kUnmapped) {
+                        const int32 shift = 8 - kCellBits;
+                        const double center = (1 << shift) / 2.0 - 0.5;
+                        cellMap[cell] = (uint16)Nearest(palette, result.colors,
+                            (p[0] >> shift << shift) + center,
+                            (p[1] >> shift << shift) + center,
+                            (p[2] >> shift << shift) + center);
+                    }
+                    entry = cellMap[cell];
+                }
+                out[i] = (uint8)entry;
+
+                if (result.alphaBits == 8)
+                    alpha[i] = p[3];
+                else if (result.alphaBits == 1 && p[3] >= 128)
+                    alpha[i / 8] |= (uint8)(1 << (i % 8));
+            }
+            result.bytes += (uint32)out.size();
+        }
+        delete exact;
+
+        // Score the levels as a reader will see them.
+        result.ssim = 1.0;
+        std::vector<uint8> stored(pixels0 * 4);
+        for (int32 l = 0; l < count; l++) {
+            if (BLPCancelled(cancel))
+                return false;
+            const BLPRateLevel& level = levels[l];
+            size_t pixels = (size_t)level.width * level.height;
+            const uint8* indices = &result.levels[l][0];
+            const uint8* alpha = indices + pixels;
+            for (size_t i = 0; i < pixels; i++) {
+                const uint8* entry = &result.palette[indices[i] * 4];
+                stored[i * 4 + 0] = entry[2];
+                stored[i * 4 + 1] = entry[1];
+                stored[i * 4 + 2] = entry[0];
+                if (result.alphaBits == 8)
+                    stored[i * 4 + 3] = alpha[i];
+                else if (result.alphaBits == 1)
+                    stored[i * 4 + 3] = (alpha[i / 8] & (1 << (i % 8))) ? 255 : 0;
+                else
+                    stored[i * 4 + 3] = level.pixels[i * 4 + 3];
+            }
+            double ssim = BLPSsim(level.pixels, &stored[0], level.width, level.height, 4, hasAlpha ? 4 : 3,
+                                  cancel);
+            if (BLPCancelled(cancel))
+                return false;
+            if (ssim < result.ssim)
+                result.ssim = ssim;
+        }
+    } catch (const std::bad_alloc&) {
+        return false;
+    }
+    return true;
+}
+
+// end BLPPalette.cpp
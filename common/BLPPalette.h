@@ -0,0 +1,47 @@
+//-------------------------------------------------------------------------------
+//
+//	File:
+//		BLPPalette.h
+//
+//	Description:
+//		Palettized (Direct) encoding of BLP1 mip levels.
+//
+//		An image of at most 256 colors keeps them exactly. Otherwise the
+//		palette comes from a median cut of mip 0's colors, counted in
+//		6-bit-per-channel cells, refined by a few k-means passes. Pixels
+//		are mapped to the nearest entry without dithering, which would
+//		only add noise to the lower levels.
+//
+//		Alpha is stored with as few bits as mip 0 needs: none when it is
+//		opaque, 1 bit when it is only 0 or 255 (lower levels are then cut
+//		at 128), else 8 bits.
+//
+//-------------------------------------------------------------------------------
+
+#ifndef __BLPPalette_H__
+#define __BLPPalette_H__
+
+#include "BLPFile.h"
+#include "BLPRateControl.h"
+#include <vector>
+
+const int32 kBLPPaletteColors = 256;
+
+typedef struct BLPDirectResult
+{
+    uint8 palette[kBLPPaletteColors * 4];   // B, G, R, 0 per entry, as in the file
+    int32 colors;                           // entries in use
+    bool exact;                             // mip 0 kept all of its colors
+    uint32 alphaBits;                       // 0, 1 or 8
+    double ssim;                            // lowest of the levels as stored (BLPMetrics.h)
+    uint32 bytes;                           // palette plus levels
+    std::vector<uint8> levels[kBLPMaxMips]; // indices, then alpha, of each level
+} BLPDirectResult;
+
+// Palettizes the count levels (RGBA, from mip 0 down). hasAlpha says
+// whether the alpha channel is stored. cancel, which may be NULL, is
+// polled between levels. Returns false if out of memory or cancelled.
+bool BLPEncodeDirect(const BLPRateLevel* levels, int32 count, bool hasAlpha, BLPDirectResult& result,
+                     const BLPCancel* cancel = NULL);
+
+#endif // __BLPPalette_H__
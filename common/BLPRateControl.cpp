@@ -0,0 +1,434 @@
+//-------------------------------------------------------------------------------
+//
+//	File:
+//		BLPRateControl.cpp
+//
+//	Description:
+//		Trial-encode quality search. See BLPRateControl.h.
+//
+//		Each trial has its own libjpeg objects and buffers, so trials run
+//		as tasks of the caller's pool (BLPTaskPool.h) with nothing shared
+//		but the source pixels. A trial dropped by a cancelled group fails.
+//		The search assumes size and SSIM grow with quality; where they do
+//		not, it still returns a quality that meets the target.
+//
+//-------------------------------------------------------------------------------
+
+#include "BLPRateControl.h"
+#include "BLPCodec.h"
+#include "BLPMetrics.h"
+#include "BLPTrace.h"
+#include <cstdio>
+#include <new>
+
+extern "C" {
+#include "../ThirdParty/jpeg/include/jpeglib.h"
+}
+
+namespace {
+
+const int32 kMinQuality = 1;
+const int32 kMaxQuality = 100;
+
+// A in the B, G, R, A components.
+const int kAlphaComponent = 3;
+
+// Searches over fewer pixels than this take less time than handing trials
+// to other threads, and run one trial at a time.
+const int64 kParallelPixels = 256 * 256;
+
+// Decodes a level encoded by BLPEncodeJpegLevel back to RGBA.
+bool DecodeLevel(const std::vector<uint8>& jpeg, const BLPRateLevel& level, std::vector<uint8>& rgba,
+                 const BLPCancel* cancel)
+{
+    BLPJpegLevelInfo info;
+    return BLPDecodeJpegLevel(&jpeg[0], jpeg.size(), level.width, level.height, 0, &rgba[0], &info, cancel) &&
+           info.width == level.width && info.height == level.height && info.components == 4;
+}
+
+// One trial: a quality, the levels encoded at it and how they scored.
+typedef struct Trial
+{
+    int32 quality;
+    bool ok;                                // encoded (and decoded) without error
+    bool meets;                             // reached the target
+    uint32 bytes;
+    double ssim;
+    std::vector<uint8> levels[kBLPMaxMips];
+} Trial;
+
+typedef struct Search
+{
+    const BLPRateLevel* levels;
+    int32 first;                            // levels first..first+count-1 are encoded
+    int32 count;
+    int32 channels;                         // SSIM channels
+    BLPEncodeSettings settings;
+    BLPRateTarget target;
+    uint32 fixedBytes;
+    BLPCancel cancel;                       // of the caller's group
+} Search;
+
+void RunTrial(const Search& search, Trial& trial)
+{
+    BLPTraceZone zone("rate trial");
+    BLPEncodeSettings settings = search.settings;
+    settings.quality = trial.quality;
+    if (settings.alphaQuality > 0) {
+        int32 alphaQuality = search.settings.alphaQuality + trial.quality - search.settings.quality;
+        settings.alphaQuality = alphaQuality < kMinQuality ? kMinQuality
+                              : alphaQuality > kMaxQuality ? kMaxQuality : alphaQuality;
+    }
+    trial.ok = true;
+    trial.bytes = search.fixedBytes;
+    trial.ssim = 1.0;
+
+    try {
+        std::vector<uint8> decoded;
+        for (int32 i = 0; trial.ok && i < search.count; i++) {
+            int32 index = search.first + i;
+            const BLPRateLevel& level = search.levels[index];
+            trial.ok = !BLPCancelled(&search.cancel) &&
+                       BLPEncodeJpegLevel(level.pixels, level.width, level.height, settings,
+                                          trial.levels[index], &search.cancel);
+            trial.bytes += (uint32)trial.levels[index].size();
+            if (trial.ok && search.target.mode == BLP_RATE_MIN_SSIM) {
+                decoded.resize((size_t)level.width * level.height * 4);
+                trial.ok = DecodeLevel(trial.levels[index], level, decoded, &search.cancel);
+                if (!trial.ok)
+                    break;
+                double ssim = BLPSsim(level.pixels, &decoded[0], level.width, level.height, 4, search.channels,
+                                      &search.cancel);
+                if (ssim < trial.ssim)
+                    trial.ssim = ssim;
+                trial.ok = !BLPCancelled(&search.cancel);
+            }
+        }
+    } catch (const std::bad_alloc&) {
+        trial.ok = false;
+    }
+
+    if (search.target.mode == BLP_RATE_FIXED)
+        trial.meets = true;
+    else if (search.target.mode == BLP_RATE_MAX_BYTES)
+        trial.meets = trial.bytes <= search.target.maxBytes;
+    else
+        trial.meets = trial.ssim >= search.target.minSsim;
+}
+
+// A trial as a task: Trials::trials[index] over Trials::searches[index],
+// or over Trials::search if there is one search for all.
+typedef struct Trials
+{
+    const Search* search;
+    const Search* searches;
+    Trial* trials;
+} Trials;
+
+void RunTrialTask(void* context, int32 index)
+{
+    Trials* job = static_cast<Trials*>(context);
+    RunTrial(job->search != NULL ? *job->search : job->searches[index], job->trials[index]);
+}
+
+// Runs the count trials of job in a group of parent, on its pool unless
+// the search is too small to split, and waits for them.
+void RunTrials(Trials& job, size_t count, BLPTaskGroup& parent, bool parallel)
+{
+    BLPTaskGroup group(parallel ? parent.Pool() : NULL, &parent);
+    for (size_t i = 0; i < count; i++) {
+        job.trials[i].ok = false;
+        group.Run(RunTrialTask, &job, (int32)i);
+    }
+    group.Wait();
+}
+
+// Finds the quality that reaches the target, highest for MAX_BYTES and
+// lowest for MIN_SSIM, over the levels of search. best gets that trial,
+// or, if no quality reaches the target, the one at the end of the range
+// closest to it. Returns false if a trial failed.
+bool FindQuality(const Search& search, BLPTaskGroup& parent, bool parallel, Trial& best, int32& trialCount)
+{
+    const int32 threads = parallel ? parent.Concurrency() : 1;
+    const bool wantHighest = search.target.mode == BLP_RATE_MAX_BYTES;
+    int32 lo = kMinQuality;
+    int32 hi = kMaxQuality;
+    bool found = false;
+
+    while (lo <= hi) {
+        // k evenly spaced qualities split [lo, hi] into k + 1 parts.
+        int32 span = hi - lo + 1;
+        int32 k = threads < span ? threads : span;
+        std::vector<Trial> trials(k);
+        for (int32 i = 0; i < k; i++)
+            trials[i].quality = k == span ? lo + i : lo + (int32)((int64)(i + 1) * span / (k + 1));
+        Trials job = { &search, NULL, &trials[0] };
+        RunTrials(job, trials.size(), parent, parallel);
+        trialCount += k;
+
+        // The qualities that meet the target are a prefix of the trials
+        // (MAX_BYTES) or a suffix (MIN_SSIM).
+        int32 newLo = lo;
+        int32 newHi = hi;
+        for (int32 i = 0; i < k; i++) {
+            Trial& trial = trials[i];
+            if (!trial.ok)
+                return false;
+            if (trial.meets == wantHighest) {
+                if (trial.quality + 1 > newLo)
+                    newLo = trial.quality + 1;
+            } else if (trial.quality - 1 < newHi) {
+                newHi = trial.quality - 1;
+            }
+            if (trial.meets && (!found || (wantHighest ? trial.quality > best.quality
+                                                       : trial.quality < best.quality))) {
+                found = true;
+                best.quality = trial.quality;
+                best.bytes = trial.bytes;
+                best.ssim = trial.ssim;
+                best.meets = true;
+                for (int32 l = 0; l < kBLPMaxMips; l++)
+                    best.levels[l].swap(trial.levels[l]);
+            }
+        }
+        lo = newLo;
+        hi = newHi;
+    }
+
+    if (!found) {
+        std::vector<Trial> fallback(1);
+        fallback[0].quality = wantHighest ? kMinQuality : kMaxQuality;
+        Trials job = { &search, NULL, &fallback[0] };
+        RunTrials(job, fallback.size(), parent, false);
+        trialCount++;
+        if (!fallback[0].ok)
+            return false;
+        best.quality = fallback[0].quality;
+        best.bytes = fallback[0].bytes;
+        best.ssim = fallback[0].ssim;
+        best.meets = false;
+        for (int32 l = 0; l < kBLPMaxMips; l++)
+            best.levels[l].swap(fallback[0].levels[l]);
+    }
+    return true;
+}
+
+} // namespace
+
+BLPEncodeSettings BLPProfileSettings(BLPEncodeProfile profile)
+{
+    BLPEncodeSettings settings;
+    settings.quality = kBLPDefaultQuality;
+    settings.alphaQuality = 0;
+    settings.alphaSampling = 1;
+    settings.trellis = false;
+    settings.dctMethod = BLP_DCT_ISLOW;
+    settings.optimizeCoding = false;
+
+    switch (profile) {
+        case BLP_PROFILE_DIFFUSE:
+            settings.alphaQuality = 70;
+            settings.alphaSampling = 2;
+            break;
+        case BLP_PROFILE_MASK:
+            settings.quality = 75;
+            settings.alphaQuality = 92;
+            break;
+        case BLP_PROFILE_NORMAL:
+            settings.quality = 92;
+            settings.alphaQuality = 70;
+            settings.alphaSampling = 2;
+            break;
+        default:
+            break;
+    }
+    return settings;
+}
+
+void BLPApplyPreset(BLPEncodePreset preset, BLPEncodeSettings& settings)
+{
+    settings.dctMethod = BLP_DCT_ISLOW;
+    settings.optimizeCoding = false;
+    settings.trellis = false;
+
+    switch (preset) {
+        case BLP_PRESET_BALANCED:
+            settings.optimizeCoding = true;
+            break;
+        case BLP_PRESET_MAX_COMPRESSION:
+            settings.optimizeCoding = true;
+            settings.trellis = true;
+            break;
+        default:
+            break;
+    }
+}
+
+void BLPSetupEncoder(struct jpeg_compress_struct* cinfo, const BLPEncodeSettings& settings)
+{
+    // One scan per component, each sequential over all coefficients.
+    static const jpeg_scan_info kComponentScans[kAlphaComponent + 1] = {
+        { 1, { 0 }, 0, DCTSIZE2 - 1, 0, 0 },
+        { 1, { 1 }, 0, DCTSIZE2 - 1, 0, 0 },
+        { 1, { 2 }, 0, DCTSIZE2 - 1, 0, 0 },
+        { 1, { 3 }, 0, DCTSIZE2 - 1, 0, 0 }
+    };
+
+    cinfo->input_components = kAlphaComponent + 1;
+    cinfo->in_color_space = JCS_CMYK;
+    jpeg_set_defaults(cinfo);
+
+    if (settings.alphaQuality > 0) {
+        // jpeg_set_quality fills slot 0 with the luminance table; keep the
+        // alpha one before the color quality replaces it.
+        unsigned int alphaTable[DCTSIZE2];
+        jpeg_set_quality(cinfo, settings.alphaQuality, TRUE);
+        for (int k = 0; k < DCTSIZE2; k++)
+            alphaTable[k] = cinfo->quant_tbl_ptrs[0]->quantval[k];
+        jpeg_set_quality(cinfo, settings.quality, TRUE);
+        jpeg_add_quant_table(cinfo, 1, alphaTable, 100, TRUE);
+        cinfo->comp_info[kAlphaComponent].quant_tbl_no = 1;
+    } else {
+        jpeg_set_quality(cinfo, settings.quality, TRUE);
+    }
+
+    if (settings.alphaSampling == 2) {
+        for (int c = 0; c < kAlphaComponent; c++) {
+            cinfo->comp_info[c].h_samp_factor = 2;
+            cinfo->comp_info[c].v_samp_factor = 2;
+        }
+        cinfo->scan_info = kComponentScans;
+        cinfo->num_scans = kAlphaComponent + 1;
+    }
+
+    switch (settings.dctMethod) {
+        case BLP_DCT_IFAST:
+            cinfo->dct_method = JDCT_IFAST;
+            break;
+        case BLP_DCT_FLOAT:
+            cinfo->dct_method = JDCT_FLOAT;
+            break;
+        default:
+            cinfo->dct_method = JDCT_ISLOW;
+            break;
+    }
+
+    // Trellis quantization counts bits with the Huffman tables, so the
+    // tables are then fitted to what it chose.
+    cinfo->trellis_quant = settings.trellis ? TRUE : FALSE;
+    cinfo->optimize_coding = settings.optimizeCoding || settings.trellis ? TRUE : FALSE;
+
+    // Disable JFIF and Adobe markers to match BLP format (Raw JPEG)
+    cinfo->write_JFIF_header = FALSE;
+    cinfo->write_Adobe_marker = FALSE;
+}
+
+bool BLPRateControl(const BLPRateLevel* levels, int32 count, bool hasAlpha,
+                    const BLPEncodeSettings& settings, const BLPRateTarget& target,
+                    uint32 fixedBytes, BLPTaskGroup& group, BLPRateResult& result)
+{
+    if (count < 1 || count > kBLPMaxMips)
+        return false;
+
+    Search search;
+    search.levels = levels;
+    search.channels = hasAlpha ? 4 : 3;
+    search.settings = settings;
+    search.target = target;
+    search.fixedBytes = 0;
+    search.cancel = group.Cancellation();
+
+    result.met = true;
+    result.trials = 0;
+    result.bytes = fixedBytes;
+    for (int32 l = 0; l < kBLPMaxMips; l++) {
+        result.quality[l] = 0;
+        result.ssim[l] = 0;
+        result.levels[l].clear();
+    }
+
+    try {
+        if (target.mode == BLP_RATE_FIXED) {
+            // One trial per level at the one quality, the levels at once.
+            std::vector<Search> searches(count, search);
+            std::vector<Trial> trials(count);
+            int64 pixels = 0;
+            for (int32 l = 0; l < count; l++) {
+                searches[l].first = l;
+                searches[l].count = 1;
+                trials[l].quality = settings.quality;
+                pixels += (int64)levels[l].width * levels[l].height;
+            }
+            Trials job = { NULL, &searches[0], &trials[0] };
+            RunTrials(job, trials.size(), group, pixels >= kParallelPixels);
+            group.Advance(pixels);
+            for (int32 l = 0; l < count; l++) {
+                if (!trials[l].ok)
+                    return false;
+                result.trials++;
+                result.quality[l] = settings.quality;
+                result.bytes += (uint32)trials[l].levels[l].size();
+                result.levels[l].swap(trials[l].levels[l]);
+            }
+            return true;
+        }
+
+        // The budget is for the file, so all levels are searched together;
+        // an SSIM floor holds per level, so each level is searched alone.
+        int32 searches = target.mode == BLP_RATE_MAX_BYTES ? 1 : count;
+        for (int32 s = 0; s < searches; s++) {
+            search.first = target.mode == BLP_RATE_MAX_BYTES ? 0 : s;
+            search.count = target.mode == BLP_RATE_MAX_BYTES ? count : 1;
+            search.fixedBytes = target.mode == BLP_RATE_MAX_BYTES ? fixedBytes : 0;
+
+            int64 pixels = 0;
+            for (int32 i = 0; i < search.count; i++)
+                pixels += (int64)levels[search.first + i].width * levels[search.first + i].height;
+
+            Trial best;
+            if (!FindQuality(search, group, pixels >= kParallelPixels, best, result.trials))
+                return false;
+            group.Advance(pixels);
+            result.met = result.met && best.meets;
+            for (int32 i = 0; i < search.count; i++) {
+                int32 index = search.first + i;
+                result.quality[index] = best.quality;
+                if (target.mode == BLP_RATE_MIN_SSIM)
+                    result.ssim[index] = best.ssim;
+                result.bytes += (uint32)best.levels[index].size();
+                result.levels[index].swap(best.levels[index]);
+            }
+        }
+    } catch (const std::bad_alloc&) {
+        return false;
+    }
+    return true;
+}
+
+bool BLPMeasureSsim(const BLPRateLevel* levels, int32 count, bool hasAlpha, BLPRateResult& result,
+                    const BLPCancel* cancel)
+{
+    if (count < 1 || count > kBLPMaxMips)
+        return false;
+
+    try {
+        std::vector<uint8> decoded;
+        for (int32 l = 0; l < count; l++) {
+            const BLPRateLevel& level = levels[l];
+            if (result.levels[l].empty())
+                return false;
+            decoded.resize((size_t)level.width * level.height * 4);
+            if (BLPCancelled(cancel) || !DecodeLevel(result.levels[l], level, decoded, cancel))
+                return false;
+            result.ssim[l] = BLPSsim(level.pixels, &decoded[0], level.width, level.height, 4, hasAlpha ? 4 : 3,
+                                     cancel);
+            if (BLPCancelled(cancel))
+                return false;
+        }
+    } catch (const std::bad_alloc&) {
+        return false;
+    }
+    return true;
+}
+
+// end BLPRateControl.cpp
@@ -0,0 +1,149 @@
+//-------------------------------------------------------------------------------
+//
+//	File:
+//		BLPRateControl.h
+//
+//	Description:
+//		Rate control for JPEG-compressed BLPs: picks the JPEG quality of
+//		each mip level from a byte budget for the whole file or from a
+//		least SSIM for every level, instead of the fixed quality.
+//
+//		The quality is searched with trial encodes, several at once: each
+//		round encodes as many evenly spaced qualities as there are threads
+//		and keeps the part of the range where the target is crossed, a
+//		binary search widened to k+1 ways. The trials use the plug-in's
+//		encoder settings (BLPSetupEncoder), so a trial is exactly the level
+//		it stands for, and the winning trials are returned to be written as
+//		they are. The quality searched is the color one; a separate alpha
+//		quality keeps its distance from it in every trial.
+//
+//		FIXED encodes every level once at the settings' quality, the levels
+//		as tasks of their own.
+//		MAX_BYTES gives every level the same quality: the highest one at
+//		which the file, all levels encoded in full, fits the budget.
+//		MIN_SSIM searches every level on its own for the lowest quality
+//		whose decoded pixels reach the SSIM (BLPMetrics.h), which gives the
+//		smallest file at that SSIM.
+//
+//-------------------------------------------------------------------------------
+
+#ifndef __BLPRateControl_H__
+#define __BLPRateControl_H__
+
+#include "BLPFile.h"
+#include "BLPTaskPool.h"
+#include <vector>
+
+struct jpeg_compress_struct;
+
+// libjpeg's forward DCTs (J_DCT_METHOD).
+enum BLPDctMethod {
+    BLP_DCT_ISLOW = 1,      // accurate integer, libjpeg's default
+    BLP_DCT_IFAST,          // faster integer, a little less accurate
+    BLP_DCT_FLOAT           // floating point; no trellis quantization
+};
+
+// The choices that decide the bytes of a level.
+typedef struct BLPEncodeSettings
+{
+    int32 quality;          // 1..100, baseline tables, for B, G and R
+    int32 alphaQuality;     // 1..100 for A on a table of its own, 0 to share the color table
+    int32 alphaSampling;    // 1, or 2 to store A at half width and height
+    bool trellis;           // trellis quantization with optimized Huffman tables (jcdctmgr.c)
+    int32 dctMethod;        // BLPDctMethod
+    bool optimizeCoding;    // Huffman tables fitted to each level, always with trellis
+} BLPEncodeSettings;
+
+const int32 kBLPDefaultQuality = 85;
+
+// Preset settings for kinds of texture content.
+enum BLPEncodeProfile {
+    BLP_PROFILE_STANDARD = 0,   // every component alike, as files were always written
+    BLP_PROFILE_DIFFUSE,        // color first; alpha, usually a soft cutout, coarser and at half size
+    BLP_PROFILE_MASK,           // the alpha mask is the content: kept full size and finer than color
+    BLP_PROFILE_NORMAL,         // B, G, R are a vector, so finer color; alpha coarser and at half size
+    BLP_PROFILE_COUNT
+};
+
+// The settings of profile.
+BLPEncodeSettings BLPProfileSettings(BLPEncodeProfile profile);
+
+// Trade-offs of encoding time against file size, independent of the
+// profile: they leave the qualities and sampling alone. NONE is already
+// libjpeg's quickest path (its SIMD DCT is the accurate one), so there is
+// no faster preset; 1, once one that was no faster, is not a preset.
+// BALANCED only changes the Huffman coding, so it decodes to the same
+// pixels as NONE. MAX_COMPRESSION also quantizes with trellis, which
+// changes them: at the same quality it gives a smaller file at a lower
+// PSNR, still smaller than a lower quality of the same PSNR.
+enum BLPEncodePreset {
+    BLP_PRESET_NONE = 0,            // the profile's: accurate DCT, default Huffman tables
+    BLP_PRESET_BALANCED = 2,        // accurate DCT, optimized Huffman tables
+    BLP_PRESET_MAX_COMPRESSION,     // balanced plus trellis quantization, for shipping builds
+    BLP_PRESET_COUNT
+};
+
+// Sets the DCT method, Huffman optimization and trellis of settings to
+// those of preset.
+void BLPApplyPreset(BLPEncodePreset preset, BLPEncodeSettings& settings);
+
+// Sets up cinfo, already created, for levels as the plug-in holds them:
+// RGBA pixels go in as 4-component CMYK in B, G, R, A order, with no JFIF
+// or Adobe marker. The image size is left to the caller.
+//
+// B, G and R all use the luminance table scaled to quality. With its own
+// alphaQuality, A gets the luminance table scaled to that in slot 1. A
+// half-size A makes the MCU 16x16, too many blocks for one interleaved
+// scan, so then each component has a scan of its own. trellis turns on
+// trellis quantization, which optimizes the Huffman tables with it.
+// A float DCT is quantized plainly, even with trellis.
+void BLPSetupEncoder(struct jpeg_compress_struct* cinfo, const BLPEncodeSettings& settings);
+
+enum BLPRateMode {
+    BLP_RATE_FIXED = 0,     // settings.quality for every level
+    BLP_RATE_MAX_BYTES,     // highest quality within maxBytes
+    BLP_RATE_MIN_SSIM       // lowest quality per level with at least minSsim
+};
+
+typedef struct BLPRateTarget
+{
+    BLPRateMode mode;
+    uint32 maxBytes;        // whole file, fixedBytes included
+    double minSsim;         // 0..1
+} BLPRateTarget;
+
+// One mip level: width x height RGBA pixels.
+typedef struct BLPRateLevel
+{
+    const uint8* pixels;
+    int32 width;
+    int32 height;
+} BLPRateLevel;
+
+typedef struct BLPRateResult
+{
+    bool met;                               // false if even the extreme quality missed
+    int32 trials;                           // trial encodes run
+    uint32 bytes;                           // file size: levels plus fixedBytes
+    int32 quality[kBLPMaxMips];
+    double ssim[kBLPMaxMips];               // of each level as encoded (MIN_SSIM or BLPMeasureSsim)
+    std::vector<uint8> levels[kBLPMaxMips]; // complete JPEG stream of each level
+} BLPRateResult;
+
+// Encodes the count levels for target. fixedBytes
+// is what the file holds besides the levels (header, padding); hasAlpha
+// says whether SSIM counts the alpha channel. The trials run in groups of
+// group, as many at once as its pool has workers, and advance it by the
+// pixels of each level as it is settled. Returns false if out of memory,
+// libjpeg failed or group was cancelled.
+bool BLPRateControl(const BLPRateLevel* levels, int32 count, bool hasAlpha,
+                    const BLPEncodeSettings& settings, const BLPRateTarget& target,
+                    uint32 fixedBytes, BLPTaskGroup& group, BLPRateResult& result);
+
+// Fills result.ssim from the levels of result as they decode, for a
+// result whose target did not score them. Returns false on error or if
+// cancel (may be NULL) fired.
+bool BLPMeasureSsim(const BLPRateLevel* levels, int32 count, bool hasAlpha, BLPRateResult& result,
+                    const BLPCancel* cancel = NULL);
+
+#endif // __BLPRateControl_H__
@@ -0,0 +1,254 @@
+//-------------------------------------------------------------------------------
+//
+//	File:
+//		BLPReader.cpp
+//
+//	Description:
+//		Reading of BLP1 files through a callback. See BLPReader.h.
+//
+//		Open checks every number the header gives before another method
+//		uses it to seek or to size a buffer: the image is not empty and
+//		not beyond kBLPMaxPixels, each level starts past the header and
+//		ends within 32 bits, and no level claims more bytes than an
+//		encoder could make of mip 0.
+//
+//-------------------------------------------------------------------------------
+
+#include "BLPReader.h"
+#include <cstring>
+#include <new>
+
+namespace {
+
+// Beyond any shared header an encoder writes, which is a few kilobytes of
+// tables.
+const uint32 kMaxJpegHeader = 1u << 20;
+
+// Slack over the RGBA bytes of mip 0 that a level may take: JPEG markers
+// of a tiny level, or a Direct level with padding.
+const uint64 kLevelSlack = 1u << 16;
+
+// The bytes DirectAlphaAllZero reads at a time.
+const uint32 kAlphaChunk = 64 * 1024;
+
+// The pixels DecodeDirect expands between polls of a BLPCancel; a multiple
+// of 8, so every piece of packed alpha starts on a byte.
+const size_t kExpandChunk = 1024 * 1024;
+
+} // namespace
+
+BLPReader::BLPReader(BLPReadProc inRead, void* inContext)
+    : read(inRead), context(inContext), jpegHeaderSize(0), levels(0)
+{
+    memset(&header, 0, sizeof(header));
+    memset(spans, 0, sizeof(spans));
+}
+
+BLPReaderError BLPReader::Open(void)
+{
+    levels = 0;
+    jpegHeaderSize = 0;
+    if (!read(context, 0, &header, sizeof(header)))
+        return BLP_READER_IO;
+    if (!BLPCheckHeader(header))
+        return BLP_READER_NOT_BLP;
+
+    if (header.Width == 0 || header.Height == 0 ||
+        (uint64)header.Width * header.Height > kBLPMaxPixels)
+        return BLP_READER_CORRUPT;
+
+    uint32 dataStart = sizeof(BLP_HEADER);
+    if (Direct()) {
+        uint32 bits = header.alpha_bits;
+        if (bits != 0 && bits != 1 && bits != 4 && bits != 8)
+            return BLP_READER_CORRUPT;
+    } else {
+        if (!read(context, sizeof(BLP_HEADER), &jpegHeaderSize, 4))
+            return BLP_READER_IO;
+        if (jpegHeaderSize > kMaxJpegHeader)
+            return BLP_READER_CORRUPT;
+        dataStart += 4;
+    }
+
+    const uint64 maxLevelBytes = (uint64)header.Width * header.Height * 4 + kLevelSlack;
+    const int32 maxLevels = BLPMipLevelCount((int32)header.Width, (int32)header.Height);
+    int32 width = (int32)header.Width;
+    int32 height = (int32)header.Height;
+    while (levels < maxLevels && header.Size[levels] != 0) {
+        const uint32 offset = header.Offset[levels];
+        const uint32 size = header.Size[levels];
+        if (offset < dataStart || size > maxLevelBytes || (uint64)offset + size > 0xFFFFFFFFull)
+            return BLP_READER_CORRUPT;
+        BLPMipSpan& span = spans[levels++];
+        span.offset = offset;
+        span.size = size;
+        span.width = width;
+        span.height = height;
+        width = width / 2 > 0 ? width / 2 : 1;
+        height = height / 2 > 0 ? height / 2 : 1;
+    }
+    if (levels == 0)
+        return BLP_READER_CORRUPT;
+    return BLP_READER_OK;
+}
+
+int32 BLPReader::PaletteEntries(void) const
+{
+    if (!Direct())
+        return 0;
+    int32 entries = (int32)((header.Offset[0] - sizeof(BLP_HEADER)) / 4);
+    return entries > 256 ? 256 : entries;
+}
+
+BLPReaderError BLPReader::ReadPalette(uint8* palette)
+{
+    memset(palette, 0, 256 * 4);
+    uint32 bytes = (uint32)PaletteEntries() * 4;
+    if (bytes != 0 && !read(context, sizeof(BLP_HEADER), palette, bytes))
+        return BLP_READER_IO;
+    return BLP_READER_OK;
+}
+
+BLPReaderError BLPReader::ReadLevel(int32 level, uint8* bytes)
+{
+    const BLPMipSpan& span = spans[level];
+    if (!read(context, span.offset, bytes, span.size))
+        return BLP_READER_IO;
+    return BLP_READER_OK;
+}
+
+BLPReaderError BLPReader::ReadJpegStream(int32 level, BLPByteBuffer& stream)
+{
+    if (Direct())
+        return BLP_READER_NOT_BLP;
+    const BLPMipSpan& span = spans[level];
+    try {
+        stream.resize((size_t)jpegHeaderSize + span.size);
+    } catch (const std::bad_alloc&) {
+        return BLP_READER_NO_MEMORY;
+    }
+    if (jpegHeaderSize != 0 && !read(context, sizeof(BLP_HEADER) + 4, stream.data(), jpegHeaderSize))
+        return BLP_READER_IO;
+    if (!read(context, span.offset, stream.data() + jpegHeaderSize, span.size))
+        return BLP_READER_IO;
+    return BLP_READER_OK;
+}
+
+uint64 BLPReader::DirectLevelBytes(int32 level) const
+{
+    const uint64 pixels = (uint64)spans[level].width * spans[level].height;
+    return pixels + (pixels * header.alpha_bits + 7) / 8;
+}
+
+BLPReaderError BLPReader::ReadDirectLevel(int32 level, BLPByteBuffer& bytes)
+{
+    if (!Direct())
+        return BLP_READER_NOT_BLP;
+    const uint64 size = DirectLevelBytes(level);
+    if ((uint64)spans[level].offset + size > 0xFFFFFFFFull)
+        return BLP_READER_CORRUPT;
+    try {
+        bytes.resize((size_t)size);
+    } catch (const std::bad_alloc&) {
+        return BLP_READER_NO_MEMORY;
+    }
+    if (!read(context, spans[level].offset, bytes.data(), (uint32)size))
+        return BLP_READER_IO;
+    return BLP_READER_OK;
+}
+
+BLPReaderError BLPReader::ReadDirectRows(int32 level, int32 firstRow, int32 rows, uint8* indices)
+{
+    if (!Direct())
+        return BLP_READER_NOT_BLP;
+    const BLPMipSpan& span = spans[level];
+    if (firstRow < 0 || rows < 0 || firstRow + (int64)rows > span.height)
+        return BLP_READER_CORRUPT;
+    const uint64 offset = (uint64)span.offset + (uint64)firstRow * span.width;
+    const uint64 size = (uint64)rows * span.width;
+    if (offset + size > 0xFFFFFFFFull)
+        return BLP_READER_CORRUPT;
+    if (size != 0 && !read(context, (uint32)offset, indices, (uint32)size))
+        return BLP_READER_IO;
+    return BLP_READER_OK;
+}
+
+BLPReaderError BLPReader::DirectAlphaAllZero(bool& allZero, const BLPCancel* cancel)
+{
+    allZero = true;
+    if (!Direct() || header.alpha_bits == 0)
+        return BLP_READER_OK;
+
+    // The alpha follows the indices.
+    const uint64 pixels = (uint64)header.Width * header.Height;
+    uint64 remaining = DirectLevelBytes(0) - pixels;
+    uint64 offset = (uint64)spans[0].offset + pixels;
+    if (offset + remaining > 0xFFFFFFFFull)
+        return BLP_READER_CORRUPT;
+
+    BLPByteBuffer buffer;
+    try {
+        buffer.resize(kAlphaChunk);
+    } catch (const std::bad_alloc&) {
+        return BLP_READER_NO_MEMORY;
+    }
+    while (remaining > 0) {
+        if (BLPCancelled(cancel))
+            return BLP_READER_CANCELLED;
+        uint32 chunk = remaining < kAlphaChunk ? (uint32)remaining : kAlphaChunk;
+        if (!read(context, (uint32)offset, buffer.data(), chunk))
+            return BLP_READER_IO;
+        for (uint32 i = 0; i < chunk; i++) {
+            if (buffer[i] != 0) {
+                allZero = false;
+                return BLP_READER_OK;
+            }
+        }
+        offset += chunk;
+        remaining -= chunk;
+    }
+    return BLP_READER_OK;
+}
+
+BLPReaderError BLPReader::DecodeJpeg(const BLPByteBuffer& stream, int32 level, long maxMemory,
+                                     uint8* rgba, BLPJpegLevelInfo* info,
+                                     const BLPCancel* cancel) const
+{
+    const BLPMipSpan& span = spans[level];
+    if (!BLPDecodeJpegLevel(stream.data(), stream.size(), span.width, span.height,
+                            maxMemory, rgba, info, cancel))
+        return BLPCancelled(cancel) ? BLP_READER_CANCELLED : BLP_READER_CORRUPT;
+    return BLP_READER_OK;
+}
+
+BLPReaderError BLPReader::DecodeDirect(const BLPByteBuffer& bytes, const uint8* palette,
+                                       int32 level, uint8* rgba, const BLPCancel* cancel) const
+{
+    if (bytes.size() < DirectLevelBytes(level))
+        return BLP_READER_CORRUPT;
+    const size_t pixels = (size_t)spans[level].width * spans[level].height;
+    const uint8* alpha = header.alpha_bits != 0 ? bytes.data() + pixels : NULL;
+    for (size_t first = 0; first < pixels; first += kExpandChunk) {
+        if (BLPCancelled(cancel))
+            return BLP_READER_CANCELLED;
+        size_t count = pixels - first < kExpandChunk ? pixels - first : kExpandChunk;
+        BLPExpandPalette(bytes.data() + first, alpha != NULL ? alpha + first * header.alpha_bits / 8 : NULL,
+                         header.alpha_bits, palette, count, rgba + first * 4);
+    }
+    return BLP_READER_OK;
+}
+
+const char* BLPReaderErrorString(BLPReaderError error)
+{
+    switch (error) {
+        case BLP_READER_OK:         return "no error";
+        case BLP_READER_IO:         return "file could not be read";
+        case BLP_READER_NOT_BLP:    return "not a BLP1 file";
+        case BLP_READER_CORRUPT:    return "file is damaged";
+        case BLP_READER_NO_MEMORY:  return "out of memory";
+        case BLP_READER_CANCELLED:  return "cancelled";
+        default:                    return "unknown error";
+    }
+}
+
+// end BLPReader.cpp
@@ -0,0 +1,124 @@
+//-------------------------------------------------------------------------------
+//
+//	File:
+//		BLPReader.h
+//
+//	Description:
+//		Reading of BLP1 files through a callback: the header, checked
+//		before anything else is trusted, the table of levels, the palette
+//		and the bytes and pixels of each level.
+//
+//		A BLPReader holds all the state of one file, so any number of them
+//		may run at once on different threads. The methods named Read* go
+//		to the source; Decode* only work on bytes already read. Errors are
+//		returned, never thrown or jumped across the caller.
+//
+//-------------------------------------------------------------------------------
+
+#ifndef __BLPReader_H__
+#define __BLPReader_H__
+
+#include "BLPCodec.h"
+#include "BLPMemStats.h"
+
+enum BLPReaderError {
+    BLP_READER_OK = 0,
+    BLP_READER_IO,                  // the source failed or ended early
+    BLP_READER_NOT_BLP,             // not a BLP1 file of a compression we read
+    BLP_READER_CORRUPT,             // bad sizes or offsets, or libjpeg rejected a level
+    BLP_READER_NO_MEMORY,
+    BLP_READER_CANCELLED            // the BLPCancel passed in fired
+};
+
+// Reads size bytes at offset from the start of the file into buffer.
+// Returns false on an error or a short read.
+typedef bool (*BLPReadProc)(void* context, uint32 offset, void* buffer, uint32 size);
+
+// The images the reader accepts are at most this many pixels, so that an
+// RGBA copy of mip 0 stays below 2 GB.
+const uint32 kBLPMaxPixels = 1u << 28;
+
+// Where a level is in the file.
+typedef struct BLPMipSpan
+{
+    uint32 offset;
+    uint32 size;            // as stored
+    int32 width;
+    int32 height;
+} BLPMipSpan;
+
+class BLPReader {
+  public:
+	BLPReader(BLPReadProc read, void* context);
+
+	/// Reads and checks the header and, for JPEG, the size of the shared
+	/// header. Nothing else works before Open has returned BLP_READER_OK.
+	BLPReaderError Open(void);
+
+	const BLP_HEADER& Header(void) const { return header; }
+	bool Direct(void) const { return header.Compression == BLP_COMPRESSION_DIRECT; }
+	int32 Width(void) const { return (int32)header.Width; }
+	int32 Height(void) const { return (int32)header.Height; }
+
+	/// Levels present from mip 0: those with a size, at most BLPMipLevelCount.
+	int32 Levels(void) const { return levels; }
+	const BLPMipSpan& Level(int32 level) const { return spans[level]; }
+
+	/// Bytes of the JPEG header all levels share, 0 for Direct.
+	uint32 JpegHeaderSize(void) const { return jpegHeaderSize; }
+
+	/// Palette entries a Direct file stores, at most 256.
+	int32 PaletteEntries(void) const;
+
+	/// The palette of a Direct file: 256 B, G, R, 0 entries, 0 past
+	/// PaletteEntries.
+	BLPReaderError ReadPalette(uint8* palette);
+
+	/// The Level(level).size bytes of level as stored, into bytes.
+	BLPReaderError ReadLevel(int32 level, uint8* bytes);
+
+	/// A complete JPEG stream for level: the shared header, then the level.
+	BLPReaderError ReadJpegStream(int32 level, BLPByteBuffer& stream);
+
+	/// The indices and the packed alpha of a Direct level, as many bytes
+	/// as its size and alpha_bits call for.
+	BLPReaderError ReadDirectLevel(int32 level, BLPByteBuffer& bytes);
+
+	/// rows rows of the indices of a Direct level from firstRow on, as
+	/// stored: Level(level).width bytes a row, no palette applied.
+	BLPReaderError ReadDirectRows(int32 level, int32 firstRow, int32 rows, uint8* indices);
+
+	/// Whether the alpha of Direct mip 0 is all 0, read in small pieces
+	/// so the level is not held, cancel polled between them. True without
+	/// alpha.
+	BLPReaderError DirectAlphaAllZero(bool& allZero, const BLPCancel* cancel = NULL);
+
+	/// Decodes a stream from ReadJpegStream into the RGBA pixels of level
+	/// (BLPDecodeJpegLevel), polling cancel. maxMemory is libjpeg's
+	/// max_memory_to_use, 0 for no limit. info and cancel may be NULL.
+	BLPReaderError DecodeJpeg(const BLPByteBuffer& stream, int32 level, long maxMemory,
+	                          uint8* rgba, BLPJpegLevelInfo* info,
+	                          const BLPCancel* cancel = NULL) const;
+
+	/// Expands bytes from ReadDirectLevel with palette into the RGBA
+	/// pixels of level, a piece at a time, polling cancel (may be NULL).
+	BLPReaderError DecodeDirect(const BLPByteBuffer& bytes, const uint8* palette,
+	                            int32 level, uint8* rgba, const BLPCancel* cancel = NULL) const;
+
+  private:
+	BLPReadProc read;
+	void* context;
+	BLP_HEADER header;
+	uint32 jpegHeaderSize;
+	int32 levels;
+	BLPMipSpan spans[kBLPMaxMips];
+
+	uint64 DirectLevelBytes(int32 level) const;
+
+	BLPReader(const BLPReader&);
+	BLPReader& operator=(const BLPReader&);
+};
+
+const char* BLPReaderErrorString(BLPReaderError error);
+
+#endif // __BLPReader_H__
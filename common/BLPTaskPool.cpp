@@ -0,0 +1,305 @@
+//-------------------------------------------------------------------------------
+//
+//	File:
+//		BLPTaskPool.cpp
+//
+//	Description:
+//		The work-stealing pool and its task groups. See BLPTaskPool.h.
+//
+//		Every deque has its own lock, held only to push or pop one task.
+//		Idle workers sleep on one condition variable, woken one at a time
+//		as tasks come in; threads that wait for a group sleep on another,
+//		woken when a group's last task is done.
+//
+//-------------------------------------------------------------------------------
+
+#include "BLPTaskPool.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// How often a thread outside the pool polls the host while it waits.
+const int32 kHostPollMilliseconds = 20;
+
+// How long a worker waiting for a group sleeps before looking for tasks
+// again, in case one came in that another worker did not take.
+const int32 kWorkerPollMilliseconds = 1;
+
+typedef struct TaskQueue
+{
+    std::mutex mutex;
+    std::deque<BLPTaskPool::Task> tasks;
+} TaskQueue;
+
+} // namespace
+
+struct BLPTaskPoolState
+{
+    int32 queueCount;
+    std::unique_ptr<TaskQueue[]> queues;    // one per worker
+    TaskQueue submitted;                    // from threads outside the pool
+    std::vector<std::thread> threads;
+    std::atomic<int32> queued;
+
+    std::mutex sleepMutex;
+    std::condition_variable workAvailable;
+    bool stopping;
+
+    std::mutex finishMutex;
+    std::condition_variable groupFinished;
+
+    static void WorkerMain(BLPTaskPool* pool, int32 index);
+};
+
+namespace {
+
+// The pool and worker the current thread belongs to, if any.
+thread_local const BLPTaskPoolState* tPool = NULL;
+thread_local int32 tWorker = -1;
+
+bool GroupCancelled(void* context)
+{
+    return static_cast<const BLPTaskGroup*>(context)->Cancelled();
+}
+
+bool PopBack(TaskQueue& queue, BLPTaskPool::Task& task)
+{
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty())
+        return false;
+    task = queue.tasks.back();
+    queue.tasks.pop_back();
+    return true;
+}
+
+bool PopFront(TaskQueue& queue, BLPTaskPool::Task& task)
+{
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty())
+        return false;
+    task = queue.tasks.front();
+    queue.tasks.pop_front();
+    return true;
+}
+
+} // namespace
+
+void BLPTaskPoolState::WorkerMain(BLPTaskPool* pool, int32 index)
+{
+    BLPTaskPoolState* state = pool->state;
+    tPool = state;
+    tWorker = index;
+    for (;;) {
+        if (pool->RunOne())
+            continue;
+        std::unique_lock<std::mutex> lock(state->sleepMutex);
+        if (state->stopping)
+            break;
+        if (state->queued.load() == 0)
+            state->workAvailable.wait(lock);
+    }
+}
+
+BLPTaskPool::BLPTaskPool(int32 workers)
+    : state(NULL)
+{
+    if (workers <= 0) {
+        workers = (int32)std::thread::hardware_concurrency();
+        if (workers < 1)
+            workers = 1;
+    }
+
+    state = new (std::nothrow) BLPTaskPoolState;
+    if (state == NULL)
+        return;
+    state->queueCount = workers;
+    state->queues.reset(new (std::nothrow) TaskQueue[workers]);
+    state->queued = 0;
+    state->stopping = false;
+    if (!state->queues) {
+        delete state;
+        state = NULL;
+        return;
+    }
+
+    try {
+        state->threads.reserve((size_t)workers);
+        for (int32 i = 0; i < workers; i++)
+            state->threads.push_back(std::thread(BLPTaskPoolState::WorkerMain, this, i));
+    } catch (const std::system_error&) {
+    } catch (const std::bad_alloc&) {
+    }
+}
+
+BLPTaskPool::~BLPTaskPool()
+{
+    if (state == NULL)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(state->sleepMutex);
+        state->stopping = true;
+    }
+    state->workAvailable.notify_all();
+    for (size_t i = 0; i < state->threads.size(); i++)
+        state->threads[i].join();
+    delete state;
+}
+
+int32 BLPTaskPool::Workers(void) const
+{
+    return state != NULL ? (int32)state->threads.size() : 0;
+}
+
+bool BLPTaskPool::OnWorker(void) const
+{
+    return state != NULL && tPool == state;
+}
+
+bool BLPTaskPool::Submit(const Task& task)
+{
+    if (Workers() == 0)
+        return false;
+    TaskQueue& queue = OnWorker() ? state->queues[tWorker] : state->submitted;
+    try {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(task);
+    } catch (const std::bad_alloc&) {
+        return false;
+    }
+    state->queued++;
+    {
+        // Taken so the increment cannot fall between a worker's check of
+        // queued and its wait.
+        std::lock_guard<std::mutex> lock(state->sleepMutex);
+    }
+    state->workAvailable.notify_one();
+    return true;
+}
+
+bool BLPTaskPool::RunOne(void)
+{
+    // Newest of our own, oldest submitted from outside, oldest of another
+    // worker's.
+    Task task;
+    bool found = PopBack(state->queues[tWorker], task) || PopFront(state->submitted, task);
+    for (int32 i = 1; !found && i < state->queueCount; i++)
+        found = PopFront(state->queues[(tWorker + i) % state->queueCount], task);
+    if (!found)
+        return false;
+    state->queued--;
+    task.group->Execute(task.proc, task.context, task.index);
+    return true;
+}
+
+void BLPTaskPool::Idle(const BLPTaskGroup& group, int32 milliseconds)
+{
+    std::unique_lock<std::mutex> lock(state->finishMutex);
+    if (group.pending.load() != 0)
+        state->groupFinished.wait_for(lock, std::chrono::milliseconds(milliseconds));
+}
+
+void BLPTaskPool::Wake(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(state->finishMutex);
+    }
+    state->groupFinished.notify_all();
+}
+
+BLPTaskGroup::BLPTaskGroup(BLPTaskPool* inPool, BLPTaskGroup* inParent)
+    : pool(inPool), parent(inParent), pending(0), cancelled(false), work(0), done(0)
+{
+}
+
+BLPTaskGroup::~BLPTaskGroup()
+{
+    Wait();
+}
+
+void BLPTaskGroup::Run(BLPTaskProc proc, void* context, int32 index)
+{
+    if (Cancelled())
+        return;
+    pending++;
+    BLPTaskPool::Task task = { proc, context, index, this };
+    if (pool == NULL || !pool->Submit(task))
+        Execute(proc, context, index);
+}
+
+void BLPTaskGroup::Execute(BLPTaskProc proc, void* context, int32 index)
+{
+    if (!Cancelled())
+        proc(context, index);
+    // The group may be gone as soon as pending reaches 0.
+    BLPTaskPool* owner = pool;
+    if (pending.fetch_sub(1) == 1 && owner != NULL && owner->Workers() != 0)
+        owner->Wake();
+}
+
+void BLPTaskGroup::Wait(const BLPTaskHost* host)
+{
+    const bool onWorker = pool != NULL && pool->OnWorker();
+    int64 reported = -1;
+    for (;;) {
+        if (host != NULL) {
+            if (host->aborted != NULL && !Cancelled() && host->aborted(host->context))
+                Cancel();
+            int64 now = done.load();
+            if (host->progress != NULL && now != reported) {
+                host->progress(host->context, now, work.load());
+                reported = now;
+            }
+        }
+        if (pending.load() == 0)
+            break;
+        if (onWorker && pool->RunOne())
+            continue;
+        pool->Idle(*this, onWorker ? kWorkerPollMilliseconds : kHostPollMilliseconds);
+    }
+}
+
+void BLPTaskGroup::Cancel(void)
+{
+    cancelled = true;
+}
+
+bool BLPTaskGroup::Cancelled(void) const
+{
+    return cancelled.load() || (parent != NULL && parent->Cancelled());
+}
+
+BLPCancel BLPTaskGroup::Cancellation(void) const
+{
+    BLPCancel cancel = { GroupCancelled, const_cast<BLPTaskGroup*>(this) };
+    return cancel;
+}
+
+void BLPTaskGroup::AddWork(int64 units)
+{
+    work += units;
+    if (parent != NULL)
+        parent->AddWork(units);
+}
+
+void BLPTaskGroup::Advance(int64 units)
+{
+    done += units;
+    if (parent != NULL)
+        parent->Advance(units);
+}
+
+int32 BLPTaskGroup::Concurrency(void) const
+{
+    int32 workers = pool != NULL ? pool->Workers() : 0;
+    return workers > 1 ? workers : 1;
+}
+
+// end BLPTaskPool.cpp
@@ -0,0 +1,152 @@
+//-------------------------------------------------------------------------------
+//
+//	File:
+//		BLPTaskPool.h
+//
+//	Description:
+//		A small work-stealing thread pool and the task groups that run on
+//		it, so that the decode, mip, encode and batch work of a call share
+//		one set of threads instead of each starting its own.
+//
+//		Each worker keeps a deque of tasks: it takes the newest of its own
+//		first, then the oldest submitted from outside, then the oldest of
+//		another worker. Tasks only ever run on the pool's threads, so no
+//		more than its worker count run at once. A worker that waits for a
+//		group runs other tasks meanwhile, so groups nest without deadlock.
+//		A thread outside the pool that waits only sleeps, and with a
+//		BLPTaskHost polls for cancellation and reports progress, so the
+//		host's callbacks are only ever called on the thread that waits.
+//
+//		A group tracks its tasks, a cancel flag and units of work done,
+//		shared with its parent group, if any. Tasks of a cancelled group
+//		that have not started are dropped; those running poll Cancelled,
+//		or hand the long loops of blpcore the group's BLPCancel. Tasks
+//		must not throw.
+//
+//-------------------------------------------------------------------------------
+
+#ifndef __BLPTaskPool_H__
+#define __BLPTaskPool_H__
+
+#include "PSIntTypes.h"
+#include <atomic>
+#include <cstddef>
+
+// A task: runs proc(context, index).
+typedef void (*BLPTaskProc)(void* context, int32 index);
+
+// What a long loop polls, every band of rows or level, to learn that it
+// should stop: cancelled(context) returns true then, and keeps returning
+// true. The loop fails as it would on an error; its caller tells the two
+// apart by asking cancelled again.
+typedef struct BLPCancel
+{
+    bool (*cancelled)(void* context);
+    void* context;
+} BLPCancel;
+
+// Whether cancel, which may be NULL, has fired.
+inline bool BLPCancelled(const BLPCancel* cancel)
+{
+    return cancel != NULL && cancel->cancelled(cancel->context);
+}
+
+class BLPTaskGroup;
+struct BLPTaskPoolState;
+
+class BLPTaskPool {
+  public:
+	/// Starts workers threads, 0 for one per processor. Threads that cannot
+	/// be started are not an error; with none, tasks run on the thread
+	/// that adds them.
+	explicit BLPTaskPool(int32 workers);
+
+	/// Stops and joins the workers. Every group must be done.
+	~BLPTaskPool();
+
+	/// Threads started, which may be fewer than asked for.
+	int32 Workers(void) const;
+
+	/// A task as queued.
+	typedef struct Task
+	{
+		BLPTaskProc proc;
+		void* context;
+		int32 index;
+		BLPTaskGroup* group;
+	} Task;
+
+  private:
+	BLPTaskPoolState* state;
+
+	friend class BLPTaskGroup;
+	friend struct BLPTaskPoolState;
+
+	bool Submit(const Task& task);
+	bool RunOne(void);
+	bool OnWorker(void) const;
+	void Idle(const BLPTaskGroup& group, int32 milliseconds);
+	void Wake(void);
+
+	BLPTaskPool(const BLPTaskPool&);
+	BLPTaskPool& operator=(const BLPTaskPool&);
+};
+
+// What a thread outside the pool does while it waits: aborted is polled,
+// and cancels the group when it returns true; progress gets the units of
+// work done and added whenever done changes. Either may be NULL.
+typedef struct BLPTaskHost
+{
+    bool (*aborted)(void* context);
+    void (*progress)(void* context, int64 done, int64 total);
+    void* context;
+} BLPTaskHost;
+
+class BLPTaskGroup {
+  public:
+	/// Tasks run on pool, or at once on the adding thread with NULL. A
+	/// group with a parent is cancelled with it and adds its work and
+	/// progress to it.
+	explicit BLPTaskGroup(BLPTaskPool* pool, BLPTaskGroup* parent = NULL);
+
+	/// Waits for the tasks still running.
+	~BLPTaskGroup();
+
+	/// Adds a task, or drops it if the group is cancelled.
+	void Run(BLPTaskProc proc, void* context, int32 index);
+
+	/// Returns when every task added has run or been dropped. host is for
+	/// a thread outside the pool, such as the host's.
+	void Wait(const BLPTaskHost* host = NULL);
+
+	void Cancel(void);
+	bool Cancelled(void) const;
+
+	/// Polls Cancelled, for code that does not know about groups.
+	BLPCancel Cancellation(void) const;
+
+	/// Units of work the tasks will do, and units done, for progress.
+	void AddWork(int64 units);
+	void Advance(int64 units);
+
+	BLPTaskPool* Pool(void) const { return pool; }
+
+	/// At most this many of the group's tasks run at once.
+	int32 Concurrency(void) const;
+
+  private:
+	BLPTaskPool* pool;
+	BLPTaskGroup* parent;
+	std::atomic<int32> pending;
+	std::atomic<bool> cancelled;
+	std::atomic<int64> work;
+	std::atomic<int64> done;
+
+	friend class BLPTaskPool;
+	void Execute(BLPTaskProc proc, void* context, int32 index);
+
+	BLPTaskGroup(const BLPTaskGroup&);
+	BLPTaskGroup& operator=(const BLPTaskGroup&);
+};
+
+#endif // __BLPTaskPool_H__
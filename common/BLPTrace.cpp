@@ -0,0 +1,214 @@
+//-------------------------------------------------------------------------------
+//
+//	File:
+//		BLPTrace.cpp
+//
+//	Description:
+//		Phase timing written as a Chrome trace. See BLPTrace.h.
+//
+//		Events are formatted as they end into one buffer under a lock;
+//		zones are phases, not inner loops, so the lock is not contended.
+//		The file is a JSON array left open at the end, which the trace
+//		viewers accept, so each flush only appends.
+//
+//-------------------------------------------------------------------------------
+
+#include "BLPTrace.h"
+#include "BLPMemStats.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#define BLPTraceProcessId() _getpid()
+#else
+#include <unistd.h>
+#define BLPTraceProcessId() getpid()
+#endif
+
+namespace {
+
+typedef struct Counter
+{
+    const char* name;
+    int64 value;
+} Counter;
+
+typedef struct ThreadTrace
+{
+    int32 id;                       // 0 until the thread first records
+    std::vector<Counter> counters;
+    bool countersChanged;
+} ThreadTrace;
+
+thread_local ThreadTrace tThread = { 0, std::vector<Counter>(), false };
+
+std::atomic<int32> gNextThreadId(1);
+std::mutex gLock;
+std::string gEvents;
+
+const std::string& TracePath(void)
+{
+    static const std::string path = getenv("BLP_TRACE") != NULL ? getenv("BLP_TRACE") : "";
+    return path;
+}
+
+int32 ThreadId(void)
+{
+    if (tThread.id == 0)
+        tThread.id = gNextThreadId++;
+    return tThread.id;
+}
+
+// Appends one event; a trace that cannot grow loses the event.
+void Append(const char* event)
+{
+    std::lock_guard<std::mutex> lock(gLock);
+    try {
+        gEvents += event;
+    } catch (const std::bad_alloc&) {
+    }
+}
+
+void AppendCounters(int64 now)
+{
+    if (!tThread.countersChanged)
+        return;
+    tThread.countersChanged = false;
+
+    char event[256];
+    for (size_t i = 0; i < tThread.counters.size(); i++) {
+        const Counter& counter = tThread.counters[i];
+        snprintf(event, sizeof(event),
+                 "{\"name\":\"%s\",\"ph\":\"C\",\"id\":%d,\"pid\":%d,\"tid\":%d,\"ts\":%.3f,"
+                 "\"args\":{\"value\":%lld}},\n",
+                 counter.name, ThreadId(), (int)BLPTraceProcessId(), ThreadId(), now / 1000.0,
+                 (long long)counter.value);
+        Append(event);
+    }
+}
+
+void AllocationTotals(int64& allocations, int64& bytes, int64& live)
+{
+    BLPMemSnapshot snapshot;
+    BLPMemTake(snapshot);
+    allocations = 0;
+    bytes = 0;
+    for (int32 kind = 0; kind < BLP_MEM_KINDS; kind++) {
+        allocations += snapshot.allocations[kind];
+        bytes += snapshot.bytes[kind];
+    }
+    live = snapshot.liveTotal;
+}
+
+} // namespace
+
+bool BLPTraceEnabled(void)
+{
+    return !TracePath().empty();
+}
+
+int64 BLPTraceNow(void)
+{
+    return (int64)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+BLPTraceZone::BLPTraceZone(const char* zoneName)
+    : name(zoneName), start(BLPTraceNow()), ended(false), allocations(0), bytes(0), peakMark(-1)
+{
+    if (BLPTraceEnabled() && BLPMemStatsEnabled()) {
+        int64 live;
+        AllocationTotals(allocations, bytes, live);
+        peakMark = BLPMemPeakBegin();
+    }
+}
+
+BLPTraceZone::~BLPTraceZone()
+{
+    if (!ended)
+        End();
+}
+
+double BLPTraceZone::End(void)
+{
+    int64 end = BLPTraceNow();
+    if (!ended && BLPTraceEnabled()) {
+        char args[160] = "";
+        int64 live = 0;
+        if (BLPMemStatsEnabled()) {
+            int64 endAllocations, endBytes;
+            AllocationTotals(endAllocations, endBytes, live);
+            int64 peak = peakMark >= 0 ? BLPMemPeakEnd(peakMark) : live;
+            snprintf(args, sizeof(args), ",\"args\":{\"allocs\":%lld,\"bytes\":%lld,\"peak\":%lld}",
+                     (long long)(endAllocations - allocations), (long long)(endBytes - bytes),
+                     (long long)peak);
+        }
+        char event[384];
+        snprintf(event, sizeof(event),
+                 "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f%s},\n",
+                 name, (int)BLPTraceProcessId(), ThreadId(), start / 1000.0, (end - start) / 1000.0, args);
+        Append(event);
+        AppendCounters(end);
+        if (BLPMemStatsEnabled()) {
+            // One track for the process: the live total is not per thread.
+            snprintf(event, sizeof(event),
+                     "{\"name\":\"live bytes\",\"ph\":\"C\",\"pid\":%d,\"ts\":%.3f,"
+                     "\"args\":{\"value\":%lld}},\n",
+                     (int)BLPTraceProcessId(), end / 1000.0, (long long)live);
+            Append(event);
+        }
+    } else if (peakMark >= 0) {
+        BLPMemPeakEnd(peakMark);
+    }
+    peakMark = -1;
+    ended = true;
+    return (end - start) / 1e6;
+}
+
+void BLPTraceCount(const char* name, int64 delta)
+{
+    if (!BLPTraceEnabled())
+        return;
+
+    std::vector<Counter>& counters = tThread.counters;
+    size_t i = 0;
+    while (i < counters.size() && counters[i].name != name)
+        i++;
+    try {
+        if (i == counters.size()) {
+            Counter counter = { name, 0 };
+            counters.push_back(counter);
+        }
+    } catch (const std::bad_alloc&) {
+        return;
+    }
+    counters[i].value += delta;
+    tThread.countersChanged = true;
+}
+
+void BLPTraceFlush(void)
+{
+    if (!BLPTraceEnabled())
+        return;
+    AppendCounters(BLPTraceNow());
+
+    std::lock_guard<std::mutex> lock(gLock);
+    if (gEvents.empty())
+        return;
+    FILE* file = fopen(TracePath().c_str(), "ab");
+    if (file == NULL)
+        return;
+    fseek(file, 0, SEEK_END);
+    if (ftell(file) == 0)
+        fputs("[\n", file);
+    fwrite(gEvents.data(), 1, gEvents.size(), file);
+    fclose(file);
+    gEvents.clear();
+}
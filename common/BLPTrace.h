@@ -0,0 +1,65 @@
+//-------------------------------------------------------------------------------
+//
+//	File:
+//		BLPTrace.h
+//
+//	Description:
+//		Phase timing on a monotonic clock, written as a Chrome trace.
+//
+//		A BLPTraceZone times the scope it lives in: parsing a header, a
+//		read or write, decoding, handing rows to the host, encoding a
+//		mip level. BLPTraceCount adds to a counter of the calling
+//		thread. With the environment variable BLP_TRACE set to a file
+//		path, zones and counters are kept and BLPTraceFlush appends them
+//		to that file in the Trace Event format, which chrome://tracing
+//		and ui.perfetto.dev open. Each thread has a track of its own.
+//
+//		Without BLP_TRACE a zone costs two reads of the clock and
+//		nothing is kept. Zone and counter names must be string
+//		literals: they are kept by address until the flush.
+//
+//		With BLP_MEMSTATS set as well, each zone also records what was
+//		allocated while it was open and the peak of live bytes (see
+//		BLPMemStats.h), and a "live bytes" counter follows it.
+//
+//-------------------------------------------------------------------------------
+
+#ifndef __BLPTrace_H__
+#define __BLPTrace_H__
+
+#include "PSIntTypes.h"
+
+// True if BLP_TRACE names a trace file.
+bool BLPTraceEnabled(void);
+
+// Nanoseconds on a monotonic clock.
+int64 BLPTraceNow(void);
+
+class BLPTraceZone {
+  public:
+	explicit BLPTraceZone(const char* name);
+	~BLPTraceZone();
+
+	/// Ends the zone early and returns its length in milliseconds.
+	double End(void);
+
+  private:
+	const char* name;
+	int64 start;
+	bool ended;
+	int64 allocations;		// counted allocations when the zone began
+	int64 bytes;
+	int32 peakMark;			// from BLPMemPeakBegin, -1 if not watching
+
+	BLPTraceZone(const BLPTraceZone&);
+	BLPTraceZone& operator=(const BLPTraceZone&);
+};
+
+// Adds delta to the calling thread's counter name. The values go to the
+// trace when a zone of the thread ends.
+void BLPTraceCount(const char* name, int64 delta);
+
+// Appends what was kept since the last flush to the trace file.
+void BLPTraceFlush(void);
+
+#endif // __BLPTrace_H__
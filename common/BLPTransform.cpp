@@ -0,0 +1,473 @@
+//-------------------------------------------------------------------------------
+//
+//	File:
+//		BLPTransform.cpp
+//
+//	Description:
+//		Lossless rotate, flip and crop of JPEG-compressed BLP1 files.
+//		See BLPTransform.h.
+//
+//		Each level is read as its full JPEG stream (the shared header,
+//		if any, followed by the level's bytes) and written back as a
+//		complete stream with a zero-length shared header, as the plug-in
+//		writes. Huffman tables are optimized per level; this changes the
+//		bytes but not the coefficients.
+//
+//		Dropping mips needs no libjpeg at all: the kept levels, and the
+//		shared JPEG header or palette, are copied byte for byte.
+//
+//-------------------------------------------------------------------------------
+
+#include "BLPTransform.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <setjmp.h>
+
+extern "C" {
+#include "../ThirdParty/jpeg/include/jpeglib.h"
+#include "../ThirdParty/jpeg/include/transupp.h"
+}
+
+namespace {
+
+// What one level has to become: the crop, in the level's own pixels after
+// the transform. Without a crop the level keeps its transformed size.
+typedef struct LevelCrop
+{
+    bool crop;
+    uint32 x;
+    uint32 y;
+    uint32 width;
+    uint32 height;
+} LevelCrop;
+
+// Everything that must survive a longjmp out of libjpeg lives here rather
+// than in locals of the frame that called setjmp.
+typedef struct TransformErrorMgr
+{
+    struct jpeg_error_mgr pub;
+    jmp_buf setjmp_buffer;
+    unsigned char* outBuffer;   // from jpeg_mem_dest, freed by us
+    unsigned long outSize;
+    uint8* samples;             // pixel path only
+    uint8* transformed;
+} TransformErrorMgr;
+
+METHODDEF(void) TransformErrorExit(j_common_ptr cinfo)
+{
+    TransformErrorMgr* err = (TransformErrorMgr*)cinfo->err;
+    longjmp(err->setjmp_buffer, 1);
+}
+
+METHODDEF(void) TransformOutputMessage(j_common_ptr)
+{
+    // A library has no console; warnings are ignored and errors returned.
+}
+
+JXFORM_CODE ToJXform(BLPTransformOp op)
+{
+    switch (op) {
+        case BLP_TRANSFORM_FLIP_H:     return JXFORM_FLIP_H;
+        case BLP_TRANSFORM_FLIP_V:     return JXFORM_FLIP_V;
+        case BLP_TRANSFORM_TRANSPOSE:  return JXFORM_TRANSPOSE;
+        case BLP_TRANSFORM_TRANSVERSE: return JXFORM_TRANSVERSE;
+        case BLP_TRANSFORM_ROT_90:     return JXFORM_ROT_90;
+        case BLP_TRANSFORM_ROT_180:    return JXFORM_ROT_180;
+        case BLP_TRANSFORM_ROT_270:    return JXFORM_ROT_270;
+        default:                       return JXFORM_NONE;
+    }
+}
+
+bool SwapsAxes(BLPTransformOp op)
+{
+    return op == BLP_TRANSFORM_TRANSPOSE || op == BLP_TRANSFORM_TRANSVERSE ||
+           op == BLP_TRANSFORM_ROT_90 || op == BLP_TRANSFORM_ROT_270;
+}
+
+// Pixel-space equivalent of the coefficient transform followed by a crop:
+// fills the width x height window at (x0, y0) of the transformed image.
+void TransformPixels(const uint8* src, uint32 srcW, uint32 srcH, int comps, BLPTransformOp op,
+                     uint32 x0, uint32 y0, uint32 width, uint32 height, uint8* dst)
+{
+    for (uint32 y = 0; y < height; y++) {
+        for (uint32 x = 0; x < width; x++) {
+            uint32 tx = x + x0;
+            uint32 ty = y + y0;
+            uint32 sx, sy;
+            switch (op) {
+                case BLP_TRANSFORM_FLIP_H:     sx = srcW - 1 - tx; sy = ty;            break;
+                case BLP_TRANSFORM_FLIP_V:     sx = tx;            sy = srcH - 1 - ty; break;
+                case BLP_TRANSFORM_TRANSPOSE:  sx = ty;            sy = tx;            break;
+                case BLP_TRANSFORM_TRANSVERSE: sx = srcW - 1 - ty; sy = srcH - 1 - tx; break;
+                case BLP_TRANSFORM_ROT_90:     sx = ty;            sy = srcH - 1 - tx; break;
+                case BLP_TRANSFORM_ROT_180:    sx = srcW - 1 - tx; sy = srcH - 1 - ty; break;
+                case BLP_TRANSFORM_ROT_270:    sx = srcW - 1 - ty; sy = tx;            break;
+                default:                       sx = tx;            sy = ty;            break;
+            }
+            memcpy(dst + ((size_t)y * width + x) * comps, src + ((size_t)sy * srcW + sx) * comps, comps);
+        }
+    }
+}
+
+// Transforms one complete JPEG stream into out. reencoded tells whether it
+// had to go through pixels.
+BLPTransformError TransformLevel(const uint8* jpeg, size_t size, BLPTransformOp op,
+                                 const LevelCrop& levelCrop, std::vector<uint8>& out, bool& reencoded)
+{
+    struct jpeg_decompress_struct src;
+    struct jpeg_compress_struct dst;
+    TransformErrorMgr jerr;
+    volatile BLPTransformError result = BLP_TRANSFORM_CORRUPT;
+
+    // Zeroed so jpeg_destroy_* is safe on an object never created.
+    memset(&src, 0, sizeof(src));
+    memset(&dst, 0, sizeof(dst));
+    jerr.outBuffer = NULL;
+    jerr.outSize = 0;
+    jerr.samples = NULL;
+    jerr.transformed = NULL;
+    reencoded = false;
+
+    src.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = TransformErrorExit;
+    jerr.pub.output_message = TransformOutputMessage;
+    dst.err = &jerr.pub;
+
+    if (setjmp(jerr.setjmp_buffer)) {
+        jpeg_destroy_compress(&dst);
+        jpeg_destroy_decompress(&src);
+        free(jerr.outBuffer);
+        free(jerr.samples);
+        free(jerr.transformed);
+        return result;
+    }
+
+    jpeg_create_decompress(&src);
+    jpeg_create_compress(&dst);
+    jpeg_mem_src(&src, jpeg, (unsigned long)size);
+    (void)jpeg_read_header(&src, TRUE);
+
+    const JXFORM_CODE transform = ToJXform(op);
+    const bool swap = SwapsAxes(op);
+    const int mcuW = src.max_h_samp_factor * src.block_size;
+    const int mcuH = src.max_v_samp_factor * src.block_size;
+    const uint32 transformedW = swap ? src.image_height : src.image_width;
+    const uint32 transformedH = swap ? src.image_width : src.image_height;
+
+    // Crop window of this level, clamped into it and block aligned.
+    uint32 cropX = 0;
+    uint32 cropY = 0;
+    uint32 cropW = transformedW;
+    uint32 cropH = transformedH;
+    if (levelCrop.crop) {
+        cropW = levelCrop.width;
+        cropH = levelCrop.height;
+        if (cropW > transformedW || cropH > transformedH)
+            longjmp(jerr.setjmp_buffer, 1);
+        cropX = levelCrop.x < transformedW - cropW ? levelCrop.x : transformedW - cropW;
+        cropY = levelCrop.y < transformedH - cropH ? levelCrop.y : transformedH - cropH;
+        cropX -= cropX % (swap ? mcuH : mcuW);
+        cropY -= cropY % (swap ? mcuW : mcuH);
+    }
+
+    if (transform == JXFORM_NONE ||
+        jtransform_perfect_transform(src.image_width, src.image_height, mcuW, mcuH, transform)) {
+        jpeg_transform_info info;
+        memset(&info, 0, sizeof(info));
+        info.transform = transform;
+        info.perfect = FALSE;
+        info.trim = FALSE;
+        info.force_grayscale = FALSE;
+        info.crop = levelCrop.crop ? TRUE : FALSE;
+        info.crop_width = cropW;
+        info.crop_width_set = JCROP_FORCE;
+        info.crop_height = cropH;
+        info.crop_height_set = JCROP_FORCE;
+        info.crop_xoffset = cropX;
+        info.crop_xoffset_set = JCROP_POS;
+        info.crop_yoffset = cropY;
+        info.crop_yoffset_set = JCROP_POS;
+
+        if (!jtransform_request_workspace(&src, &info)) {
+            result = BLP_TRANSFORM_BAD_CROP;
+            longjmp(jerr.setjmp_buffer, 1);
+        }
+        jvirt_barray_ptr* srcCoefs = jpeg_read_coefficients(&src);
+        jpeg_copy_critical_parameters(&src, &dst);
+        jvirt_barray_ptr* dstCoefs = jtransform_adjust_parameters(&src, &dst, srcCoefs, &info);
+
+        dst.write_JFIF_header = FALSE;
+        dst.write_Adobe_marker = FALSE;
+        dst.optimize_coding = TRUE;
+        jpeg_mem_dest(&dst, &jerr.outBuffer, &jerr.outSize);
+        jpeg_write_coefficients(&dst, dstCoefs);
+        jtransform_execute_transform(&src, &dst, srcCoefs, &info);
+        jpeg_finish_compress(&dst);
+        (void)jpeg_finish_decompress(&src);
+    } else {
+        // Decode without color conversion, move the pixels, and encode with
+        // the source's tables.
+        src.out_color_space = src.jpeg_color_space;
+        (void)jpeg_start_decompress(&src);
+
+        const int comps = src.output_components;
+        const uint32 srcW = src.output_width;
+        const uint32 srcH = src.output_height;
+        jerr.samples = (uint8*)malloc((size_t)srcW * srcH * comps);
+        jerr.transformed = (uint8*)malloc((size_t)cropW * cropH * comps);
+        if (jerr.samples == NULL || jerr.transformed == NULL) {
+            result = BLP_TRANSFORM_NO_MEMORY;
+            longjmp(jerr.setjmp_buffer, 1);
+        }
+        while (src.output_scanline < srcH) {
+            JSAMPROW row = jerr.samples + (size_t)src.output_scanline * srcW * comps;
+            (void)jpeg_read_scanlines(&src, &row, 1);
+        }
+        TransformPixels(jerr.samples, srcW, srcH, comps, op, cropX, cropY, cropW, cropH, jerr.transformed);
+
+        jpeg_copy_critical_parameters(&src, &dst);
+        dst.image_width = cropW;
+        dst.image_height = cropH;
+        // A level inside one block costs a few bytes whatever the tables,
+        // so it gets unit ones and keeps its pixels to within rounding.
+        if (cropW <= (uint32)src.block_size && cropH <= (uint32)src.block_size)
+            jpeg_set_quality(&dst, 100, TRUE);
+        dst.write_JFIF_header = FALSE;
+        dst.write_Adobe_marker = FALSE;
+        dst.optimize_coding = TRUE;
+        jpeg_mem_dest(&dst, &jerr.outBuffer, &jerr.outSize);
+        jpeg_start_compress(&dst, TRUE);
+        while (dst.next_scanline < cropH) {
+            JSAMPROW row = jerr.transformed + (size_t)dst.next_scanline * cropW * comps;
+            (void)jpeg_write_scanlines(&dst, &row, 1);
+        }
+        jpeg_finish_compress(&dst);
+        (void)jpeg_finish_decompress(&src);
+        reencoded = true;
+    }
+
+    jpeg_destroy_compress(&dst);
+    jpeg_destroy_decompress(&src);
+    free(jerr.samples);
+    free(jerr.transformed);
+
+    result = BLP_TRANSFORM_OK;
+    try {
+        out.assign(jerr.outBuffer, jerr.outBuffer + jerr.outSize);
+    } catch (const std::bad_alloc&) {
+        result = BLP_TRANSFORM_NO_MEMORY;
+    }
+    free(jerr.outBuffer);
+    return result;
+}
+
+inline uint32 ScaleDown(uint32 size, int32 level)
+{
+    return (size >> level) > 0 ? size >> level : 1;
+}
+
+} // namespace
+
+/*****************************************************************************/
+
+BLPTransformError BLPLosslessTransform(const uint8* blp, size_t size,
+                                       const BLPTransformSpec& spec,
+                                       std::vector<uint8>& out,
+                                       BLPTransformStats* stats)
+{
+    BLP_HEADER header;
+    uint32 jpegHeaderSize = 0;
+
+    if (stats != NULL) {
+        stats->levels = 0;
+        stats->reencodedLevels = 0;
+    }
+    if (size < sizeof(BLP_HEADER) + 4 || memcmp(blp, "BLP1", 4) != 0)
+        return BLP_TRANSFORM_NOT_BLP;
+    memcpy(&header, blp, sizeof(BLP_HEADER));
+    if (header.Compression != BLP_COMPRESSION_JPEG)
+        return BLP_TRANSFORM_NOT_JPEG;
+    memcpy(&jpegHeaderSize, blp + sizeof(BLP_HEADER), 4);
+    if (jpegHeaderSize > size - sizeof(BLP_HEADER) - 4 || header.Size[0] == 0)
+        return BLP_TRANSFORM_CORRUPT;
+    const uint8* jpegHeader = blp + sizeof(BLP_HEADER) + 4;
+
+    const bool swap = SwapsAxes(spec.op);
+    const uint32 width = swap ? header.Height : header.Width;
+    const uint32 height = swap ? header.Width : header.Height;
+    if (spec.crop) {
+        if (spec.cropWidth == 0 || spec.cropHeight == 0 ||
+            spec.cropX >= width || spec.cropWidth > width - spec.cropX ||
+            spec.cropY >= height || spec.cropHeight > height - spec.cropY ||
+            spec.cropX % 8 != 0 || spec.cropY % 8 != 0)
+            return BLP_TRANSFORM_BAD_CROP;
+    }
+
+    std::vector<uint8> levelData[kBLPMaxMips];
+    std::vector<uint8> stream;
+    int32 levels = 0;
+    int32 reencoded = 0;
+
+    for (int32 level = 0; level < kBLPMaxMips && header.Size[level] != 0; level++) {
+        const uint32 offset = header.Offset[level];
+        const uint32 bytes = header.Size[level];
+        if (offset > size || bytes > size - offset)
+            return BLP_TRANSFORM_CORRUPT;
+
+        try {
+            stream.resize((size_t)jpegHeaderSize + bytes);
+        } catch (const std::bad_alloc&) {
+            return BLP_TRANSFORM_NO_MEMORY;
+        }
+        memcpy(&stream[0], jpegHeader, jpegHeaderSize);
+        memcpy(&stream[jpegHeaderSize], blp + offset, bytes);
+
+        LevelCrop levelCrop;
+        levelCrop.crop = spec.crop;
+        levelCrop.x = spec.cropX >> level;
+        levelCrop.y = spec.cropY >> level;
+        levelCrop.width = ScaleDown(spec.cropWidth, level);
+        levelCrop.height = ScaleDown(spec.cropHeight, level);
+
+        bool viaPixels = false;
+        BLPTransformError error = TransformLevel(&stream[0], stream.size(), spec.op, levelCrop, levelData[level], viaPixels);
+        if (error != BLP_TRANSFORM_OK)
+            return error;
+        levels++;
+        if (viaPixels)
+            reencoded++;
+
+        // A crop can reach 1x1 before the source chain ends.
+        const uint32 levelW = spec.crop ? levelCrop.width : ScaleDown(width, level);
+        const uint32 levelH = spec.crop ? levelCrop.height : ScaleDown(height, level);
+        if (levelW == 1 && levelH == 1)
+            break;
+    }
+
+    // Same layout as the plug-in writes: header, empty shared JPEG header,
+    // then the levels in order.
+    size_t total = sizeof(BLP_HEADER) + 4;
+    for (int32 level = 0; level < levels; level++)
+        total += levelData[level].size();
+    if (total > 0xFFFFFFFFu)
+        return BLP_TRANSFORM_CORRUPT;
+
+    header.Width = spec.crop ? spec.cropWidth : width;
+    header.Height = spec.crop ? spec.cropHeight : height;
+    uint32 offset = sizeof(BLP_HEADER) + 4;
+    for (int32 level = 0; level < kBLPMaxMips; level++) {
+        header.Offset[level] = level < levels ? offset : 0;
+        header.Size[level] = level < levels ? (uint32)levelData[level].size() : 0;
+        offset += header.Size[level];
+    }
+
+    try {
+        out.resize(total);
+    } catch (const std::bad_alloc&) {
+        return BLP_TRANSFORM_NO_MEMORY;
+    }
+    memcpy(&out[0], &header, sizeof(BLP_HEADER));
+    memset(&out[sizeof(BLP_HEADER)], 0, 4);
+    for (int32 level = 0; level < levels; level++) {
+        if (!levelData[level].empty())
+            memcpy(&out[header.Offset[level]], &levelData[level][0], levelData[level].size());
+    }
+
+    if (stats != NULL) {
+        stats->levels = levels;
+        stats->reencodedLevels = reencoded;
+    }
+    return BLP_TRANSFORM_OK;
+}
+
+/*****************************************************************************/
+
+BLPTransformError BLPDropMips(const uint8* blp, size_t size, int32 drop,
+                              std::vector<uint8>& out, BLPTransformStats* stats)
+{
+    BLP_HEADER header;
+
+    if (stats != NULL) {
+        stats->levels = 0;
+        stats->reencodedLevels = 0;
+    }
+    if (size < sizeof(BLP_HEADER) || memcmp(blp, "BLP1", 4) != 0)
+        return BLP_TRANSFORM_NOT_BLP;
+    memcpy(&header, blp, sizeof(BLP_HEADER));
+
+    // Everything between the header and the first level is copied as is:
+    // the shared JPEG header with its size, or the Direct palette.
+    size_t preamble = 0;
+    if (header.Compression == BLP_COMPRESSION_JPEG) {
+        uint32 jpegHeaderSize = 0;
+        if (size < sizeof(BLP_HEADER) + 4)
+            return BLP_TRANSFORM_CORRUPT;
+        memcpy(&jpegHeaderSize, blp + sizeof(BLP_HEADER), 4);
+        if (jpegHeaderSize > size - sizeof(BLP_HEADER) - 4)
+            return BLP_TRANSFORM_CORRUPT;
+        preamble = 4 + (size_t)jpegHeaderSize;
+    } else {
+        if (header.Offset[0] < sizeof(BLP_HEADER) || header.Offset[0] > size)
+            return BLP_TRANSFORM_CORRUPT;
+        preamble = header.Offset[0] - sizeof(BLP_HEADER);
+    }
+
+    int32 levels = 0;
+    while (levels < kBLPMaxMips && header.Size[levels] != 0) {
+        if (header.Offset[levels] > size || header.Size[levels] > size - header.Offset[levels])
+            return BLP_TRANSFORM_CORRUPT;
+        levels++;
+    }
+    if (levels == 0)
+        return BLP_TRANSFORM_CORRUPT;
+    if (drop < 0)
+        drop = 0;
+    if (drop > levels - 1)
+        drop = levels - 1;
+
+    BLP_HEADER dropped = header;
+    dropped.Width = ScaleDown(header.Width, drop);
+    dropped.Height = ScaleDown(header.Height, drop);
+    size_t total = sizeof(BLP_HEADER) + preamble;
+    for (int32 level = 0; level < kBLPMaxMips; level++) {
+        const int32 from = level + drop;
+        const bool kept = from < levels;
+        dropped.Offset[level] = kept ? (uint32)total : 0;
+        dropped.Size[level] = kept ? header.Size[from] : 0;
+        total += dropped.Size[level];
+    }
+
+    try {
+        out.resize(total);
+    } catch (const std::bad_alloc&) {
+        return BLP_TRANSFORM_NO_MEMORY;
+    }
+    memcpy(&out[0], &dropped, sizeof(BLP_HEADER));
+    if (preamble != 0)
+        memcpy(&out[sizeof(BLP_HEADER)], blp + sizeof(BLP_HEADER), preamble);
+    for (int32 level = 0; level + drop < levels; level++)
+        memcpy(&out[dropped.Offset[level]], blp + header.Offset[level + drop], dropped.Size[level]);
+
+    if (stats != NULL)
+        stats->levels = levels - drop;
+    return BLP_TRANSFORM_OK;
+}
+
+/*****************************************************************************/
+
+const char* BLPTransformErrorString(BLPTransformError error)
+{
+    switch (error) {
+        case BLP_TRANSFORM_OK:        return "no error";
+        case BLP_TRANSFORM_NOT_BLP:   return "not a BLP1 file";
+        case BLP_TRANSFORM_NOT_JPEG:  return "not a JPEG-compressed BLP";
+        case BLP_TRANSFORM_BAD_CROP:  return "crop is outside the image or not 8-pixel aligned";
+        case BLP_TRANSFORM_CORRUPT:   return "file is damaged";
+        case BLP_TRANSFORM_NO_MEMORY: return "out of memory";
+        default:                      return "unknown error";
+    }
+}
+
+// end BLPTransform.cpp
@@ -0,0 +1,91 @@
+//-------------------------------------------------------------------------------
+//
+//	File:
+//		BLPTransform.h
+//
+//	Description:
+//		Lossless rotate, flip and crop of JPEG-compressed BLP1 files,
+//		and lossless mip dropping for any BLP1 file.
+//
+//		Every mip level is transformed in the DCT coefficient domain with
+//		libjpeg's transupp.c (the engine behind jpegtran) and written back
+//		with a new offset table, so the image data goes through no decode
+//		and re-encode.
+//
+//		JPEG cannot move a partial edge block, so a level whose width or
+//		height is not a multiple of the block size is rotated or flipped
+//		through pixels and re-encoded: with its own quantization tables,
+//		or with unit tables if it fits in one block. In a power-of-two
+//		texture only the levels below 8 pixels are affected.
+//
+//		The crop rectangle is given in mip 0 coordinates after the
+//		transform, as with jpegtran, and its corner must fall on a block
+//		boundary. Each lower level is cropped to the same rectangle scaled
+//		down, with its corner moved up and left to the block boundary of
+//		that level.
+//
+//		Files go in and come out whole, as bytes in memory;
+//		BLPTransformTool runs the transforms over batches of them.
+//
+//-------------------------------------------------------------------------------
+
+#ifndef __BLPTransform_H__
+#define __BLPTransform_H__
+
+#include "BLPFile.h"
+#include <cstddef>
+#include <vector>
+
+// Same meaning as jpegtran's -flip, -rotate, -transpose and -transverse.
+// Rotations are clockwise.
+enum BLPTransformOp {
+    BLP_TRANSFORM_NONE = 0,
+    BLP_TRANSFORM_FLIP_H,
+    BLP_TRANSFORM_FLIP_V,
+    BLP_TRANSFORM_TRANSPOSE,
+    BLP_TRANSFORM_TRANSVERSE,
+    BLP_TRANSFORM_ROT_90,
+    BLP_TRANSFORM_ROT_180,
+    BLP_TRANSFORM_ROT_270
+};
+
+enum BLPTransformError {
+    BLP_TRANSFORM_OK = 0,
+    BLP_TRANSFORM_NOT_BLP,          // not a BLP1 file
+    BLP_TRANSFORM_NOT_JPEG,         // a Direct (palettized) file
+    BLP_TRANSFORM_BAD_CROP,         // crop outside the image or not block aligned
+    BLP_TRANSFORM_CORRUPT,          // bad offsets, or libjpeg rejected a level
+    BLP_TRANSFORM_NO_MEMORY
+};
+
+typedef struct BLPTransformSpec
+{
+    BLPTransformOp op;
+    bool crop;
+    uint32 cropX;
+    uint32 cropY;
+    uint32 cropWidth;
+    uint32 cropHeight;
+} BLPTransformSpec;
+
+typedef struct BLPTransformStats
+{
+    int32 levels;           // levels written
+    int32 reencodedLevels;  // of those, levels that went through pixels
+} BLPTransformStats;
+
+// Transforms the BLP1 file of size bytes at blp into out. stats may be NULL.
+BLPTransformError BLPLosslessTransform(const uint8* blp, size_t size,
+                                       const BLPTransformSpec& spec,
+                                       std::vector<uint8>& out,
+                                       BLPTransformStats* stats);
+
+// Drops the first drop levels of the BLP1 file of size bytes at blp (JPEG
+// or Direct) and makes level drop the new mip 0, without touching the
+// compressed data. At least one level is kept. stats may be NULL.
+BLPTransformError BLPDropMips(const uint8* blp, size_t size, int32 drop,
+                              std::vector<uint8>& out, BLPTransformStats* stats);
+
+const char* BLPTransformErrorString(BLPTransformError error);
+
+#endif // __BLPTransform_H__
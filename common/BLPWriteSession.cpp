@@ -0,0 +1,424 @@
+//-------------------------------------------------------------------------------
+//
+//	File:
+//		BLPWriteSession.cpp
+//
+//	Description:
+//		A whole save, from the RGBA pixels of mip 0 to the file. See
+//		BLPWriteSession.h.
+//
+//		Levels encoded one at a time are resized into two buffers in
+//		turn, each big enough for the first level that uses it, so a save
+//		holds mip 0 plus half of it. Levels encoded up front need the
+//		whole chain at once, which is resized into one block and freed as
+//		soon as they are encoded.
+//
+//-------------------------------------------------------------------------------
+
+#include "BLPWriteSession.h"
+#include "BLPCodec.h"
+#include "BLPHash.h"
+#include "BLPTrace.h"
+#include <cstring>
+
+namespace {
+
+// A trace zone whose time also adds to a total of the report.
+class TimedZone {
+  public:
+	TimedZone(const char* name, double& inTotal) : zone(name), total(inTotal), ended(false) {}
+	~TimedZone() { End(); }
+
+	void End(void)
+	{
+		if (ended)
+			return;
+		ended = true;
+		total += zone.End();
+	}
+
+  private:
+	BLPTraceZone zone;
+	double& total;
+	bool ended;
+
+	TimedZone(const TimedZone&);
+	TimedZone& operator=(const TimedZone&);
+};
+
+// Trace zones of the levels as they are written.
+const char* const kEncodeMipZones[kBLPMaxMips] = {
+    "encode mip 0", "encode mip 1", "encode mip 2", "encode mip 3",
+    "encode mip 4", "encode mip 5", "encode mip 6", "encode mip 7",
+    "encode mip 8", "encode mip 9", "encode mip 10", "encode mip 11",
+    "encode mip 12", "encode mip 13", "encode mip 14", "encode mip 15"
+};
+
+int32 Halved(int32 size)
+{
+    return size / 2 > 0 ? size / 2 : 1;
+}
+
+// The work of EncodeUpFront, shared by its two tasks.
+typedef struct UpFrontJob
+{
+    const BLPRateLevel* levels;
+    int32 count;
+    bool hasAlpha;
+    const BLPEncodeSettings* settings;
+    const BLPRateTarget* target;
+    bool measure;                   // also score levels the target did not
+    BLPTaskGroup* group;
+    BLPRateResult* rate;
+    BLPDirectResult* palettized;
+    bool jpegOk;
+    bool directOk;
+} UpFrontJob;
+
+enum {
+    kUpFrontJpeg,
+    kUpFrontDirect
+};
+
+// Index kUpFrontJpeg: the levels through BLPRateControl, whose trials run
+// in a group of their own; kUpFrontDirect: the levels through
+// BLPEncodeDirect. Each advances the group by the pixels it encoded.
+void EncodeUpFrontTask(void* context, int32 index)
+{
+    UpFrontJob* job = static_cast<UpFrontJob*>(context);
+    const BLPCancel cancel = job->group->Cancellation();
+    if (index == kUpFrontJpeg) {
+        job->jpegOk = BLPRateControl(job->levels, job->count, job->hasAlpha, *job->settings, *job->target,
+                                     sizeof(BLP_HEADER) + 4, *job->group, *job->rate);
+        if (job->jpegOk && job->measure && job->target->mode != BLP_RATE_MIN_SSIM)
+            job->jpegOk = BLPMeasureSsim(job->levels, job->count, job->hasAlpha, *job->rate, &cancel);
+    } else {
+        job->directOk = BLPEncodeDirect(job->levels, job->count, job->hasAlpha, *job->palettized, &cancel);
+        int64 pixels = 0;
+        for (int32 level = 0; level < job->count; level++)
+            pixels += (int64)job->levels[level].width * job->levels[level].height;
+        job->group->Advance(pixels);
+    }
+}
+
+// The rate target of options: a byte budget before an SSIM floor.
+BLPRateTarget RateTarget(const BLPWriteOptions& options)
+{
+    BLPRateTarget target;
+    target.mode = options.byteBudget != 0 ? BLP_RATE_MAX_BYTES
+                : options.minSsim > 0 ? BLP_RATE_MIN_SSIM : BLP_RATE_FIXED;
+    target.maxBytes = options.byteBudget;
+    target.minSsim = options.minSsim;
+    return target;
+}
+
+} // namespace
+
+uint64 BLPEncodeSettingsHash(const BLPEncodeSettings& settings)
+{
+    const int32 fields[3] = { settings.trellis ? 1 : 0, settings.dctMethod,
+                              settings.optimizeCoding ? 1 : 0 };
+    return BLPHash64(fields, sizeof(fields));
+}
+
+bool BLPEncodesUpFront(const BLPWriteOptions& options)
+{
+    return options.byteBudget != 0 || options.minSsim > 0 ||
+           options.compression != BLP_WRITE_JPEG || options.settings.trellis;
+}
+
+int32 BLPWriteLevels(const BLPWriteOptions& options, int32 width, int32 height)
+{
+    int32 levels = BLPMipLevelCount(width, height);
+    if (options.levels > 0 && options.levels < levels)
+        levels = options.levels;
+    return levels;
+}
+
+void BLPShapeWrite(const BLPWriteOptions& options, int32 width, int32 height, int32 threads,
+                   BLPWriteShape& shape)
+{
+    shape.width = width;
+    shape.height = height;
+    shape.levels = BLPWriteLevels(options, width, height);
+    shape.preEncoded = BLPEncodesUpFront(options);
+    shape.jpeg = options.compression != BLP_WRITE_DIRECT;
+    shape.direct = options.compression != BLP_WRITE_JPEG;
+    shape.scored = options.minSsim > 0 || options.compression == BLP_WRITE_AUTO;
+    shape.threads = threads;
+}
+
+BLPWriteSession::BLPWriteSession(const BLPWriteOptions& inOptions, const BLPWriteEnvironment& inEnvironment)
+    : options(inOptions), environment(inEnvironment),
+      writer(inEnvironment.write, inEnvironment.context, inOptions.layout),
+      pixels(NULL), width(0), height(0), levels(0)
+{
+    memset(&report, 0, sizeof(report));
+    report.compression = BLP_WRITE_JPEG;
+    report.targetMet = -1;
+}
+
+BLPWriteSession::~BLPWriteSession()
+{
+}
+
+bool BLPWriteSession::Cancelled(void) const
+{
+    return BLPCancelled(environment.cancel);
+}
+
+BLPWriterError BLPWriteSession::Write(const uint8* rgba, int32 inWidth, int32 inHeight,
+                                      const void* reuse, size_t reuseSize)
+{
+    pixels = rgba;
+    width = inWidth;
+    height = inHeight;
+    levels = BLPWriteLevels(options, width, height);
+
+    const BLPRateTarget target = RateTarget(options);
+    const bool preEncoded = BLPEncodesUpFront(options);
+    bool direct = false;
+    BLPWriterError error = BLP_WRITER_OK;
+    if (preEncoded) {
+        error = EncodeUpFront(direct);
+        if (error == BLP_WRITER_OK)
+            error = WriteLevels(direct, NULL, NULL);
+    } else {
+        // One compressor serves every mip level.
+        BLPJpegEncoder encoder;
+        error = encoder.Create(options.settings, options.maxMemory, environment.cancel);
+        if (error == BLP_WRITER_OK)
+            error = WriteLevels(false, &encoder, Reusable(reuse, reuseSize, encoder.TablesHash()));
+    }
+
+    report.compression = direct ? BLP_WRITE_DIRECT : BLP_WRITE_JPEG;
+    report.rateControlled = target.mode != BLP_RATE_FIXED && !direct;
+    if (report.rateControlled) {
+        report.rateMet = rate.met;
+        report.rateQuality = rate.quality[0];
+        report.rateTrials = rate.trials;
+    }
+
+    // Writes the levels held for smallestFirst and rewrites the header.
+    if (error == BLP_WRITER_OK)
+        error = writer.Finish();
+    if (error != BLP_WRITER_OK)
+        return error;
+
+    // A budget or floor that cannot be reached still writes the closest
+    // file; whether it was reached is judged on what was written, the budget
+    // against the whole file, padding included.
+    if (target.mode == BLP_RATE_MAX_BYTES)
+        report.targetMet = writer.Bytes() <= options.byteBudget ? 1 : 0;
+    else if (target.mode == BLP_RATE_MIN_SSIM)
+        report.targetMet = (direct ? palettized.ssim >= options.minSsim : rate.met) ? 1 : 0;
+    return BLP_WRITER_OK;
+}
+
+// The levels of reuse that a save of pixels with the compressor's tables
+// (tablesHash) and settings may copy: NULL unless it was kept for this
+// size, quantization and settings, its offsets lie within reuseSize, mip 0
+// is unchanged and, with a shared header, which serves every level, it
+// holds all of them.
+const BLPReuseInfo* BLPWriteSession::Reusable(const void* reuse, size_t reuseSize, uint64 tablesHash) const
+{
+    if (reuse == NULL || reuseSize < sizeof(BLPReuseInfo))
+        return NULL;
+
+    const BLPReuseInfo* info = static_cast<const BLPReuseInfo*>(reuse);
+    bool ok = info->tag == kBLPReuseTag &&
+        info->width == (uint32)width && info->height == (uint32)height &&
+        info->levels > 0 && info->levels <= kBLPMaxMips &&
+        info->tablesHash == tablesHash && info->settingsHash == BLPEncodeSettingsHash(options.settings);
+
+    uint64 available = (uint64)reuseSize - sizeof(BLPReuseInfo);
+    ok = ok && info->headerSize <= available;
+    for (int32 level = 0; ok && level < info->levels; level++)
+        ok = (uint64)info->offset[level] + info->size[level] <= available && info->size[level] != 0;
+
+    ok = ok && BLPHash64(pixels, static_cast<size_t>(width) * height * 4u) == info->mip0Hash;
+    ok = ok && (info->headerSize == 0 || info->levels >= levels);
+    return ok ? info : NULL;
+}
+
+// Resizes the levels of the mip chain of pixels into one block, which the
+// caller frees, and describes them in chain, mip 0 first.
+BLPWriterError BLPWriteSession::ResizeChain(BLPRateLevel* chain, uint8*& block)
+{
+    size_t chainBytes = 0;
+    int32 w = width;
+    int32 h = height;
+    for (int32 level = 0; level < levels; level++) {
+        chain[level].width = w;
+        chain[level].height = h;
+        if (level > 0)
+            chainBytes += static_cast<size_t>(w) * h * 4u;
+        w = Halved(w);
+        h = Halved(h);
+    }
+
+    block = (uint8*)BLPLargeAlloc(chainBytes > 0 ? chainBytes : 1, environment.blocks);
+    if (block == NULL)
+        return BLP_WRITER_NO_MEMORY;
+    chain[0].pixels = pixels;
+    BLPTraceZone zone("resize");
+    uint8* next = block;
+    for (int32 level = 1; level < levels; level++) {
+        const BLPRateLevel& above = chain[level - 1];
+        BLPResizeLevel(above.pixels, above.width, above.height, next, chain[level].width, chain[level].height,
+                       environment.cancel);
+        if (Cancelled()) {
+            BLPLargeFree(block);
+            block = NULL;
+            return BLP_WRITER_CANCELLED;
+        }
+        chain[level].pixels = next;
+        next += static_cast<size_t>(chain[level].width) * chain[level].height * 4u;
+    }
+    return BLP_WRITER_OK;
+}
+
+// Encodes every level before any is written: JPEG with the trial search
+// of BLPRateControl.h, Direct with BLPPalette.h. AUTO makes both at once,
+// each a task of the pool, and keeps the smaller of those that reach the
+// SSIM floor and fit the byte budget, else the one of higher SSIM. direct
+// says which was kept. While the tasks run the calling thread only polls
+// the waiter, which cancels them, and reports their progress to it.
+// Alignment padding (alignMips) is not counted against a byte budget.
+BLPWriterError BLPWriteSession::EncodeUpFront(bool& direct)
+{
+    TimedZone zone("encode up front", report.encodeMs);
+    BLPRateLevel chain[kBLPMaxMips];
+    uint8* block = NULL;
+    BLPWriterError error = ResizeChain(chain, block);
+    if (error != BLP_WRITER_OK)
+        return error;
+
+    const BLPRateTarget target = RateTarget(options);
+    const bool wantJpeg = options.compression != BLP_WRITE_DIRECT;
+    const bool wantDirect = options.compression != BLP_WRITE_JPEG;
+    int64 pixelCount = 0;
+    for (int32 level = 0; level < levels; level++)
+        pixelCount += (int64)chain[level].width * chain[level].height;
+
+    BLPTaskGroup group(environment.pool);
+    UpFrontJob job = { chain, levels, options.hasAlpha, &options.settings, &target,
+                       options.compression == BLP_WRITE_AUTO, &group, &rate, &palettized, true, true };
+    group.AddWork(pixelCount * ((wantJpeg ? 1 : 0) + (wantDirect ? 1 : 0)));
+    if (wantJpeg)
+        group.Run(EncodeUpFrontTask, &job, kUpFrontJpeg);
+    if (wantDirect)
+        group.Run(EncodeUpFrontTask, &job, kUpFrontDirect);
+    group.Wait(environment.waiter);
+    BLPLargeFree(block);
+
+    if (group.Cancelled())
+        return BLP_WRITER_CANCELLED;
+    if (!job.jpegOk || !job.directOk)
+        return BLP_WRITER_NO_MEMORY;
+
+    direct = wantDirect;
+    if (wantJpeg && wantDirect) {
+        double floor = options.minSsim > 0 ? options.minSsim : kBLPAutoMinSsim;
+        double jpegSsim = 1.0;
+        for (int32 level = 0; level < levels; level++) {
+            if (rate.ssim[level] < jpegSsim)
+                jpegSsim = rate.ssim[level];
+        }
+        uint32 jpegBytes = rate.bytes;
+        uint32 directBytes = sizeof(BLP_HEADER) + palettized.bytes;
+        bool jpegMeets = jpegSsim >= floor && (options.byteBudget == 0 || jpegBytes <= options.byteBudget);
+        bool directMeets = palettized.ssim >= floor &&
+                           (options.byteBudget == 0 || directBytes <= options.byteBudget);
+        if (jpegMeets && directMeets)
+            direct = directBytes < jpegBytes;
+        else if (jpegMeets || directMeets)
+            direct = directMeets;
+        else
+            direct = palettized.ssim > jpegSsim;
+
+        report.autoChosen = true;
+        report.jpegBytes = jpegBytes;
+        report.jpegSsim = jpegSsim;
+        report.directBytes = directBytes;
+        report.directSsim = palettized.ssim;
+    }
+    return BLP_WRITER_OK;
+}
+
+// Writes the levels: those of reuse as they are, then those encoded up
+// front, or else each one as encoder compresses it, resizing the next
+// from it unless every level left is reused.
+BLPWriterError BLPWriteSession::WriteLevels(bool direct, BLPJpegEncoder* encoder, const BLPReuseInfo* reuse)
+{
+    // A Direct file has its palette where a JPEG file has its header size
+    // (0 unless a shared header is reused).
+    const uint8* reuseBytes = reuse != NULL ? (const uint8*)(reuse + 1) : NULL;
+    BLPWriterError error = direct
+        ? writer.BeginDirect(width, height, levels, palettized.alphaBits, palettized.palette)
+        : writer.BeginJpeg(width, height, levels, options.hasAlpha ? 8 : 0, reuseBytes,
+                           reuse != NULL ? reuse->headerSize : 0);
+    if (error != BLP_WRITER_OK)
+        return error;
+
+    // Mips 1, 3, 5... are resized into resized[0], mips 2, 4, 6... into
+    // resized[1].
+    const bool reuseAll = reuse != NULL && reuse->levels >= levels;
+    uint8* resized[2] = { NULL, NULL };
+    if (encoder != NULL && !reuseAll && levels > 1) {
+        resized[0] = (uint8*)BLPLargeAlloc(static_cast<size_t>(Halved(width)) * Halved(height) * 4u,
+                                           environment.blocks);
+        resized[1] = (uint8*)BLPLargeAlloc(static_cast<size_t>(Halved(Halved(width))) * Halved(Halved(height)) * 4u,
+                                           environment.blocks);
+        if (resized[0] == NULL || resized[1] == NULL)
+            error = BLP_WRITER_NO_MEMORY;
+    }
+
+    int32 curW = width;
+    int32 curH = height;
+    const uint8* current = pixels;
+    for (int32 level = 0; error == BLP_WRITER_OK && level < levels; level++) {
+        if (Cancelled()) {
+            error = BLP_WRITER_CANCELLED;
+            break;
+        }
+
+        TimedZone encodeZone(kEncodeMipZones[level], report.encodeMs);
+        const uint8* data = NULL;
+        uint32 size = 0;
+        if (reuse != NULL && level < reuse->levels) {
+            data = reuseBytes + reuse->offset[level];
+            size = reuse->size[level];
+            report.reusedLevels++;
+        } else if (direct) {
+            data = palettized.levels[level].data();
+            size = (uint32)palettized.levels[level].size();
+        } else if (encoder == NULL) {
+            data = rate.levels[level].data();
+            size = (uint32)rate.levels[level].size();
+        } else {
+            error = encoder->EncodePixels(current, curW, curH);
+            data = encoder->Data();
+            size = encoder->Size();
+        }
+        encodeZone.End();
+
+        if (error == BLP_WRITER_OK)
+            error = writer.AddLevel(data, size);
+
+        const int32 nextW = Halved(curW);
+        const int32 nextH = Halved(curH);
+        if (error == BLP_WRITER_OK && level + 1 < levels && encoder != NULL && !reuseAll) {
+            TimedZone zone("resize", report.resizeMs);
+            uint8* next = resized[level & 1];
+            BLPResizeLevel(current, curW, curH, next, nextW, nextH, environment.cancel);
+            current = next;
+        }
+        curW = nextW;
+        curH = nextH;
+    }
+
+    BLPLargeFree(resized[0]);
+    BLPLargeFree(resized[1]);
+    return error;
+}
@@ -0,0 +1,173 @@
+//-------------------------------------------------------------------------------
+//
+//	File:
+//		BLPWriteSession.h
+//
+//	Description:
+//		A whole save: RGBA pixels of mip 0 and the save's settings in, a
+//		BLP1 file out through a BLPWriteProc.
+//
+//		A session makes the mip chain, decides whether the levels of the
+//		file the document was read from can be copied instead of encoded
+//		(BLPReuseInfo), chooses between the fixed quality of one
+//		BLPJpegEncoder, rate control (BLPRateControl.h) and palettizing
+//		(BLPPalette.h), and drives a BLPWriter with the levels. The caller
+//		hands it the pixels and tells it where to write, where to take
+//		large blocks from, what to poll for a cancel and which pool to run
+//		tasks on (BLPWriteEnvironment), so a plug-in selector and a tool
+//		drive the same code.
+//
+//-------------------------------------------------------------------------------
+
+#ifndef __BLPWriteSession_H__
+#define __BLPWriteSession_H__
+
+#include "BLPMemPolicy.h"
+#include "BLPPalette.h"
+#include "BLPRateControl.h"
+#include "BLPTaskPool.h"
+#include "BLPWriter.h"
+#include <cstddef>
+
+// How a save stores the levels.
+enum BLPWriteCompression {
+    BLP_WRITE_JPEG = 0,     // JPEG, as rate control or the fixed quality decides
+    BLP_WRITE_DIRECT,       // 256-color palette (BLPPalette.h)
+    BLP_WRITE_AUTO          // the smaller of both that reaches the SSIM floor
+};
+
+// The SSIM floor of BLP_WRITE_AUTO when minSsim is not set.
+const double kBLPAutoMinSsim = 0.97;
+
+// What the plug-in keeps with a document read from a JPEG BLP (in
+// Photoshop's revertInfo), so that a save of the unchanged pixels can copy
+// the compressed levels instead of encoding them again. The shared JPEG
+// header and the level bytes follow the struct. The levels below mip 0 are
+// resized from it, so while mip 0 is unchanged they are too and only its
+// hash is kept.
+const uint32 kBLPReuseTag = 0x42527532;	// 'BRu2'; change with the layout
+
+typedef struct BLPReuseInfo
+{
+	uint32 tag;
+	uint32 width;
+	uint32 height;
+	int32 levels;					// levels kept, from mip 0
+	uint64 tablesHash;				// BLPQuantTablesHash of mip 0
+	uint64 settingsHash;			// BLPEncodeSettingsHash of a save with no options
+	uint64 mip0Hash;				// BLPHash64 of the RGBA pixels of mip 0
+	uint32 headerSize;				// shared JPEG header, first in the bytes
+	uint32 offset[kBLPMaxMips];		// of each level in the bytes
+	uint32 size[kBLPMaxMips];
+} BLPReuseInfo;
+
+// What decides the bytes of a level besides the quantization tables, which
+// stand for the quality, the alpha quality and the alpha sampling: the
+// encoder's other settings.
+uint64 BLPEncodeSettingsHash(const BLPEncodeSettings& settings);
+
+// The choices of a save besides the pixels.
+typedef struct BLPWriteOptions
+{
+    int32 levels;               // to write from mip 0, 0 for all of them down to 1x1
+    bool hasAlpha;              // store the alpha channel
+    BLPEncodeSettings settings;
+    int32 compression;          // BLPWriteCompression
+    uint32 byteBudget;          // largest file, 0 for none (BLPRateControl.h)
+    double minSsim;             // least SSIM of every level, 0 for none
+    BLPWriterLayout layout;
+    long maxMemory;             // libjpeg's max_memory_to_use, 0 for no limit
+} BLPWriteOptions;
+
+// Where a session writes and what it runs on. Everything but write may be
+// NULL; all of it is used on the thread that calls Write only, except the
+// pool.
+typedef struct BLPWriteEnvironment
+{
+    BLPWriteProc write;
+    void* context;              // of write
+    const BLPBlockSource* blocks;   // for the image-sized buffers (BLPLargeAlloc)
+    const BLPCancel* cancel;    // polled between levels and every band of rows
+    const BLPTaskHost* waiter;  // while the tasks of an up-front encode run
+    BLPTaskPool* pool;          // for them, NULL to run them on the calling thread
+} BLPWriteEnvironment;
+
+// With a byte budget, an SSIM floor, a compression other than JPEG or
+// trellis quantization every level is encoded before any is written, the
+// trials, the palettizing and trellis levels as tasks of the pool.
+// Otherwise one compressor serves the levels as they are resized.
+bool BLPEncodesUpFront(const BLPWriteOptions& options);
+
+// The levels options writes for a width x height image.
+int32 BLPWriteLevels(const BLPWriteOptions& options, int32 width, int32 height);
+
+// The shape of a save of a width x height image with options, its trials
+// on threads threads, for BLPWriteWorkingSet.
+void BLPShapeWrite(const BLPWriteOptions& options, int32 width, int32 height, int32 threads,
+                   BLPWriteShape& shape);
+
+// What a session did, for stats and the log.
+typedef struct BLPWriteReport
+{
+    int32 compression;          // BLP_WRITE_JPEG or BLP_WRITE_DIRECT, as stored
+    int32 reusedLevels;         // copied from the BLPReuseInfo
+    int32 targetMet;            // byte budget or SSIM floor: 1 met, 0 missed, -1 none
+    bool rateControlled;        // JPEG levels from BLPRateControl with a target
+    bool rateMet;               // whether it reached the target
+    int32 rateQuality;          // of mip 0
+    int32 rateTrials;
+    bool autoChosen;            // BLP_WRITE_AUTO compared the two below
+    uint32 jpegBytes;
+    double jpegSsim;            // lowest of the levels
+    uint32 directBytes;
+    double directSsim;
+    double resizeMs;            // making the next level, one compressor
+    double encodeMs;            // compressing, with the resizing when up front
+} BLPWriteReport;
+
+class BLPWriteSession {
+  public:
+	BLPWriteSession(const BLPWriteOptions& options, const BLPWriteEnvironment& environment);
+	~BLPWriteSession();
+
+	/// Writes the file of width x height RGBA pixels at rgba. reuse, if
+	/// not NULL, holds reuseSize bytes of a BLPReuseInfo and its levels;
+	/// they are copied if they stand for rgba at these settings and
+	/// ignored if not. Returns BLP_WRITER_CANCELLED once cancel has fired
+	/// or the tasks were cancelled, and BLP_WRITER_NO_MEMORY if a buffer
+	/// could not be had or an up-front encode failed. One call per
+	/// session.
+	BLPWriterError Write(const uint8* rgba, int32 width, int32 height,
+	                     const void* reuse = NULL, size_t reuseSize = 0);
+
+	/// The header as written, complete after Write.
+	const BLP_HEADER& Header(void) const { return writer.Header(); }
+
+	/// The bytes written, the file size after Write.
+	uint32 Bytes(void) const { return writer.Bytes(); }
+
+	const BLPWriteReport& Report(void) const { return report; }
+
+  private:
+	BLPWriteOptions options;
+	BLPWriteEnvironment environment;
+	BLPWriter writer;
+	BLPWriteReport report;
+	BLPRateResult rate;
+	BLPDirectResult palettized;
+	const uint8* pixels;
+	int32 width;
+	int32 height;
+	int32 levels;
+
+	BLPWriterError EncodeUpFront(bool& direct);
+	BLPWriterError ResizeChain(BLPRateLevel* chain, uint8*& block);
+	BLPWriterError WriteLevels(bool direct, BLPJpegEncoder* encoder, const BLPReuseInfo* reuse);
+	const BLPReuseInfo* Reusable(const void* reuse, size_t reuseSize, uint64 tablesHash) const;
+	bool Cancelled(void) const;
+
+	BLPWriteSession(const BLPWriteSession&);
+	BLPWriteSession& operator=(const BLPWriteSession&);
+};
+
+#endif // __BLPWriteSession_H__
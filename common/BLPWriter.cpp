@@ -0,0 +1,359 @@
+//-------------------------------------------------------------------------------
+//
+//	File:
+//		BLPWriter.cpp
+//
+//	Description:
+//		Writing of BLP1 files and the JPEG encoder of their levels. See
+//		BLPWriter.h.
+//
+//		libjpeg reports errors with longjmp. Each encoder method that calls
+//		it sets its own jump point and leaves the work to a function below
+//		it, so the frame that called setjmp has no locals to lose. The
+//		destination grows its buffer in C++ and turns a bad_alloc into a
+//		libjpeg error, so no exception crosses libjpeg either.
+//
+//-------------------------------------------------------------------------------
+
+#include "BLPWriter.h"
+#include "BLPCodec.h"
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <setjmp.h>
+
+extern "C" {
+#include "../ThirdParty/jpeg/include/jpeglib.h"
+#include "../ThirdParty/jpeg/include/jerror.h"
+#include "../ThirdParty/jpeg/include/jmemarena.h"
+}
+
+namespace {
+
+// The output buffer starts at this size and doubles when full.
+const size_t kMinOutputBytes = 65536;
+
+typedef struct EncoderErrorMgr
+{
+    struct jpeg_error_mgr pub;
+    jmp_buf setjmp_buffer;
+    bool noMemory;              // the destination could not grow
+} EncoderErrorMgr;
+
+typedef struct EncoderDestination
+{
+    struct jpeg_destination_mgr pub;
+    struct BLPJpegEncoderState* state;
+} EncoderDestination;
+
+} // namespace
+
+struct BLPJpegEncoderState
+{
+    struct jpeg_compress_struct cinfo;
+    EncoderErrorMgr err;
+    EncoderDestination dest;
+    jpeg_arena* arena;
+    BLPByteBuffer output;       // sized for the largest level so far
+    size_t outputSize;          // of the level encoded last
+    BLPByteBuffer row;
+    BLPCancel cancel;           // what libjpeg polls; cancelled is NULL for nothing
+    bool created;               // the compressor is set up
+};
+
+namespace {
+
+METHODDEF(void) EncoderErrorExit(j_common_ptr cinfo)
+{
+    EncoderErrorMgr* err = (EncoderErrorMgr*)cinfo->err;
+    longjmp(err->setjmp_buffer, 1);
+}
+
+METHODDEF(void) EncoderOutputMessage(j_common_ptr)
+{
+    // Warnings are ignored and errors returned.
+}
+
+METHODDEF(void) InitDestination(j_compress_ptr cinfo)
+{
+    EncoderDestination* dest = (EncoderDestination*)cinfo->dest;
+    dest->pub.next_output_byte = dest->state->output.data();
+    dest->pub.free_in_buffer = dest->state->output.size();
+}
+
+METHODDEF(boolean) EmptyOutputBuffer(j_compress_ptr cinfo)
+{
+    EncoderDestination* dest = (EncoderDestination*)cinfo->dest;
+    BLPByteBuffer& output = dest->state->output;
+    size_t used = output.size();
+    bool grown = true;
+    try {
+        output.resize(used * 2);
+    } catch (const std::bad_alloc&) {
+        grown = false;
+    }
+    if (!grown) {
+        dest->state->err.noMemory = true;
+        (*cinfo->err->error_exit)((j_common_ptr)cinfo);
+    }
+    dest->pub.next_output_byte = output.data() + used;
+    dest->pub.free_in_buffer = output.size() - used;
+    return TRUE;
+}
+
+METHODDEF(void) TermDestination(j_compress_ptr cinfo)
+{
+    EncoderDestination* dest = (EncoderDestination*)cinfo->dest;
+    dest->state->outputSize = dest->state->output.size() - dest->pub.free_in_buffer;
+}
+
+// What a longjmp out of libjpeg comes back as. The compressor drops the
+// level it was on and can take the next one.
+BLPWriterError EncoderFailed(BLPJpegEncoderState* state)
+{
+    bool noMemory = state->err.noMemory || state->err.pub.msg_code == JERR_OUT_OF_MEMORY;
+    bool cancelled = state->cancel.cancelled != NULL && BLPCancelled(&state->cancel);
+    state->err.noMemory = false;
+    jpeg_abort_compress(&state->cinfo);
+    state->outputSize = 0;
+    return cancelled ? BLP_WRITER_CANCELLED : noMemory ? BLP_WRITER_NO_MEMORY : BLP_WRITER_JPEG;
+}
+
+// Makes room for a level of width pixels per row before libjpeg runs:
+// the output starts from its whole capacity, so the space an earlier
+// level grew it to is kept.
+bool PrepareBuffers(BLPJpegEncoderState* state, int32 width)
+{
+    try {
+        if (state->row.size() < (size_t)width * 4)
+            state->row.resize((size_t)width * 4);
+        size_t capacity = state->output.capacity();
+        state->output.resize(capacity > kMinOutputBytes ? capacity : kMinOutputBytes);
+    } catch (const std::bad_alloc&) {
+        return false;
+    }
+    return true;
+}
+
+void CreateCompressor(BLPJpegEncoderState* state, const BLPEncodeSettings& settings, long maxMemory)
+{
+    jpeg_create_compress(&state->cinfo);
+    jpeg_set_arena((j_common_ptr)&state->cinfo, state->arena);
+    state->cinfo.mem->max_memory_to_use = maxMemory;
+    if (state->cancel.cancelled != NULL)
+        BLPWatchCancel((j_common_ptr)&state->cinfo, state->cancel);
+    BLPSetupEncoder(&state->cinfo, settings);
+    state->cinfo.dest = &state->dest.pub;
+}
+
+void WritePixels(BLPJpegEncoderState* state, const uint8* rgba, int32 width, int32 height)
+{
+    j_compress_ptr cinfo = &state->cinfo;
+    cinfo->image_width = width;
+    cinfo->image_height = height;
+    jpeg_start_compress(cinfo, TRUE);
+
+    // Written as CMYK components in B, G, R, A order.
+    BLPWriteJpegScanlines(cinfo, rgba, width, state->row.data());
+
+    // Also returns the level's pools to the arena for the next level.
+    jpeg_finish_compress(cinfo);
+}
+
+} // namespace
+
+/*****************************************************************************/
+
+BLPWriter::BLPWriter(BLPWriteProc inWrite, void* inContext, const BLPWriterLayout& inLayout)
+    : write(inWrite), context(inContext), layout(inLayout), levels(0), added(0), position(0)
+{
+    memset(&header, 0, sizeof(header));
+}
+
+BLPWriterError BLPWriter::Put(const void* data, uint32 size)
+{
+    if ((uint64)position + size > 0xFFFFFFFFull || !write(context, position, data, size))
+        return BLP_WRITER_IO;
+    position += size;
+    return BLP_WRITER_OK;
+}
+
+BLPWriterError BLPWriter::Begin(int32 width, int32 height, int32 inLevels, uint32 compression,
+                                uint32 alphaBits)
+{
+    memset(&header, 0, sizeof(header));
+    memcpy(&header.MagicNumber, "BLP1", 4);
+    header.Compression = compression;
+    header.alpha_bits = alphaBits;
+    header.Width = width;
+    header.Height = height;
+    header.extra = 4; // Team color flag, usually 4 or 5
+    header.has_mipMaps = inLevels > 1 ? 1 : 0;
+    levels = inLevels < kBLPMaxMips ? inLevels : kBLPMaxMips;
+    added = 0;
+    position = 0;
+    return Put(&header, sizeof(header));
+}
+
+BLPWriterError BLPWriter::BeginDirect(int32 width, int32 height, int32 inLevels, uint32 alphaBits,
+                                      const uint8* palette)
+{
+    BLPWriterError error = Begin(width, height, inLevels, BLP_COMPRESSION_DIRECT, alphaBits);
+    if (error == BLP_WRITER_OK)
+        error = Put(palette, 256 * 4);
+    return error;
+}
+
+BLPWriterError BLPWriter::BeginJpeg(int32 width, int32 height, int32 inLevels, uint32 alphaBits,
+                                    const uint8* jpegHeader, uint32 headerSize)
+{
+    BLPWriterError error = Begin(width, height, inLevels, BLP_COMPRESSION_JPEG, alphaBits);
+    if (error == BLP_WRITER_OK)
+        error = Put(&headerSize, 4);
+    if (error == BLP_WRITER_OK && headerSize != 0)
+        error = Put(jpegHeader, headerSize);
+    return error;
+}
+
+// Writes level at the position, after zero padding up to the next
+// kBLPMipAlignment boundary if the level qualifies.
+BLPWriterError BLPWriter::PutLevel(int32 level, const uint8* data, uint32 size)
+{
+    if (layout.alignMips && size >= kBLPMipAlignment && position % kBLPMipAlignment != 0) {
+        static const uint8 zeros[kBLPMipAlignment] = { 0 };
+        BLPWriterError error = Put(zeros, kBLPMipAlignment - position % kBLPMipAlignment);
+        if (error != BLP_WRITER_OK)
+            return error;
+    }
+    header.Offset[level] = position;
+    header.Size[level] = size;
+    return Put(data, size);
+}
+
+BLPWriterError BLPWriter::AddLevel(const uint8* data, uint32 size)
+{
+    if (added >= levels)
+        return BLP_WRITER_IO;
+    int32 level = added++;
+    if (!layout.smallestFirst)
+        return PutLevel(level, data, size);
+
+    try {
+        held[level].assign(data, data + size);
+    } catch (const std::bad_alloc&) {
+        return BLP_WRITER_NO_MEMORY;
+    }
+    header.Size[level] = size;
+    return BLP_WRITER_OK;
+}
+
+BLPWriterError BLPWriter::Finish(void)
+{
+    // The smallest levels end up in one run right after the palette or
+    // the JPEG header.
+    if (layout.smallestFirst) {
+        for (int32 level = added - 1; level >= 0; level--) {
+            BLPWriterError error = PutLevel(level, held[level].data(), (uint32)held[level].size());
+            BLPByteBuffer().swap(held[level]);
+            if (error != BLP_WRITER_OK)
+                return error;
+        }
+    }
+    if (!write(context, 0, &header, sizeof(header)))
+        return BLP_WRITER_IO;
+    return BLP_WRITER_OK;
+}
+
+/*****************************************************************************/
+
+BLPJpegEncoder::BLPJpegEncoder() : state(NULL)
+{
+}
+
+BLPJpegEncoder::~BLPJpegEncoder()
+{
+    if (state == NULL)
+        return;
+    jpeg_destroy_compress(&state->cinfo);
+    if (state->arena != NULL)
+        jpeg_arena_destroy(state->arena);
+    delete state;
+}
+
+BLPWriterError BLPJpegEncoder::Create(const BLPEncodeSettings& settings, long maxMemory,
+                                      const BLPCancel* cancel)
+{
+    if (state != NULL)
+        return BLP_WRITER_JPEG;
+    state = new (std::nothrow) BLPJpegEncoderState;
+    if (state == NULL)
+        return BLP_WRITER_NO_MEMORY;
+    memset(&state->cinfo, 0, sizeof(state->cinfo));
+    state->cinfo.err = jpeg_std_error(&state->err.pub);
+    state->err.pub.error_exit = EncoderErrorExit;
+    state->err.pub.output_message = EncoderOutputMessage;
+    state->err.noMemory = false;
+    state->dest.pub.init_destination = InitDestination;
+    state->dest.pub.empty_output_buffer = EmptyOutputBuffer;
+    state->dest.pub.term_destination = TermDestination;
+    state->dest.state = state;
+    state->outputSize = 0;
+    state->cancel.cancelled = NULL;
+    state->cancel.context = NULL;
+    if (cancel != NULL)
+        state->cancel = *cancel;
+    state->created = false;
+
+    state->arena = jpeg_arena_create(0);
+    if (state->arena == NULL)
+        return BLP_WRITER_NO_MEMORY;
+
+    if (setjmp(state->err.setjmp_buffer))
+        return EncoderFailed(state);
+    CreateCompressor(state, settings, maxMemory);
+    state->created = true;
+    return BLP_WRITER_OK;
+}
+
+uint64 BLPJpegEncoder::TablesHash(void) const
+{
+    return state != NULL ? BLPQuantTablesHash(&state->cinfo) : 0;
+}
+
+BLPWriterError BLPJpegEncoder::EncodePixels(const uint8* rgba, int32 width, int32 height)
+{
+    if (state == NULL || !state->created)
+        return BLP_WRITER_JPEG;
+    if (!PrepareBuffers(state, width))
+        return BLP_WRITER_NO_MEMORY;
+    if (setjmp(state->err.setjmp_buffer))
+        return EncoderFailed(state);
+    WritePixels(state, rgba, width, height);
+    return BLP_WRITER_OK;
+}
+
+const uint8* BLPJpegEncoder::Data(void) const
+{
+    return state != NULL ? state->output.data() : NULL;
+}
+
+uint32 BLPJpegEncoder::Size(void) const
+{
+    return state != NULL ? (uint32)state->outputSize : 0;
+}
+
+/*****************************************************************************/
+
+const char* BLPWriterErrorString(BLPWriterError error)
+{
+    switch (error) {
+        case BLP_WRITER_OK:         return "no error";
+        case BLP_WRITER_IO:         return "file could not be written";
+        case BLP_WRITER_NO_MEMORY:  return "out of memory";
+        case BLP_WRITER_JPEG:       return "JPEG encoder failed";
+        case BLP_WRITER_CANCELLED:  return "cancelled";
+        default:                    return "unknown error";
+    }
+}
+
+// end BLPWriter.cpp
@@ -0,0 +1,134 @@
+//-------------------------------------------------------------------------------
+//
+//	File:
+//		BLPWriter.h
+//
+//	Description:
+//		Writing of BLP1 files through a callback, and the JPEG encoder of
+//		their levels.
+//
+//		BLPWriter lays a file out: the header, the palette of a Direct
+//		file or the shared header of a JPEG file, then the levels in the
+//		order they are added, or smallest first, each one optionally
+//		aligned. The header is rewritten with the offsets and sizes last.
+//
+//		BLPJpegEncoder keeps one libjpeg compressor for every level of a
+//		file. Each object holds all of its state, so any number may run at
+//		once on different threads. libjpeg's errors end the method that
+//		ran into them and come back as a BLPWriterError; no jump leaves
+//		BLPWriter.cpp.
+//
+//		BLPWriteSession (BLPWriteSession.h) drives both for a whole save.
+//
+//-------------------------------------------------------------------------------
+
+#ifndef __BLPWriter_H__
+#define __BLPWriter_H__
+
+#include "BLPFile.h"
+#include "BLPMemStats.h"
+#include "BLPRateControl.h"
+
+enum BLPWriterError {
+    BLP_WRITER_OK = 0,
+    BLP_WRITER_IO,                  // the destination failed
+    BLP_WRITER_NO_MEMORY,
+    BLP_WRITER_JPEG,                // libjpeg failed for another reason
+    BLP_WRITER_CANCELLED            // the BLPCancel of the encoder fired
+};
+
+// Writes size bytes at offset from the start of the file. Returns false
+// on an error or a short write.
+typedef bool (*BLPWriteProc)(void* context, uint32 offset, const void* data, uint32 size);
+
+// With alignMips, levels of at least this many bytes start on a multiple
+// of it, so a streamer can read them with unbuffered (direct) I/O.
+const uint32 kBLPMipAlignment = 4096;
+
+typedef struct BLPWriterLayout
+{
+    bool smallestFirst;     // the smallest levels in one run after the palette or shared header
+    bool alignMips;         // see kBLPMipAlignment; padding is zeros
+} BLPWriterLayout;
+
+class BLPWriter {
+  public:
+	BLPWriter(BLPWriteProc write, void* context, const BLPWriterLayout& layout);
+
+	/// Writes the header of a width x height Direct file of levels levels,
+	/// its offsets and sizes still 0, and the 256 B, G, R, 0 entries of
+	/// palette.
+	BLPWriterError BeginDirect(int32 width, int32 height, int32 levels, uint32 alphaBits,
+	                           const uint8* palette);
+
+	/// The same for a JPEG file, with the shared header of headerSize bytes
+	/// at jpegHeader (0 and NULL for none).
+	BLPWriterError BeginJpeg(int32 width, int32 height, int32 levels, uint32 alphaBits,
+	                         const uint8* jpegHeader, uint32 headerSize);
+
+	/// Adds the next level, mip 0 first. It is written now, or copied
+	/// until Finish with smallestFirst.
+	BLPWriterError AddLevel(const uint8* data, uint32 size);
+
+	/// Writes the levels held for smallestFirst and rewrites the header.
+	BLPWriterError Finish(void);
+
+	/// The header as written, complete after Finish.
+	const BLP_HEADER& Header(void) const { return header; }
+
+	/// The bytes written, the file size after Finish.
+	uint32 Bytes(void) const { return position; }
+
+  private:
+	BLPWriteProc write;
+	void* context;
+	BLPWriterLayout layout;
+	BLP_HEADER header;
+	int32 levels;
+	int32 added;
+	uint32 position;
+	BLPByteBuffer held[kBLPMaxMips];
+
+	BLPWriterError Begin(int32 width, int32 height, int32 levels, uint32 compression,
+	                     uint32 alphaBits);
+	BLPWriterError Put(const void* data, uint32 size);
+	BLPWriterError PutLevel(int32 level, const uint8* data, uint32 size);
+
+	BLPWriter(const BLPWriter&);
+	BLPWriter& operator=(const BLPWriter&);
+};
+
+struct BLPJpegEncoderState;
+
+class BLPJpegEncoder {
+  public:
+	BLPJpegEncoder();
+	~BLPJpegEncoder();
+
+	/// Makes the compressor with settings (BLPSetupEncoder), its pools in
+	/// an arena (jmemarena.h) so that only the first, largest level
+	/// reaches malloc. maxMemory is libjpeg's max_memory_to_use, 0 for
+	/// no limit. Every level polls cancel, if not NULL, as it encodes.
+	BLPWriterError Create(const BLPEncodeSettings& settings, long maxMemory,
+	                      const BLPCancel* cancel = NULL);
+
+	/// BLPQuantTablesHash of the compressor.
+	uint64 TablesHash(void) const;
+
+	/// Encodes width x height RGBA pixels as one level.
+	BLPWriterError EncodePixels(const uint8* rgba, int32 width, int32 height);
+
+	/// The level encoded last, valid until the next one.
+	const uint8* Data(void) const;
+	uint32 Size(void) const;
+
+  private:
+	BLPJpegEncoderState* state;
+
+	BLPJpegEncoder(const BLPJpegEncoder&);
+	BLPJpegEncoder& operator=(const BLPJpegEncoder&);
+};
+
+const char* BLPWriterErrorString(BLPWriterError error);
+
+#endif // __BLPWriter_H__
@@ -1,5 +1,5 @@
 #include "PIDefines.h"
-#include <fstream>
+#include <string>
 #include <vector>
 #include "ASTypes.h"
 
@@ -16,31 +16,69 @@ typedef basic_string<ASUnicode, char_traits<ASUnicode>, allocator<ASUnicode> > p
 
 const bool kWriteEOL = true;
 
+/** Levels of a log line, lowest first.
+**/
+#define LOGGER_DEBUG	0
+#define LOGGER_INFO		1
+#define LOGGER_WARNING	2
+#define LOGGER_ERROR	3
+
+/** Lines below this level are compiled out of LOGGER_WRITE. Set it with
+ *  the compiler, e.g. -DLOGGER_MIN_LEVEL=0 for a build that can debug.
+**/
+#ifndef LOGGER_MIN_LEVEL
+#define LOGGER_MIN_LEVEL LOGGER_INFO
+#endif
 
-/** Write stuff to a file on the desktop or in a fullpath
+/** Writes a fragment at level when the build and the log want it. Below
+ *  LOGGER_MIN_LEVEL the condition is a constant false and the call,
+ *  arguments included, is dropped by the compiler.
+**/
+#define LOGGER_WRITE(logger, level, ...) \
+	do { \
+		if ((level) >= LOGGER_MIN_LEVEL && (logger) != NULL && (logger)->Wants(level)) \
+			(logger)->At(level).Write(__VA_ARGS__); \
+	} while (0)
+
+struct LoggerQueue;
+
+/** Write stuff to a file on the desktop or in a fullpath.
+ *
+ *  Logging is off unless the environment variable BLP_LOG is set to a
+ *  level: debug, info, warning or error. Fragments are formatted into a
+ *  buffer of the calling thread; the end of a line hands the line to a
+ *  lock-free ring that a background thread writes to the file. A full
+ *  ring drops lines rather than wait.
 **/
 class Logger {
 
-	char fullPath[MAX_PATH];
+	LoggerQueue * queue;
 
-	ofstream fileOut;
+	int32 level;
 
-	void Open(void);
-	
-	void Close(void);
+	void EndLine(void);
 
 	/// Not allowed
 	Logger();
+	Logger( const Logger & );
+	Logger & operator=( const Logger & );
 
  public:
 
-	/// Create a logger file on the Desktop with .log on the end
+	/// Create a logger for the file on the Desktop with .log on the end;
+	/// the file is opened by the background thread on the first line
 	Logger( const char * inString );
 
-	/// Do nothing
+	/// Write out the lines still queued and stop the background thread
 	~Logger();
 
-	/// Write out a message to the log file, open, write, close
+	/// True if lines at inLevel go to the file
+	bool Wants( const int32 inLevel ) const { return queue != NULL && inLevel >= level; }
+
+	/// Raise the level of the line of the calling thread to inLevel
+	Logger & At( const int32 inLevel );
+
+	/// Add to the line of the calling thread, queue it with endOfLine
 	void Write( const char * inMessage, const bool endOfLine = false );
 	void Write( const int32 inValue, const bool endOfLine = false );
 	void Write( const double inValue, const bool endOfLine = false );
@@ -48,7 +86,7 @@ class Logger {
 	void Write( ps_wstring & inValue, const bool endOfLine = false );
 	void Write( vector<string> & inValue, const bool endOfLine = false );
 	void Write( vector<ps_wstring> & inValue, const bool endOfLine = false );
-    
+
     static const bool addEndOfLine;
 
 };
@@ -1,60 +1,308 @@
 #include "PITypes.h"
 #include "Logger.h"
 #include "PIUFile.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <new>
+#include <system_error>
+#include <thread>
 
 const bool Logger::addEndOfLine = true;
 
-Logger::Logger( const char * inString )
+// Lines are cut at kLineBytes - 1 characters; the ring holds kRecords of
+// them, a power of two.
+static const size_t kLineBytes = 240;
+static const size_t kRecords = 256;
+
+typedef struct LoggerRecord
+{
+	std::atomic<size_t> sequence;	// see LoggerQueue
+	int32 level;
+	uint32 thread;
+	int64 time;						// milliseconds since 1970
+	char text[kLineBytes];
+} LoggerRecord;
+
+// A bounded multi-producer, single-consumer ring (D. Vyukov's): a record
+// whose sequence equals the enqueue position is free, one whose sequence
+// is the position + 1 is full. Producers claim a position with one
+// compare-exchange and never wait.
+struct LoggerQueue
+{
+	LoggerRecord records[kRecords];
+	std::atomic<size_t> enqueuePos;
+	std::atomic<size_t> dequeuePos;
+	std::atomic<uint32> dropped;
+
+	char name[MAX_PATH];
+	FILE * file;
+	bool fileFailed;
+
+	std::atomic<bool> started;
+	std::atomic<bool> stopping;
+	std::thread flusher;
+	std::mutex wakeLock;
+	std::condition_variable wake;
+};
+
+typedef struct LoggerLine
+{
+	char text[kLineBytes];
+	size_t length;
+	int32 level;
+} LoggerLine;
+
+static thread_local LoggerLine tLine = { { 0 }, 0, LOGGER_DEBUG };
+static thread_local uint32 tThread = 0;
+static std::atomic<uint32> gNextThread(1);
+
+static const char * const kLevelNames[] = { "DEBUG", "INFO ", "WARN ", "ERROR" };
+
+/*****************************************************************************/
+
+// The level BLP_LOG asks for, -1 for none.
+static int32 LevelFromEnvironment(void)
 {
+	const char * value = getenv("BLP_LOG");
+	if (value == NULL || value[0] == '\0')
+		return -1;
+	if (strcmp(value, "debug") == 0 || strcmp(value, "0") == 0)
+		return LOGGER_DEBUG;
+	if (strcmp(value, "info") == 0 || strcmp(value, "1") == 0)
+		return LOGGER_INFO;
+	if (strcmp(value, "warning") == 0 || strcmp(value, "2") == 0)
+		return LOGGER_WARNING;
+	if (strcmp(value, "error") == 0 || strcmp(value, "3") == 0)
+		return LOGGER_ERROR;
+	return -1;
+}
 
+static bool Push(LoggerQueue * queue, const LoggerLine & line)
+{
+	size_t pos = queue->enqueuePos.load(std::memory_order_relaxed);
+	LoggerRecord * record;
+	for (;;)
+	{
+		record = &queue->records[pos & (kRecords - 1)];
+		size_t sequence = record->sequence.load(std::memory_order_acquire);
+		intptr_t difference = (intptr_t)sequence - (intptr_t)pos;
+		if (difference == 0)
+		{
+			if (queue->enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if (difference < 0)
+		{
+			queue->dropped++;
+			return false;
+		}
+		else
+		{
+			pos = queue->enqueuePos.load(std::memory_order_relaxed);
+		}
+	}
+
+	if (tThread == 0)
+		tThread = gNextThread++;
+	record->level = line.level;
+	record->thread = tThread;
+	record->time = (int64)std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+	memcpy(record->text, line.text, line.length + 1);
+	record->sequence.store(pos + 1, std::memory_order_release);
+	return true;
+}
+
+// Opens the file on first use, off the plug-in's thread: finding the
+// Desktop can take a while.
+static FILE * OpenFile(LoggerQueue * queue)
+{
+	if (queue->file != NULL || queue->fileFailed)
+		return queue->file;
+
+	char fullPath[MAX_PATH];
 	if (GetFullPathToDesktop(fullPath, MAX_PATH))
 	{
 		fullPath[0] = '\0';
 	}
-	
-	PIstrlcat(fullPath, inString, MAX_PATH-1);
-
+	PIstrlcat(fullPath, queue->name, MAX_PATH-1);
 	PIstrlcat(fullPath, ".log", MAX_PATH-1);
-	
+
+	queue->file = fopen(fullPath, "a");
+	queue->fileFailed = queue->file == NULL;
+	return queue->file;
+}
+
+// Writes the queued lines. Only one thread at a time may drain.
+static void Drain(LoggerQueue * queue)
+{
+	bool wrote = false;
+	for (;;)
+	{
+		size_t pos = queue->dequeuePos.load(std::memory_order_relaxed);
+		LoggerRecord & record = queue->records[pos & (kRecords - 1)];
+		size_t sequence = record.sequence.load(std::memory_order_acquire);
+		if ((intptr_t)sequence - (intptr_t)(pos + 1) < 0)
+			break;
+
+		FILE * file = OpenFile(queue);
+		if (file != NULL)
+		{
+			time_t seconds = (time_t)(record.time / 1000);
+			struct tm local;
+		  #if MSWindows
+			localtime_s(&local, &seconds);
+		  #else
+			localtime_r(&seconds, &local);
+		  #endif
+			char stamp[32];
+			strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &local);
+			fprintf(file, "%s.%03d %s [%u] %s\n", stamp, (int)(record.time % 1000),
+					kLevelNames[record.level], (unsigned)record.thread, record.text);
+			wrote = true;
+		}
+
+		record.sequence.store(pos + kRecords, std::memory_order_release);
+		queue->dequeuePos.store(pos + 1, std::memory_order_relaxed);
+	}
+
+	uint32 dropped = queue->dropped.exchange(0);
+	if (dropped != 0 && OpenFile(queue) != NULL)
+	{
+		fprintf(queue->file, "(%u lines dropped, the log could not keep up)\n", (unsigned)dropped);
+		wrote = true;
+	}
+	if (wrote)
+		fflush(queue->file);
+}
+
+static void Flusher(LoggerQueue * queue)
+{
+	for (;;)
+	{
+		bool stopping = queue->stopping.load(std::memory_order_acquire);
+		Drain(queue);
+		if (stopping)
+			break;
+		// The destructor sets stopping under wakeLock, so checking it here
+		// under the lock cannot miss its notify.
+		std::unique_lock<std::mutex> lock(queue->wakeLock);
+		if (!queue->stopping.load(std::memory_order_acquire))
+			queue->wake.wait_for(lock, std::chrono::milliseconds(100));
+	}
+}
+
+/*****************************************************************************/
+
+Logger::Logger( const char * inString ) : queue(NULL), level(LOGGER_ERROR + 1)
+{
+	int32 wanted = LevelFromEnvironment();
+	if (wanted < 0)
+		return;
+
+	queue = new (std::nothrow) LoggerQueue;
+	if (queue == NULL)
+		return;
+	for (size_t i = 0; i < kRecords; i++)
+		queue->records[i].sequence.store(i, std::memory_order_relaxed);
+	queue->enqueuePos = 0;
+	queue->dequeuePos = 0;
+	queue->dropped = 0;
+	queue->name[0] = '\0';
+	PIstrlcat(queue->name, inString, MAX_PATH-1);
+	queue->file = NULL;
+	queue->fileFailed = false;
+	queue->started = false;
+	queue->stopping = false;
+	level = wanted;
 }
 
 Logger::~Logger()
 {
+	if (queue == NULL)
+		return;
 	try
 	{
-		fileOut.close();
+		{
+			std::lock_guard<std::mutex> lock(queue->wakeLock);
+			queue->stopping.store(true, std::memory_order_release);
+			queue->wake.notify_one();
+		}
+		if (queue->flusher.joinable())
+			queue->flusher.join();
+		Drain(queue);
+		if (queue->file != NULL)
+			fclose(queue->file);
 	}
 	catch (...)
 	{
 		/* Do nothing here, guarding against destructor throwing. */
 	}
+	delete queue;
+}
+
+Logger & Logger::At( const int32 inLevel )
+{
+	if (inLevel > tLine.level)
+		tLine.level = inLevel;
+	return *this;
+}
+
+void Logger::EndLine(void)
+{
+	if (Push(queue, tLine))
+	{
+		if (!queue->started.exchange(true))
+		{
+			try
+			{
+				queue->flusher = std::thread(Flusher, queue);
+			}
+			catch (const std::system_error &)
+			{
+				/* The destructor writes what the ring holds. */
+			}
+		}
+		queue->wake.notify_one();
+	}
+	tLine.length = 0;
+	tLine.text[0] = '\0';
+	tLine.level = LOGGER_DEBUG;
 }
-	
+
 void Logger::Write( const char * inMessage, const bool endOfLine )
 {
-	Open();
-	fileOut << inMessage;
+	if (queue == NULL)
+		return;
+	size_t room = kLineBytes - 1 - tLine.length;
+	size_t length = strlen(inMessage);
+	if (length > room)
+		length = room;
+	memcpy(tLine.text + tLine.length, inMessage, length);
+	tLine.length += length;
+	tLine.text[tLine.length] = '\0';
 	if (endOfLine)
-		fileOut << endl;
-	Close();
+		EndLine();
 }
-	
+
 void Logger::Write( const int32 inValue, const bool endOfLine )
 {
-	Open();
-	fileOut << inValue;
-	if (endOfLine)
-		fileOut << endl;
-	Close();
+	char text[16];
+	snprintf(text, sizeof(text), "%d", (int)inValue);
+	Write(text, endOfLine);
 }
 
 void Logger::Write( const double inValue, const bool endOfLine )
 {
-	Open();
-	fileOut << inValue;
-	if (endOfLine)
-		fileOut << endl;
-	Close();
+	char text[32];
+	snprintf(text, sizeof(text), "%g", inValue);
+	Write(text, endOfLine);
 }
 
 void Logger::Write( const string & inValue, const bool endOfLine )
@@ -74,12 +322,14 @@ void Logger::Write( vector<string> & inValue, const bool endOfLine )
 
 void Logger::Write( ps_wstring & inValue, const bool endOfLine )
 {
+	if (queue == NULL)
+		return;
 	ASZString zString;
 	if (!sASZString2->MakeFromUnicode((ASUnicode*)inValue.c_str(), inValue.size(), &zString))
 	{
 		ASUInt32 utf8Size = sASZString2->LengthAsUTF8String(zString);
 		unsigned char * utf8Buffer = new unsigned char[utf8Size];
-		if (!sASZString2->AsUTF8String(zString, utf8Buffer, utf8Size, true /* check string size */)) 
+		if (!sASZString2->AsUTF8String(zString, utf8Buffer, utf8Size, true /* check string size */))
 		{
 			Write((char*)utf8Buffer, endOfLine);
 		}
@@ -90,6 +340,8 @@ void Logger::Write( ps_wstring & inValue, const bool endOfLine )
 
 void Logger::Write( vector<ps_wstring> & inValue, const bool endOfLine )
 {
+	if (queue == NULL)
+		return;
 	vector<ps_wstring>::iterator iter = inValue.begin();
 	while (iter != inValue.end())
 	{
@@ -98,7 +350,7 @@ void Logger::Write( vector<ps_wstring> & inValue, const bool endOfLine )
 		{
 			ASUInt32 utf8Size = sASZString2->LengthAsUTF8String(zString);
 			unsigned char * utf8Buffer = new unsigned char[utf8Size];
-			if (!sASZString2->AsUTF8String(zString, utf8Buffer, utf8Size, true /* check string size */)) 
+			if (!sASZString2->AsUTF8String(zString, utf8Buffer, utf8Size, true /* check string size */))
 			{
 				Write((char*)utf8Buffer, endOfLine);
 			}
@@ -108,15 +360,4 @@ void Logger::Write( vector<ps_wstring> & inValue, const bool endOfLine )
 		iter++;
 	}
 }
-
-void Logger::Open(void)
-{
-	// Disabled to prevent log file creation on desktop
-	// fileOut.open(fullPath, ios_base::app|ios_base::out);
-}
-
-void Logger::Close(void)
-{
-	fileOut.close();
-}
 // end Logger.cpp
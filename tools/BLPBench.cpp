@@ -0,0 +1,433 @@
+//-------------------------------------------------------------------------------
+//
+//	File:
+//		BLPBench.cpp
+//
+//	Description:
+//		Microbenchmarks of the blpcore kernels (BLPCodec.h) and of a whole
+//		save (BLPWriteSession.h) on generated images, reported in
+//		megapixels per second.
+//
+//	Use:
+//		BLPBench [switches] [kernel...]
+//
+//		-size N					mip 0 width and height (default 1024)
+//		-minsize N				smallest mip size for the JPEG kernels (default 16)
+//		-runs N					timed runs per kernel (default 7)
+//		-time MS				least time of one run (default 50)
+//		-seed N					seed of the generated image (default 1)
+//		-list					list the kernels and exit
+//
+//		A kernel argument runs only the kernels whose name starts with
+//		it. Every run repeats the kernel until it has taken -time; the
+//		table gives the median and the best run. The image depends only
+//		on -size and -seed, so figures from the same machine and build
+//		are comparable between changes.
+//
+//		With BLP_TRACE set to a file path, each kernel and the phases
+//		inside it are appended to that file as a Chrome trace (BLPTrace.h).
+//
+//-------------------------------------------------------------------------------
+
+#include "BLPCodec.h"
+#include "BLPRateControl.h"
+#include "BLPTrace.h"
+#include "BLPWriteSession.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// Keeps the compiler from dropping kernels whose results go unused.
+volatile uint32 gSink = 0;
+
+typedef struct Options
+{
+    int32 size;
+    int32 minSize;
+    int32 runs;
+    double runMs;
+    uint32 seed;
+} Options;
+
+// Inputs shared by the kernels, made once.
+typedef struct Images
+{
+    int32 size;
+    std::vector<uint8> rgba;            // mip 0
+    std::vector<uint8> opaqueZero;      // mip 0 with alpha 0, the whole-image alpha scan
+    std::vector<uint8> indices;         // one palette index per pixel
+    std::vector<uint8> alpha8;          // 8-bit Direct alpha
+    std::vector<uint8> palette;         // 256 B, G, R, 0 entries
+    std::vector<uint8> levels[kBLPMaxMips];
+    std::vector<uint8> jpegs[kBLPMaxMips];
+    int32 levelCount;
+} Images;
+
+typedef struct Kernel
+{
+    std::string name;
+    int32 width;
+    int32 height;
+    // One call of the kernel; returns something that depends on its output.
+    uint32 (*run)(const Images& images, int32 level, std::vector<uint8>& scratch);
+    int32 level;
+} Kernel;
+
+void Usage(void)
+{
+    fprintf(stderr,
+        "usage: BLPBench [switches] [kernel...]\n"
+        "  -size N      mip 0 width and height (default 1024)\n"
+        "  -minsize N   smallest mip size for the JPEG kernels (default 16)\n"
+        "  -runs N      timed runs per kernel (default 7)\n"
+        "  -time MS     least time of one run (default 50)\n"
+        "  -seed N      seed of the generated image (default 1)\n"
+        "  -list        list the kernels and exit\n"
+        "a kernel argument runs the kernels whose name starts with it\n");
+}
+
+// A small xorshift generator: the same image on every platform.
+uint32 NextRandom(uint32& state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// A texture-like image: smooth gradients, a periodic pattern, noise, hard
+// edged shapes and a soft alpha disc, so that the JPEG kernels see a mix
+// of flat, smooth and busy blocks.
+void MakeImage(int32 size, uint32 seed, std::vector<uint8>& rgba)
+{
+    uint32 state = seed != 0 ? seed : 1;
+    rgba.resize((size_t)size * size * 4);
+    const double center = size / 2.0;
+    for (int32 y = 0; y < size; y++) {
+        for (int32 x = 0; x < size; x++) {
+            uint8* p = &rgba[((size_t)y * size + x) * 4];
+            double u = (double)x / size;
+            double v = (double)y / size;
+            double pattern = 40.0 * sin(x * 0.21) * cos(y * 0.13);
+            int32 noise = (int32)(NextRandom(state) % 17) - 8;
+            bool inBox = ((x / 64) + (y / 64)) % 5 == 0;
+            int32 r = (int32)(200 * u + pattern) + noise;
+            int32 g = (int32)(180 * v - pattern) + noise;
+            int32 b = inBox ? 230 : (int32)(90 + 60 * u * v) + noise;
+            double d = sqrt((x - center) * (x - center) + (y - center) * (y - center)) / center;
+            int32 a = d < 0.7 ? 255 : d > 0.9 ? 0 : (int32)(255 * (0.9 - d) / 0.2);
+            p[0] = (uint8)std::min(255, std::max(0, r));
+            p[1] = (uint8)std::min(255, std::max(0, g));
+            p[2] = (uint8)std::min(255, std::max(0, b));
+            p[3] = (uint8)a;
+        }
+    }
+}
+
+bool MakeImages(const Options& options, Images& images)
+{
+    const int32 size = options.size;
+    const size_t pixels = (size_t)size * size;
+    images.size = size;
+    MakeImage(size, options.seed, images.rgba);
+
+    images.opaqueZero = images.rgba;
+    for (size_t i = 0; i < pixels; i++)
+        images.opaqueZero[i * 4 + 3] = 0;
+
+    uint32 state = options.seed * 2654435761u + 1;
+    images.palette.resize(256 * 4);
+    for (int32 i = 0; i < 256; i++) {
+        images.palette[i * 4 + 0] = (uint8)NextRandom(state);
+        images.palette[i * 4 + 1] = (uint8)NextRandom(state);
+        images.palette[i * 4 + 2] = (uint8)NextRandom(state);
+        images.palette[i * 4 + 3] = 0;
+    }
+    images.indices.resize(pixels);
+    images.alpha8.resize(pixels);
+    for (size_t i = 0; i < pixels; i++) {
+        const uint8* p = &images.rgba[i * 4];
+        images.indices[i] = (uint8)((p[0] & 0xE0) | ((p[1] >> 3) & 0x1C) | (p[2] >> 6));
+        images.alpha8[i] = p[3];
+    }
+
+    // The mip chain as the plug-in makes it, and each level as it stores it.
+    BLPEncodeSettings settings = BLPProfileSettings(BLP_PROFILE_STANDARD);
+    images.levelCount = BLPMipLevelCount(size, size);
+    images.levels[0] = images.rgba;
+    int32 w = size;
+    for (int32 level = 0; level < images.levelCount; level++) {
+        if (level > 0) {
+            int32 next = w / 2 > 0 ? w / 2 : 1;
+            images.levels[level].resize((size_t)next * next * 4);
+            BLPResizeLevel(&images.levels[level - 1][0], w, w, &images.levels[level][0], next, next);
+            w = next;
+        }
+        if (!BLPEncodeJpegLevel(&images.levels[level][0], w, w, settings, images.jpegs[level]))
+            return false;
+    }
+    return true;
+}
+
+uint32 RunPaletteExpand(const Images& images, int32, std::vector<uint8>& scratch)
+{
+    size_t pixels = images.indices.size();
+    BLPExpandPalette(&images.indices[0], &images.alpha8[0], 8, &images.palette[0], pixels, &scratch[0]);
+    return scratch[pixels * 2];
+}
+
+uint32 RunSwizzle(const Images& images, int32, std::vector<uint8>& scratch)
+{
+    BLPSwapRedBlue(&images.rgba[0], &scratch[0], images.rgba.size() / 4);
+    return scratch[4];
+}
+
+uint32 RunResize(const Images& images, int32, std::vector<uint8>& scratch)
+{
+    int32 half = images.size / 2 > 0 ? images.size / 2 : 1;
+    BLPResizeLevel(&images.rgba[0], images.size, images.size, &scratch[0], half, half);
+    return scratch[0];
+}
+
+uint32 RunAlphaScan(const Images& images, int32, std::vector<uint8>&)
+{
+    return BLPAlphaAllZero(&images.opaqueZero[0], images.opaqueZero.size() / 4) ? 1 : 0;
+}
+
+uint32 RunJpegEncode(const Images& images, int32 level, std::vector<uint8>& scratch)
+{
+    static const BLPEncodeSettings settings = BLPProfileSettings(BLP_PROFILE_STANDARD);
+    int32 w = images.size >> level > 0 ? images.size >> level : 1;
+    if (!BLPEncodeJpegLevel(&images.levels[level][0], w, w, settings, scratch))
+        return 0;
+    return (uint32)scratch.size();
+}
+
+uint32 RunJpegDecode(const Images& images, int32 level, std::vector<uint8>& scratch)
+{
+    int32 w = images.size >> level > 0 ? images.size >> level : 1;
+    const std::vector<uint8>& jpeg = images.jpegs[level];
+    if (!BLPDecodeJpegLevel(&jpeg[0], jpeg.size(), w, w, 0, &scratch[0], NULL))
+        return 0;
+    return scratch[0];
+}
+
+// A BLPWriteProc into the byte vector at context, which grows to fit.
+bool WriteToVector(void* context, uint32 offset, const void* data, uint32 size)
+{
+    std::vector<uint8>* file = static_cast<std::vector<uint8>*>(context);
+    if (file->size() < (size_t)offset + size)
+        file->resize((size_t)offset + size);
+    memcpy(&(*file)[offset], data, size);
+    return true;
+}
+
+// A save of mip 0 with the plug-in's defaults, every level resized and
+// encoded, into memory.
+uint32 RunSave(const Images& images, int32, std::vector<uint8>& scratch)
+{
+    BLPWriteOptions options;
+    options.levels = 0;
+    options.hasAlpha = true;
+    options.settings = BLPProfileSettings(BLP_PROFILE_STANDARD);
+    options.compression = BLP_WRITE_JPEG;
+    options.byteBudget = 0;
+    options.minSsim = 0;
+    options.layout.smallestFirst = false;
+    options.layout.alignMips = false;
+    options.maxMemory = 0;
+    const BLPWriteEnvironment environment = { WriteToVector, &scratch, NULL, NULL, NULL, NULL };
+    BLPWriteSession session(options, environment);
+    if (session.Write(&images.rgba[0], images.size, images.size) != BLP_WRITER_OK)
+        return 0;
+    return session.Bytes();
+}
+
+void AddKernels(const Options& options, const Images& images, std::vector<Kernel>& kernels)
+{
+    const int32 size = options.size;
+    Kernel kernel;
+    kernel.level = 0;
+
+    kernel.name = "palette_expand";
+    kernel.width = size;
+    kernel.height = size;
+    kernel.run = RunPaletteExpand;
+    kernels.push_back(kernel);
+
+    kernel.name = "swizzle";
+    kernel.run = RunSwizzle;
+    kernels.push_back(kernel);
+
+    // Counted in source pixels, as every one of them is read.
+    kernel.name = "resize";
+    kernel.run = RunResize;
+    kernels.push_back(kernel);
+
+    kernel.name = "alpha_scan";
+    kernel.run = RunAlphaScan;
+    kernels.push_back(kernel);
+
+    // Counted in the pixels of mip 0.
+    kernel.name = "save";
+    kernel.run = RunSave;
+    kernels.push_back(kernel);
+
+    for (int32 pass = 0; pass < 2; pass++) {
+        for (int32 level = 0; level < images.levelCount; level++) {
+            int32 w = size >> level > 0 ? size >> level : 1;
+            if (w < options.minSize && level > 0)
+                break;
+            char name[64];
+            snprintf(name, sizeof(name), "%s/%d", pass == 0 ? "jpeg_encode" : "jpeg_decode", (int)w);
+            kernel.name = name;
+            kernel.width = w;
+            kernel.height = w;
+            kernel.run = pass == 0 ? RunJpegEncode : RunJpegDecode;
+            kernel.level = level;
+            kernels.push_back(kernel);
+        }
+    }
+}
+
+bool Selected(const Kernel& kernel, const std::vector<std::string>& filters)
+{
+    if (filters.empty())
+        return true;
+    for (size_t i = 0; i < filters.size(); i++) {
+        if (kernel.name.compare(0, filters[i].size(), filters[i]) == 0)
+            return true;
+    }
+    return false;
+}
+
+// Times kernel: calls per run from a calibration, then options.runs runs.
+// Returns the median and best megapixels per second.
+void Measure(const Options& options, const Images& images, const Kernel& kernel,
+             double& median, double& best, double& msPerCall)
+{
+    std::vector<uint8> scratch((size_t)images.size * images.size * 4);
+    uint32 sink = 0;
+
+    // Warm up and find how many calls take runMs.
+    int64 calls = 1;
+    for (;;) {
+        Clock::time_point start = Clock::now();
+        for (int64 i = 0; i < calls; i++)
+            sink += kernel.run(images, kernel.level, scratch);
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        if (ms >= options.runMs || calls >= ((int64)1 << 30))
+            break;
+        calls = ms > 0.5 ? (int64)(calls * options.runMs / ms) + 1 : calls * 8;
+    }
+
+    std::vector<double> rates;
+    double bestMs = 0;
+    const double megapixels = (double)kernel.width * kernel.height / 1e6;
+    for (int32 run = 0; run < options.runs; run++) {
+        Clock::time_point start = Clock::now();
+        for (int64 i = 0; i < calls; i++)
+            sink += kernel.run(images, kernel.level, scratch);
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count() / calls;
+        rates.push_back(megapixels / (ms / 1000.0));
+        if (run == 0 || ms < bestMs)
+            bestMs = ms;
+    }
+    gSink = gSink + sink;
+
+    std::sort(rates.begin(), rates.end());
+    median = rates[rates.size() / 2];
+    best = rates.back();
+    msPerCall = bestMs;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    options.size = 1024;
+    options.minSize = 16;
+    options.runs = 7;
+    options.runMs = 50;
+    options.seed = 1;
+    bool list = false;
+    std::vector<std::string> filters;
+
+    for (int arg = 1; arg < argc; arg++) {
+        const char* s = argv[arg];
+        const char* value = arg + 1 < argc ? argv[arg + 1] : NULL;
+        bool ok = true;
+
+        if (strcmp(s, "-size") == 0 && value != NULL) {
+            options.size = atoi(value);
+            ok = options.size >= 8 && options.size <= 8192;
+            arg++;
+        } else if (strcmp(s, "-minsize") == 0 && value != NULL) {
+            options.minSize = atoi(value);
+            ok = options.minSize >= 1;
+            arg++;
+        } else if (strcmp(s, "-runs") == 0 && value != NULL) {
+            options.runs = atoi(value);
+            ok = options.runs >= 1;
+            arg++;
+        } else if (strcmp(s, "-time") == 0 && value != NULL) {
+            options.runMs = atof(value);
+            ok = options.runMs > 0;
+            arg++;
+        } else if (strcmp(s, "-seed") == 0 && value != NULL) {
+            options.seed = (uint32)strtoul(value, NULL, 10);
+            arg++;
+        } else if (strcmp(s, "-list") == 0) {
+            list = true;
+        } else if (s[0] == '-') {
+            ok = false;
+        } else {
+            filters.push_back(s);
+        }
+
+        if (!ok) {
+            Usage();
+            return 2;
+        }
+    }
+
+    Images images;
+    if (!MakeImages(options, images)) {
+        fprintf(stderr, "BLPBench: could not encode the test image\n");
+        return 1;
+    }
+    std::vector<Kernel> kernels;
+    AddKernels(options, images, kernels);
+
+    if (list) {
+        for (size_t i = 0; i < kernels.size(); i++)
+            printf("%s\n", kernels[i].name.c_str());
+        return 0;
+    }
+
+    printf("image %dx%d, seed %u, %d runs of at least %.0f ms\n",
+           (int)options.size, (int)options.size, (unsigned)options.seed, (int)options.runs, options.runMs);
+    printf("%-20s %12s %12s %12s\n", "kernel", "MP/s median", "MP/s best", "ms/call");
+    for (size_t i = 0; i < kernels.size(); i++) {
+        if (!Selected(kernels[i], filters))
+            continue;
+        double median, best, ms;
+        BLPTraceZone zone(kernels[i].name.c_str());
+        Measure(options, images, kernels[i], median, best, ms);
+        zone.End();
+        BLPTraceFlush();
+        printf("%-20s %12.1f %12.1f %12.4f\n", kernels[i].name.c_str(), median, best, ms);
+        fflush(stdout);
+    }
+    return 0;
+}
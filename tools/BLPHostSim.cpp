@@ -0,0 +1,1654 @@
+//-------------------------------------------------------------------------------
+//
+//	File:
+//		BLPHostSim.cpp
+//
+//	Description:
+//		A stand-in for Photoshop that drives the plug-in's PluginMain
+//		through the read and write selector sequences, on any POSIX
+//		system and without a Photoshop license.
+//
+//		The host fakes what the plug-in uses of the FormatRecord: the
+//		advanceState and progress callbacks, the Handle and Buffer
+//		suites, the pseudo-resource and descriptor procs and POSIX file
+//		I/O through posixFileDescriptor. The plug-in is compiled as a
+//		Macintosh plug-in against the declarations in tools/hostsim.
+//
+//		For every selector it reports the wall time, the advanceState
+//		calls and the shape of the chunks they moved, the pixel bytes
+//		moved, the peak of the host memory the plug-in held and the peak
+//		RSS of the process. With BLP_MEMSTATS set it adds the allocations
+//		the plug-in and libjpeg made and the peak of the bytes they held
+//		(see BLPMemStats.h), and for the Prepare selectors the maxData the
+//		plug-in kept of what was offered. The Buffer suite, like
+//		Photoshop's, refuses requests beyond the offered maxData less what
+//		the plug-in already holds.
+//
+//		With -abort, abortProc starts returning true MS milliseconds into
+//		each run, and the host reports how long the plug-in took from then
+//		to return userCanceledErr, how often it polled and the longest gap
+//		between two polls. Buffers the plug-in still holds after a run, or
+//		with BLP_MEMSTATS set heap and libjpeg bytes, are protocol errors,
+//		cancelled or not.
+//
+//	Use:
+//		BLPHostSim [switches] read FILE.blp
+//		BLPHostSim [switches] write IMAGE OUT.blp
+//		BLPHostSim [switches] resave FILE.blp OUT.blp
+//		BLPHostSim [switches] roundtrip IMAGE OUT.blp
+//
+//		-maxdata N[K|M]			maxData offered at the Prepare selectors (default 512M)
+//		-set KEY=VALUE			a scripting parameter for the Prepare selectors,
+//								KEY a four-character key of BLPFormatTerminology.h
+//								and VALUE true, false, an integer or a number
+//		-runs N					run the sequence N times (default 1)
+//		-o FILE					read, resave, roundtrip: save the document read as PAM
+//		-abort MS				abortProc returns true from MS milliseconds into each run
+//
+//		IMAGE is a binary PGM, PPM or PAM file, or gen:WxH for a generated
+//		RGBA image. resave opens FILE and saves the document again with
+//		the revertInfo and resources of the read, as Photoshop does on
+//		File > Save. roundtrip saves IMAGE, opens the result and reports
+//		the PSNR against IMAGE.
+//
+//		The exit status is 0 if every selector returned noErr, or the
+//		sequence ended in userCanceledErr after the abort, and the plug-in
+//		kept to the protocol, 1 if not and 2 for bad arguments.
+//
+//-------------------------------------------------------------------------------
+
+#include "PIDefines.h"
+#include "PIFormat.h"
+#include "PIActions.h"
+#include "PIBufferSuite.h"
+#include "PIHandleSuite.h"
+#include "PITerminology.h"
+#include "SPBasic.h"
+#include "BLPHash.h"
+#include "BLPMemStats.h"
+#include "BLPMetrics.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+DLLExport MACPASCAL void PluginMain (const int16 selector,
+						             FormatRecordPtr formatParamBlock,
+						             intptr_t* data,
+						             int16* result);
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+const int16 kSelectorCount = formatSelectorFilterFile + 1;
+
+const char* SelectorName(int16 selector)
+{
+    switch (selector) {
+        case formatSelectorReadPrepare:      return "ReadPrepare";
+        case formatSelectorReadStart:        return "ReadStart";
+        case formatSelectorReadContinue:     return "ReadContinue";
+        case formatSelectorReadFinish:       return "ReadFinish";
+        case formatSelectorOptionsPrepare:   return "OptionsPrepare";
+        case formatSelectorOptionsStart:     return "OptionsStart";
+        case formatSelectorOptionsContinue:  return "OptionsContinue";
+        case formatSelectorOptionsFinish:    return "OptionsFinish";
+        case formatSelectorEstimatePrepare:  return "EstimatePrepare";
+        case formatSelectorEstimateStart:    return "EstimateStart";
+        case formatSelectorEstimateContinue: return "EstimateContinue";
+        case formatSelectorEstimateFinish:   return "EstimateFinish";
+        case formatSelectorWritePrepare:     return "WritePrepare";
+        case formatSelectorWriteStart:       return "WriteStart";
+        case formatSelectorWriteContinue:    return "WriteContinue";
+        case formatSelectorWriteFinish:      return "WriteFinish";
+        case formatSelectorFilterFile:       return "FilterFile";
+    }
+    return "?";
+}
+
+//-------------------------------------------------------------------------------
+//	The document
+//-------------------------------------------------------------------------------
+
+// An 8-bit document as the host keeps it: one plane after the other.
+typedef struct HostDocument
+{
+    int32 width;
+    int32 height;
+    int16 planes;
+    int16 imageMode;
+    int32 transparencyPlane;
+    LookUpTable lut[3];             // red, green, blue of an indexed document
+    std::vector<uint8> pixels;
+
+    uint8* Plane(int32 plane) { return &pixels[(size_t)plane * width * height]; }
+} HostDocument;
+
+// RGBA pixels of doc, alpha 255 without a transparency plane.
+void DocumentToRgba(HostDocument& doc, std::vector<uint8>& rgba)
+{
+    const size_t count = (size_t)doc.width * doc.height;
+    rgba.assign(count * 4, 255);
+    for (size_t i = 0; i < count; i++) {
+        uint8* p = &rgba[i * 4];
+        if (doc.imageMode == plugInModeIndexedColor) {
+            uint8 index = doc.Plane(0)[i];
+            p[0] = doc.lut[0][index];
+            p[1] = doc.lut[1][index];
+            p[2] = doc.lut[2][index];
+        } else if (doc.planes < 3) {
+            p[0] = p[1] = p[2] = doc.Plane(0)[i];
+        } else {
+            p[0] = doc.Plane(0)[i];
+            p[1] = doc.Plane(1)[i];
+            p[2] = doc.Plane(2)[i];
+        }
+        if (doc.planes == 2 || doc.planes >= 4)
+            p[3] = doc.Plane(doc.planes == 2 ? 1 : 3)[i];
+    }
+}
+
+bool ReadToken(FILE* file, std::string& token)
+{
+    token.clear();
+    int c = fgetc(file);
+    while (c != EOF) {
+        if (c == '#') {
+            while (c != EOF && c != '\n')
+                c = fgetc(file);
+        } else if (isspace(c)) {
+            if (!token.empty())
+                return true;
+        } else {
+            token += (char)c;
+        }
+        c = fgetc(file);
+    }
+    return !token.empty();
+}
+
+// Loads a binary PGM (P5), PPM (P6) or PAM (P7) with maxval 255.
+bool LoadImage(const char* path, HostDocument& doc, std::string& error)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        error = std::string("cannot open ") + path;
+        return false;
+    }
+
+    std::string magic, token;
+    int32 width = 0, height = 0, depth = 0, maxval = 0;
+    ReadToken(file, magic);
+    if (magic == "P5" || magic == "P6") {
+        depth = magic == "P5" ? 1 : 3;
+        if (ReadToken(file, token)) width = atoi(token.c_str());
+        if (ReadToken(file, token)) height = atoi(token.c_str());
+        if (ReadToken(file, token)) maxval = atoi(token.c_str());
+    } else if (magic == "P7") {
+        while (ReadToken(file, token) && token != "ENDHDR") {
+            std::string value;
+            ReadToken(file, value);
+            if (token == "WIDTH") width = atoi(value.c_str());
+            else if (token == "HEIGHT") height = atoi(value.c_str());
+            else if (token == "DEPTH") depth = atoi(value.c_str());
+            else if (token == "MAXVAL") maxval = atoi(value.c_str());
+        }
+    }
+    if (width <= 0 || height <= 0 || depth < 1 || depth > 4 || maxval != 255) {
+        fclose(file);
+        error = std::string(path) + ": not an 8-bit PGM, PPM or PAM file";
+        return false;
+    }
+
+    std::vector<uint8> samples((size_t)width * height * depth);
+    bool ok = fread(&samples[0], 1, samples.size(), file) == samples.size();
+    fclose(file);
+    if (!ok) {
+        error = std::string(path) + ": truncated";
+        return false;
+    }
+
+    doc.width = width;
+    doc.height = height;
+    doc.planes = (int16)depth;
+    doc.imageMode = depth < 3 ? plugInModeGrayScale : plugInModeRGBColor;
+    doc.transparencyPlane = depth == 2 || depth == 4 ? depth - 1 : -1;
+    doc.pixels.resize(samples.size());
+    const size_t count = (size_t)width * height;
+    for (int32 plane = 0; plane < depth; plane++)
+        for (size_t i = 0; i < count; i++)
+            doc.Plane(plane)[i] = samples[i * depth + plane];
+    return true;
+}
+
+// gen:WxH, an RGBA image of gradients, hard edges, noise and a soft alpha
+// disc; the same on every platform.
+bool GenerateImage(const char* spec, HostDocument& doc)
+{
+    int32 width = 0, height = 0;
+    if (sscanf(spec, "gen:%dx%d", &width, &height) != 2 ||
+        width < 1 || height < 1 || width > 30000 || height > 30000)
+        return false;
+
+    doc.width = width;
+    doc.height = height;
+    doc.planes = 4;
+    doc.imageMode = plugInModeRGBColor;
+    doc.transparencyPlane = 3;
+    doc.pixels.resize((size_t)width * height * 4);
+
+    uint32 state = 1;
+    const double cx = width / 2.0, cy = height / 2.0;
+    for (int32 y = 0; y < height; y++) {
+        for (int32 x = 0; x < width; x++) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            size_t i = (size_t)y * width + x;
+            int32 noise = (int32)(state % 17) - 8;
+            bool inBox = ((x / 64) + (y / 64)) % 5 == 0;
+            double d = sqrt((x - cx) * (x - cx) / (cx * cx) + (y - cy) * (y - cy) / (cy * cy));
+            doc.Plane(0)[i] = (uint8)std::min(255, std::max(0, 200 * x / width + noise));
+            doc.Plane(1)[i] = (uint8)std::min(255, std::max(0, 180 * y / height + noise));
+            doc.Plane(2)[i] = inBox ? 230 : (uint8)std::min(255, std::max(0, 90 + noise));
+            doc.Plane(3)[i] = d < 0.7 ? 255 : d > 0.9 ? 0 : (uint8)(255 * (0.9 - d) / 0.2);
+        }
+    }
+    return true;
+}
+
+// Saves doc as PAM: GRAYSCALE, RGB or RGB_ALPHA, indexed documents expanded.
+bool SaveImage(const char* path, HostDocument& doc)
+{
+    std::vector<uint8> rgba;
+    DocumentToRgba(doc, rgba);
+    const bool alpha = doc.planes == 2 || doc.planes >= 4;
+    const bool gray = doc.imageMode == plugInModeGrayScale;
+    const int32 depth = gray ? (alpha ? 2 : 1) : (alpha ? 4 : 3);
+    const char* tuple = gray ? (alpha ? "GRAYSCALE_ALPHA" : "GRAYSCALE") : (alpha ? "RGB_ALPHA" : "RGB");
+
+    FILE* file = fopen(path, "wb");
+    if (file == NULL)
+        return false;
+    fprintf(file, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL 255\nTUPLTYPE %s\nENDHDR\n",
+            doc.width, doc.height, depth, tuple);
+    std::vector<uint8> row((size_t)doc.width * depth);
+    for (int32 y = 0; y < doc.height; y++) {
+        for (int32 x = 0; x < doc.width; x++) {
+            const uint8* p = &rgba[((size_t)y * doc.width + x) * 4];
+            uint8* q = &row[(size_t)x * depth];
+            if (gray) {
+                q[0] = p[0];
+                if (alpha) q[1] = p[3];
+            } else {
+                q[0] = p[0];
+                q[1] = p[1];
+                q[2] = p[2];
+                if (alpha) q[3] = p[3];
+            }
+        }
+        fwrite(&row[0], 1, row.size(), file);
+    }
+    return fclose(file) == 0;
+}
+
+//-------------------------------------------------------------------------------
+//	Statistics
+//-------------------------------------------------------------------------------
+
+typedef struct SelectorStats
+{
+    int32 calls;                // in the last run
+    int32 order;                // of the first call in the last run, from 1
+    std::vector<double> runMs;  // time in the selector, per run
+    int64 advances;             // advanceState calls in the last run
+    int64 chunks;               // chunks moved in the last run
+    int32 minRows;              // rows of the chunks
+    int32 maxRows;
+    int32 maxPlanes;            // planes of the widest chunk
+    int64 bytes;                // pixel bytes moved in the last run
+    int64 progressCalls;
+    int64 hostPeak;             // peak Handle and Buffer bytes held, over the runs
+    int64 peakRssKB;            // over the runs
+    int64 allocations;          // counted by BLPMemStats in the last run
+    int64 memPeak;              // peak bytes they held, over the runs
+    int64 keptMaxData;          // maxData left by a Prepare selector in the last run, or -1
+    int16 result;               // of the last call
+} SelectorStats;
+
+int64 ReadPeakRssKB(void)
+{
+    FILE* file = fopen("/proc/self/status", "r");
+    if (file == NULL)
+        return 0;
+    char line[256];
+    int64 kb = 0;
+    while (fgets(line, sizeof(line), file) != NULL)
+        if (strncmp(line, "VmHWM:", 6) == 0)
+            kb = atoll(line + 6);
+    fclose(file);
+    return kb;
+}
+
+// Resets the peak RSS to the current RSS (Linux 4.0 and later), so that
+// the peak after a selector is that selector's. False if not possible, in
+// which case the figures are the process peak so far.
+bool ResetPeakRss(void)
+{
+    int fd = open("/proc/self/clear_refs", O_WRONLY);
+    if (fd < 0)
+        return false;
+    bool ok = write(fd, "5", 1) == 1;
+    close(fd);
+    return ok;
+}
+
+//-------------------------------------------------------------------------------
+//	The host
+//-------------------------------------------------------------------------------
+
+typedef struct HostHandle
+{
+    Ptr data;                   // first, so that a HostHandle* is a Handle
+    int32 size;
+    Boolean locked;
+} HostHandle;
+
+typedef struct HostBuffer
+{
+    Ptr data;
+    int32 size;
+} HostBuffer;
+
+// One key of a descriptor, as the host stores it in a descriptor handle.
+// An object is an item of typeObject whose integer counts the items of
+// the object that follow it.
+typedef struct DescriptorItem
+{
+    DescriptorKeyID key;
+    DescriptorTypeID type;
+    int32 integer;
+    real64 number;
+    char text[256];             // typeChar
+} DescriptorItem;
+
+typedef struct DescriptorReader
+{
+    std::vector<DescriptorItem> items;
+    size_t next;
+} DescriptorReader;
+
+typedef struct DescriptorWriter
+{
+    std::vector<DescriptorItem> items;
+} DescriptorWriter;
+
+typedef struct Host
+{
+    FormatRecord record;
+    intptr_t pluginData;
+    HostDocument doc;
+    bool haveDocument;
+    std::map<ResType, std::vector<std::vector<char> > > resources;
+    std::map<Ptr, size_t> buffers;  // from the Buffer suite
+    std::vector<DescriptorItem> scriptParams;
+    std::vector<DescriptorItem> readParams;   // as the Finish selectors left them
+    std::vector<DescriptorItem> writeParams;
+
+    int64 heldBytes;            // in handles and buffers
+    int64 heldPeak;
+    SelectorStats stats[kSelectorCount];
+    SelectorStats* current;
+    int32 run;
+    int32 calledSelectors;      // in this run
+    bool rssResettable;
+    std::string protocolError;
+    std::thread::id thread;     // the only one the callbacks may be called on
+
+    int32 maxData;
+    double abortMs;             // -abort, or < 0
+    Clock::time_point runStart;
+    Clock::time_point lastPoll; // of abortProc, or runStart
+    int64 abortPolls;           // in this run
+    double maxPollGapMs;        // from runStart to the abort
+    bool aborting;              // abortProc has returned true in this run
+    int16 cancelSelector;       // that returned userCanceledErr, or -1
+    double cancelMs;            // from the abort to its return
+} Host;
+
+Host* gHost = NULL;
+
+void Hold(int64 bytes)
+{
+    gHost->heldBytes += bytes;
+    if (gHost->heldBytes > gHost->heldPeak)
+        gHost->heldPeak = gHost->heldBytes;
+}
+
+void ProtocolError(const std::string& message)
+{
+    if (gHost->protocolError.empty())
+        gHost->protocolError = message;
+}
+
+// Photoshop's callbacks are not thread safe; a plug-in must call them on
+// the thread that called it.
+void CheckThread(const char* callback)
+{
+    if (std::this_thread::get_id() != gHost->thread)
+        ProtocolError(std::string(callback) + " called on a thread of the plug-in");
+}
+
+// Handles ------------------------------------------------------------------
+
+MACPASCAL Handle HostNewHandle(int32 size)
+{
+    if (size < 0)
+        return NULL;
+    HostHandle* h = (HostHandle*)calloc(1, sizeof(HostHandle));
+    if (h == NULL)
+        return NULL;
+    h->data = (Ptr)malloc(size > 0 ? size : 1);
+    if (h->data == NULL) {
+        free(h);
+        return NULL;
+    }
+    h->size = size;
+    Hold(size);
+    return (Handle)h;
+}
+
+MACPASCAL void HostDisposeHandle(Handle handle)
+{
+    HostHandle* h = (HostHandle*)handle;
+    if (h == NULL)
+        return;
+    Hold(-(int64)h->size);
+    free(h->data);
+    free(h);
+}
+
+MACPASCAL int32 HostGetHandleSize(Handle handle)
+{
+    return handle != NULL ? ((HostHandle*)handle)->size : 0;
+}
+
+MACPASCAL OSErr HostSetHandleSize(Handle handle, int32 size)
+{
+    HostHandle* h = (HostHandle*)handle;
+    if (h == NULL || size < 0)
+        return paramErr;
+    if (h->locked)
+        return memFullErr;
+    Ptr data = (Ptr)realloc(h->data, size > 0 ? size : 1);
+    if (data == NULL)
+        return memFullErr;
+    Hold((int64)size - h->size);
+    h->data = data;
+    h->size = size;
+    return noErr;
+}
+
+MACPASCAL void HostSetHandleLock(Handle handle, Boolean lock, Ptr* address, Boolean* oldLock)
+{
+    HostHandle* h = (HostHandle*)handle;
+    if (oldLock != NULL)
+        *oldLock = h != NULL ? h->locked : false;
+    if (h == NULL) {
+        if (address != NULL)
+            *address = NULL;
+        return;
+    }
+    h->locked = lock;
+    if (address != NULL)
+        *address = lock ? h->data : NULL;
+}
+
+MACPASCAL Ptr HostLockHandle(Handle handle, Boolean)
+{
+    Ptr address = NULL;
+    HostSetHandleLock(handle, true, &address, NULL);
+    return address;
+}
+
+MACPASCAL void HostUnlockHandle(Handle handle)
+{
+    HostSetHandleLock(handle, false, NULL, NULL);
+}
+
+MACPASCAL void HostRecoverSpace(int32)
+{
+}
+
+Handle CopyToHandle(const void* data, size_t size)
+{
+    Handle h = HostNewHandle((int32)size);
+    if (h != NULL && size > 0)
+        memcpy(*h, data, size);
+    return h;
+}
+
+// Buffers ------------------------------------------------------------------
+
+SPAPI unsigned32 HostBufferGetSpace(void)
+{
+    int64 space = (int64)gHost->maxData - gHost->heldBytes;
+    return space > 0 ? (unsigned32)space : 0;
+}
+
+SPAPI Ptr HostBufferNew(unsigned32* pRequestedSize, unsigned32 minimumSize)
+{
+    if (pRequestedSize == NULL)
+        return NULL;
+    // Only what is left of maxData; a plug-in must fall back on its own.
+    unsigned32 size = *pRequestedSize;
+    const unsigned32 space = HostBufferGetSpace();
+    if (size > space)
+        size = space;
+    if (size < minimumSize)
+        return NULL;
+    Ptr p = (Ptr)malloc(size > 0 ? size : 1);
+    if (p == NULL && minimumSize < size) {
+        size = minimumSize;
+        p = (Ptr)malloc(size > 0 ? size : 1);
+    }
+    if (p == NULL)
+        return NULL;
+    *pRequestedSize = size;
+    gHost->buffers[p] = size;
+    Hold(size);
+    return p;
+}
+
+SPAPI void HostBufferDispose(Ptr* ppBuffer)
+{
+    if (ppBuffer == NULL || *ppBuffer == NULL)
+        return;
+    std::map<Ptr, size_t>::iterator it = gHost->buffers.find(*ppBuffer);
+    if (it == gHost->buffers.end()) {
+        ProtocolError("Buffer suite Dispose of a pointer it did not allocate");
+        return;
+    }
+    Hold(-(int64)it->second);
+    gHost->buffers.erase(it);
+    free(*ppBuffer);
+    *ppBuffer = NULL;
+}
+
+SPAPI unsigned32 HostBufferGetSize(Ptr pBuffer)
+{
+    std::map<Ptr, size_t>::iterator it = gHost->buffers.find(pBuffer);
+    return it != gHost->buffers.end() ? (unsigned32)it->second : 0;
+}
+
+MACPASCAL OSErr HostAllocateBuffer(int32 size, BufferID* bufferID)
+{
+    if (bufferID == NULL || size < 0)
+        return paramErr;
+    HostBuffer* b = (HostBuffer*)calloc(1, sizeof(HostBuffer));
+    if (b != NULL)
+        b->data = (Ptr)malloc(size > 0 ? size : 1);
+    if (b == NULL || b->data == NULL) {
+        free(b);
+        *bufferID = NULL;
+        return memFullErr;
+    }
+    b->size = size;
+    Hold(size);
+    *bufferID = (BufferID)b;
+    return noErr;
+}
+
+MACPASCAL Ptr HostLockBuffer(BufferID bufferID, Boolean)
+{
+    return bufferID != NULL ? ((HostBuffer*)bufferID)->data : NULL;
+}
+
+MACPASCAL void HostUnlockBuffer(BufferID)
+{
+}
+
+MACPASCAL void HostFreeBuffer(BufferID bufferID)
+{
+    HostBuffer* b = (HostBuffer*)bufferID;
+    if (b == NULL)
+        return;
+    Hold(-(int64)b->size);
+    free(b->data);
+    free(b);
+}
+
+MACPASCAL int32 HostBufferSpace(void)
+{
+    return (int32)HostBufferGetSpace();
+}
+
+MACPASCAL OSErr HostReserveSpace(int32)
+{
+    return noErr;
+}
+
+// Pseudo-resources ---------------------------------------------------------
+
+MACPASCAL int16 HostCountResources(ResType type)
+{
+    return (int16)gHost->resources[type].size();
+}
+
+// The host owns the handle it returns; it lives until the next call.
+MACPASCAL Handle HostGetResource(ResType type, int16 index)
+{
+    static Handle last = NULL;
+    std::vector<std::vector<char> >& list = gHost->resources[type];
+    if (index < 1 || index > (int16)list.size())
+        return NULL;
+    if (last != NULL)
+        HostDisposeHandle(last);
+    const std::vector<char>& data = list[index - 1];
+    last = CopyToHandle(data.empty() ? NULL : &data[0], data.size());
+    return last;
+}
+
+MACPASCAL void HostDeleteResource(ResType type, int16 index)
+{
+    std::vector<std::vector<char> >& list = gHost->resources[type];
+    if (index >= 1 && index <= (int16)list.size())
+        list.erase(list.begin() + (index - 1));
+}
+
+MACPASCAL OSErr HostAddResource(ResType type, Handle data)
+{
+    HostHandle* h = (HostHandle*)data;
+    if (h == NULL)
+        return paramErr;
+    gHost->resources[type].push_back(std::vector<char>(h->data, h->data + h->size));
+    return noErr;
+}
+
+// Descriptors --------------------------------------------------------------
+//
+// The plug-in stores integers, floats, booleans, strings and objects; the
+// procs for the other types are left NULL.
+
+Handle DescriptorHandle(const std::vector<DescriptorItem>& items)
+{
+    return CopyToHandle(items.empty() ? NULL : &items[0], items.size() * sizeof(DescriptorItem));
+}
+
+MACPASCAL PIReadDescriptor HostOpenReadDescriptor(PIDescriptorHandle handle, DescriptorKeyIDArray)
+{
+    HostHandle* h = (HostHandle*)handle;
+    if (h == NULL)
+        return NULL;
+    DescriptorReader* reader = new DescriptorReader;
+    const DescriptorItem* items = (const DescriptorItem*)h->data;
+    reader->items.assign(items, items + h->size / sizeof(DescriptorItem));
+    reader->next = 0;
+    return (PIReadDescriptor)reader;
+}
+
+MACPASCAL OSErr HostCloseReadDescriptor(PIReadDescriptor token)
+{
+    delete (DescriptorReader*)token;
+    return noErr;
+}
+
+MACPASCAL Boolean HostGetKey(PIReadDescriptor token, DescriptorKeyID* key, DescriptorTypeID* type, int32* flags)
+{
+    DescriptorReader* reader = (DescriptorReader*)token;
+    if (reader->next >= reader->items.size())
+        return false;
+    const DescriptorItem& item = reader->items[reader->next++];
+    *key = item.key;
+    *type = item.type;
+    if (flags != NULL)
+        *flags = 0;
+    return true;
+}
+
+const DescriptorItem* CurrentItem(PIReadDescriptor token)
+{
+    DescriptorReader* reader = (DescriptorReader*)token;
+    return reader->next > 0 ? &reader->items[reader->next - 1] : NULL;
+}
+
+MACPASCAL OSErr HostGetInteger(PIReadDescriptor token, int32* value)
+{
+    const DescriptorItem* item = CurrentItem(token);
+    if (item == NULL)
+        return errMissingParameter;
+    *value = item->type == typeFloat ? (int32)item->number : item->integer;
+    return noErr;
+}
+
+MACPASCAL OSErr HostGetFloat(PIReadDescriptor token, real64* value)
+{
+    const DescriptorItem* item = CurrentItem(token);
+    if (item == NULL)
+        return errMissingParameter;
+    *value = item->type == typeFloat ? item->number : item->integer;
+    return noErr;
+}
+
+MACPASCAL OSErr HostGetBoolean(PIReadDescriptor token, Boolean* value)
+{
+    const DescriptorItem* item = CurrentItem(token);
+    if (item == NULL)
+        return errMissingParameter;
+    *value = (item->type == typeFloat ? item->number != 0 : item->integer != 0);
+    return noErr;
+}
+
+MACPASCAL PIWriteDescriptor HostOpenWriteDescriptor(void)
+{
+    return (PIWriteDescriptor)new DescriptorWriter;
+}
+
+MACPASCAL OSErr HostCloseWriteDescriptor(PIWriteDescriptor token, PIDescriptorHandle* handle)
+{
+    DescriptorWriter* writer = (DescriptorWriter*)token;
+    if (handle != NULL)
+        *handle = DescriptorHandle(writer->items);
+    delete writer;
+    return noErr;
+}
+
+OSErr PutItem(PIWriteDescriptor token, DescriptorKeyID key, DescriptorTypeID type, int32 integer, real64 number)
+{
+    DescriptorItem item = { key, type, integer, number, "" };
+    ((DescriptorWriter*)token)->items.push_back(item);
+    return noErr;
+}
+
+MACPASCAL OSErr HostPutInteger(PIWriteDescriptor token, DescriptorKeyID key, int32 value)
+{
+    return PutItem(token, key, typeInteger, value, 0);
+}
+
+MACPASCAL OSErr HostPutFloat(PIWriteDescriptor token, DescriptorKeyID key, const real64* value)
+{
+    return PutItem(token, key, typeFloat, 0, *value);
+}
+
+MACPASCAL OSErr HostPutBoolean(PIWriteDescriptor token, DescriptorKeyID key, Boolean value)
+{
+    return PutItem(token, key, typeBoolean, value ? 1 : 0, 0);
+}
+
+MACPASCAL OSErr HostPutString(PIWriteDescriptor token, DescriptorKeyID key, ConstStr255Param value)
+{
+    PutItem(token, key, typeChar, 0, 0);
+    DescriptorItem& item = ((DescriptorWriter*)token)->items.back();
+    memcpy(item.text, value + 1, value[0]);
+    item.text[value[0]] = 0;
+    return noErr;
+}
+
+// Copies the object, as Photoshop does: the plug-in disposes of its handle.
+MACPASCAL OSErr HostPutObject(PIWriteDescriptor token, DescriptorKeyID key, DescriptorTypeID, PIDescriptorHandle handle)
+{
+    HostHandle* h = (HostHandle*)handle;
+    if (h == NULL)
+        return nilHandleErr;
+    const DescriptorItem* items = (const DescriptorItem*)h->data;
+    size_t count = h->size / sizeof(DescriptorItem);
+    PutItem(token, key, typeObject, (int32)count, 0);
+    std::vector<DescriptorItem>& to = ((DescriptorWriter*)token)->items;
+    to.insert(to.end(), items, items + count);
+    return noErr;
+}
+
+// Suites -------------------------------------------------------------------
+
+PSHandleSuite1 gHandleSuite1 = { HostNewHandle, HostDisposeHandle, HostSetHandleLock,
+                                 HostGetHandleSize, HostSetHandleSize, HostRecoverSpace };
+PSHandleSuite2 gHandleSuite2 = { HostNewHandle, HostDisposeHandle, HostDisposeHandle, HostSetHandleLock,
+                                 HostGetHandleSize, HostSetHandleSize, HostRecoverSpace };
+PSBufferSuite1 gBufferSuite1 = { HostBufferNew, HostBufferDispose, HostBufferGetSize, HostBufferGetSpace };
+BufferProcs gBufferProcs;
+HandleProcs gHandleProcs;
+ResourceProcs gResourceProcs;
+ReadDescriptorProcs gReadDescriptorProcs;
+WriteDescriptorProcs gWriteDescriptorProcs;
+PIDescriptorParameters gDescriptorParameters;
+SPBasicSuite gBasicSuite;
+
+SPAPI SPErr HostAcquireSuite(const char* name, int32 version, const void** suite)
+{
+    *suite = NULL;
+    if (strcmp(name, kPSHandleSuite) == 0 && version == kPSHandleSuiteVersion2)
+        *suite = &gHandleSuite2;
+    else if (strcmp(name, kPSHandleSuite) == 0 && version == kPSHandleSuiteVersion1)
+        *suite = &gHandleSuite1;
+    else if (strcmp(name, kPSBufferSuite) == 0 && version == kPSBufferSuiteVersion1)
+        *suite = &gBufferSuite1;
+    else if (strcmp(name, kPIBufferSuite) == 0 && version == kPIBufferSuiteVersion)
+        *suite = &gBufferProcs;
+    else if (strcmp(name, kPIResourceSuite) == 0 && version == kPIResourceSuiteVersion)
+        *suite = &gResourceProcs;
+    return *suite != NULL ? kSPNoError : kSPSuiteNotFoundError;
+}
+
+SPAPI SPErr HostReleaseSuite(const char*, int32)
+{
+    return kSPNoError;
+}
+
+SPAPI SPBoolean HostIsEqual(const char* token1, const char* token2)
+{
+    return strcmp(token1, token2) == 0;
+}
+
+SPAPI SPErr HostAllocateBlock(size_t size, void** block)
+{
+    *block = malloc(size);
+    return *block != NULL ? kSPNoError : kSPOutOfMemoryError;
+}
+
+SPAPI SPErr HostFreeBlock(void* block)
+{
+    free(block);
+    return kSPNoError;
+}
+
+SPAPI SPErr HostReallocateBlock(void* block, size_t newSize, void** newBlock)
+{
+    *newBlock = realloc(block, newSize);
+    return *newBlock != NULL ? kSPNoError : kSPOutOfMemoryError;
+}
+
+SPAPI SPErr HostUndefined(void)
+{
+    return kSPUnimplementedError;
+}
+
+void InitSuites(void)
+{
+    gBufferProcs.bufferProcsVersion = kCurrentBufferProcsVersion;
+    gBufferProcs.numBufferProcs = kCurrentBufferProcsCount;
+    gBufferProcs.allocateProc = HostAllocateBuffer;
+    gBufferProcs.lockProc = HostLockBuffer;
+    gBufferProcs.unlockProc = HostUnlockBuffer;
+    gBufferProcs.freeProc = HostFreeBuffer;
+    gBufferProcs.spaceProc = HostBufferSpace;
+    gBufferProcs.reserveProc = HostReserveSpace;
+
+    gHandleProcs.handleProcsVersion = kCurrentHandleProcsVersion;
+    gHandleProcs.numHandleProcs = kCurrentHandleProcsCount;
+    gHandleProcs.newProc = HostNewHandle;
+    gHandleProcs.disposeProc = HostDisposeHandle;
+    gHandleProcs.getSizeProc = HostGetHandleSize;
+    gHandleProcs.setSizeProc = HostSetHandleSize;
+    gHandleProcs.lockProc = HostLockHandle;
+    gHandleProcs.unlockProc = HostUnlockHandle;
+    gHandleProcs.recoverSpaceProc = HostRecoverSpace;
+    gHandleProcs.disposeRegularHandleProc = HostDisposeHandle;
+
+    gResourceProcs.resourceProcsVersion = kCurrentResourceProcsVersion;
+    gResourceProcs.numResourceProcs = kCurrentResourceProcsCount;
+    gResourceProcs.countProc = HostCountResources;
+    gResourceProcs.getProc = HostGetResource;
+    gResourceProcs.deleteProc = HostDeleteResource;
+    gResourceProcs.addProc = HostAddResource;
+
+    gReadDescriptorProcs.readDescriptorProcsVersion = kCurrentReadDescriptorProcsVersion;
+    gReadDescriptorProcs.numReadDescriptorProcs = kCurrentReadDescriptorProcsCount;
+    gReadDescriptorProcs.openReadDescriptorProc = HostOpenReadDescriptor;
+    gReadDescriptorProcs.closeReadDescriptorProc = HostCloseReadDescriptor;
+    gReadDescriptorProcs.getKeyProc = HostGetKey;
+    gReadDescriptorProcs.getIntegerProc = HostGetInteger;
+    gReadDescriptorProcs.getFloatProc = HostGetFloat;
+    gReadDescriptorProcs.getBooleanProc = HostGetBoolean;
+
+    gWriteDescriptorProcs.writeDescriptorProcsVersion = kCurrentWriteDescriptorProcsVersion;
+    gWriteDescriptorProcs.numWriteDescriptorProcs = kCurrentWriteDescriptorProcsCount;
+    gWriteDescriptorProcs.openWriteDescriptorProc = HostOpenWriteDescriptor;
+    gWriteDescriptorProcs.closeWriteDescriptorProc = HostCloseWriteDescriptor;
+    gWriteDescriptorProcs.putIntegerProc = HostPutInteger;
+    gWriteDescriptorProcs.putFloatProc = HostPutFloat;
+    gWriteDescriptorProcs.putBooleanProc = HostPutBoolean;
+    gWriteDescriptorProcs.putStringProc = HostPutString;
+    gWriteDescriptorProcs.putObjectProc = HostPutObject;
+
+    gDescriptorParameters.descriptorParametersVersion = kCurrentDescriptorParametersVersion;
+    gDescriptorParameters.playInfo = plugInDialogSilent;
+    gDescriptorParameters.recordInfo = plugInDialogOptional;
+    gDescriptorParameters.writeDescriptorProcs = &gWriteDescriptorProcs;
+    gDescriptorParameters.readDescriptorProcs = &gReadDescriptorProcs;
+
+    gBasicSuite.AcquireSuite = HostAcquireSuite;
+    gBasicSuite.ReleaseSuite = HostReleaseSuite;
+    gBasicSuite.IsEqual = HostIsEqual;
+    gBasicSuite.AllocateBlock = HostAllocateBlock;
+    gBasicSuite.FreeBlock = HostFreeBlock;
+    gBasicSuite.ReallocateBlock = HostReallocateBlock;
+    gBasicSuite.Undefined = HostUndefined;
+}
+
+// Pixels -------------------------------------------------------------------
+
+// Moves the chunk the record describes between data and the document:
+// into the document when reading, out of it when writing.
+OSErr MoveChunk(bool reading)
+{
+    FormatRecord& r = gHost->record;
+    HostDocument& doc = gHost->doc;
+
+    VRect rect;
+    if (r.PluginUsing32BitCoordinates) {
+        rect = r.theRect32;
+    } else {
+        rect.top = r.theRect.top;
+        rect.left = r.theRect.left;
+        rect.bottom = r.theRect.bottom;
+        rect.right = r.theRect.right;
+    }
+    if (rect.bottom <= rect.top || rect.right <= rect.left)
+        return noErr;
+
+    char message[256];
+    if (!gHost->haveDocument) {
+        ProtocolError("pixels moved before the document was described");
+        return paramErr;
+    }
+    if (r.data == NULL || r.depth != 8 ||
+        rect.top < 0 || rect.left < 0 || rect.bottom > doc.height || rect.right > doc.width ||
+        r.loPlane < 0 || r.hiPlane < r.loPlane || r.hiPlane >= doc.planes ||
+        r.colBytes < 1 || r.rowBytes < r.colBytes * (rect.right - rect.left)) {
+        snprintf(message, sizeof(message),
+                 "bad chunk: rect %d,%d-%d,%d planes %d-%d col %d row %d plane %d depth %d",
+                 rect.left, rect.top, rect.right, rect.bottom, r.loPlane, r.hiPlane,
+                 r.colBytes, r.rowBytes, r.planeBytes, r.depth);
+        ProtocolError(message);
+        return paramErr;
+    }
+
+    const int32 rows = rect.bottom - rect.top;
+    const int32 columns = rect.right - rect.left;
+    const int32 planes = r.hiPlane - r.loPlane + 1;
+    for (int32 p = 0; p < planes; p++) {
+        int16 docPlane = r.planeMap[r.loPlane + p];
+        if (docPlane < 0 || docPlane >= doc.planes)
+            docPlane = (int16)(r.loPlane + p);
+        for (int32 y = 0; y < rows; y++) {
+            uint8* chunk = (uint8*)r.data + (size_t)y * r.rowBytes + (size_t)p * r.planeBytes;
+            uint8* pixel = doc.Plane(docPlane) + (size_t)(rect.top + y) * doc.width + rect.left;
+            if (r.colBytes == 1) {
+                if (reading)
+                    memcpy(pixel, chunk, columns);
+                else
+                    memcpy(chunk, pixel, columns);
+            } else {
+                for (int32 x = 0; x < columns; x++, chunk += r.colBytes) {
+                    if (reading)
+                        pixel[x] = *chunk;
+                    else
+                        *chunk = pixel[x];
+                }
+            }
+        }
+    }
+
+    SelectorStats* s = gHost->current;
+    if (s != NULL) {
+        s->chunks++;
+        s->bytes += (int64)rows * columns * planes;
+        s->minRows = s->minRows == 0 ? rows : std::min(s->minRows, rows);
+        s->maxRows = std::max(s->maxRows, rows);
+        s->maxPlanes = std::max(s->maxPlanes, planes);
+    }
+    return noErr;
+}
+
+bool gReading = false;
+
+MACPASCAL OSErr HostAdvanceState(void)
+{
+    CheckThread("advanceState");
+    if (gHost->current != NULL)
+        gHost->current->advances++;
+    return MoveChunk(gReading);
+}
+
+MACPASCAL void HostProgress(int32 done, int32 total)
+{
+    CheckThread("progressProc");
+    if (gHost->current != NULL)
+        gHost->current->progressCalls++;
+    if (done < 0 || done > total)
+        ProtocolError("progress done outside 0..total");
+}
+
+MACPASCAL Boolean HostTestAbort(void)
+{
+    CheckThread("abortProc");
+    Clock::time_point now = Clock::now();
+    if (!gHost->aborting) {
+        gHost->abortPolls++;
+        gHost->maxPollGapMs = std::max(gHost->maxPollGapMs,
+            std::chrono::duration<double, std::milli>(now - gHost->lastPoll).count());
+        gHost->lastPoll = now;
+    }
+    if (gHost->abortMs >= 0 &&
+        std::chrono::duration<double, std::milli>(now - gHost->runStart).count() >= gHost->abortMs)
+        gHost->aborting = true;
+    return gHost->aborting;
+}
+
+// The time from when abortProc was due to return true.
+double SinceAbortMs(Clock::time_point now)
+{
+    Clock::time_point due = gHost->runStart +
+        std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(gHost->abortMs));
+    return std::chrono::duration<double, std::milli>(now - due).count();
+}
+
+// Sequences ----------------------------------------------------------------
+
+// Fresh record for a sequence on the file fd; the document, revertInfo and
+// resources stay with the host.
+void ResetRecord(int fd)
+{
+    FormatRecord& r = gHost->record;
+    Handle revertInfo = r.revertInfo;
+    memset(&r, 0, sizeof(r));
+
+    r.abortProc = HostTestAbort;
+    r.progressProc = HostProgress;
+    r.maxData = gHost->maxData;
+    r.dataFork = fd;
+    r.hostSig = 'HSim';
+    r.hostModes = (1 << plugInModeGrayScale) | (1 << plugInModeIndexedColor) | (1 << plugInModeRGBColor);
+    r.revertInfo = revertInfo;
+    r.hostNewHdl = HostNewHandle;
+    r.hostDisposeHdl = HostDisposeHandle;
+    r.bufferProcs = &gBufferProcs;
+    r.resourceProcs = &gResourceProcs;
+    r.handleProcs = &gHandleProcs;
+    r.advanceState = HostAdvanceState;
+    r.descriptorParameters = &gDescriptorParameters;
+    r.sSPBasic = &gBasicSuite;
+    r.transparencyPlane = -1;
+    r.HostSupports32BitCoordinates = true;
+    r.hostSupportsPOSIXIO = true;
+    r.posixFileDescriptor = fd;
+    for (int16 i = 0; i < 16; i++)
+        r.planeMap[i] = i;
+}
+
+void DescribeDocument(void)
+{
+    FormatRecord& r = gHost->record;
+    HostDocument& doc = gHost->doc;
+    r.imageMode = doc.imageMode;
+    r.depth = 8;
+    r.planes = doc.planes;
+    r.transparencyPlane = doc.transparencyPlane;
+    r.imageSize.h = (int16)std::min(doc.width, 30000);
+    r.imageSize.v = (int16)std::min(doc.height, 30000);
+    r.imageSize32.h = doc.width;
+    r.imageSize32.v = doc.height;
+    memcpy(r.redLUT, doc.lut[0], sizeof(LookUpTable));
+    memcpy(r.greenLUT, doc.lut[1], sizeof(LookUpTable));
+    memcpy(r.blueLUT, doc.lut[2], sizeof(LookUpTable));
+}
+
+// The document the plug-in described at ReadStart.
+bool AcceptDocument(void)
+{
+    FormatRecord& r = gHost->record;
+    HostDocument& doc = gHost->doc;
+    doc.width = r.PluginUsing32BitCoordinates ? r.imageSize32.h : r.imageSize.h;
+    doc.height = r.PluginUsing32BitCoordinates ? r.imageSize32.v : r.imageSize.v;
+    doc.planes = r.planes;
+    doc.imageMode = r.imageMode;
+    doc.transparencyPlane = r.transparencyPlane;
+    memcpy(doc.lut[0], r.redLUT, sizeof(LookUpTable));
+    memcpy(doc.lut[1], r.greenLUT, sizeof(LookUpTable));
+    memcpy(doc.lut[2], r.blueLUT, sizeof(LookUpTable));
+    if (doc.width < 1 || doc.height < 1 || doc.planes < 1 || doc.planes > 16 || r.depth != 8) {
+        char message[128];
+        snprintf(message, sizeof(message), "ReadStart described a %dx%d document of %d planes at depth %d",
+                 doc.width, doc.height, doc.planes, r.depth);
+        ProtocolError(message);
+        return false;
+    }
+    doc.pixels.assign((size_t)doc.width * doc.height * doc.planes, 0);
+    gHost->haveDocument = true;
+    return true;
+}
+
+bool CallPlugin(int16 selector)
+{
+    SelectorStats& s = gHost->stats[selector];
+    gHost->current = &s;
+    gHost->heldPeak = gHost->heldBytes;
+    if (gHost->rssResettable)
+        gHost->rssResettable = ResetPeakRss();
+
+    // Scripting parameters go to the Prepare selectors, which read them.
+    if (selector == formatSelectorReadPrepare || selector == formatSelectorWritePrepare ||
+        selector == formatSelectorOptionsPrepare) {
+        if (gDescriptorParameters.descriptor != NULL)
+            HostDisposeHandle(gDescriptorParameters.descriptor);
+        gDescriptorParameters.descriptor = gHost->scriptParams.empty()
+            ? NULL : DescriptorHandle(gHost->scriptParams);
+    }
+
+    BLPMemSnapshot before;
+    BLPMemTake(before);
+    BLPMemPeak memPeak;
+
+    int16 result = noErr;
+    Clock::time_point start = Clock::now();
+    PluginMain(selector, &gHost->record, &gHost->pluginData, &result);
+    Clock::time_point end = Clock::now();
+    double ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+    BLPMemSnapshot after;
+    BLPMemTake(after);
+    for (int32 kind = 0; kind < BLP_MEM_KINDS; kind++)
+        s.allocations += after.allocations[kind] - before.allocations[kind];
+    s.memPeak = std::max(s.memPeak, memPeak.End());
+
+    if (s.calls++ == 0)
+        s.order = ++gHost->calledSelectors;
+    s.runMs[gHost->run] += ms;
+    s.result = result;
+    if (selector == formatSelectorReadPrepare || selector == formatSelectorWritePrepare)
+        s.keptMaxData = gHost->record.maxData;
+    s.hostPeak = std::max(s.hostPeak, gHost->heldPeak);
+    s.peakRssKB = std::max(s.peakRssKB, ReadPeakRssKB());
+    gHost->current = NULL;
+
+    if (result == userCanceledErr && gHost->cancelSelector < 0) {
+        if (!gHost->aborting)
+            ProtocolError(std::string(SelectorName(selector)) + " returned userCanceledErr with no abort");
+        gHost->cancelSelector = selector;
+        gHost->cancelMs = SinceAbortMs(end);
+    } else if (result != noErr) {
+        fprintf(stderr, "BLPHostSim: %s returned %d\n", SelectorName(selector), result);
+    }
+    return result == noErr && gHost->protocolError.empty();
+}
+
+// Calls continueSelector at least once and then until the plug-in sets data
+// to NULL, as Photoshop does, moving the chunk the plug-in leaves described.
+bool ContinueLoop(int16 continueSelector, bool reading)
+{
+    const int32 kMaxCalls = 1 << 24;
+    int32 calls = 0;
+    do {
+        if (calls++ == kMaxCalls) {
+            ProtocolError(std::string(SelectorName(continueSelector)) + " never set data to NULL");
+            return false;
+        }
+        gReading = reading;
+        if (gHost->record.data != NULL && MoveChunk(reading) != noErr)
+            return false;
+        if (!CallPlugin(continueSelector))
+            return false;
+    } while (gHost->record.data != NULL);
+    return true;
+}
+
+void KeepReturnedParams(std::vector<DescriptorItem>& params)
+{
+    params.clear();
+    HostHandle* h = (HostHandle*)gDescriptorParameters.descriptor;
+    if (h == NULL)
+        return;
+    const DescriptorItem* items = (const DescriptorItem*)h->data;
+    params.assign(items, items + h->size / sizeof(DescriptorItem));
+    HostDisposeHandle(gDescriptorParameters.descriptor);
+    gDescriptorParameters.descriptor = NULL;
+}
+
+bool ReadSequence(const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "BLPHostSim: cannot open %s\n", path);
+        return false;
+    }
+    ResetRecord(fd);
+    gHost->haveDocument = false;
+    gReading = true;
+
+    bool ok = CallPlugin(formatSelectorFilterFile) &&
+              CallPlugin(formatSelectorReadPrepare);
+    if (ok) {
+        gHost->record.maxData = gHost->maxData;
+        bool started = CallPlugin(formatSelectorReadStart) && AcceptDocument();
+        if (started)
+            ok = ContinueLoop(formatSelectorReadContinue, true);
+        ok = CallPlugin(formatSelectorReadFinish) && ok && started;
+        KeepReturnedParams(gHost->readParams);
+    }
+    close(fd);
+    return ok;
+}
+
+bool WriteSequence(const char* path)
+{
+    ResetRecord(-1);
+    DescribeDocument();
+    gReading = false;
+
+    bool ok = CallPlugin(formatSelectorOptionsPrepare) &&
+              CallPlugin(formatSelectorOptionsStart) &&
+              ContinueLoop(formatSelectorOptionsContinue, false) &&
+              CallPlugin(formatSelectorOptionsFinish);
+    ok = ok && CallPlugin(formatSelectorEstimatePrepare) &&
+               CallPlugin(formatSelectorEstimateStart) &&
+               ContinueLoop(formatSelectorEstimateContinue, false) &&
+               CallPlugin(formatSelectorEstimateFinish);
+    if (!ok)
+        return false;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "BLPHostSim: cannot create %s\n", path);
+        return false;
+    }
+    gHost->record.dataFork = fd;
+    gHost->record.posixFileDescriptor = fd;
+    gHost->record.maxData = gHost->maxData;
+    gHost->record.data = NULL;
+
+    ok = CallPlugin(formatSelectorWritePrepare);
+    if (ok) {
+        bool started = CallPlugin(formatSelectorWriteStart);
+        if (started)
+            ok = ContinueLoop(formatSelectorWriteContinue, false);
+        ok = CallPlugin(formatSelectorWriteFinish) && ok && started;
+        KeepReturnedParams(gHost->writeParams);
+    }
+    close(fd);
+    return ok;
+}
+
+//-------------------------------------------------------------------------------
+//	Driver
+//-------------------------------------------------------------------------------
+
+void Usage(void)
+{
+    fprintf(stderr,
+        "usage: BLPHostSim [switches] read FILE.blp\n"
+        "       BLPHostSim [switches] write IMAGE OUT.blp\n"
+        "       BLPHostSim [switches] resave FILE.blp OUT.blp\n"
+        "       BLPHostSim [switches] roundtrip IMAGE OUT.blp\n"
+        "  -maxdata N[K|M]  maxData offered at the Prepare selectors (default 512M)\n"
+        "  -set KEY=VALUE   scripting parameter, KEY four characters (qual=80, optH=true, stat=true)\n"
+        "  -runs N          run the sequence N times (default 1)\n"
+        "  -o FILE          save the document read as PAM\n"
+        "  -abort MS        abortProc returns true from MS milliseconds into each run\n"
+        "IMAGE is a binary PGM, PPM or PAM file, or gen:WxH\n");
+}
+
+std::string KeyName(DescriptorKeyID key)
+{
+    char name[5] = { (char)(key >> 24), (char)(key >> 16), (char)(key >> 8), (char)key, 0 };
+    return name;
+}
+
+bool ParseScriptParam(const char* s, DescriptorItem& item)
+{
+    const char* equals = strchr(s, '=');
+    if (equals == NULL || equals - s != 4 || equals[1] == 0)
+        return false;
+    item.key = ((DescriptorKeyID)(uint8)s[0] << 24) | ((DescriptorKeyID)(uint8)s[1] << 16) |
+               ((DescriptorKeyID)(uint8)s[2] << 8) | (DescriptorKeyID)(uint8)s[3];
+    const char* value = equals + 1;
+    item.integer = 0;
+    item.number = 0;
+    item.text[0] = 0;
+    if (strcmp(value, "true") == 0 || strcmp(value, "false") == 0) {
+        item.type = typeBoolean;
+        item.integer = value[0] == 't';
+        return true;
+    }
+    char* end = NULL;
+    if (strpbrk(value, ".eE") != NULL) {
+        item.type = typeFloat;
+        item.number = strtod(value, &end);
+    } else {
+        item.type = typeInteger;
+        item.integer = (int32)strtol(value, &end, 10);
+    }
+    return end != NULL && *end == 0;
+}
+
+bool ParseBytes(const char* s, int32& bytes)
+{
+    char* end = NULL;
+    double value = strtod(s, &end);
+    if (end == s || value < 0)
+        return false;
+    if (*end == 'K' || *end == 'k') { value *= 1024; end++; }
+    else if (*end == 'M' || *end == 'm') { value *= 1024 * 1024; end++; }
+    if (*end != 0 || value > 0x7FFFFFFF)
+        return false;
+    bytes = (int32)value;
+    return true;
+}
+
+uint64 DocumentHash(HostDocument& doc)
+{
+    int32 shape[4] = { doc.width, doc.height, doc.planes, doc.imageMode };
+    uint64 hash = BLPHash64(shape, sizeof(shape));
+    hash = BLPHash64(doc.pixels.empty() ? NULL : &doc.pixels[0], doc.pixels.size(), hash);
+    if (doc.imageMode == plugInModeIndexedColor)
+        hash = BLPHash64(doc.lut, sizeof(doc.lut), hash);
+    return hash;
+}
+
+bool FileHash(const char* path, int64& size, uint64& hash)
+{
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+        return false;
+    std::vector<uint8> data;
+    uint8 block[65536];
+    size_t got;
+    while ((got = fread(block, 1, sizeof(block), file)) > 0)
+        data.insert(data.end(), block, block + got);
+    fclose(file);
+    size = (int64)data.size();
+    hash = BLPHash64(data.empty() ? NULL : &data[0], data.size());
+    return true;
+}
+
+double Median(std::vector<double> values)
+{
+    std::sort(values.begin(), values.end());
+    size_t n = values.size();
+    return n == 0 ? 0 : n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+void PrintStats(int32 runs)
+{
+    const bool memStats = BLPMemStatsEnabled();
+    printf("%-17s %5s %10s %10s %8s %9s %6s %9s %8s %8s",
+           "selector", "calls", "median ms", "best ms", "advance", "rows", "planes",
+           "MB moved", "host MB", "RSS MB");
+    if (memStats)
+        printf(" %8s %8s", "allocs", "alloc MB");
+    printf("\n");
+    const double mb = 1024.0 * 1024.0;
+    std::vector<double> totals(runs, 0.0);
+    std::vector<std::pair<int32, int16> > called;
+    for (int16 selector = 0; selector < kSelectorCount; selector++)
+        if (gHost->stats[selector].calls > 0)
+            called.push_back(std::make_pair(gHost->stats[selector].order, selector));
+    std::sort(called.begin(), called.end());
+
+    for (size_t i = 0; i < called.size(); i++) {
+        const int16 selector = called[i].second;
+        SelectorStats& s = gHost->stats[selector];
+        for (int32 run = 0; run < runs; run++)
+            totals[run] += s.runMs[run];
+        char rows[32] = "-";
+        if (s.chunks > 0) {
+            if (s.minRows == s.maxRows)
+                snprintf(rows, sizeof(rows), "%d", s.maxRows);
+            else
+                snprintf(rows, sizeof(rows), "%d-%d", s.minRows, s.maxRows);
+        }
+        printf("%-17s %5d %10.3f %10.3f %8lld %9s %6d %9.2f %8.2f %8.1f",
+               SelectorName(selector), s.calls, Median(s.runMs),
+               *std::min_element(s.runMs.begin(), s.runMs.end()),
+               (long long)s.advances, rows, s.maxPlanes, s.bytes / mb, s.hostPeak / mb,
+               s.peakRssKB / 1024.0);
+        if (memStats)
+            printf(" %8lld %8.2f", (long long)s.allocations, s.memPeak / mb);
+        printf("\n");
+    }
+    printf("%-17s %5s %10.3f %10.3f\n", "total", "", Median(totals),
+           *std::min_element(totals.begin(), totals.end()));
+    for (size_t i = 0; i < called.size(); i++) {
+        const SelectorStats& s = gHost->stats[called[i].second];
+        if (s.keptMaxData >= 0)
+            printf("%s kept %.2f MB of the %.2f MB of maxData offered\n",
+                   SelectorName(called[i].second), s.keptMaxData / mb, gHost->maxData / mb);
+    }
+    if (!gHost->rssResettable)
+        printf("RSS is the peak of the process so far: /proc/self/clear_refs is not writable\n");
+    if (memStats)
+        printf("alloc MB is the peak of the plug-in's counted heap, Buffer and libjpeg bytes\n");
+}
+
+void PrintDocument(const char* label, HostDocument& doc)
+{
+    printf("%s: %dx%d, %d planes, mode %d, transparency plane %d, hash %016llx\n",
+           label, doc.width, doc.height, doc.planes, doc.imageMode, doc.transparencyPlane,
+           (unsigned long long)DocumentHash(doc));
+}
+
+void PrintDescriptor(const char* label, const std::vector<DescriptorItem>& params)
+{
+    if (params.empty())
+        return;
+    printf("%s:", label);
+    std::vector<size_t> objectEnds;
+    for (size_t i = 0; i < params.size(); i++) {
+        const DescriptorItem& item = params[i];
+        if (item.type == typeObject)
+            printf(" %s={", KeyName(item.key).c_str());
+        else if (item.type == typeFloat)
+            printf(" %s=%g", KeyName(item.key).c_str(), item.number);
+        else if (item.type == typeBoolean)
+            printf(" %s=%s", KeyName(item.key).c_str(), item.integer ? "true" : "false");
+        else if (item.type == typeChar)
+            printf(" %s=\"%s\"", KeyName(item.key).c_str(), item.text);
+        else
+            printf(" %s=%d", KeyName(item.key).c_str(), item.integer);
+        if (item.type == typeObject)
+            objectEnds.push_back(i + item.integer);
+        while (!objectEnds.empty() && objectEnds.back() == i) {
+            printf(" }");
+            objectEnds.pop_back();
+        }
+    }
+    printf("\n");
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    static Host host;
+    gHost = &host;
+    host.thread = std::this_thread::get_id();
+    host.maxData = 512 << 20;
+    host.abortMs = -1;
+    host.rssResettable = true;
+    int32 runs = 1;
+    const char* savePath = NULL;
+    std::vector<const char*> args;
+
+    for (int arg = 1; arg < argc; arg++) {
+        const char* s = argv[arg];
+        const char* value = arg + 1 < argc ? argv[arg + 1] : NULL;
+        bool ok = true;
+
+        if (strcmp(s, "-maxdata") == 0 && value != NULL) {
+            ok = ParseBytes(value, host.maxData);
+            arg++;
+        } else if (strcmp(s, "-set") == 0 && value != NULL) {
+            DescriptorItem item;
+            ok = ParseScriptParam(value, item);
+            if (ok)
+                host.scriptParams.push_back(item);
+            arg++;
+        } else if (strcmp(s, "-runs") == 0 && value != NULL) {
+            runs = atoi(value);
+            ok = runs >= 1;
+            arg++;
+        } else if (strcmp(s, "-o") == 0 && value != NULL) {
+            savePath = value;
+            arg++;
+        } else if (strcmp(s, "-abort") == 0 && value != NULL) {
+            char* end = NULL;
+            host.abortMs = strtod(value, &end);
+            ok = end != value && *end == 0 && host.abortMs >= 0;
+            arg++;
+        } else if (s[0] == '-') {
+            ok = false;
+        } else {
+            args.push_back(s);
+        }
+
+        if (!ok) {
+            Usage();
+            return 2;
+        }
+    }
+
+    const std::string mode = args.empty() ? "" : args[0];
+    const bool reads = mode == "read" || mode == "resave" || mode == "roundtrip";
+    const bool writes = mode == "write" || mode == "resave" || mode == "roundtrip";
+    if (!(mode == "read" && args.size() == 2) && !(writes && args.size() == 3)) {
+        Usage();
+        return 2;
+    }
+
+    HostDocument source;
+    if (mode == "write" || mode == "roundtrip") {
+        std::string error;
+        if (strncmp(args[1], "gen:", 4) == 0) {
+            if (!GenerateImage(args[1], source)) {
+                Usage();
+                return 2;
+            }
+        } else if (!LoadImage(args[1], source, error)) {
+            fprintf(stderr, "BLPHostSim: %s\n", error.c_str());
+            return 2;
+        }
+    }
+
+    InitSuites();
+    for (int16 selector = 0; selector < kSelectorCount; selector++)
+        host.stats[selector].runMs.assign(runs, 0.0);
+
+    bool ok = true;
+    for (host.run = 0; ok && host.run < runs; host.run++) {
+        for (int16 selector = 0; selector < kSelectorCount; selector++) {
+            SelectorStats& s = host.stats[selector];
+            s.calls = s.order = 0;
+            s.advances = s.chunks = s.bytes = s.progressCalls = s.allocations = 0;
+            s.minRows = s.maxRows = s.maxPlanes = 0;
+            s.keptMaxData = -1;
+        }
+        host.calledSelectors = 0;
+        host.resources.clear();
+        if (host.record.revertInfo != NULL) {
+            HostDisposeHandle(host.record.revertInfo);
+            host.record.revertInfo = NULL;
+        }
+        // The document is the host's before the run starts: copying it is
+        // no time of the plug-in's.
+        if (mode == "write" || mode == "roundtrip") {
+            host.doc = source;
+            host.haveDocument = true;
+        }
+        host.runStart = host.lastPoll = Clock::now();
+        host.abortPolls = 0;
+        host.maxPollGapMs = 0;
+        host.aborting = false;
+        host.cancelSelector = -1;
+        BLPMemSnapshot runBefore;
+        BLPMemTake(runBefore);
+
+        if (mode == "read") {
+            ok = ReadSequence(args[1]);
+        } else if (mode == "write") {
+            ok = WriteSequence(args[2]);
+        } else if (mode == "resave") {
+            ok = ReadSequence(args[1]) && WriteSequence(args[2]);
+        } else {
+            ok = WriteSequence(args[2]) && ReadSequence(args[2]);
+        }
+
+        // Photoshop keeps the plug-in's data for as long as the plug-in is
+        // loaded; the plug-in allocates it with malloc.
+        free((void*)host.pluginData);
+        host.pluginData = 0;
+
+        // Whatever the plug-in still holds now, it leaked.
+        BLPMemSnapshot runAfter;
+        BLPMemTake(runAfter);
+        char leak[128];
+        if (!host.buffers.empty()) {
+            snprintf(leak, sizeof(leak), "%d Buffer suite buffers left after the run", (int)host.buffers.size());
+            ProtocolError(leak);
+        }
+        for (int32 kind = BLP_MEM_HEAP; kind < BLP_MEM_KINDS; kind++)
+            if (runAfter.live[kind] != runBefore.live[kind]) {
+                snprintf(leak, sizeof(leak), "%lld bytes of kind %d left after the run",
+                         (long long)(runAfter.live[kind] - runBefore.live[kind]), kind);
+                ProtocolError(leak);
+            }
+
+        if (host.cancelSelector >= 0) {
+            printf("cancelled: %s returned userCanceledErr %.3f ms after the abort; "
+                   "%lld abortProc polls before it, longest gap %.3f ms\n",
+                   SelectorName(host.cancelSelector), host.cancelMs,
+                   (long long)host.abortPolls, host.maxPollGapMs);
+            ok = host.protocolError.empty();
+            break;
+        }
+        if (host.abortMs >= 0 && !host.aborting)
+            printf("abort: run %d finished before %.0f ms, %lld abortProc polls, longest gap %.3f ms\n",
+                   host.run + 1, host.abortMs, (long long)host.abortPolls, host.maxPollGapMs);
+        ok = ok && host.protocolError.empty();
+    }
+
+    if (!host.protocolError.empty())
+        fprintf(stderr, "BLPHostSim: protocol error: %s\n", host.protocolError.c_str());
+    if (!ok)
+        return 1;
+    if (host.cancelSelector >= 0)
+        return 0;
+    if (host.run > 0)
+        PrintStats(runs);
+
+    if (reads) {
+        PrintDocument("document", host.doc);
+        if (savePath != NULL && !SaveImage(savePath, host.doc)) {
+            fprintf(stderr, "BLPHostSim: cannot write %s\n", savePath);
+            return 1;
+        }
+    }
+    if (writes) {
+        int64 size = 0;
+        uint64 hash = 0;
+        if (FileHash(args[2], size, hash))
+            printf("file: %lld bytes, hash %016llx\n", (long long)size, (unsigned long long)hash);
+    }
+    if (mode == "roundtrip") {
+        std::vector<uint8> a, b;
+        DocumentToRgba(source, a);
+        DocumentToRgba(host.doc, b);
+        if (source.width == host.doc.width && source.height == host.doc.height)
+            printf("PSNR: RGB %.2f dB, alpha %.2f dB\n",
+                   BLPPsnr(&a[0], &b[0], source.width, source.height, 4, 3),
+                   BLPPsnr(&a[3], &b[3], source.width, source.height, 4, 1));
+        else
+            printf("PSNR: the document read is %dx%d, not %dx%d\n",
+                   host.doc.width, host.doc.height, source.width, source.height);
+    }
+    PrintDescriptor("read descriptor", host.readParams);
+    PrintDescriptor("write descriptor", host.writeParams);
+    return 0;
+}
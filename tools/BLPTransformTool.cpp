@@ -0,0 +1,335 @@
+//-------------------------------------------------------------------------------
+//
+//	File:
+//		BLPTransformTool.cpp
+//
+//	Description:
+//		Command-line front end to BLPTransform.h for batches of files.
+//
+//	Use:
+//		BLPTransformTool [switches] (-outdir dir | -inplace) input...
+//
+//		-flip horizontal|vertical
+//		-rotate 90|180|270		clockwise
+//		-transpose				across the upper-left to lower-right axis
+//		-transverse				across the upper-right to lower-left axis
+//		-crop WxH+X+Y			after the transform; X and Y multiples of 8
+//		-dropmips N				make mip N the new mip 0 (before any transform)
+//		-outdir dir				write the results under dir
+//		-inplace				replace each input file
+//		-threads N				files processed at once (default: one per core)
+//		-verbose				report every file
+//
+//		An input is a .blp file, a directory, which is searched for .blp
+//		files recursively and mirrored under -outdir, or @list, a text file
+//		with one input per line.
+//
+//-------------------------------------------------------------------------------
+
+#include "BLPTaskPool.h"
+#include "BLPTransform.h"
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+typedef struct Job
+{
+    fs::path input;
+    fs::path output;
+} Job;
+
+typedef struct Options
+{
+    BLPTransformSpec spec;
+    int32 dropMips;
+    bool verbose;
+} Options;
+
+std::mutex gConsole;
+
+void Usage(void)
+{
+    fprintf(stderr,
+        "usage: BLPTransformTool [switches] (-outdir dir | -inplace) input...\n"
+        "  -flip horizontal|vertical\n"
+        "  -rotate 90|180|270      clockwise\n"
+        "  -transpose              across the upper-left to lower-right axis\n"
+        "  -transverse             across the upper-right to lower-left axis\n"
+        "  -crop WxH+X+Y           after the transform; X and Y multiples of 8\n"
+        "  -dropmips N             make mip N the new mip 0 (before any transform)\n"
+        "  -outdir dir             write the results under dir\n"
+        "  -inplace                replace each input file\n"
+        "  -threads N              files processed at once (default: one per core)\n"
+        "  -verbose                report every file\n"
+        "an input is a .blp file, a directory (searched recursively), or @list\n");
+}
+
+bool ReadFile(const fs::path& path, std::vector<uint8>& data)
+{
+    FILE* file = fopen(path.string().c_str(), "rb");
+    if (file == NULL)
+        return false;
+    bool ok = fseek(file, 0, SEEK_END) == 0;
+    long size = ok ? ftell(file) : -1;
+    ok = size > 0 && fseek(file, 0, SEEK_SET) == 0;
+    if (ok) {
+        data.resize((size_t)size);
+        ok = fread(&data[0], 1, data.size(), file) == data.size();
+    }
+    fclose(file);
+    return ok;
+}
+
+bool WriteFile(const fs::path& path, const std::vector<uint8>& data)
+{
+    std::error_code error;
+    if (path.has_parent_path())
+        fs::create_directories(path.parent_path(), error);
+    FILE* file = fopen(path.string().c_str(), "wb");
+    if (file == NULL)
+        return false;
+    bool ok = fwrite(&data[0], 1, data.size(), file) == data.size();
+    ok = fclose(file) == 0 && ok;
+    return ok;
+}
+
+bool IsBlp(const fs::path& path)
+{
+    std::string extension = path.extension().string();
+    for (size_t i = 0; i < extension.size(); i++)
+        extension[i] = (char)tolower((unsigned char)extension[i]);
+    return extension == ".blp";
+}
+
+// Adds the jobs for one input: a file, or every .blp file under a directory.
+void AddInput(const fs::path& input, const fs::path& outDir, std::vector<Job>& jobs)
+{
+    std::error_code error;
+    if (fs::is_directory(input, error)) {
+        for (fs::recursive_directory_iterator it(input, error), end; !error && it != end; it.increment(error)) {
+            if (!it->is_regular_file(error) || !IsBlp(it->path()))
+                continue;
+            Job job;
+            job.input = it->path();
+            job.output = outDir.empty() ? job.input : outDir / fs::relative(job.input, input, error);
+            jobs.push_back(job);
+        }
+        if (error)
+            fprintf(stderr, "%s: %s\n", input.string().c_str(), error.message().c_str());
+    } else {
+        Job job;
+        job.input = input;
+        job.output = outDir.empty() ? input : outDir / input.filename();
+        jobs.push_back(job);
+    }
+}
+
+void ReadList(const char* path, std::vector<std::string>& inputs)
+{
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "BLPTransformTool: cannot open list %s\n", path);
+        return;
+    }
+    char line[4096];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        size_t length = strcspn(line, "\r\n");
+        line[length] = '\0';
+        if (length > 0)
+            inputs.push_back(line);
+    }
+    fclose(file);
+}
+
+// Sets op from a second transform switch only if none was given yet.
+bool SetOp(BLPTransformSpec& spec, BLPTransformOp op)
+{
+    if (spec.op != BLP_TRANSFORM_NONE) {
+        fprintf(stderr, "BLPTransformTool: only one transform per run\n");
+        return false;
+    }
+    spec.op = op;
+    return true;
+}
+
+// Runs one job; returns false, after saying why, if it failed.
+bool RunJob(const Job& job, const Options& options, std::vector<uint8>& data, std::vector<uint8>& result)
+{
+    const char* failure = NULL;
+    BLPTransformStats stats;
+    BLPTransformError error = BLP_TRANSFORM_OK;
+    size_t inputSize = 0;
+
+    if (!ReadFile(job.input, data)) {
+        failure = "cannot read";
+    } else {
+        inputSize = data.size();
+        if (options.dropMips > 0) {
+            error = BLPDropMips(&data[0], data.size(), options.dropMips, result, &stats);
+            if (error == BLP_TRANSFORM_OK)
+                data.swap(result);
+        }
+        if (error == BLP_TRANSFORM_OK && (options.spec.op != BLP_TRANSFORM_NONE || options.spec.crop))
+            error = BLPLosslessTransform(&data[0], data.size(), options.spec, result, &stats);
+        else
+            result.swap(data);
+        if (error != BLP_TRANSFORM_OK)
+            failure = BLPTransformErrorString(error);
+        else if (!WriteFile(job.output, result))
+            failure = "cannot write";
+    }
+
+    std::lock_guard<std::mutex> lock(gConsole);
+    if (failure != NULL)
+        fprintf(stderr, "%s: %s\n", job.input.string().c_str(), failure);
+    else if (options.verbose)
+        printf("%s: %d levels (%d re-encoded), %u -> %u bytes\n", job.output.string().c_str(),
+               (int)stats.levels, (int)stats.reencodedLevels,
+               (unsigned int)inputSize, (unsigned int)result.size());
+    return failure == NULL;
+}
+
+// The batch: each job is a task of a BLPTaskPool.
+typedef struct Batch
+{
+    const std::vector<Job>* jobs;
+    const Options* options;
+    std::atomic<int> failed;
+} Batch;
+
+void RunJobTask(void* context, int32 index)
+{
+    // A worker keeps its buffers from one file to the next.
+    thread_local std::vector<uint8> data;
+    thread_local std::vector<uint8> result;
+    Batch* batch = static_cast<Batch*>(context);
+    if (!RunJob((*batch->jobs)[index], *batch->options, data, result))
+        batch->failed++;
+}
+
+} // namespace
+
+/*****************************************************************************/
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    memset(&options.spec, 0, sizeof(options.spec));
+    options.dropMips = 0;
+    options.verbose = false;
+    std::string outDir;
+    bool inPlace = false;
+    int threads = (int)std::thread::hardware_concurrency();
+    std::vector<std::string> inputs;
+
+    for (int arg = 1; arg < argc; arg++) {
+        const char* s = argv[arg];
+        const char* value = arg + 1 < argc ? argv[arg + 1] : NULL;
+        BLPTransformSpec& spec = options.spec;
+        bool ok = true;
+
+        if (strcmp(s, "-flip") == 0 && value != NULL) {
+            if (strcmp(value, "horizontal") == 0)
+                ok = SetOp(spec, BLP_TRANSFORM_FLIP_H);
+            else if (strcmp(value, "vertical") == 0)
+                ok = SetOp(spec, BLP_TRANSFORM_FLIP_V);
+            else
+                ok = false;
+            arg++;
+        } else if (strcmp(s, "-rotate") == 0 && value != NULL) {
+            if (strcmp(value, "90") == 0)
+                ok = SetOp(spec, BLP_TRANSFORM_ROT_90);
+            else if (strcmp(value, "180") == 0)
+                ok = SetOp(spec, BLP_TRANSFORM_ROT_180);
+            else if (strcmp(value, "270") == 0)
+                ok = SetOp(spec, BLP_TRANSFORM_ROT_270);
+            else
+                ok = false;
+            arg++;
+        } else if (strcmp(s, "-transpose") == 0) {
+            ok = SetOp(spec, BLP_TRANSFORM_TRANSPOSE);
+        } else if (strcmp(s, "-transverse") == 0) {
+            ok = SetOp(spec, BLP_TRANSFORM_TRANSVERSE);
+        } else if (strcmp(s, "-crop") == 0 && value != NULL) {
+            unsigned int w, h, x, y;
+            char end;
+            ok = sscanf(value, "%ux%u+%u+%u%c", &w, &h, &x, &y, &end) == 4;
+            spec.crop = true;
+            spec.cropWidth = w;
+            spec.cropHeight = h;
+            spec.cropX = x;
+            spec.cropY = y;
+            arg++;
+        } else if (strcmp(s, "-dropmips") == 0 && value != NULL) {
+            options.dropMips = atoi(value);
+            ok = options.dropMips > 0;
+            arg++;
+        } else if (strcmp(s, "-outdir") == 0 && value != NULL) {
+            outDir = value;
+            arg++;
+        } else if (strcmp(s, "-inplace") == 0) {
+            inPlace = true;
+        } else if (strcmp(s, "-threads") == 0 && value != NULL) {
+            threads = atoi(value);
+            ok = threads > 0;
+            arg++;
+        } else if (strcmp(s, "-verbose") == 0) {
+            options.verbose = true;
+        } else if (s[0] == '@') {
+            ReadList(s + 1, inputs);
+        } else if (s[0] == '-') {
+            ok = false;
+        } else {
+            inputs.push_back(s);
+        }
+
+        if (!ok) {
+            Usage();
+            return 2;
+        }
+    }
+
+    if (inputs.empty() || outDir.empty() == !inPlace ||
+        (options.spec.op == BLP_TRANSFORM_NONE && !options.spec.crop && options.dropMips == 0)) {
+        Usage();
+        return 2;
+    }
+
+    std::vector<Job> jobs;
+    for (size_t i = 0; i < inputs.size(); i++)
+        AddInput(fs::path(inputs[i]), fs::path(outDir), jobs);
+
+    // The jobs are independent files, so this is mostly I/O bound for
+    // -dropmips.
+    if ((size_t)threads > jobs.size())
+        threads = (int)(jobs.empty() ? 1 : jobs.size());
+    Batch batch;
+    batch.jobs = &jobs;
+    batch.options = &options;
+    batch.failed = 0;
+    {
+        BLPTaskPool pool(threads);
+        BLPTaskGroup group(&pool);
+        for (size_t i = 0; i < jobs.size(); i++)
+            group.Run(RunJobTask, &batch, (int32)i);
+        group.Wait();
+    }
+    int failed = batch.failed;
+
+    if (options.verbose || failed != 0)
+        printf("%u files, %d failed\n", (unsigned int)jobs.size(), (int)failed);
+    return failed != 0 ? 1 : 0;
+}
+
+// end BLPTransformTool.cpp
@@ -0,0 +1,4 @@
+// See CoreServices.h. Objective-C classes are opaque here.
+#include <CoreServices/CoreServices.h>
+
+typedef struct NSFileHandle NSFileHandle;
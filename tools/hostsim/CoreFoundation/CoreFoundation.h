@@ -0,0 +1,2 @@
+// See CoreServices.h.
+#include <CoreServices/CoreServices.h>
@@ -0,0 +1,126 @@
+//-------------------------------------------------------------------------------
+//
+//	File:
+//		CoreServices.h
+//
+//	Description:
+//		The Macintosh types and constants the Photoshop SDK headers and the
+//		plug-in's Macintosh code use, so that both compile on a POSIX
+//		system for BLPHostSim. Only declarations live here; the few
+//		platform routines the plug-in calls are in HostSimPlatform.cpp.
+//
+//		BLPHostSim builds the plug-in as a Macintosh plug-in that uses
+//		POSIX file I/O, the path Photoshop takes when hostSupportsPOSIXIO
+//		is set.
+//
+//-------------------------------------------------------------------------------
+
+#ifndef __HostSimCoreServices_H__
+#define __HostSimCoreServices_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef pascal
+#define pascal
+#endif
+
+typedef unsigned char Boolean;
+typedef int16_t OSErr;
+typedef int32_t OSStatus;
+typedef uint32_t FourCharCode;
+typedef FourCharCode OSType;
+typedef FourCharCode ResType;
+typedef int32_t Fixed;
+typedef char* Ptr;
+typedef Ptr* Handle;
+typedef long Size;
+typedef uint8_t UInt8;
+typedef int8_t SInt8;
+typedef uint16_t UInt16;
+typedef int16_t SInt16;
+typedef uint32_t UInt32;
+typedef int32_t SInt32;
+typedef uint64_t UInt64;
+typedef int64_t SInt64;
+typedef unsigned long ByteCount;
+typedef uint16_t UniChar;
+typedef SInt16 FSIORefNum;
+
+typedef unsigned char Str255[256];
+typedef unsigned char Str63[64];
+typedef unsigned char Str31[32];
+typedef unsigned char* StringPtr;
+typedef const unsigned char* ConstStringPtr;
+typedef const unsigned char* ConstStr255Param;
+
+typedef struct Rect { int16_t top, left, bottom, right; } Rect;
+typedef struct Point { int16_t v, h; } Point;
+typedef struct RGBColor { uint16_t red, green, blue; } RGBColor;
+
+typedef struct FSRef { UInt8 hidden[80]; } FSRef;
+typedef struct FSSpec { SInt16 vRefNum; SInt32 parID; Str63 name; } FSSpec;
+typedef struct HFSUniStr255 { UInt16 length; UniChar unicode[255]; } HFSUniStr255;
+typedef struct AliasRecord { OSType userType; UInt16 aliasSize; } AliasRecord;
+typedef AliasRecord* AliasPtr;
+typedef AliasPtr* AliasHandle;
+typedef UInt32 FSAliasInfoBitmap;
+typedef struct FSAliasInfo { UInt32 volumeCreateDate; OSType fileType; OSType fileCreator; } FSAliasInfo;
+
+typedef const struct __CFData* CFDataRef;
+typedef const struct __CFURL* CFURLRef;
+typedef const struct __CFString* CFStringRef;
+typedef const struct __CFAllocator* CFAllocatorRef;
+typedef struct __CFBundle* CFBundleRef;
+typedef struct __CFError* CFErrorRef;
+typedef const void* CFTypeRef;
+typedef long CFIndex;
+
+typedef struct GrafPort* GrafPtr;
+typedef struct OpaqueWindowPtr* WindowRef;
+typedef struct OpaqueDialogPtr* DialogRef;
+typedef struct EventRecord { UInt16 what; UInt32 message; UInt32 when; Point where; UInt16 modifiers; } EventRecord;
+
+enum {
+	noErr = 0,
+	userCanceledErr = -128,
+	memFullErr = -108,
+	nilHandleErr = -109,
+	eofErr = -39,
+	dskFulErr = -34,
+	ioErr = -36,
+	readErr = -19,
+	writErr = -20,
+	controlErr = -17,
+	paramErr = -50,
+	fnfErr = -43,
+	resNotFound = -192,
+	coreFoundationUnknownErr = -4960
+};
+
+enum {
+	fsAtMark = 0,
+	fsFromStart = 1,
+	fsFromLEOF = 2,
+	fsFromMark = 3
+};
+
+// The Apple event descriptor types PIActions.h takes from AppleEvents.h.
+#define typeBoolean 'bool'
+#define typeChar 'TEXT'
+#define typeSInt16 'shor'
+#define typeSInt32 'long'
+#define typeInteger typeSInt32
+#define typeIEEE64BitFloatingPoint 'doub'
+#define typeFloat typeIEEE64BitFloatingPoint
+#define typeEnumerated 'enum'
+#define typeType 'type'
+#define typeAlias 'alis'
+#define typeTrue 'true'
+#define typeFalse 'fals'
+
+#endif // __HostSimCoreServices_H__
@@ -0,0 +1,106 @@
+//-------------------------------------------------------------------------------
+//
+//	File:
+//		HostSimPlatform.cpp
+//
+//	Description:
+//		The Macintosh routines the plug-in calls that live in Objective-C
+//		sources (FileUtilitiesMac.cpp, PIUFile.cpp), written for a POSIX
+//		system so that BLPHostSim can link the plug-in.
+//
+//		Only the POSIX file I/O path is here: BLPHostSim always reports
+//		hostSupportsPOSIXIO, and the File Manager calls fail with ioErr.
+//
+//-------------------------------------------------------------------------------
+
+#include "PIDefines.h"
+#include "FileUtilities.h"
+#include "PIUFile.h"
+#include <unistd.h>
+
+/*****************************************************************************/
+
+OSErr PSSDKWrite(int32 refNum, int32 refFD, int16 usePOSIXIO, int32 * count, void * buffPtr)
+{
+	(void)refNum;
+	if (NULL == count || NULL == buffPtr)
+		return writErr;
+	if (!usePOSIXIO)
+		return ioErr;
+
+	ssize_t written = write(refFD, buffPtr, *count);
+	if (written != *count)
+		return writErr;
+	return noErr;
+}
+
+/*****************************************************************************/
+
+OSErr PSSDKWrite(FileHandle refNum, int32 * count, void * buffPtr)
+{
+	(void)refNum;
+	(void)count;
+	(void)buffPtr;
+	return ioErr;
+}
+
+/*****************************************************************************/
+
+OSErr PSSDKSetFPos(int32 refNum, int32 refFD, int16 usePOSIXIO, short posMode, long posOff)
+{
+	(void)refNum;
+	if (!usePOSIXIO)
+		return ioErr;
+
+	int whence = SEEK_SET;
+	if (posMode == fsFromLEOF)
+		whence = SEEK_END;
+	else if (posMode == fsFromMark)
+		whence = SEEK_CUR;
+	if (lseek(refFD, posOff, whence) == -1)
+		return controlErr;
+	return noErr;
+}
+
+/*****************************************************************************/
+
+OSErr PSSDKRead(int32 refNum, int32 refFD, int16 usePOSIXIO, int32 * count, void * buffPtr)
+{
+	(void)refNum;
+	if (NULL == count || NULL == buffPtr)
+		return readErr;
+	if (!usePOSIXIO)
+		return ioErr;
+
+	ssize_t got = read(refFD, buffPtr, *count);
+	if (got != *count)
+		return readErr;
+	return noErr;
+}
+
+/*****************************************************************************/
+
+void UnLoadRuntimeFunctions(void)
+{
+}
+
+/*****************************************************************************/
+
+int32 GetFullPathToDesktop(char * fullPath, int32 maxPathLength)
+{
+	if (fullPath == NULL || maxPathLength < 1)
+		return kSPBadParameterError;
+
+	const char * dir = getenv("TMPDIR");
+	if (dir == NULL || dir[0] == 0)
+		dir = "/tmp";
+	int length = snprintf(fullPath, maxPathLength, "%s/", dir);
+	if (length < 0 || length >= maxPathLength)
+	{
+		fullPath[0] = 0;
+		return kSPBadParameterError;
+	}
+	return 0;
+}
+
+// end HostSimPlatform.cpp
@@ -0,0 +1,24 @@
+//-------------------------------------------------------------------------------
+//
+//	File:
+//		HostSimPrefix.h
+//
+//	Description:
+//		Prefix header for the plug-in sources BLPHostSim compiles, in
+//		place of PIMachORelease.h: a Macintosh plug-in on a POSIX system.
+//
+//-------------------------------------------------------------------------------
+
+#ifndef __HostSimPrefix_H__
+#define __HostSimPrefix_H__
+
+#define __PIMac__	1
+#define MAC_ENV		1
+
+#ifdef __cplusplus
+#define DLLExport	extern "C" __attribute__((visibility("default")))
+#else
+#define DLLExport	__attribute__((visibility("default")))
+#endif
+
+#endif // __HostSimPrefix_H__
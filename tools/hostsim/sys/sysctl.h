@@ -0,0 +1 @@
+// Empty: the plug-in includes it on Macintosh but calls nothing from it.